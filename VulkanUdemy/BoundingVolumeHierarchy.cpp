@@ -0,0 +1,538 @@
+#include "BoundingVolumeHierarchy.h"
+
+#include "FrustumCuller.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+#include <random>
+
+#include <glm/gtc/matrix_transform.hpp>
+
+static float surfaceArea(const glm::vec3& min, const glm::vec3& max)
+{
+	glm::vec3 size = max - min;
+	return 2.0f * (size.x * size.y + size.y * size.z + size.z * size.x);
+}
+
+static void growBox(glm::vec3& min, glm::vec3& max, const BoundingBox& box)
+{
+	min = glm::min(min, box.min);
+	max = glm::max(max, box.max);
+}
+
+// Distance along the ray where it enters the box (0 if it starts inside), FLT_MAX if it misses
+static float rayEnter(const glm::vec3& origin, const glm::vec3& inverseDirection, const glm::vec3& min, const glm::vec3& max)
+{
+	glm::vec3 t1 = (min - origin) * inverseDirection;
+	glm::vec3 t2 = (max - origin) * inverseDirection;
+	glm::vec3 tNear = glm::min(t1, t2);
+	glm::vec3 tFar = glm::max(t1, t2);
+	float enter = std::max(std::max(tNear.x, tNear.y), std::max(tNear.z, 0.0f));
+	float exit = std::min(std::min(tFar.x, tFar.y), tFar.z);
+	return enter <= exit ? enter : FLT_MAX;
+}
+
+BoundingVolumeHierarchy::BoundingVolumeHierarchy()
+{
+}
+
+BoundingVolumeHierarchy::~BoundingVolumeHierarchy()
+{
+}
+
+BoundingBox BoundingVolumeHierarchy::transformBox(const BoundingBox& box, const glm::mat4& model)
+{
+	// Centre through the matrix, half extent through its absolute values (Arvo), same as FrustumCuller::add
+	glm::vec3 centre = glm::vec3(model * glm::vec4((box.min + box.max) * 0.5f, 1.0f));
+	glm::mat3 absolute(glm::abs(glm::vec3(model[0])), glm::abs(glm::vec3(model[1])), glm::abs(glm::vec3(model[2])));
+	glm::vec3 extent = absolute * ((box.max - box.min) * 0.5f);
+	return { centre - extent, centre + extent };
+}
+
+void BoundingVolumeHierarchy::build(const std::vector<BoundingBox>& objectBoxes)
+{
+	boxes = objectBoxes;
+	buildTree();
+}
+
+void BoundingVolumeHierarchy::rebuild()
+{
+	buildTree();
+}
+
+void BoundingVolumeHierarchy::buildTree()
+{
+	uint32_t objectCount = static_cast<uint32_t>(boxes.size());
+	nodes.clear();
+	parents.clear();
+	dirtyLeaves.clear();
+	objectIndices.resize(objectCount);
+	objectLeaves.resize(objectCount);
+	if (objectCount == 0) {
+		leafDirty.clear();
+		builtCost = 0.0f;
+		return;
+	}
+
+	std::vector<glm::vec3> centroids(objectCount);
+	for (uint32_t i = 0; i < objectCount; i++) {
+		objectIndices[i] = i;
+		centroids[i] = (boxes[i].min + boxes[i].max) * 0.5f;
+	}
+
+	// At most one leaf per object, so at most 2n - 1 nodes and the vector never reallocates under the references below
+	nodes.reserve(objectCount * 2);
+	parents.reserve(objectCount * 2);
+	nodes.push_back({ glm::vec3(0.0f), 0, glm::vec3(0.0f), objectCount });
+	parents.push_back(0);
+
+	std::vector<uint32_t> pending = { 0 };
+	while (!pending.empty()) {
+		uint32_t index = pending.back();
+		pending.pop_back();
+		fitLeaf(index);
+
+		int axis;
+		float splitPosition;
+		if (nodes[index].count <= BVH_MAX_LEAF_OBJECTS || !findSplit(nodes[index], centroids, &axis, &splitPosition)) continue;
+
+		// Objects with their centroid left of the split go first
+		uint32_t first = nodes[index].first;
+		uint32_t count = nodes[index].count;
+		uint32_t* begin = objectIndices.data() + first;
+		uint32_t* middle = std::partition(begin, begin + count, [&](uint32_t object) { return centroids[object][axis] < splitPosition; });
+		uint32_t leftCount = static_cast<uint32_t>(middle - begin);
+		if (leftCount == 0 || leftCount == count) continue;
+
+		uint32_t left = static_cast<uint32_t>(nodes.size());
+		nodes.push_back({ glm::vec3(0.0f), first, glm::vec3(0.0f), leftCount });
+		nodes.push_back({ glm::vec3(0.0f), first + leftCount, glm::vec3(0.0f), count - leftCount });
+		parents.push_back(index);
+		parents.push_back(index);
+		nodes[index].first = left;
+		nodes[index].count = 0;
+
+		pending.push_back(left + 1);
+		pending.push_back(left);
+	}
+
+	for (uint32_t i = 0; i < nodes.size(); i++) {
+		for (uint32_t j = 0; j < nodes[i].count; j++) {
+			objectLeaves[objectIndices[nodes[i].first + j]] = i;
+		}
+	}
+	leafDirty.assign(nodes.size(), false);
+	builtCost = getCost();
+}
+
+bool BoundingVolumeHierarchy::findSplit(const BvhNode& node, const std::vector<glm::vec3>& centroids, int* axis, float* splitPosition)
+{
+	// Splits are placed between bins of the centroids' bounds, cheaper than sorting and nearly as good
+	glm::vec3 centroidMin(FLT_MAX);
+	glm::vec3 centroidMax(-FLT_MAX);
+	for (uint32_t i = 0; i < node.count; i++) {
+		const glm::vec3& centroid = centroids[objectIndices[node.first + i]];
+		centroidMin = glm::min(centroidMin, centroid);
+		centroidMax = glm::max(centroidMax, centroid);
+	}
+
+	// Cost of not splitting is testing every object, of splitting the node itself plus each side weighted by its area
+	float nodeArea = surfaceArea(node.min, node.max);
+	float bestCost = nodeArea * node.count;
+	bool found = false;
+
+	for (int a = 0; a < 3; a++) {
+		float extent = centroidMax[a] - centroidMin[a];
+		if (extent <= 0.0f) continue;
+
+		struct Bin {
+			glm::vec3 min = glm::vec3(FLT_MAX);
+			glm::vec3 max = glm::vec3(-FLT_MAX);
+			uint32_t count = 0;
+		};
+		std::array<Bin, BVH_SAH_BINS> bins;
+		float scale = BVH_SAH_BINS / extent;
+		for (uint32_t i = 0; i < node.count; i++) {
+			uint32_t object = objectIndices[node.first + i];
+			uint32_t bin = std::min(static_cast<uint32_t>((centroids[object][a] - centroidMin[a]) * scale), BVH_SAH_BINS - 1);
+			growBox(bins[bin].min, bins[bin].max, boxes[object]);
+			bins[bin].count++;
+		}
+
+		// Areas and counts left of each split from one sweep, right of it from the other
+		std::array<float, BVH_SAH_BINS - 1> leftArea, rightArea;
+		std::array<uint32_t, BVH_SAH_BINS - 1> leftCount, rightCount;
+		glm::vec3 leftMin(FLT_MAX), leftMax(-FLT_MAX), rightMin(FLT_MAX), rightMax(-FLT_MAX);
+		uint32_t leftSum = 0, rightSum = 0;
+		for (uint32_t i = 0; i < BVH_SAH_BINS - 1; i++) {
+			leftSum += bins[i].count;
+			if (bins[i].count > 0) growBox(leftMin, leftMax, { bins[i].min, bins[i].max });
+			leftCount[i] = leftSum;
+			leftArea[i] = leftSum > 0 ? surfaceArea(leftMin, leftMax) : 0.0f;
+
+			uint32_t r = BVH_SAH_BINS - 1 - i;
+			rightSum += bins[r].count;
+			if (bins[r].count > 0) growBox(rightMin, rightMax, { bins[r].min, bins[r].max });
+			rightCount[r - 1] = rightSum;
+			rightArea[r - 1] = rightSum > 0 ? surfaceArea(rightMin, rightMax) : 0.0f;
+		}
+
+		for (uint32_t i = 0; i < BVH_SAH_BINS - 1; i++) {
+			if (leftCount[i] == 0 || rightCount[i] == 0) continue;
+			float cost = nodeArea + leftArea[i] * leftCount[i] + rightArea[i] * rightCount[i];
+			if (cost < bestCost) {
+				bestCost = cost;
+				*axis = a;
+				*splitPosition = centroidMin[a] + (i + 1) / scale;
+				found = true;
+			}
+		}
+	}
+	return found;
+}
+
+void BoundingVolumeHierarchy::fitLeaf(uint32_t node)
+{
+	BvhNode& leaf = nodes[node];
+	leaf.min = glm::vec3(FLT_MAX);
+	leaf.max = glm::vec3(-FLT_MAX);
+	for (uint32_t i = 0; i < leaf.count; i++) {
+		growBox(leaf.min, leaf.max, boxes[objectIndices[leaf.first + i]]);
+	}
+}
+
+void BoundingVolumeHierarchy::fitInterior(uint32_t node)
+{
+	BvhNode& interior = nodes[node];
+	const BvhNode& left = nodes[interior.first];
+	const BvhNode& right = nodes[interior.first + 1];
+	interior.min = glm::min(left.min, right.min);
+	interior.max = glm::max(left.max, right.max);
+}
+
+void BoundingVolumeHierarchy::update(uint32_t object, const BoundingBox& box)
+{
+	boxes[object] = box;
+	uint32_t leaf = objectLeaves[object];
+	if (!leafDirty[leaf]) {
+		leafDirty[leaf] = true;
+		dirtyLeaves.push_back(leaf);
+	}
+}
+
+void BoundingVolumeHierarchy::refit()
+{
+	if (dirtyLeaves.empty()) return;
+
+	if (dirtyLeaves.size() * 8 > nodes.size()) {
+		// Most of the tree moved, one pass from the bottom up (children always come after their parent)
+		for (uint32_t i = static_cast<uint32_t>(nodes.size()); i-- > 0;) {
+			if (nodes[i].count > 0) fitLeaf(i);
+			else fitInterior(i);
+		}
+	}
+	else {
+		// Walk up from each moved leaf, stopping where a parent's box no longer changes
+		for (uint32_t leaf : dirtyLeaves) {
+			fitLeaf(leaf);
+			uint32_t node = leaf;
+			while (node != 0) {
+				node = parents[node];
+				glm::vec3 oldMin = nodes[node].min;
+				glm::vec3 oldMax = nodes[node].max;
+				fitInterior(node);
+				if (nodes[node].min == oldMin && nodes[node].max == oldMax) break;
+			}
+		}
+	}
+
+	for (uint32_t leaf : dirtyLeaves) {
+		leafDirty[leaf] = false;
+	}
+	dirtyLeaves.clear();
+}
+
+bool BoundingVolumeHierarchy::needsRebuild()
+{
+	return !nodes.empty() && getCost() > builtCost * BVH_REBUILD_COST_RATIO;
+}
+
+float BoundingVolumeHierarchy::getCost()
+{
+	if (nodes.empty()) return 0.0f;
+
+	float cost = 0.0f;
+	for (const BvhNode& node : nodes) {
+		cost += surfaceArea(node.min, node.max) * (node.count > 0 ? node.count : 1);
+	}
+	float rootArea = surfaceArea(nodes[0].min, nodes[0].max);
+	return rootArea > 0.0f ? cost / rootArea : 0.0f;
+}
+
+void BoundingVolumeHierarchy::queryFrustum(const std::array<glm::vec4, 6>& planes, std::vector<uint32_t>& objects)
+{
+	objects.clear();
+	if (nodes.empty()) return;
+
+	std::array<glm::vec3, 6> absoluteNormals;
+	for (int i = 0; i < 6; i++) {
+		absoluteNormals[i] = glm::abs(glm::vec3(planes[i]));
+	}
+
+	// Which planes a box is outside of (-1), inside of (clears its bit) or straddles, only straddled planes are passed down
+	auto classify = [&](const glm::vec3& min, const glm::vec3& max, uint32_t planeMask) -> int64_t {
+		glm::vec3 centre = (min + max) * 0.5f;
+		glm::vec3 extent = (max - min) * 0.5f;
+		for (int i = 0; i < 6; i++) {
+			if ((planeMask & (1u << i)) == 0) continue;
+			float distance = glm::dot(glm::vec3(planes[i]), centre) + planes[i].w;
+			float radius = glm::dot(absoluteNormals[i], extent);
+			if (distance + radius < 0.0f) return -1;
+			if (distance - radius >= 0.0f) planeMask &= ~(1u << i);
+		}
+		return planeMask;
+	};
+
+	stack.clear();
+	stack.push_back({ 0, 0x3f });
+	while (!stack.empty()) {
+		uint32_t index = stack.back().first;
+		uint32_t planeMask = stack.back().second;
+		stack.pop_back();
+
+		const BvhNode& node = nodes[index];
+		int64_t straddled = classify(node.min, node.max, planeMask);
+		if (straddled < 0) continue;
+		if (straddled == 0) {
+			collect(index, objects);
+			continue;
+		}
+
+		if (node.count > 0) {
+			for (uint32_t i = 0; i < node.count; i++) {
+				uint32_t object = objectIndices[node.first + i];
+				if (classify(boxes[object].min, boxes[object].max, static_cast<uint32_t>(straddled)) >= 0) objects.push_back(object);
+			}
+			continue;
+		}
+
+		stack.push_back({ node.first + 1, static_cast<uint32_t>(straddled) });
+		stack.push_back({ node.first, static_cast<uint32_t>(straddled) });
+	}
+}
+
+void BoundingVolumeHierarchy::collect(uint32_t node, std::vector<uint32_t>& objects)
+{
+	// Every object under the node, without testing. Leaves of a subtree aren't contiguous in objectIndices, so walk it
+	size_t base = stack.size();
+	stack.push_back({ node, 0 });
+	while (stack.size() > base) {
+		const BvhNode& current = nodes[stack.back().first];
+		stack.pop_back();
+		if (current.count > 0) {
+			objects.insert(objects.end(), objectIndices.begin() + current.first, objectIndices.begin() + current.first + current.count);
+		}
+		else {
+			stack.push_back({ current.first + 1, 0 });
+			stack.push_back({ current.first, 0 });
+		}
+	}
+}
+
+void BoundingVolumeHierarchy::querySphere(const BoundingSphere& sphere, std::vector<uint32_t>& objects)
+{
+	objects.clear();
+	if (nodes.empty()) return;
+
+	float radiusSquared = sphere.radius * sphere.radius;
+	auto touches = [&](const glm::vec3& min, const glm::vec3& max) {
+		glm::vec3 closest = glm::clamp(sphere.centre, min, max);
+		glm::vec3 offset = sphere.centre - closest;
+		return glm::dot(offset, offset) <= radiusSquared;
+	};
+
+	stack.clear();
+	stack.push_back({ 0, 0 });
+	while (!stack.empty()) {
+		const BvhNode& node = nodes[stack.back().first];
+		stack.pop_back();
+		if (!touches(node.min, node.max)) continue;
+
+		if (node.count > 0) {
+			for (uint32_t i = 0; i < node.count; i++) {
+				uint32_t object = objectIndices[node.first + i];
+				if (touches(boxes[object].min, boxes[object].max)) objects.push_back(object);
+			}
+			continue;
+		}
+		stack.push_back({ node.first + 1, 0 });
+		stack.push_back({ node.first, 0 });
+	}
+}
+
+bool BoundingVolumeHierarchy::raycast(const Ray& ray, float maxDistance, uint32_t* object, float* distance)
+{
+	if (nodes.empty()) return false;
+
+	glm::vec3 inverseDirection = 1.0f / ray.direction;
+	float nearest = maxDistance;
+	bool hit = false;
+
+	// Nearer child first, so farther subtrees are usually skipped once something closer is hit. Entry distance kept as bits
+	auto push = [&](uint32_t node, float enter) {
+		uint32_t bits;
+		memcpy(&bits, &enter, sizeof(bits));
+		stack.push_back({ node, bits });
+	};
+
+	stack.clear();
+	float rootEnter = rayEnter(ray.origin, inverseDirection, nodes[0].min, nodes[0].max);
+	if (rootEnter < nearest) push(0, rootEnter);
+
+	while (!stack.empty()) {
+		uint32_t index = stack.back().first;
+		float enter;
+		memcpy(&enter, &stack.back().second, sizeof(enter));
+		stack.pop_back();
+		if (enter >= nearest) continue;
+
+		const BvhNode& node = nodes[index];
+		if (node.count > 0) {
+			for (uint32_t i = 0; i < node.count; i++) {
+				uint32_t candidate = objectIndices[node.first + i];
+				float candidateEnter = rayEnter(ray.origin, inverseDirection, boxes[candidate].min, boxes[candidate].max);
+				if (candidateEnter < nearest) {
+					nearest = candidateEnter;
+					*object = candidate;
+					hit = true;
+				}
+			}
+			continue;
+		}
+
+		float leftEnter = rayEnter(ray.origin, inverseDirection, nodes[node.first].min, nodes[node.first].max);
+		float rightEnter = rayEnter(ray.origin, inverseDirection, nodes[node.first + 1].min, nodes[node.first + 1].max);
+		uint32_t nearChild = leftEnter <= rightEnter ? node.first : node.first + 1;
+		uint32_t farChild = leftEnter <= rightEnter ? node.first + 1 : node.first;
+		float nearEnter = std::min(leftEnter, rightEnter);
+		float farEnter = std::max(leftEnter, rightEnter);
+		if (farEnter < nearest) push(farChild, farEnter);
+		if (nearEnter < nearest) push(nearChild, nearEnter);
+	}
+
+	if (hit) *distance = nearest;
+	return hit;
+}
+
+void BoundingVolumeHierarchy::benchmark()
+{
+	std::mt19937 random(1234);
+	auto elapsed = [](std::chrono::steady_clock::time_point start) {
+		return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	};
+
+	for (uint32_t count : { 10000u, 100000u, 1000000u }) {
+		// Same density at every size, boxes half a unit to two units across with about 8 cubic units each
+		float side = std::cbrt(count * 8.0f);
+		std::uniform_real_distribution<float> position(-side * 0.5f, side * 0.5f);
+		std::uniform_real_distribution<float> halfSize(0.25f, 1.0f);
+		std::uniform_real_distribution<float> offset(-0.5f, 0.5f);
+
+		std::vector<BoundingBox> objectBoxes(count);
+		for (BoundingBox& box : objectBoxes) {
+			glm::vec3 centre(position(random), position(random), position(random));
+			glm::vec3 extent(halfSize(random), halfSize(random), halfSize(random));
+			box = { centre - extent, centre + extent };
+		}
+
+		BoundingVolumeHierarchy bvh;
+		auto start = std::chrono::steady_clock::now();
+		bvh.build(objectBoxes);
+		double buildTime = elapsed(start);
+
+		// A tenth of the objects nudged, like a scene with some animated objects, then all of them
+		std::vector<std::pair<uint32_t, glm::vec3>> moves(count / 10);
+		for (auto& move : moves) {
+			move = { static_cast<uint32_t>(random() % count), glm::vec3(offset(random), offset(random), offset(random)) };
+		}
+		start = std::chrono::steady_clock::now();
+		for (const auto& move : moves) {
+			bvh.update(move.first, { objectBoxes[move.first].min + move.second, objectBoxes[move.first].max + move.second });
+		}
+		bvh.refit();
+		double partialRefitTime = elapsed(start);
+
+		std::vector<glm::vec3> allMoves(count);
+		for (glm::vec3& move : allMoves) {
+			move = glm::vec3(offset(random), offset(random), offset(random));
+		}
+		start = std::chrono::steady_clock::now();
+		for (uint32_t i = 0; i < count; i++) {
+			bvh.update(i, { objectBoxes[i].min + allMoves[i], objectBoxes[i].max + allMoves[i] });
+		}
+		bvh.refit();
+		double fullRefitTime = elapsed(start);
+		float costRatio = bvh.getCost() / bvh.builtCost;
+
+		// From the edge of the scene looking into it, the far plane halfway across
+		glm::mat4 projection = glm::perspective(glm::radians(45.0f), 16.0f / 9.0f, 0.1f, side * 0.5f);
+		glm::mat4 view = glm::lookAt(glm::vec3(0.0f, 0.0f, side * 0.5f), glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+		std::array<glm::vec4, 6> planes = FrustumCuller::extractPlanes(projection * view);
+
+		const int QUERY_RUNS = 10;
+		std::vector<uint32_t> visible;
+		start = std::chrono::steady_clock::now();
+		for (int run = 0; run < QUERY_RUNS; run++) {
+			bvh.queryFrustum(planes, visible);
+		}
+		double bvhQueryTime = elapsed(start) / QUERY_RUNS;
+
+		// The flat SIMD culler tests every box, what the tree has to beat
+		FrustumCuller flatCuller;
+		flatCuller.setFrustum(projection * view);
+		for (const BoundingBox& box : bvh.boxes) {
+			flatCuller.add(box, glm::mat4(1.0f));
+		}
+		std::vector<uint32_t> flatVisible;
+		start = std::chrono::steady_clock::now();
+		for (int run = 0; run < QUERY_RUNS; run++) {
+			flatCuller.cull(flatVisible);
+		}
+		double flatQueryTime = elapsed(start) / QUERY_RUNS;
+
+		// Picking rays from the camera, and spheres the reach of a point light
+		const int RAY_COUNT = 1000;
+		std::vector<Ray> rays(RAY_COUNT);
+		std::vector<BoundingSphere> spheres(RAY_COUNT);
+		for (int i = 0; i < RAY_COUNT; i++) {
+			glm::vec3 target(position(random), position(random), position(random));
+			rays[i] = { glm::vec3(0.0f, 0.0f, side * 0.5f), target - glm::vec3(0.0f, 0.0f, side * 0.5f) };
+			spheres[i] = { target, 5.0f };
+		}
+		uint32_t hits = 0;
+		start = std::chrono::steady_clock::now();
+		for (const Ray& ray : rays) {
+			uint32_t object;
+			float distance;
+			if (bvh.raycast(ray, FLT_MAX, &object, &distance)) hits++;
+		}
+		double rayTime = elapsed(start) * 1000.0 / RAY_COUNT;
+
+		std::vector<uint32_t> lit;
+		size_t litTotal = 0;
+		start = std::chrono::steady_clock::now();
+		for (const BoundingSphere& sphere : spheres) {
+			bvh.querySphere(sphere, lit);
+			litTotal += lit.size();
+		}
+		double sphereTime = elapsed(start) * 1000.0 / RAY_COUNT;
+
+		printf("BVH %u objects, %zu nodes: build %.2f ms, refit %.3f ms (10%% moved) %.3f ms (all moved, cost x%.2f)\n",
+			count, bvh.getNodeCount(), buildTime, partialRefitTime, fullRefitTime, costRatio);
+		printf("  frustum %.3f ms vs flat %.3f ms (%zu / %zu visible), ray %.2f us (%u of %d hit), sphere %.2f us (%.1f objects each)\n",
+			bvhQueryTime, flatQueryTime, visible.size(), flatVisible.size(), rayTime, hits, RAY_COUNT, sphereTime, (double)litTotal / RAY_COUNT);
+	}
+}
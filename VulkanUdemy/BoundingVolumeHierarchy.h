@@ -0,0 +1,85 @@
+#pragma once
+
+#include <vector>
+#include <array>
+
+#include <glm/glm.hpp>
+
+#include "Utilities.h"
+
+struct Ray {
+	glm::vec3 origin;
+	glm::vec3 direction; // Hit distances are in multiples of it
+};
+
+// 32 bytes, two to a cache line. Children are allocated in pairs so a node only needs its first child's index
+struct BvhNode {
+	glm::vec3 min;
+	uint32_t first; // Interior: left child, the right one is first + 1. Leaf: first of its objects in objectIndices
+	glm::vec3 max;
+	uint32_t count; // Objects in a leaf, 0 for interior nodes
+};
+
+const uint32_t BVH_MAX_LEAF_OBJECTS = 4;
+const uint32_t BVH_SAH_BINS = 16;
+const float BVH_REBUILD_COST_RATIO = 1.5f; // Refits keep the topology, rebuild once the tree costs this much more than when built
+
+// Bounding volume hierarchy over world space boxes, for scene queries that shouldn't touch every object. Built top down
+// with a binned surface area heuristic. Moving objects are refit in place, only the nodes above them are touched, and
+// needsRebuild says when enough has moved that the old splits no longer fit the scene.
+class BoundingVolumeHierarchy
+{
+public:
+	BoundingVolumeHierarchy();
+
+	// Object i is objectBoxes[i], queries return these indices
+	void build(const std::vector<BoundingBox>& objectBoxes);
+	void rebuild(); // From the current boxes
+
+	// Moves an object, the tree is fixed up by the next refit
+	void update(uint32_t object, const BoundingBox& box);
+	void refit();
+	bool needsRebuild();
+
+	// Objects at least partly inside the planes (FrustumCuller::extractPlanes), subtrees fully inside aren't tested further
+	void queryFrustum(const std::array<glm::vec4, 6>& planes, std::vector<uint32_t>& objects);
+
+	// Objects whose boxes touch the sphere, e.g. the ones a point light reaches
+	void querySphere(const BoundingSphere& sphere, std::vector<uint32_t>& objects);
+
+	// Nearest object box the ray enters within maxDistance, false if none
+	bool raycast(const Ray& ray, float maxDistance, uint32_t* object, float* distance);
+
+	size_t getObjectCount() { return boxes.size(); }
+	size_t getNodeCount() { return nodes.size(); }
+
+	// Surface area heuristic cost relative to the root, what the build minimises
+	float getCost();
+
+	// Local bounds into world space, the box around the transformed box
+	static BoundingBox transformBox(const BoundingBox& box, const glm::mat4& model);
+
+	// Build, refit and query times on synthetic scenes of 10k to 1M objects, no device needed
+	static void benchmark();
+
+	~BoundingVolumeHierarchy();
+
+private:
+	std::vector<BvhNode> nodes; // Root first, a parent always comes before its children
+	std::vector<uint32_t> parents; // Apart from the nodes, only refits walk up
+	std::vector<uint32_t> objectIndices; // Leaves own a range of it
+	std::vector<BoundingBox> boxes;
+	std::vector<uint32_t> objectLeaves; // Leaf holding each object
+
+	std::vector<uint32_t> dirtyLeaves;
+	std::vector<bool> leafDirty; // Per node
+	float builtCost = 0.0f;
+
+	std::vector<std::pair<uint32_t, uint32_t>> stack; // Traversal scratch: node and the planes it still straddles
+
+	void buildTree();
+	bool findSplit(const BvhNode& node, const std::vector<glm::vec3>& centroids, int* axis, float* splitPosition);
+	void fitLeaf(uint32_t node);
+	void fitInterior(uint32_t node);
+	void collect(uint32_t node, std::vector<uint32_t>& objects);
+};
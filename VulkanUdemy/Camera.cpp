@@ -67,6 +67,11 @@ glm::vec3 Camera::getCameraPosition()
 	return position;
 }
 
+glm::vec3 Camera::getCameraDirection()
+{
+	return glm::normalize(front);
+}
+
 void Camera::update()
 {
 	glm::vec3 direction(1.0f);
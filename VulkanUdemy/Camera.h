@@ -13,6 +13,7 @@ public:
 	void mouseControl(GLfloat xChange, GLfloat yChange);
 	glm::mat4 calculateViewMatrix();
 	glm::vec3 getCameraPosition();
+	glm::vec3 getCameraDirection();
 
 	~Camera();
 private:
@@ -0,0 +1,198 @@
+#include "CpuProfiler.h"
+
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <chrono>
+#include <fstream>
+#include <algorithm>
+#include <stdexcept>
+#include <cstdio>
+
+#if defined(_M_X64) || defined(_M_IX86)
+#include <intrin.h>
+#define CPU_PROFILER_RDTSC
+#elif defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define CPU_PROFILER_RDTSC
+#endif
+
+struct CpuProfileEvent {
+	const char* name;
+	uint64_t start;
+	uint64_t end;
+};
+
+// One per thread that has recorded, kept after the thread exits so its events can still be written
+struct CpuProfileThread {
+	std::vector<CpuProfileEvent> events; // Sized on the first event, so naming a thread that never records costs nothing
+	std::atomic<uint64_t> written{ 0 }; // Events ever recorded, only the last CPU_PROFILER_EVENTS_PER_THREAD are kept
+	uint32_t threadId = 0;
+	const char* name = nullptr;
+};
+
+std::atomic<bool> CpuProfiler::enabled{ false };
+
+static std::mutex threadsMutex;
+static std::vector<std::unique_ptr<CpuProfileThread>> threads;
+static thread_local CpuProfileThread* currentThread = nullptr;
+
+// Ticks and steady_clock read together when enabled, compared against another pair to get the tick rate
+static uint64_t calibrationTicks = 0;
+static std::chrono::steady_clock::time_point calibrationTime;
+
+static CpuProfileThread* getCurrentThread()
+{
+	// The first event on a thread is the only time recording takes a lock
+	if (currentThread == nullptr) {
+		std::lock_guard<std::mutex> lock(threadsMutex);
+		threads.push_back(std::unique_ptr<CpuProfileThread>(new CpuProfileThread()));
+		currentThread = threads.back().get();
+		currentThread->threadId = static_cast<uint32_t>(threads.size());
+	}
+	return currentThread;
+}
+
+static void writeJsonString(std::ofstream& file, const char* text)
+{
+	file << '"';
+	for (const char* c = text; *c; c++) {
+		if (*c == '"' || *c == '\\') file << '\\';
+		file << *c;
+	}
+	file << '"';
+}
+
+void CpuProfiler::setEnabled(bool enable)
+{
+	if (enable && calibrationTicks == 0) {
+		calibrationTicks = now();
+		calibrationTime = std::chrono::steady_clock::now();
+	}
+	enabled.store(enable, std::memory_order_relaxed);
+}
+
+uint64_t CpuProfiler::now()
+{
+#ifdef CPU_PROFILER_RDTSC
+	return __rdtsc(); // Invariant on anything recent, a few ns against tens for steady_clock on some platforms
+#else
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+void CpuProfiler::record(const char* name, uint64_t start, uint64_t end)
+{
+	// Only this thread writes its ring, the release publishes the event to whoever writes the trace
+	CpuProfileThread* thread = getCurrentThread();
+	if (thread->events.empty()) {
+		thread->events.resize(CPU_PROFILER_EVENTS_PER_THREAD);
+	}
+	uint64_t index = thread->written.load(std::memory_order_relaxed);
+	thread->events[index % CPU_PROFILER_EVENTS_PER_THREAD] = { name, start, end };
+	thread->written.store(index + 1, std::memory_order_release);
+}
+
+void CpuProfiler::setThreadName(const char* name)
+{
+	getCurrentThread()->name = name;
+}
+
+void CpuProfiler::writeChromeTrace(const std::string& fileName)
+{
+	if (calibrationTicks == 0) return; // Never enabled
+
+	// Tick rate over the whole run, long enough that reading the two clocks at slightly different times doesn't matter
+	uint64_t ticks = now();
+	double elapsedMicroseconds = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - calibrationTime).count();
+	double ticksPerMicrosecond = elapsedMicroseconds > 0.0 ? (ticks - calibrationTicks) / elapsedMicroseconds : 1.0;
+
+	std::ofstream file(fileName, std::ios::trunc);
+	if (!file.is_open()) {
+		throw std::runtime_error("Failed to open " + fileName + " to write the CPU trace");
+	}
+
+	std::lock_guard<std::mutex> lock(threadsMutex);
+
+	// Times are from the earliest event still held
+	uint64_t firstTick = ~0ull;
+	for (auto& thread : threads) {
+		uint64_t written = thread->written.load(std::memory_order_acquire);
+		for (uint64_t i = written - std::min<uint64_t>(written, CPU_PROFILER_EVENTS_PER_THREAD); i < written; i++) {
+			firstTick = std::min(firstTick, thread->events[i % CPU_PROFILER_EVENTS_PER_THREAD].start);
+		}
+	}
+
+	// Complete ("X") events, the viewer nests them by time
+	file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+	uint64_t eventCount = 0;
+	uint64_t overwritten = 0;
+	bool first = true;
+	char numbers[128];
+	for (auto& thread : threads) {
+		if (thread->name) {
+			file << (first ? "\n" : ",\n") << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << thread->threadId << ",\"args\":{\"name\":";
+			writeJsonString(file, thread->name);
+			file << "}}";
+			first = false;
+		}
+
+		uint64_t written = thread->written.load(std::memory_order_acquire);
+		uint64_t count = std::min<uint64_t>(written, CPU_PROFILER_EVENTS_PER_THREAD);
+		overwritten += written - count;
+		for (uint64_t i = written - count; i < written; i++) {
+			const CpuProfileEvent& event = thread->events[i % CPU_PROFILER_EVENTS_PER_THREAD];
+			file << (first ? "\n" : ",\n") << "{\"name\":";
+			writeJsonString(file, event.name);
+			snprintf(numbers, sizeof(numbers), ",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}", thread->threadId,
+				(event.start - firstTick) / ticksPerMicrosecond, (event.end - event.start) / ticksPerMicrosecond);
+			file << numbers;
+			first = false;
+			eventCount++;
+		}
+	}
+	file << "\n]}\n";
+	file.close();
+
+	printf("CPU trace: %llu events from %zu threads written to %s (%llu older ones overwritten)\n",
+		(unsigned long long)eventCount, threads.size(), fileName.c_str(), (unsigned long long)overwritten);
+}
+
+void CpuProfiler::benchmark()
+{
+	const uint32_t SCOPES = 10000000;
+	const uint32_t SCOPES_PER_FRAME = 50; // Roughly what a frame of the renderer records across its threads
+	auto elapsed = [](std::chrono::steady_clock::time_point start) {
+		return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+	};
+	bool wasEnabled = isEnabled();
+	volatile uint64_t sink = 0; // Work the loops can't drop
+
+	auto start = std::chrono::steady_clock::now();
+	for (uint32_t i = 0; i < SCOPES; i++) {
+		sink = sink + i;
+	}
+	double loopTime = elapsed(start) / SCOPES;
+
+	setEnabled(false);
+	start = std::chrono::steady_clock::now();
+	for (uint32_t i = 0; i < SCOPES; i++) {
+		CPU_PROFILE_SCOPE("benchmark");
+		sink = sink + i;
+	}
+	double disabledTime = std::max(elapsed(start) / SCOPES - loopTime, 0.0);
+
+	setEnabled(true);
+	start = std::chrono::steady_clock::now();
+	for (uint32_t i = 0; i < SCOPES; i++) {
+		CPU_PROFILE_SCOPE("benchmark");
+		sink = sink + i;
+	}
+	double enabledTime = std::max(elapsed(start) / SCOPES - loopTime, 0.0);
+	setEnabled(wasEnabled);
+
+	printf("CPU profiler%s: %.2f ns per scope disabled, %.2f ns enabled (%u scopes)\n", ENABLE_CPU_PROFILER ? "" : " (compiled out)",
+		disabledTime, enabledTime, SCOPES);
+	printf("  %u scopes a frame enabled: %.4f ms, %.3f%% of a 60 fps frame\n", SCOPES_PER_FRAME,
+		enabledTime * SCOPES_PER_FRAME / 1000000.0, enabledTime * SCOPES_PER_FRAME / (1000000000.0 / 60.0) * 100.0);
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <atomic>
+
+// 0 compiles every marker out, they then cost nothing
+#ifndef ENABLE_CPU_PROFILER
+#define ENABLE_CPU_PROFILER 1
+#endif
+
+#define CPU_PROFILE_CONCAT_INNER(a, b) a##b
+#define CPU_PROFILE_CONCAT(a, b) CPU_PROFILE_CONCAT_INNER(a, b)
+
+#if ENABLE_CPU_PROFILER
+// Times the rest of the enclosing block, name must outlive the program (a string literal)
+#define CPU_PROFILE_SCOPE(name) CpuProfileScope CPU_PROFILE_CONCAT(cpuProfileScope, __LINE__)(name)
+#define CPU_PROFILE_THREAD(name) CpuProfiler::setThreadName(name)
+#else
+#define CPU_PROFILE_SCOPE(name)
+#define CPU_PROFILE_THREAD(name)
+#endif
+
+const uint32_t CPU_PROFILER_EVENTS_PER_THREAD = 1 << 16; // Ring size, older events are overwritten
+
+// Where CPU time goes, as nested scopes on each thread. Every thread records into a ring of its own, so recording
+// takes no locks: the thread writes the event then publishes it by bumping its count. Scopes are only recorded while
+// enabled, otherwise a marker is a load and a branch. Timestamps are TSC ticks on x86 (steady_clock elsewhere),
+// converted to time against steady_clock when the trace is written.
+class CpuProfiler
+{
+public:
+	static void setEnabled(bool enable);
+	static bool isEnabled() { return enabled.load(std::memory_order_relaxed); }
+
+	static uint64_t now();
+	static void record(const char* name, uint64_t start, uint64_t end);
+
+	// Shown for the calling thread's events, must outlive the program like scope names
+	static void setThreadName(const char* name);
+
+	// Chrome trace event JSON (chrome://tracing, ui.perfetto.dev) of what every thread's ring still holds. Threads
+	// mustn't be recording while it's written, stop or join them first
+	static void writeChromeTrace(const std::string& fileName);
+
+	// Cost of a scope disabled and enabled, against the same loop without markers
+	static void benchmark();
+
+private:
+	static std::atomic<bool> enabled;
+};
+
+// Records the time between its construction and destruction, use CPU_PROFILE_SCOPE rather than this directly
+class CpuProfileScope
+{
+public:
+	CpuProfileScope(const char* newName) : name(newName), start(CpuProfiler::isEnabled() ? CpuProfiler::now() : 0) {}
+
+	~CpuProfileScope()
+	{
+		if (start != 0) CpuProfiler::record(name, start, CpuProfiler::now());
+	}
+
+private:
+	const char* name;
+	uint64_t start; // 0 if not recording
+};
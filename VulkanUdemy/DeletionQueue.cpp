@@ -0,0 +1,104 @@
+#include "DeletionQueue.h"
+
+#include <iterator>
+
+DeletionQueue::DeletionQueue()
+{
+}
+
+DeletionQueue::~DeletionQueue()
+{
+}
+
+void DeletionQueue::init(VkDevice newDevice)
+{
+	device = newDevice;
+}
+
+void DeletionQueue::push(uint64_t lastUsedValue, std::function<void()> deletion)
+{
+	// Keep the queue ordered so collect can stop at the first entry still in use
+	auto position = deletions.end();
+	while (position != deletions.begin() && std::prev(position)->value > lastUsedValue) {
+		--position;
+	}
+	deletions.insert(position, { lastUsedValue, deletion });
+}
+
+void DeletionQueue::destroyBuffer(VkBuffer buffer, VkDeviceMemory memory)
+{
+	VkDevice logicalDevice = device;
+	push([=]() {
+		vkDestroyBuffer(logicalDevice, buffer, nullptr);
+		vkFreeMemory(logicalDevice, memory, nullptr);
+	});
+}
+
+void DeletionQueue::destroyImage(VkImage image, VkDeviceMemory memory)
+{
+	VkDevice logicalDevice = device;
+	push([=]() {
+		vkDestroyImage(logicalDevice, image, nullptr);
+		if (memory != VK_NULL_HANDLE) {
+			vkFreeMemory(logicalDevice, memory, nullptr);
+		}
+	});
+}
+
+void DeletionQueue::destroyImageView(VkImageView imageView)
+{
+	VkDevice logicalDevice = device;
+	push([=]() { vkDestroyImageView(logicalDevice, imageView, nullptr); });
+}
+
+void DeletionQueue::destroyFramebuffer(VkFramebuffer framebuffer)
+{
+	VkDevice logicalDevice = device;
+	push([=]() { vkDestroyFramebuffer(logicalDevice, framebuffer, nullptr); });
+}
+
+void DeletionQueue::destroyPipeline(VkPipeline pipeline)
+{
+	VkDevice logicalDevice = device;
+	push([=]() { vkDestroyPipeline(logicalDevice, pipeline, nullptr); });
+}
+
+void DeletionQueue::destroyPipelineLayout(VkPipelineLayout pipelineLayout)
+{
+	VkDevice logicalDevice = device;
+	push([=]() { vkDestroyPipelineLayout(logicalDevice, pipelineLayout, nullptr); });
+}
+
+void DeletionQueue::destroyRenderPass(VkRenderPass renderPass)
+{
+	VkDevice logicalDevice = device;
+	push([=]() { vkDestroyRenderPass(logicalDevice, renderPass, nullptr); });
+}
+
+void DeletionQueue::destroyDescriptorPool(VkDescriptorPool pool)
+{
+	VkDevice logicalDevice = device;
+	push([=]() { vkDestroyDescriptorPool(logicalDevice, pool, nullptr); });
+}
+
+size_t DeletionQueue::collect(uint64_t completedValue)
+{
+	size_t count = 0;
+	while (!deletions.empty() && deletions.front().value <= completedValue) {
+		// Pop before running so a deletion can safely push more
+		std::function<void()> destroy = deletions.front().destroy;
+		deletions.pop_front();
+		destroy();
+		count++;
+	}
+	return count;
+}
+
+void DeletionQueue::flush()
+{
+	while (!deletions.empty()) {
+		std::function<void()> destroy = deletions.front().destroy;
+		deletions.pop_front();
+		destroy();
+	}
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include <deque>
+#include <functional>
+
+// Destroys GPU objects once the last frame that could have used them has finished, instead of waiting for the device
+// to go idle. Entries are keyed by a frame timeline value: the object is freed once the timeline has reached it.
+class DeletionQueue
+{
+public:
+	DeletionQueue();
+
+	void init(VkDevice newDevice);
+
+	// Timeline value of the frame currently being built, entries pushed without a value retire after this frame
+	void setCurrentValue(uint64_t value) { currentValue = value; }
+	uint64_t getCurrentValue() { return currentValue; }
+
+	void push(std::function<void()> deletion) { push(currentValue, deletion); }
+	void push(uint64_t lastUsedValue, std::function<void()> deletion);
+
+	void destroyBuffer(VkBuffer buffer, VkDeviceMemory memory);
+	void destroyImage(VkImage image, VkDeviceMemory memory);
+	void destroyImageView(VkImageView imageView);
+	void destroyFramebuffer(VkFramebuffer framebuffer);
+	void destroyPipeline(VkPipeline pipeline);
+	void destroyPipelineLayout(VkPipelineLayout pipelineLayout);
+	void destroyRenderPass(VkRenderPass renderPass);
+	void destroyDescriptorPool(VkDescriptorPool pool); // Sets are retired with their whole pool, not one by one
+
+	// Run every deletion whose frame has completed, returns how many ran
+	size_t collect(uint64_t completedValue);
+	// Run everything, only once the device is idle
+	void flush();
+
+	size_t getPendingCount() { return deletions.size(); }
+
+	~DeletionQueue();
+
+private:
+	struct Deletion {
+		uint64_t value;
+		std::function<void()> destroy;
+	};
+
+	VkDevice device;
+	uint64_t currentValue = 0;
+	std::deque<Deletion> deletions; // Sorted by value, frames only ever move forward
+};
@@ -0,0 +1,334 @@
+#include "DepthPyramid.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+
+const uint32_t REDUCE_GROUP_SIZE = 8; // local_size_x and y in hiz.comp
+
+DepthPyramid::DepthPyramid()
+{
+}
+
+DepthPyramid::~DepthPyramid()
+{
+}
+
+void DepthPyramid::init(VulkanDevice newDevice, VkQueue newTransferQueue, VkCommandPool newTransferCommandPool, VkPipelineCache pipelineCache,
+	DeletionQueue* newDeletionQueue, SamplerCache* samplerCache)
+{
+	device = newDevice;
+	transferQueue = newTransferQueue;
+	transferCommandPool = newTransferCommandPool;
+	deletionQueue = newDeletionQueue;
+
+	// Levels are picked by the cull shader, never blended between
+	SamplerSettings settings;
+	settings.magFilter = VK_FILTER_NEAREST;
+	settings.minFilter = VK_FILTER_NEAREST;
+	settings.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+	settings.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	settings.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	settings.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	settings.anisotropyEnable = VK_FALSE;
+	sampler = samplerCache->getSampler(settings);
+
+	// Layout from the shader, like the other pipelines
+	std::vector<char> code = readFile(DEPTH_PYRAMID_SHADER_FILE);
+	ReflectedLayout layout = ReflectedLayout::merge({ ShaderReflection::reflect(code) });
+	if (layout.sets.size() != 1 || layout.sets[0].size() != 3) {
+		throw std::runtime_error("Depth pyramid shader should use set 0 bindings 0 to 2 (depth, source, destination), rebuild the shaders");
+	}
+	if (layout.pushConstantRanges.size() != 1 || layout.pushConstantRanges[0].size != sizeof(ReduceConstants)) {
+		throw std::runtime_error("Depth pyramid shader push constants don't match ReduceConstants, rebuild the shaders");
+	}
+
+	VkDescriptorSetLayoutCreateInfo setLayoutCreateInfo = {};
+	setLayoutCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+	setLayoutCreateInfo.bindingCount = static_cast<uint32_t>(layout.sets[0].size());
+	setLayoutCreateInfo.pBindings = layout.sets[0].data();
+
+	VkResult result = vkCreateDescriptorSetLayout(device.logicalDevice, &setLayoutCreateInfo, nullptr, &setLayout);
+	if (result != VK_SUCCESS) {
+		throw std::runtime_error("Failed to create a Descriptor Set Layout!");
+	}
+
+	VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo = {};
+	pipelineLayoutCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+	pipelineLayoutCreateInfo.setLayoutCount = 1;
+	pipelineLayoutCreateInfo.pSetLayouts = &setLayout;
+	pipelineLayoutCreateInfo.pushConstantRangeCount = 1;
+	pipelineLayoutCreateInfo.pPushConstantRanges = &layout.pushConstantRanges[0];
+
+	result = vkCreatePipelineLayout(device.logicalDevice, &pipelineLayoutCreateInfo, nullptr, &pipelineLayout);
+	if (result != VK_SUCCESS) {
+		throw std::runtime_error("Failed to create the depth pyramid pipeline layout");
+	}
+
+	// Create Shader Module
+	VkShaderModuleCreateInfo shaderCreateInfo = {};
+	shaderCreateInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+	shaderCreateInfo.codeSize = code.size();
+	shaderCreateInfo.pCode = reinterpret_cast<const uint32_t*>(code.data());
+
+	VkShaderModule shaderModule;
+	result = vkCreateShaderModule(device.logicalDevice, &shaderCreateInfo, nullptr, &shaderModule);
+	if (result != VK_SUCCESS) {
+		throw std::runtime_error("Failed to create a shader module!");
+	}
+
+	VkComputePipelineCreateInfo pipelineCreateInfo = {};
+	pipelineCreateInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+	pipelineCreateInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+	pipelineCreateInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+	pipelineCreateInfo.stage.module = shaderModule;
+	pipelineCreateInfo.stage.pName = "main";
+	pipelineCreateInfo.layout = pipelineLayout;
+
+	result = vkCreateComputePipelines(device.logicalDevice, pipelineCache, 1, &pipelineCreateInfo, nullptr, &pipeline);
+	vkDestroyShaderModule(device.logicalDevice, shaderModule, nullptr);
+	if (result != VK_SUCCESS) {
+		throw std::runtime_error("Failed to create the depth pyramid pipeline");
+	}
+}
+
+void DepthPyramid::resize(uint32_t screenWidth, uint32_t screenHeight)
+{
+	// Largest power of two that fits, so every level below is an exact 2x2 reduction of the one above
+	uint32_t newWidth = 1;
+	while (newWidth * 2 <= screenWidth) newWidth *= 2;
+	uint32_t newHeight = 1;
+	while (newHeight * 2 <= screenHeight) newHeight *= 2;
+	if (newWidth == width && newHeight == height && image != VK_NULL_HANDLE) return;
+
+	// Frames in flight may still be reading the old one
+	retireImage();
+	retireDescriptorSets();
+
+	width = newWidth;
+	height = newHeight;
+	createImage();
+}
+
+void DepthPyramid::createImage()
+{
+	uint32_t levelCount = static_cast<uint32_t>(std::floor(std::log2(std::max(width, height)))) + 1;
+
+	image = ::createImage(device.physicalDevice, device.logicalDevice, width, height, levelCount, DEPTH_PYRAMID_FORMAT, VK_IMAGE_TILING_OPTIMAL,
+		VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+		&imageMemory, VK_SAMPLE_COUNT_1_BIT);
+
+	// One view over every level to sample, one per level to write
+	for (uint32_t level = 0; level <= levelCount; level++) {
+		VkImageViewCreateInfo viewCreateInfo = {};
+		viewCreateInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+		viewCreateInfo.image = image;
+		viewCreateInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+		viewCreateInfo.format = DEPTH_PYRAMID_FORMAT;
+		viewCreateInfo.components.r = VK_COMPONENT_SWIZZLE_IDENTITY;
+		viewCreateInfo.components.g = VK_COMPONENT_SWIZZLE_IDENTITY;
+		viewCreateInfo.components.b = VK_COMPONENT_SWIZZLE_IDENTITY;
+		viewCreateInfo.components.a = VK_COMPONENT_SWIZZLE_IDENTITY;
+		viewCreateInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		viewCreateInfo.subresourceRange.baseMipLevel = level < levelCount ? level : 0;
+		viewCreateInfo.subresourceRange.levelCount = level < levelCount ? 1 : levelCount;
+		viewCreateInfo.subresourceRange.baseArrayLayer = 0;
+		viewCreateInfo.subresourceRange.layerCount = 1;
+
+		VkImageView view;
+		VkResult result = vkCreateImageView(device.logicalDevice, &viewCreateInfo, nullptr, &view);
+		if (result != VK_SUCCESS) {
+			throw std::runtime_error("Failed to create a depth pyramid image view!");
+		}
+		if (level < levelCount) {
+			levelViews.push_back(view);
+		}
+		else {
+			imageView = view;
+		}
+	}
+
+	// Cleared to the far plane (nothing hidden) and left in the layout it's kept in between frames
+	VkCommandBuffer commandBuffer = beginCommandBuffer(device.logicalDevice, transferCommandPool);
+
+	VkImageMemoryBarrier barrier = {};
+	barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+	barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+	barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.image = image;
+	barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	barrier.subresourceRange.baseMipLevel = 0;
+	barrier.subresourceRange.levelCount = levelCount;
+	barrier.subresourceRange.baseArrayLayer = 0;
+	barrier.subresourceRange.layerCount = 1;
+	barrier.srcAccessMask = 0;
+	barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+	VkClearColorValue farPlane = { { 1.0f, 1.0f, 1.0f, 1.0f } };
+	vkCmdClearColorImage(commandBuffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, &farPlane, 1, &barrier.subresourceRange);
+
+	barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+	barrier.newLayout = DEPTH_PYRAMID_LAYOUT;
+	barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+	endAndSubmitCommandBuffer(device.logicalDevice, transferCommandPool, transferQueue, commandBuffer);
+}
+
+void DepthPyramid::setDepthSource(VkImageView newDepthView, uint32_t newWidth, uint32_t newHeight, VkSampleCountFlagBits samples)
+{
+	if (newDepthView == depthView && levelSets.size() == levelViews.size()) return;
+
+	retireDescriptorSets();
+	depthView = newDepthView;
+	depthWidth = newWidth;
+	depthHeight = newHeight;
+	depthSamples = samples;
+	createDescriptorSets();
+}
+
+void DepthPyramid::createDescriptorSets()
+{
+	uint32_t levelCount = static_cast<uint32_t>(levelViews.size());
+
+	std::array<VkDescriptorPoolSize, 2> poolSizes = {};
+	poolSizes[0].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	poolSizes[0].descriptorCount = levelCount;
+	poolSizes[1].type = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+	poolSizes[1].descriptorCount = levelCount * 2;
+
+	VkDescriptorPoolCreateInfo poolCreateInfo = {};
+	poolCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+	poolCreateInfo.maxSets = levelCount;
+	poolCreateInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
+	poolCreateInfo.pPoolSizes = poolSizes.data();
+
+	VkResult result = vkCreateDescriptorPool(device.logicalDevice, &poolCreateInfo, nullptr, &descriptorPool);
+	if (result != VK_SUCCESS) {
+		throw std::runtime_error("Failed to create the depth pyramid descriptor pool!");
+	}
+
+	std::vector<VkDescriptorSetLayout> setLayouts(levelCount, setLayout);
+	levelSets.resize(levelCount);
+
+	VkDescriptorSetAllocateInfo setAllocInfo = {};
+	setAllocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+	setAllocInfo.descriptorPool = descriptorPool;
+	setAllocInfo.descriptorSetCount = levelCount;
+	setAllocInfo.pSetLayouts = setLayouts.data();
+
+	result = vkAllocateDescriptorSets(device.logicalDevice, &setAllocInfo, levelSets.data());
+	if (result != VK_SUCCESS) {
+		throw std::runtime_error("Failed to allocate depth pyramid descriptor sets");
+	}
+
+	for (uint32_t level = 0; level < levelCount; level++) {
+		// Level 0 reads the depth buffer, its source binding is never read but must still be valid
+		VkDescriptorImageInfo depthInfo = { sampler, depthView, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL };
+		VkDescriptorImageInfo sourceInfo = { VK_NULL_HANDLE, levelViews[level > 0 ? level - 1 : 0], VK_IMAGE_LAYOUT_GENERAL };
+		VkDescriptorImageInfo destinationInfo = { VK_NULL_HANDLE, levelViews[level], VK_IMAGE_LAYOUT_GENERAL };
+
+		std::array<VkWriteDescriptorSet, 3> setWrites = {};
+		for (uint32_t i = 0; i < setWrites.size(); i++) {
+			setWrites[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+			setWrites[i].dstSet = levelSets[level];
+			setWrites[i].dstBinding = i;
+			setWrites[i].dstArrayElement = 0;
+			setWrites[i].descriptorCount = 1;
+			setWrites[i].descriptorType = i == 0 ? VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER : VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+		}
+		setWrites[0].pImageInfo = &depthInfo;
+		setWrites[1].pImageInfo = &sourceInfo;
+		setWrites[2].pImageInfo = &destinationInfo;
+
+		vkUpdateDescriptorSets(device.logicalDevice, static_cast<uint32_t>(setWrites.size()), setWrites.data(), 0, nullptr);
+	}
+}
+
+void DepthPyramid::record(VkCommandBuffer commandBuffer)
+{
+	if (levelSets.empty()) return;
+
+	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
+
+	uint32_t sourceWidth = depthWidth;
+	uint32_t sourceHeight = depthHeight;
+	for (uint32_t level = 0; level < levelSets.size(); level++) {
+		uint32_t levelWidth = std::max(width >> level, 1u);
+		uint32_t levelHeight = std::max(height >> level, 1u);
+
+		ReduceConstants constants = {};
+		constants.sourceWidth = static_cast<int32_t>(sourceWidth);
+		constants.sourceHeight = static_cast<int32_t>(sourceHeight);
+		constants.destinationWidth = static_cast<int32_t>(levelWidth);
+		constants.destinationHeight = static_cast<int32_t>(levelHeight);
+		constants.samples = static_cast<int32_t>(depthSamples);
+		constants.fromDepth = level == 0 ? 1 : 0;
+
+		vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipelineLayout, 0, 1, &levelSets[level], 0, nullptr);
+		vkCmdPushConstants(commandBuffer, pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(ReduceConstants), &constants);
+		vkCmdDispatch(commandBuffer, (levelWidth + REDUCE_GROUP_SIZE - 1) / REDUCE_GROUP_SIZE, (levelHeight + REDUCE_GROUP_SIZE - 1) / REDUCE_GROUP_SIZE, 1);
+
+		// The next level reads this one
+		VkImageMemoryBarrier barrier = {};
+		barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+		barrier.oldLayout = VK_IMAGE_LAYOUT_GENERAL;
+		barrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
+		barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.image = image;
+		barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		barrier.subresourceRange.baseMipLevel = level;
+		barrier.subresourceRange.levelCount = 1;
+		barrier.subresourceRange.baseArrayLayer = 0;
+		barrier.subresourceRange.layerCount = 1;
+		barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+		barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+		sourceWidth = levelWidth;
+		sourceHeight = levelHeight;
+	}
+}
+
+void DepthPyramid::retireImage()
+{
+	if (image == VK_NULL_HANDLE) return;
+
+	deletionQueue->destroyImageView(imageView);
+	for (VkImageView view : levelViews) {
+		deletionQueue->destroyImageView(view);
+	}
+	deletionQueue->destroyImage(image, imageMemory);
+	levelViews.clear();
+	imageView = VK_NULL_HANDLE;
+	image = VK_NULL_HANDLE;
+}
+
+void DepthPyramid::retireDescriptorSets()
+{
+	if (descriptorPool == VK_NULL_HANDLE) return;
+
+	deletionQueue->destroyDescriptorPool(descriptorPool);
+	descriptorPool = VK_NULL_HANDLE;
+	levelSets.clear();
+	depthView = VK_NULL_HANDLE;
+}
+
+void DepthPyramid::cleanup()
+{
+	// Only once the device is idle, retired objects are freed when the deletion queue is flushed after this
+	retireImage();
+	retireDescriptorSets();
+
+	if (pipeline != VK_NULL_HANDLE) {
+		vkDestroyPipeline(device.logicalDevice, pipeline, nullptr);
+		vkDestroyPipelineLayout(device.logicalDevice, pipelineLayout, nullptr);
+		vkDestroyDescriptorSetLayout(device.logicalDevice, setLayout, nullptr);
+		pipeline = VK_NULL_HANDLE;
+	}
+}
@@ -0,0 +1,92 @@
+#pragma once
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include <string>
+#include <vector>
+#include <stdexcept>
+
+#include "Utilities.h"
+#include "DeletionQueue.h"
+#include "SamplerCache.h"
+#include "ShaderReflection.h"
+
+// Built with the project from the sources in shaders/, compile.bat rebuilds them for hot reload
+const std::string DEPTH_PYRAMID_SHADER_FILE = "shaders/hiz.spv";
+
+const VkFormat DEPTH_PYRAMID_FORMAT = VK_FORMAT_R32_SFLOAT;
+const VkImageLayout DEPTH_PYRAMID_LAYOUT = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL; // Kept in between frames, for the cull shader
+
+// Hierarchical depth: a mip chain of the depth buffer where each texel holds the furthest depth it covers, so a box can
+// be tested for occlusion with four samples from the level where it's about a texel across. Level 0 is the largest
+// power of two that fits in the screen. The image outlives frames, the early cull of a frame reads the last one's.
+class DepthPyramid
+{
+public:
+	DepthPyramid();
+
+	void init(VulkanDevice newDevice, VkQueue newTransferQueue, VkCommandPool newTransferCommandPool, VkPipelineCache pipelineCache,
+		DeletionQueue* newDeletionQueue, SamplerCache* samplerCache);
+
+	// Recreates the pyramid for a new screen size, cleared to the far plane so nothing is occluded by it until it's built
+	void resize(uint32_t screenWidth, uint32_t screenHeight);
+
+	// Depth buffer level 0 is built from, sampled in SHADER_READ_ONLY_OPTIMAL
+	void setDepthSource(VkImageView depthView, uint32_t width, uint32_t height, VkSampleCountFlagBits samples);
+
+	// Every level in turn, the image must be in GENERAL and is left in it
+	void record(VkCommandBuffer commandBuffer);
+
+	VkImage getImage() { return image; }
+	VkImageView getImageView() { return imageView; } // Every level
+	VkSampler getSampler() { return sampler; } // Nearest, the levels are sampled explicitly
+	uint32_t getWidth() { return width; }
+	uint32_t getHeight() { return height; }
+	uint32_t getLevelCount() { return static_cast<uint32_t>(levelViews.size()); }
+
+	void cleanup();
+
+	~DepthPyramid();
+
+private:
+	// Push constant block of hiz.comp
+	struct ReduceConstants {
+		int32_t sourceWidth;
+		int32_t sourceHeight;
+		int32_t destinationWidth;
+		int32_t destinationHeight;
+		int32_t samples;
+		int32_t fromDepth;
+	};
+
+	VulkanDevice device;
+	VkQueue transferQueue;
+	VkCommandPool transferCommandPool;
+	DeletionQueue* deletionQueue = nullptr;
+
+	VkDescriptorSetLayout setLayout = VK_NULL_HANDLE;
+	VkPipelineLayout pipelineLayout = VK_NULL_HANDLE;
+	VkPipeline pipeline = VK_NULL_HANDLE;
+	VkSampler sampler = VK_NULL_HANDLE; // Owned by the sampler cache
+
+	uint32_t width = 0;
+	uint32_t height = 0;
+	VkImage image = VK_NULL_HANDLE;
+	VkDeviceMemory imageMemory = VK_NULL_HANDLE;
+	VkImageView imageView = VK_NULL_HANDLE;
+	std::vector<VkImageView> levelViews;
+
+	// One set per level, rebuilt (and the old pool retired) when the depth buffer or the pyramid is replaced
+	VkImageView depthView = VK_NULL_HANDLE;
+	uint32_t depthWidth = 0;
+	uint32_t depthHeight = 0;
+	VkSampleCountFlagBits depthSamples = VK_SAMPLE_COUNT_1_BIT;
+	VkDescriptorPool descriptorPool = VK_NULL_HANDLE;
+	std::vector<VkDescriptorSet> levelSets;
+
+	void createImage();
+	void createDescriptorSets();
+	void retireImage();
+	void retireDescriptorSets();
+};
@@ -0,0 +1,95 @@
+#include "FrameAllocator.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <new>
+
+#ifdef COUNT_HEAP_ALLOCATIONS
+static thread_local uint64_t threadHeapAllocations = 0;
+
+// Array and nothrow forms call these, over-aligned allocations aren't counted
+void* operator new(size_t size)
+{
+	threadHeapAllocations++;
+	void* memory = malloc(size > 0 ? size : 1);
+	if (memory == nullptr) {
+		throw std::bad_alloc();
+	}
+	return memory;
+}
+
+void operator delete(void* memory) noexcept
+{
+	free(memory);
+}
+
+void operator delete(void* memory, size_t) noexcept
+{
+	free(memory);
+}
+
+uint64_t getThreadHeapAllocations()
+{
+	return threadHeapAllocations;
+}
+#else
+uint64_t getThreadHeapAllocations()
+{
+	return 0;
+}
+#endif
+
+FrameAllocator::FrameAllocator()
+{
+}
+
+FrameAllocator::~FrameAllocator()
+{
+}
+
+void* FrameAllocator::allocate(size_t size, size_t alignment)
+{
+	// Worst case padding is counted so a block sized from it always fits
+	requested += size + alignment - 1;
+
+	uintptr_t base = reinterpret_cast<uintptr_t>(block.get());
+	uintptr_t aligned = (base + used + alignment - 1) & ~static_cast<uintptr_t>(alignment - 1);
+	if (block && aligned + size <= base + capacity) {
+		used = aligned + size - base;
+		return reinterpret_cast<void*>(aligned);
+	}
+
+	// Out of room until the next reset grows the block
+	overflow.push_back(std::unique_ptr<char[]>(new char[size + alignment - 1]));
+	uintptr_t memory = reinterpret_cast<uintptr_t>(overflow.back().get());
+	return reinterpret_cast<void*>((memory + alignment - 1) & ~static_cast<uintptr_t>(alignment - 1));
+}
+
+void FrameAllocator::reset()
+{
+	peakUsed = std::max(peakUsed, requested);
+
+	// One block big enough for the whole of the last frame, doubled so slow growth doesn't reallocate every frame
+	if (!overflow.empty()) {
+		size_t newCapacity = capacity > MIN_BLOCK_SIZE ? capacity : MIN_BLOCK_SIZE;
+		while (newCapacity < requested) {
+			newCapacity *= 2;
+		}
+		block.reset(new char[newCapacity]);
+		capacity = newCapacity;
+		overflow.clear();
+	}
+
+	used = 0;
+	requested = 0;
+}
+
+void FrameAllocator::cleanup()
+{
+	block.reset();
+	overflow.clear();
+	overflow.shrink_to_fit();
+	capacity = 0;
+	used = 0;
+	requested = 0;
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <memory>
+#include <stdexcept>
+#include <type_traits>
+
+// Debug builds count heap allocations per thread, so the render thread and tests can check a warmed up frame doesn't make any
+#ifndef NDEBUG
+#define COUNT_HEAP_ALLOCATIONS
+#endif
+
+// Allocations through the global operator new made by the calling thread so far, always 0 without COUNT_HEAP_ALLOCATIONS
+uint64_t getThreadHeapAllocations();
+
+// Bump allocator for data that only lives for one frame. Nothing is freed on its own, reset frees everything at once
+// when the frame slot comes round again. Allocations that don't fit go to the heap, and the next reset grows the
+// block to cover them, so after the first few frames a frame's worth of allocations never touches the heap.
+class FrameAllocator
+{
+public:
+	FrameAllocator();
+
+	void* allocate(size_t size, size_t alignment);
+
+	// Everything allocated since the last reset must no longer be in use
+	void reset();
+
+	size_t getCapacity() { return capacity; }
+	size_t getPeakUsed() { return peakUsed; } // Most any frame has needed
+
+	void cleanup();
+
+	~FrameAllocator();
+
+private:
+	static const size_t MIN_BLOCK_SIZE = 64 * 1024;
+
+	std::unique_ptr<char[]> block;
+	size_t capacity = 0;
+	size_t used = 0;
+	size_t requested = 0; // Since the last reset, including overflow
+	size_t peakUsed = 0;
+	std::vector<std::unique_ptr<char[]>> overflow; // Heap allocations that didn't fit in the block
+};
+
+// Lets standard containers allocate from a frame allocator. Freeing does nothing, the memory goes when the
+// allocator resets, so a container must be cleared or given a new allocator before its frame slot is reused.
+template<typename T>
+struct FrameStlAllocator {
+	typedef T value_type;
+	typedef std::true_type propagate_on_container_copy_assignment;
+	typedef std::true_type propagate_on_container_move_assignment;
+	typedef std::true_type propagate_on_container_swap;
+
+	FrameAllocator* allocator;
+
+	FrameStlAllocator(FrameAllocator* newAllocator = nullptr) : allocator(newAllocator) {}
+
+	template<typename U>
+	FrameStlAllocator(const FrameStlAllocator<U>& other) : allocator(other.allocator) {}
+
+	T* allocate(size_t count)
+	{
+		if (allocator == nullptr) {
+			throw std::runtime_error("Frame container used without a frame allocator");
+		}
+		return static_cast<T*>(allocator->allocate(sizeof(T) * count, alignof(T)));
+	}
+
+	void deallocate(T*, size_t) {}
+
+	template<typename U>
+	bool operator==(const FrameStlAllocator<U>& other) const { return allocator == other.allocator; }
+	template<typename U>
+	bool operator!=(const FrameStlAllocator<U>& other) const { return allocator != other.allocator; }
+};
+
+template<typename T>
+using FrameVector = std::vector<T, FrameStlAllocator<T>>;
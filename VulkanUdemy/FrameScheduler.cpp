@@ -0,0 +1,240 @@
+#include "FrameScheduler.h"
+
+#include <cstdio>
+#include <algorithm>
+#include <limits>
+
+FrameScheduler::FrameScheduler()
+{
+}
+
+FrameScheduler::~FrameScheduler()
+{
+}
+
+void FrameScheduler::init(VulkanDevice newDevice, uint32_t queueFamilyIndex)
+{
+	device = newDevice;
+	deletionQueue.init(device.logicalDevice);
+
+	// One timeline for every frame, starts at 0 so "nothing submitted" is already complete
+	VkSemaphoreTypeCreateInfo timelineCreateInfo = {};
+	timelineCreateInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
+	timelineCreateInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+	timelineCreateInfo.initialValue = 0;
+
+	VkSemaphoreCreateInfo timelineSemaphoreInfo = {};
+	timelineSemaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+	timelineSemaphoreInfo.pNext = &timelineCreateInfo;
+
+	VkResult result = vkCreateSemaphore(device.logicalDevice, &timelineSemaphoreInfo, nullptr, &timeline);
+	if (result != VK_SUCCESS) {
+		throw std::runtime_error("Failed to create the frame timeline semaphore!");
+	}
+
+	VkSemaphoreCreateInfo semaphoreCreateInfo = {};
+	semaphoreCreateInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+
+	VkCommandPoolCreateInfo poolInfo = {};
+	poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+	poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT; // Buffers only live for one frame
+	poolInfo.queueFamilyIndex = queueFamilyIndex;
+
+	for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+		FrameResources& frame = frames[i];
+		frame.timelineValue = 0;
+		frame.uploadsRecorded = false;
+
+		if (vkCreateSemaphore(device.logicalDevice, &semaphoreCreateInfo, nullptr, &frame.imageAvailable) != VK_SUCCESS ||
+			vkCreateSemaphore(device.logicalDevice, &semaphoreCreateInfo, nullptr, &frame.renderFinished) != VK_SUCCESS) {
+			throw std::runtime_error("Failed to create frame semaphores!");
+		}
+
+		result = vkCreateCommandPool(device.logicalDevice, &poolInfo, nullptr, &frame.commandPool);
+		if (result != VK_SUCCESS) {
+			throw std::runtime_error("Failed to create a frame command pool!");
+		}
+
+		VkCommandBufferAllocateInfo cbAllocInfo = {};
+		cbAllocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+		cbAllocInfo.commandPool = frame.commandPool;
+		cbAllocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+		cbAllocInfo.commandBufferCount = 1;
+
+		result = vkAllocateCommandBuffers(device.logicalDevice, &cbAllocInfo, &frame.commandBuffer);
+		if (result != VK_SUCCESS) {
+			throw std::runtime_error("Failed to allocate a frame command buffer!");
+		}
+
+		result = vkAllocateCommandBuffers(device.logicalDevice, &cbAllocInfo, &frame.uploadCommandBuffer);
+		if (result != VK_SUCCESS) {
+			throw std::runtime_error("Failed to allocate a frame upload command buffer!");
+		}
+	}
+}
+
+void FrameScheduler::beginFrame()
+{
+	CPU_PROFILE_SCOPE("beginFrame");
+	Clock::time_point now = Clock::now();
+	if (hasLastFrameStart) {
+		FrameStats& current = stats[framesInFlight - 1];
+		current.frames++;
+		current.frameTimeTotal += std::chrono::duration<double, std::milli>(now - lastFrameStart).count();
+	}
+	lastFrameStart = now;
+	hasLastFrameStart = true;
+
+	// Only framesInFlight frames may be queued, wait for the oldest one to finish if we're at the limit.
+	// framesInFlight <= MAX_FRAMES_IN_FLIGHT so this also means the slot's previous frame has finished
+	uint64_t nextValue = submittedValue + 1;
+	if (nextValue > framesInFlight) {
+		waitForValue(nextValue - framesInFlight);
+	}
+	recordCompletedFrames();
+
+	// Anything whose last use has finished can go, not just what this slot's previous frame used
+	deletionQueue.collect(getCompletedValue());
+	deletionQueue.setCurrentValue(nextValue);
+
+	FrameResources& frame = getFrame();
+	vkResetCommandPool(device.logicalDevice, frame.commandPool, 0);
+	frame.uploadsRecorded = false;
+	frameAllocators[getFrameIndex()].reset();
+
+	frameStartTimes[getFrameIndex()] = now;
+}
+
+void FrameScheduler::submit(VkQueue queue, VkPipelineStageFlags waitStage)
+{
+	CPU_PROFILE_SCOPE("submit");
+	FrameResources& frame = getFrame();
+	uint64_t frameValue = submittedValue + 1;
+
+	// Binary semaphores ignore their value, only the timeline's matters
+	uint64_t waitValues[] = { 0 };
+	uint64_t signalValues[] = { 0, frameValue };
+	VkSemaphore signalSemaphores[] = { frame.renderFinished, timeline };
+
+	VkTimelineSemaphoreSubmitInfo timelineInfo = {};
+	timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+	timelineInfo.waitSemaphoreValueCount = 1;
+	timelineInfo.pWaitSemaphoreValues = waitValues;
+	timelineInfo.signalSemaphoreValueCount = 2;
+	timelineInfo.pSignalSemaphoreValues = signalValues;
+
+	VkSubmitInfo submitInfo = {};
+	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+	submitInfo.pNext = &timelineInfo;
+	submitInfo.waitSemaphoreCount = 1;
+	submitInfo.pWaitSemaphores = &frame.imageAvailable;
+	submitInfo.pWaitDstStageMask = &waitStage;
+
+	// Uploads go first in the batch, their barriers make the copies visible to the frame's commands
+	VkCommandBuffer commandBuffers[] = { frame.uploadCommandBuffer, frame.commandBuffer };
+	if (frame.uploadsRecorded) {
+		vkEndCommandBuffer(frame.uploadCommandBuffer);
+		frame.uploadsRecorded = false;
+		submitInfo.commandBufferCount = 2;
+		submitInfo.pCommandBuffers = commandBuffers;
+	}
+	else {
+		submitInfo.commandBufferCount = 1;
+		submitInfo.pCommandBuffers = &frame.commandBuffer;
+	}
+	submitInfo.signalSemaphoreCount = 2;
+	submitInfo.pSignalSemaphores = signalSemaphores;
+
+	VkResult result = vkQueueSubmit(queue, 1, &submitInfo, VK_NULL_HANDLE);
+	if (result != VK_SUCCESS) {
+		throw std::runtime_error("Failed to submit command buffer to queue");
+	}
+
+	frame.timelineValue = frameValue;
+	submittedValue = frameValue;
+}
+
+VkCommandBuffer FrameScheduler::getUploadCommandBuffer()
+{
+	FrameResources& frame = getFrame();
+	if (!frame.uploadsRecorded) {
+		VkCommandBufferBeginInfo beginInfo = {};
+		beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+		beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+		vkBeginCommandBuffer(frame.uploadCommandBuffer, &beginInfo);
+		frame.uploadsRecorded = true;
+	}
+	return frame.uploadCommandBuffer;
+}
+
+uint64_t FrameScheduler::getCompletedValue()
+{
+	uint64_t value = 0;
+	vkGetSemaphoreCounterValue(device.logicalDevice, timeline, &value);
+	return value;
+}
+
+void FrameScheduler::waitForValue(uint64_t value)
+{
+	CPU_PROFILE_SCOPE("waitForFrame");
+	VkSemaphoreWaitInfo waitInfo = {};
+	waitInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+	waitInfo.semaphoreCount = 1;
+	waitInfo.pSemaphores = &timeline;
+	waitInfo.pValues = &value;
+
+	vkWaitSemaphores(device.logicalDevice, &waitInfo, std::numeric_limits<uint64_t>::max());
+}
+
+void FrameScheduler::setFramesInFlight(uint32_t count)
+{
+	count = std::min(std::max(count, 1u), MAX_FRAMES_IN_FLIGHT);
+	if (count == framesInFlight) return;
+
+	// Lowering the limit takes effect on the next beginFrame, which waits for the extra frames to drain
+	framesInFlight = count;
+	hasLastFrameStart = false; // Don't count the switch-over frame
+}
+
+void FrameScheduler::printStats()
+{
+	printf("Frames in flight | frames | avg frame (ms) | fps | avg latency (ms)\n");
+	for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+		const FrameStats& stat = stats[i];
+		if (stat.frames == 0) continue;
+
+		double frameTime = stat.frameTimeTotal / stat.frames;
+		double latency = stat.latencySamples > 0 ? stat.latencyTotal / stat.latencySamples : 0.0;
+		printf("%16u | %6llu | %14.3f | %5.1f | %16.3f\n", i + 1, (unsigned long long)stat.frames, frameTime, 1000.0 / frameTime, latency);
+	}
+}
+
+void FrameScheduler::cleanup()
+{
+	waitForValue(submittedValue);
+	deletionQueue.flush();
+
+	for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+		FrameResources& frame = frames[i];
+		vkDestroyCommandPool(device.logicalDevice, frame.commandPool, nullptr);
+		vkDestroySemaphore(device.logicalDevice, frame.imageAvailable, nullptr);
+		vkDestroySemaphore(device.logicalDevice, frame.renderFinished, nullptr);
+		frameAllocators[i].cleanup();
+	}
+	vkDestroySemaphore(device.logicalDevice, timeline, nullptr);
+}
+
+void FrameScheduler::recordCompletedFrames()
+{
+	// Latency of every frame the GPU has finished since last time, as seen from the CPU
+	uint64_t completedValue = getCompletedValue();
+	Clock::time_point now = Clock::now();
+	FrameStats& current = stats[framesInFlight - 1];
+
+	for (uint64_t value = std::max(measuredValue + 1, completedValue > MAX_FRAMES_IN_FLIGHT ? completedValue - MAX_FRAMES_IN_FLIGHT + 1 : 1); value <= completedValue; value++) {
+		current.latencySamples++;
+		current.latencyTotal += std::chrono::duration<double, std::milli>(now - frameStartTimes[value % MAX_FRAMES_IN_FLIGHT]).count();
+	}
+	measuredValue = std::max(measuredValue, completedValue);
+}
@@ -0,0 +1,103 @@
+#pragma once
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include <vector>
+#include <functional>
+#include <chrono>
+#include <stdexcept>
+
+#include "Utilities.h"
+#include "DeletionQueue.h"
+#include "FrameAllocator.h"
+#include "CpuProfiler.h"
+
+const uint32_t DEFAULT_FRAMES_IN_FLIGHT = 2;
+
+// Per frame slot resources, reused once the frame that last used the slot has finished on the GPU
+struct FrameResources {
+	VkCommandPool commandPool; // Reset as a whole at the start of the frame
+	VkCommandBuffer commandBuffer;
+	VkCommandBuffer uploadCommandBuffer; // Transfers for the frame, submitted in the same batch ahead of commandBuffer
+	bool uploadsRecorded; // uploadCommandBuffer has been begun this frame
+	VkSemaphore imageAvailable; // Binary, swapchain acquire can't signal a timeline semaphore
+	VkSemaphore renderFinished; // Binary, present can't wait on a timeline semaphore
+	uint64_t timelineValue; // Timeline value the frame signals when it finishes, 0 if never submitted
+};
+
+// Timing for one frames in flight setting
+struct FrameStats {
+	uint64_t frames = 0;
+	double frameTimeTotal = 0.0; // CPU time between frame starts (ms)
+	uint64_t latencySamples = 0;
+	double latencyTotal = 0.0; // Frame start to the CPU seeing the GPU finish it (ms)
+};
+
+// Paces frames on one timeline semaphore. Frame N signals value N when its GPU work finishes, so any CPU system
+// can wait for a frame with waitForValue instead of needing its own fence. The number of frames allowed in flight
+// can be changed at runtime (1 to MAX_FRAMES_IN_FLIGHT), resources exist for the maximum.
+class FrameScheduler
+{
+public:
+	FrameScheduler();
+
+	void init(VulkanDevice newDevice, uint32_t queueFamilyIndex);
+
+	// Waits until the slot for the next frame is free, then resets its command pool and allocator and frees retired resources
+	void beginFrame();
+
+	// Submit the frame's command buffer, waiting on imageAvailable and signalling renderFinished + the timeline
+	void submit(VkQueue queue, VkPipelineStageFlags waitStage);
+
+	// Command buffer for uploads, begun on first use between beginFrame and submit. It runs before the frame's own
+	// commands and the frame's timeline value covers it, so nothing waits on the CPU for the copies
+	VkCommandBuffer getUploadCommandBuffer();
+
+	FrameResources& getFrame() { return frames[getFrameIndex()]; }
+	FrameResources& getFrame(uint32_t frameIndex) { return frames[frameIndex]; }
+	uint32_t getFrameIndex() { return static_cast<uint32_t>((submittedValue + 1) % MAX_FRAMES_IN_FLIGHT); }
+
+	// Transient CPU data for the frame being built, good until the slot comes round again
+	FrameAllocator* getFrameAllocator() { return &frameAllocators[getFrameIndex()]; }
+
+	// Timeline value the frame being built will signal
+	uint64_t getCurrentFrameValue() { return submittedValue + 1; }
+	uint64_t getSubmittedValue() { return submittedValue; }
+	uint64_t getCompletedValue();
+	void waitForValue(uint64_t value);
+
+	// Free something once the current frame (and every frame before it) has finished on the GPU
+	void deferDelete(std::function<void()> deletion) { deletionQueue.push(deletion); }
+	DeletionQueue& getDeletionQueue() { return deletionQueue; }
+
+	void setFramesInFlight(uint32_t count);
+	uint32_t getFramesInFlight() { return framesInFlight; }
+
+	FrameStats getStats(uint32_t framesInFlightCount) { return stats[framesInFlightCount - 1]; }
+	void printStats();
+
+	void cleanup();
+
+	~FrameScheduler();
+
+private:
+	VulkanDevice device;
+	VkSemaphore timeline;
+	uint64_t submittedValue = 0; // Last value a submitted frame will signal
+
+	uint32_t framesInFlight = DEFAULT_FRAMES_IN_FLIGHT;
+	FrameResources frames[MAX_FRAMES_IN_FLIGHT];
+	FrameAllocator frameAllocators[MAX_FRAMES_IN_FLIGHT];
+	DeletionQueue deletionQueue; // Keyed by timeline value, collected at the start of every frame
+
+	// Measurements
+	typedef std::chrono::steady_clock Clock;
+	Clock::time_point lastFrameStart;
+	bool hasLastFrameStart = false;
+	Clock::time_point frameStartTimes[MAX_FRAMES_IN_FLIGHT]; // Start time of the frame each slot last submitted
+	uint64_t measuredValue = 0; // Last frame whose latency has been recorded
+	FrameStats stats[MAX_FRAMES_IN_FLIGHT];
+
+	void recordCompletedFrames();
+};
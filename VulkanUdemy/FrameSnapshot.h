@@ -0,0 +1,32 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include "DirectionalLight.h"
+#include "SceneCommandStream.h"
+
+// Renderer settings changed during a simulation frame, -1 where nothing was asked for
+struct RenderSettingRequests {
+	int framesInFlight = -1;
+	int fullRebuildOnResize = -1;
+	int wireframe = -1;
+	int depthPrePass = -1;
+	int gpuCulling = -1;
+	int occlusionCulling = -1;
+	int bvhCulling = -1;
+	bool pick = false;
+};
+
+// Everything a frame is drawn from, written by the simulation thread and then only read by the render thread. Scene
+// commands and requests are what changed since the last snapshot the render thread took, the rest is current state.
+struct FrameSnapshot {
+	uint64_t frame = 0; // Simulation frame that last wrote it
+	glm::mat4 view = glm::mat4(1.0f);
+	glm::vec3 cameraPosition = glm::vec3(0.0f);
+	glm::vec3 cameraDirection = glm::vec3(0.0f, 0.0f, -1.0f);
+	DirectionalLight light;
+	int framebufferWidth = 0; // 0 while minimised
+	int framebufferHeight = 0;
+	SceneCommandStream sceneCommands;
+	RenderSettingRequests requests;
+};
@@ -0,0 +1,138 @@
+#include "FrustumCuller.h"
+
+#include <cmath>
+#include <immintrin.h>
+
+#if defined(__AVX__)
+const uint32_t CULL_BATCH = 8;
+#else
+const uint32_t CULL_BATCH = 4;
+#endif
+
+FrustumCuller::FrustumCuller()
+{
+}
+
+FrustumCuller::~FrustumCuller()
+{
+}
+
+void FrustumCuller::setFrustum(const glm::mat4& viewProjection)
+{
+	planes = extractPlanes(viewProjection);
+}
+
+std::array<glm::vec4, 6> FrustumCuller::extractPlanes(const glm::mat4& viewProjection)
+{
+	// Gribb/Hartmann, each plane is the last row of the matrix plus or minus another row (glm is column major)
+	glm::vec4 rows[4];
+	for (int i = 0; i < 4; i++) {
+		rows[i] = glm::vec4(viewProjection[0][i], viewProjection[1][i], viewProjection[2][i], viewProjection[3][i]);
+	}
+
+	std::array<glm::vec4, 6> frustumPlanes;
+	frustumPlanes[0] = rows[3] + rows[0]; // Left
+	frustumPlanes[1] = rows[3] - rows[0]; // Right
+	frustumPlanes[2] = rows[3] + rows[1]; // Bottom (top once y is flipped, the pair covers both either way)
+	frustumPlanes[3] = rows[3] - rows[1]; // Top
+	frustumPlanes[4] = rows[3] + rows[2]; // Near at -w, for a 0 to 1 depth range it's slightly behind the real one, so it never culls too much
+	frustumPlanes[5] = rows[3] - rows[2]; // Far
+	return frustumPlanes;
+}
+
+void FrustumCuller::clear()
+{
+	count = 0;
+	centreX.clear();
+	centreY.clear();
+	centreZ.clear();
+	extentX.clear();
+	extentY.clear();
+	extentZ.clear();
+}
+
+uint32_t FrustumCuller::add(const BoundingBox& bounds, const glm::mat4& model)
+{
+	// World space box around the transformed box: the centre is transformed, the half extent goes through |M| (Arvo)
+	glm::vec3 centre = glm::vec3(model * glm::vec4((bounds.min + bounds.max) * 0.5f, 1.0f));
+	glm::vec3 halfExtent = (bounds.max - bounds.min) * 0.5f;
+	glm::mat3 absolute = glm::mat3(model);
+	for (int i = 0; i < 3; i++) {
+		absolute[i] = glm::abs(absolute[i]);
+	}
+	glm::vec3 extent = absolute * halfExtent;
+
+	// Fill the padding slot this box lands in, or start a new batch of padding
+	if (count == centreX.size()) {
+		size_t padded = centreX.size() + CULL_BATCH;
+		centreX.resize(padded, 0.0f);
+		centreY.resize(padded, 0.0f);
+		centreZ.resize(padded, 0.0f);
+		extentX.resize(padded, 0.0f);
+		extentY.resize(padded, 0.0f);
+		extentZ.resize(padded, 0.0f);
+	}
+
+	centreX[count] = centre.x;
+	centreY[count] = centre.y;
+	centreZ[count] = centre.z;
+	extentX[count] = extent.x;
+	extentY[count] = extent.y;
+	extentZ[count] = extent.z;
+	return count++;
+}
+
+void FrustumCuller::cull(std::vector<uint32_t>& visible)
+{
+	visible.clear();
+
+	// A box is outside a plane when its centre's distance is below -(projected half extent): dot(n, c) + d + dot(|n|, e) < 0
+	for (uint32_t first = 0; first < count; first += CULL_BATCH) {
+#if defined(__AVX__)
+		__m256 cx = _mm256_loadu_ps(&centreX[first]);
+		__m256 cy = _mm256_loadu_ps(&centreY[first]);
+		__m256 cz = _mm256_loadu_ps(&centreZ[first]);
+		__m256 ex = _mm256_loadu_ps(&extentX[first]);
+		__m256 ey = _mm256_loadu_ps(&extentY[first]);
+		__m256 ez = _mm256_loadu_ps(&extentZ[first]);
+
+		__m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+		for (const glm::vec4& plane : planes) {
+			__m256 distance = _mm256_add_ps(
+				_mm256_add_ps(_mm256_mul_ps(cx, _mm256_set1_ps(plane.x)), _mm256_mul_ps(cy, _mm256_set1_ps(plane.y))),
+				_mm256_add_ps(_mm256_mul_ps(cz, _mm256_set1_ps(plane.z)), _mm256_set1_ps(plane.w)));
+			__m256 radius = _mm256_add_ps(
+				_mm256_add_ps(_mm256_mul_ps(ex, _mm256_set1_ps(std::abs(plane.x))), _mm256_mul_ps(ey, _mm256_set1_ps(std::abs(plane.y)))),
+				_mm256_mul_ps(ez, _mm256_set1_ps(std::abs(plane.z))));
+			inside = _mm256_and_ps(inside, _mm256_cmp_ps(_mm256_add_ps(distance, radius), _mm256_setzero_ps(), _CMP_GE_OQ));
+		}
+		uint32_t mask = static_cast<uint32_t>(_mm256_movemask_ps(inside));
+#else
+		__m128 cx = _mm_loadu_ps(&centreX[first]);
+		__m128 cy = _mm_loadu_ps(&centreY[first]);
+		__m128 cz = _mm_loadu_ps(&centreZ[first]);
+		__m128 ex = _mm_loadu_ps(&extentX[first]);
+		__m128 ey = _mm_loadu_ps(&extentY[first]);
+		__m128 ez = _mm_loadu_ps(&extentZ[first]);
+
+		__m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+		for (const glm::vec4& plane : planes) {
+			__m128 distance = _mm_add_ps(
+				_mm_add_ps(_mm_mul_ps(cx, _mm_set1_ps(plane.x)), _mm_mul_ps(cy, _mm_set1_ps(plane.y))),
+				_mm_add_ps(_mm_mul_ps(cz, _mm_set1_ps(plane.z)), _mm_set1_ps(plane.w)));
+			__m128 radius = _mm_add_ps(
+				_mm_add_ps(_mm_mul_ps(ex, _mm_set1_ps(std::abs(plane.x))), _mm_mul_ps(ey, _mm_set1_ps(std::abs(plane.y)))),
+				_mm_mul_ps(ez, _mm_set1_ps(std::abs(plane.z))));
+			inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(distance, radius), _mm_setzero_ps()));
+		}
+		uint32_t mask = static_cast<uint32_t>(_mm_movemask_ps(inside));
+#endif
+
+		// Padding past count is ignored
+		for (uint32_t i = 0; i < CULL_BATCH && first + i < count; i++) {
+			if (mask & (1u << i)) {
+				visible.push_back(first + i);
+			}
+		}
+	}
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <vector>
+#include <array>
+
+#include <glm/glm.hpp>
+
+#include "Utilities.h"
+
+// Tests world space boxes against the view frustum in batches, 8 boxes per instruction with AVX or 4 with SSE.
+// Boxes are kept as structure of arrays (centre and half extent per axis) so a batch is one load per component.
+class FrustumCuller
+{
+public:
+	FrustumCuller();
+
+	// Planes are extracted from the combined projection * view matrix
+	void setFrustum(const glm::mat4& viewProjection);
+
+	// ax + by + cz + d >= 0 inside, not normalised (only the sign is tested). Shared with the GPU culler
+	static std::array<glm::vec4, 6> extractPlanes(const glm::mat4& viewProjection);
+
+	void clear();
+
+	// Local bounds moved into world space by model, returns the box's index
+	uint32_t add(const BoundingBox& bounds, const glm::mat4& model);
+
+	// Indices of boxes at least partly inside the frustum, in the order they were added
+	void cull(std::vector<uint32_t>& visible);
+
+	size_t size() { return count; }
+
+	~FrustumCuller();
+
+private:
+	std::array<glm::vec4, 6> planes;
+
+	uint32_t count = 0;
+	std::vector<float> centreX, centreY, centreZ;
+	std::vector<float> extentX, extentY, extentZ; // Padded to a whole batch, padding is never reported
+};
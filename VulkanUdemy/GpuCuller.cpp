@@ -0,0 +1,515 @@
+#include "GpuCuller.h"
+
+#include "FrustumCuller.h"
+
+#include <algorithm>
+
+const uint32_t CULL_GROUP_SIZE = 64; // local_size_x in cull.comp
+
+GpuCuller::GpuCuller()
+{
+}
+
+GpuCuller::~GpuCuller()
+{
+}
+
+void GpuCuller::init(VulkanDevice newDevice, VkQueue newTransferQueue, VkCommandPool newTransferCommandPool, VkPipelineCache pipelineCache,
+	DeletionQueue* newDeletionQueue, const std::string& vertexShaderFile)
+{
+	device = newDevice;
+	transferQueue = newTransferQueue;
+	transferCommandPool = newTransferCommandPool;
+	deletionQueue = newDeletionQueue;
+
+	// Layouts come from the shaders like the graphics ones, set 0 of the cull shader and set 2 of the vertex shader
+	std::vector<char> cullCode = readFile(CULL_COMPUTE_SHADER_FILE);
+	ReflectedLayout cullLayout = ReflectedLayout::merge({ ShaderReflection::reflect(cullCode) });
+	if (cullLayout.sets.size() != 1 || cullLayout.sets[0].size() != 7) {
+		throw std::runtime_error("Cull shader should use set 0 bindings 0 to 6 (objects, batches, commands, counts, cull data, late objects, depth pyramid), rebuild the shaders");
+	}
+	if (cullLayout.pushConstantRanges.size() != 1 || cullLayout.pushConstantRanges[0].size != sizeof(CullConstants)) {
+		throw std::runtime_error("Cull shader push constants don't match CullConstants, rebuild the shaders");
+	}
+
+	ReflectedLayout vertexLayout = ReflectedLayout::merge({ ShaderReflection::reflectFile(vertexShaderFile) });
+	if (vertexLayout.sets.size() != 3 || vertexLayout.sets[2].size() != 1) {
+		throw std::runtime_error("Indirect vertex shader should read its objects from set 2, rebuild the shaders");
+	}
+
+	cullSetLayout = createSetLayout(cullLayout.sets[0]);
+	objectSetLayout = createSetLayout(vertexLayout.sets[2]);
+
+	VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo = {};
+	pipelineLayoutCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+	pipelineLayoutCreateInfo.setLayoutCount = 1;
+	pipelineLayoutCreateInfo.pSetLayouts = &cullSetLayout;
+	pipelineLayoutCreateInfo.pushConstantRangeCount = 1;
+	pipelineLayoutCreateInfo.pPushConstantRanges = &cullLayout.pushConstantRanges[0];
+
+	VkResult result = vkCreatePipelineLayout(device.logicalDevice, &pipelineLayoutCreateInfo, nullptr, &cullPipelineLayout);
+	if (result != VK_SUCCESS) {
+		throw std::runtime_error("Failed to create the cull pipeline layout");
+	}
+
+	// Create Shader Module
+	VkShaderModuleCreateInfo shaderCreateInfo = {};
+	shaderCreateInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+	shaderCreateInfo.codeSize = cullCode.size();
+	shaderCreateInfo.pCode = reinterpret_cast<const uint32_t*>(cullCode.data());
+
+	VkShaderModule shaderModule;
+	result = vkCreateShaderModule(device.logicalDevice, &shaderCreateInfo, nullptr, &shaderModule);
+	if (result != VK_SUCCESS) {
+		throw std::runtime_error("Failed to create a shader module!");
+	}
+
+	VkComputePipelineCreateInfo pipelineCreateInfo = {};
+	pipelineCreateInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+	pipelineCreateInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+	pipelineCreateInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+	pipelineCreateInfo.stage.module = shaderModule;
+	pipelineCreateInfo.stage.pName = "main";
+	pipelineCreateInfo.layout = cullPipelineLayout;
+
+	result = vkCreateComputePipelines(device.logicalDevice, pipelineCache, 1, &pipelineCreateInfo, nullptr, &cullPipeline);
+	vkDestroyShaderModule(device.logicalDevice, shaderModule, nullptr);
+	if (result != VK_SUCCESS) {
+		throw std::runtime_error("Failed to create the cull pipeline");
+	}
+}
+
+VkDescriptorSetLayout GpuCuller::createSetLayout(const std::vector<VkDescriptorSetLayoutBinding>& bindings)
+{
+	VkDescriptorSetLayoutCreateInfo createInfo = {};
+	createInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+	createInfo.bindingCount = static_cast<uint32_t>(bindings.size());
+	createInfo.pBindings = bindings.data();
+
+	VkDescriptorSetLayout setLayout;
+	VkResult result = vkCreateDescriptorSetLayout(device.logicalDevice, &createInfo, nullptr, &setLayout);
+	if (result != VK_SUCCESS) {
+		throw std::runtime_error("Failed to create a Descriptor Set Layout!");
+	}
+	return setLayout;
+}
+
+void GpuCuller::setDepthPyramid(VkImageView newPyramidView, VkSampler newPyramidSampler, uint32_t width, uint32_t height, uint32_t levels)
+{
+	cullData.pyramidSize = glm::vec2(static_cast<float>(width), static_cast<float>(height));
+	cullData.pyramidLevels = static_cast<float>(levels);
+	if (newPyramidView == pyramidView && newPyramidSampler == pyramidSampler) return;
+
+	pyramidView = newPyramidView;
+	pyramidSampler = newPyramidSampler;
+
+	// Sets of frames in flight can't be updated, new ones are made and the old pool retired
+	if (descriptorPool != VK_NULL_HANDLE) {
+		retireDescriptorPool();
+		createDescriptorSets();
+	}
+}
+
+void GpuCuller::update(uint32_t frameIndex, const std::vector<GpuCullObject>& objects, const glm::mat4& viewProjection)
+{
+	if (sceneChanged(objects)) {
+		rebuild(objects);
+	}
+
+	// The early phase projects into the pyramid with the view it was rendered from
+	cullData.planes = FrustumCuller::extractPlanes(viewProjection);
+	cullData.viewProjection = viewProjection;
+	cullData.previousViewProjection = previousViewProjection;
+	cullData.objectCount = static_cast<uint32_t>(objects.size());
+	cullData.batchCount = static_cast<uint32_t>(batches.size());
+	cullData.occlusion = occlusion && pyramidView != VK_NULL_HANDLE ? 1 : 0;
+	previousViewProjection = viewProjection;
+
+	FrameBuffers& frame = frames[frameIndex];
+	void* cullDataMapped;
+	vkMapMemory(device.logicalDevice, frame.cullDataBufferMemory, 0, sizeof(GpuCullData), 0, &cullDataMapped);
+	memcpy(cullDataMapped, &cullData, sizeof(GpuCullData));
+	vkUnmapMemory(device.logicalDevice, frame.cullDataBufferMemory);
+
+	// Only transforms change between rebuilds, but the slot's buffer was last written frames ago so all of it is rewritten
+	objectData.resize(objects.size());
+	for (size_t i = 0; i < objects.size(); i++) {
+		objectData[i].model = objects[i].model;
+
+		// Texture sets are per frame slot, the one this slot binds is fetched again every frame. Keeping the last frame's
+		// would bind a set frames in flight may still be reading while it's rewritten
+		Batch& batch = batches[objectData[i].batch];
+		batch.textureSet = objects[i].textureSet;
+		batch.pushTexture = objects[i].pushTexture;
+	}
+
+	if (objectData.empty()) return;
+
+	VkDeviceSize size = sizeof(GpuCullObjectData) * objectData.size();
+	void* data;
+	vkMapMemory(device.logicalDevice, frame.objectBufferMemory, 0, size, 0, &data);
+	memcpy(data, objectData.data(), size);
+	vkUnmapMemory(device.logicalDevice, frame.objectBufferMemory);
+}
+
+bool GpuCuller::sceneChanged(const std::vector<GpuCullObject>& objects)
+{
+	if (objects.size() != scene.size() || vertexBuffer == VK_NULL_HANDLE) return true;
+
+	for (size_t i = 0; i < objects.size(); i++) {
+		if (objects[i].vertexBuffer != scene[i].vertexBuffer || objects[i].texId != scene[i].texId || objects[i].modelOffset != scene[i].modelOffset) {
+			return true;
+		}
+	}
+	return false;
+}
+
+void GpuCuller::rebuild(const std::vector<GpuCullObject>& objects)
+{
+	// Frames in flight still cull and draw with the old buffers
+	retireSceneResources();
+
+	scene.clear();
+	for (const GpuCullObject& object : objects) {
+		scene.push_back({ object.vertexBuffer, object.texId, object.modelOffset });
+	}
+
+	createSharedGeometry(objects);
+
+	// Objects sharing a texture and model offset are drawn by one indirect call
+	std::map<std::pair<int, uint32_t>, uint32_t> batchIds;
+	objectData.resize(objects.size());
+	for (size_t i = 0; i < objects.size(); i++) {
+		const GpuCullObject& object = objects[i];
+		auto batchId = batchIds.find({ object.texId, object.modelOffset });
+		if (batchId == batchIds.end()) {
+			batchId = batchIds.insert({ { object.texId, object.modelOffset }, static_cast<uint32_t>(batches.size()) }).first;
+			batches.push_back({ object.textureSet, object.pushTexture, object.modelOffset, 0, 0 });
+		}
+		batches[batchId->second].capacity++;
+
+		BoundingBox bounds = object.localBox;
+		MeshRange range = meshRanges[object.vertexBuffer];
+		GpuCullObjectData& objectEntry = objectData[i];
+		objectEntry.boundsMin = glm::vec4(bounds.min, 0.0f);
+		objectEntry.boundsMax = glm::vec4(bounds.max, 0.0f);
+		objectEntry.indexCount = object.indexCount;
+		objectEntry.firstIndex = range.firstIndex;
+		objectEntry.vertexOffset = range.vertexOffset;
+		objectEntry.batch = batchId->second;
+	}
+
+	// Each batch gets room for all of its objects, the count says how many were written
+	std::vector<uint32_t> commandOffsets;
+	uint32_t commandCount = 0;
+	for (Batch& batch : batches) {
+		batch.commandOffset = commandCount;
+		commandOffsets.push_back(commandCount);
+		commandCount += batch.capacity;
+	}
+
+	VkDeviceSize batchBufferSize = sizeof(uint32_t) * std::max<size_t>(commandOffsets.size(), 1);
+	createBuffer(device.physicalDevice, device.logicalDevice, batchBufferSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &batchBuffer, &batchBufferMemory);
+	if (!commandOffsets.empty()) {
+		void* data;
+		vkMapMemory(device.logicalDevice, batchBufferMemory, 0, sizeof(uint32_t) * commandOffsets.size(), 0, &data);
+		memcpy(data, commandOffsets.data(), sizeof(uint32_t) * commandOffsets.size());
+		vkUnmapMemory(device.logicalDevice, batchBufferMemory);
+	}
+
+	createFrameBuffers(static_cast<uint32_t>(objects.size()));
+	createDescriptorSets();
+
+	if (printStats) printf("GPU culling: %zu objects in %zu batches, %zu meshes in shared buffers\n", objects.size(), batches.size(), meshRanges.size());
+}
+
+void GpuCuller::createSharedGeometry(const std::vector<GpuCullObject>& objects)
+{
+	// Every mesh once, placed one after the other
+	VkDeviceSize vertexSize = 0;
+	VkDeviceSize indexSize = 0;
+	std::vector<const GpuCullObject*> meshes;
+	for (const GpuCullObject& object : objects) {
+		if (meshRanges.count(object.vertexBuffer) != 0) continue;
+
+		meshRanges[object.vertexBuffer] = { static_cast<uint32_t>(indexSize / sizeof(uint32_t)), static_cast<int32_t>(vertexSize / sizeof(Vertex)) };
+		vertexSize += sizeof(Vertex) * object.vertexCount;
+		indexSize += sizeof(uint32_t) * object.indexCount;
+		meshes.push_back(&object);
+	}
+
+	createBuffer(device.physicalDevice, device.logicalDevice, std::max<VkDeviceSize>(vertexSize, sizeof(Vertex)),
+		VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &vertexBuffer, &vertexBufferMemory);
+	createBuffer(device.physicalDevice, device.logicalDevice, std::max<VkDeviceSize>(indexSize, sizeof(uint32_t)),
+		VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &indexBuffer, &indexBufferMemory);
+	if (meshes.empty()) return;
+
+	// Copied on the GPU from the meshes' own buffers, all in one submission
+	VkCommandBuffer transferCommandBuffer = beginCommandBuffer(device.logicalDevice, transferCommandPool);
+	for (const GpuCullObject* mesh : meshes) {
+		MeshRange range = meshRanges[mesh->vertexBuffer];
+
+		VkBufferCopy vertexRegion = {};
+		vertexRegion.dstOffset = sizeof(Vertex) * range.vertexOffset;
+		vertexRegion.size = sizeof(Vertex) * mesh->vertexCount;
+		vkCmdCopyBuffer(transferCommandBuffer, mesh->vertexBuffer, vertexBuffer, 1, &vertexRegion);
+
+		VkBufferCopy indexRegion = {};
+		indexRegion.dstOffset = sizeof(uint32_t) * range.firstIndex;
+		indexRegion.size = sizeof(uint32_t) * mesh->indexCount;
+		vkCmdCopyBuffer(transferCommandBuffer, mesh->indexBuffer, indexBuffer, 1, &indexRegion);
+	}
+	endAndSubmitCommandBuffer(device.logicalDevice, transferCommandPool, transferQueue, transferCommandBuffer);
+}
+
+void GpuCuller::createFrameBuffers(uint32_t objectCount)
+{
+	// Sized for every object drawn in each phase, at least one entry so the buffers are never empty
+	VkDeviceSize objectBufferSize = sizeof(GpuCullObjectData) * std::max(objectCount, 1u);
+	VkDeviceSize commandBufferSize = sizeof(VkDrawIndexedIndirectCommand) * std::max(objectCount, 1u) * 2;
+	VkDeviceSize countBufferSize = sizeof(uint32_t) * (batches.size() * 2 + COUNT_STAT_COUNT);
+	VkDeviceSize lateBufferSize = sizeof(uint32_t) * std::max(objectCount, 1u);
+
+	for (FrameBuffers& frame : frames) {
+		createBuffer(device.physicalDevice, device.logicalDevice, objectBufferSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &frame.objectBuffer, &frame.objectBufferMemory);
+		createBuffer(device.physicalDevice, device.logicalDevice, commandBufferSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
+			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &frame.commandBuffer, &frame.commandBufferMemory);
+		createBuffer(device.physicalDevice, device.logicalDevice, countBufferSize,
+			VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &frame.countBuffer, &frame.countBufferMemory);
+		createBuffer(device.physicalDevice, device.logicalDevice, sizeof(GpuCullData), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &frame.cullDataBuffer, &frame.cullDataBufferMemory);
+		createBuffer(device.physicalDevice, device.logicalDevice, lateBufferSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &frame.lateBuffer, &frame.lateBufferMemory);
+		frame.culled = false;
+	}
+}
+
+void GpuCuller::createDescriptorSets()
+{
+	// Sets point at buffers that are replaced on a rebuild, so the pool is rebuilt (and the old one retired) with them
+	std::array<VkDescriptorPoolSize, 3> poolSizes = {};
+	poolSizes[0].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	poolSizes[0].descriptorCount = MAX_FRAMES_IN_FLIGHT * 6; // 5 cull bindings and the object set
+	poolSizes[1].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+	poolSizes[1].descriptorCount = MAX_FRAMES_IN_FLIGHT;
+	poolSizes[2].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	poolSizes[2].descriptorCount = MAX_FRAMES_IN_FLIGHT;
+
+	VkDescriptorPoolCreateInfo poolCreateInfo = {};
+	poolCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+	poolCreateInfo.maxSets = MAX_FRAMES_IN_FLIGHT * 2;
+	poolCreateInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
+	poolCreateInfo.pPoolSizes = poolSizes.data();
+
+	VkResult result = vkCreateDescriptorPool(device.logicalDevice, &poolCreateInfo, nullptr, &descriptorPool);
+	if (result != VK_SUCCESS) {
+		throw std::runtime_error("Failed to create the cull descriptor pool!");
+	}
+
+	for (FrameBuffers& frame : frames) {
+		std::array<VkDescriptorSetLayout, 2> setLayouts = { cullSetLayout, objectSetLayout };
+		std::array<VkDescriptorSet, 2> sets;
+
+		VkDescriptorSetAllocateInfo setAllocInfo = {};
+		setAllocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+		setAllocInfo.descriptorPool = descriptorPool;
+		setAllocInfo.descriptorSetCount = static_cast<uint32_t>(setLayouts.size());
+		setAllocInfo.pSetLayouts = setLayouts.data();
+
+		result = vkAllocateDescriptorSets(device.logicalDevice, &setAllocInfo, sets.data());
+		if (result != VK_SUCCESS) {
+			throw std::runtime_error("Failed to allocate cull descriptor sets");
+		}
+		frame.cullSet = sets[0];
+		frame.objectSet = sets[1];
+
+		// Objects, batches, commands, counts, cull data, late objects, the pyramid, then the objects again for the vertex shader
+		std::array<VkDescriptorBufferInfo, 6> bufferInfos = {};
+		bufferInfos[0] = { frame.objectBuffer, 0, VK_WHOLE_SIZE };
+		bufferInfos[1] = { batchBuffer, 0, VK_WHOLE_SIZE };
+		bufferInfos[2] = { frame.commandBuffer, 0, VK_WHOLE_SIZE };
+		bufferInfos[3] = { frame.countBuffer, 0, VK_WHOLE_SIZE };
+		bufferInfos[4] = { frame.cullDataBuffer, 0, VK_WHOLE_SIZE };
+		bufferInfos[5] = { frame.lateBuffer, 0, VK_WHOLE_SIZE };
+		VkDescriptorImageInfo pyramidInfo = { pyramidSampler, pyramidView, DEPTH_PYRAMID_LAYOUT };
+
+		std::array<VkWriteDescriptorSet, 8> setWrites = {};
+		for (uint32_t i = 0; i < setWrites.size(); i++) {
+			setWrites[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+			setWrites[i].dstSet = i < 7 ? frame.cullSet : frame.objectSet;
+			setWrites[i].dstBinding = i < 7 ? i : 0;
+			setWrites[i].dstArrayElement = 0;
+			setWrites[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+			setWrites[i].descriptorCount = 1;
+			setWrites[i].pBufferInfo = &bufferInfos[i < 6 ? i : 0];
+		}
+		setWrites[4].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+		setWrites[6].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+		setWrites[6].pBufferInfo = nullptr;
+		setWrites[6].pImageInfo = &pyramidInfo;
+
+		vkUpdateDescriptorSets(device.logicalDevice, static_cast<uint32_t>(setWrites.size()), setWrites.data(), 0, nullptr);
+	}
+}
+
+void GpuCuller::retireSceneResources()
+{
+	if (vertexBuffer != VK_NULL_HANDLE) {
+		deletionQueue->destroyBuffer(vertexBuffer, vertexBufferMemory);
+		deletionQueue->destroyBuffer(indexBuffer, indexBufferMemory);
+		deletionQueue->destroyBuffer(batchBuffer, batchBufferMemory);
+		vertexBuffer = VK_NULL_HANDLE;
+		indexBuffer = VK_NULL_HANDLE;
+		batchBuffer = VK_NULL_HANDLE;
+	}
+
+	for (FrameBuffers& frame : frames) {
+		if (frame.objectBuffer == VK_NULL_HANDLE) continue;
+		deletionQueue->destroyBuffer(frame.objectBuffer, frame.objectBufferMemory);
+		deletionQueue->destroyBuffer(frame.commandBuffer, frame.commandBufferMemory);
+		deletionQueue->destroyBuffer(frame.countBuffer, frame.countBufferMemory);
+		deletionQueue->destroyBuffer(frame.cullDataBuffer, frame.cullDataBufferMemory);
+		deletionQueue->destroyBuffer(frame.lateBuffer, frame.lateBufferMemory);
+		frame = FrameBuffers();
+	}
+
+	retireDescriptorPool();
+
+	batches.clear();
+	meshRanges.clear();
+}
+
+void GpuCuller::retireDescriptorPool()
+{
+	if (descriptorPool == VK_NULL_HANDLE) return;
+
+	deletionQueue->destroyDescriptorPool(descriptorPool);
+	descriptorPool = VK_NULL_HANDLE;
+}
+
+void GpuCuller::recordCull(VkCommandBuffer commandBuffer, uint32_t frameIndex, uint32_t phase)
+{
+	FrameBuffers& frame = frames[frameIndex];
+	if (frame.countBuffer == VK_NULL_HANDLE) return;
+
+	VkBufferMemoryBarrier barrier = {};
+	barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+	barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.offset = 0;
+	barrier.size = VK_WHOLE_SIZE;
+
+	if (phase == 0) {
+		// Counts of both phases start at 0, cull.comp appends to them
+		vkCmdFillBuffer(commandBuffer, frame.countBuffer, 0, VK_WHOLE_SIZE, 0);
+
+		barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+		barrier.buffer = frame.countBuffer;
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0,
+			0, nullptr, 1, &barrier, 0, nullptr);
+	}
+	else {
+		// The late phase reads what the early one marked and keeps counting after it
+		std::array<VkBufferMemoryBarrier, 2> earlyBarriers = { barrier, barrier };
+		earlyBarriers[0].srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+		earlyBarriers[0].dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+		earlyBarriers[0].buffer = frame.lateBuffer;
+		earlyBarriers[1].srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+		earlyBarriers[1].dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+		earlyBarriers[1].buffer = frame.countBuffer;
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0,
+			0, nullptr, static_cast<uint32_t>(earlyBarriers.size()), earlyBarriers.data(), 0, nullptr);
+	}
+
+	// Without occlusion nothing is left for the late phase, its counts stay at 0
+	if (cullData.objectCount > 0 && (phase == 0 || cullData.occlusion != 0)) {
+		CullConstants constants = { phase };
+		vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, cullPipeline);
+		vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, cullPipelineLayout, 0, 1, &frame.cullSet, 0, nullptr);
+		vkCmdPushConstants(commandBuffer, cullPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(CullConstants), &constants);
+		vkCmdDispatch(commandBuffer, (cullData.objectCount + CULL_GROUP_SIZE - 1) / CULL_GROUP_SIZE, 1, 1);
+	}
+
+	// Commands and counts are read as indirect parameters, the counts by the host too once the frame has finished
+	std::array<VkBufferMemoryBarrier, 2> drawBarriers = { barrier, barrier };
+	drawBarriers[0].srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+	drawBarriers[0].dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT;
+	drawBarriers[0].buffer = frame.commandBuffer;
+	drawBarriers[1].srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+	drawBarriers[1].dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_HOST_READ_BIT;
+	drawBarriers[1].buffer = frame.countBuffer;
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_HOST_BIT, 0,
+		0, nullptr, static_cast<uint32_t>(drawBarriers.size()), drawBarriers.data(), 0, nullptr);
+
+	frame.culled = true;
+}
+
+void GpuCuller::recordDraws(VkCommandBuffer commandBuffer, uint32_t frameIndex, uint32_t phase, VkPipelineLayout pipelineLayout, VkDescriptorSet frameSet, bool bindTextures)
+{
+	FrameBuffers& frame = frames[frameIndex];
+	if (batches.empty() || frame.commandBuffer == VK_NULL_HANDLE) return;
+
+	// Each phase has its own region of commands and counts
+	VkDeviceSize commandBase = sizeof(VkDrawIndexedIndirectCommand) * phase * scene.size();
+	VkDeviceSize countBase = sizeof(uint32_t) * phase * batches.size();
+
+	VkDeviceSize offset = 0;
+	vkCmdBindVertexBuffers(commandBuffer, 0, 1, &vertexBuffer, &offset);
+	vkCmdBindIndexBuffer(commandBuffer, indexBuffer, 0, VK_INDEX_TYPE_UINT32);
+	vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 2, 1, &frame.objectSet, 0, nullptr);
+
+	for (uint32_t i = 0; i < batches.size(); i++) {
+		const Batch& batch = batches[i];
+		vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &frameSet, 1, &batch.modelOffset);
+		if (bindTextures) {
+			vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 1, 1, &batch.textureSet, 0, nullptr);
+			vkCmdPushConstants(commandBuffer, pipelineLayout, VK_SHADER_STAGE_FRAGMENT_BIT, sizeof(glm::mat4), sizeof(PushTexture), &batch.pushTexture);
+		}
+
+		vkCmdDrawIndexedIndirectCount(commandBuffer, frame.commandBuffer, commandBase + sizeof(VkDrawIndexedIndirectCommand) * batch.commandOffset,
+			frame.countBuffer, countBase + sizeof(uint32_t) * i, batch.capacity, sizeof(VkDrawIndexedIndirectCommand));
+	}
+}
+
+bool GpuCuller::collectStats(uint32_t frameIndex, FrameAllocator* allocator, GpuCullStats* stats)
+{
+	FrameBuffers& frame = frames[frameIndex];
+	if (!frame.culled) return false;
+	frame.culled = false;
+
+	// The slot's last frame has finished, so the counts are final
+	size_t batchCount = batches.size();
+	FrameVector<uint32_t> counts(batchCount * 2 + COUNT_STAT_COUNT, 0, allocator);
+	void* data;
+	vkMapMemory(device.logicalDevice, frame.countBufferMemory, 0, sizeof(uint32_t) * counts.size(), 0, &data);
+	memcpy(counts.data(), data, sizeof(uint32_t) * counts.size());
+	vkUnmapMemory(device.logicalDevice, frame.countBufferMemory);
+
+	*stats = {};
+	stats->total = static_cast<uint32_t>(scene.size());
+	for (size_t i = 0; i < batchCount; i++) {
+		stats->earlyDrawn += counts[i];
+		stats->lateDrawn += counts[batchCount + i];
+	}
+	stats->frustumCulled = counts[batchCount * 2 + COUNT_FRUSTUM_CULLED];
+	stats->occluded = counts[batchCount * 2 + COUNT_OCCLUDED];
+	return true;
+}
+
+void GpuCuller::cleanup()
+{
+	// Only once the device is idle, retired buffers are freed when the deletion queue is flushed after this
+	retireSceneResources();
+
+	if (cullPipeline != VK_NULL_HANDLE) {
+		vkDestroyPipeline(device.logicalDevice, cullPipeline, nullptr);
+		vkDestroyPipelineLayout(device.logicalDevice, cullPipelineLayout, nullptr);
+		vkDestroyDescriptorSetLayout(device.logicalDevice, cullSetLayout, nullptr);
+		vkDestroyDescriptorSetLayout(device.logicalDevice, objectSetLayout, nullptr);
+		cullPipeline = VK_NULL_HANDLE;
+	}
+}
@@ -0,0 +1,205 @@
+#pragma once
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include <string>
+#include <vector>
+#include <map>
+#include <array>
+#include <stdexcept>
+
+#include <glm/glm.hpp>
+
+#include "Utilities.h"
+#include "DeletionQueue.h"
+#include "ShaderReflection.h"
+#include "DepthPyramid.h"
+#include "FrameAllocator.h"
+
+// Built with the project from the sources in shaders/, compile.bat rebuilds them for hot reload
+const std::string CULL_COMPUTE_SHADER_FILE = "shaders/cull.spv";
+
+// A mesh instance for the GPU to cull and draw
+struct GpuCullObject {
+	VkBuffer vertexBuffer;			// The mesh's own buffers, copied into the shared ones
+	VkBuffer indexBuffer;
+	uint32_t vertexCount;
+	uint32_t indexCount;
+	BoundingBox localBox;
+	glm::mat4 model;
+	uint32_t modelOffset;			// Dynamic offset into the model uniform buffer (set 0)
+	int texId;
+	VkDescriptorSet textureSet;		// Set 1
+	PushTexture pushTexture;
+};
+
+// One object in the object buffer, std430 layout of ObjectData in cull.comp and indirect.vert
+struct GpuCullObjectData {
+	glm::mat4 model;
+	glm::vec4 boundsMin;
+	glm::vec4 boundsMax;
+	uint32_t indexCount;
+	uint32_t firstIndex;
+	int32_t vertexOffset;
+	uint32_t batch;
+};
+
+// Uniform block of cull.comp, std140
+struct GpuCullData {
+	std::array<glm::vec4, 6> planes;
+	glm::mat4 viewProjection;
+	glm::mat4 previousViewProjection;
+	glm::vec2 pyramidSize;
+	float pyramidLevels;
+	uint32_t objectCount;
+	uint32_t batchCount;
+	uint32_t occlusion;
+};
+
+// Results of a cull, read back once its frame has finished
+struct GpuCullStats {
+	uint32_t total;
+	uint32_t earlyDrawn;
+	uint32_t lateDrawn;
+	uint32_t frustumCulled;
+	uint32_t occluded;			// Hidden in both phases
+};
+
+// Frustum culls every object in a compute shader that writes compacted indirect draws and a draw count per batch, the
+// graphics passes then draw each batch with one vkCmdDrawIndexedIndirectCount. Meshes are copied into one shared
+// vertex and index buffer so a batch needs no buffer binds between draws. Objects sharing a texture and model uniform
+// offset make a batch, the only state that still changes between draws.
+// With occlusion culling on, culling is split into two phases around a depth pyramid. The early phase tests against the
+// pyramid of the previous frame and the passes draw what survives, the pyramid is rebuilt from that depth, and the late
+// phase retests only what the early phase found hidden so newly visible objects are drawn in the same frame.
+class GpuCuller
+{
+public:
+	GpuCuller();
+
+	// Needs the drawIndirectCount and multiDrawIndirect features, and the shaders built
+	void init(VulkanDevice newDevice, VkQueue newTransferQueue, VkCommandPool newTransferCommandPool, VkPipelineCache pipelineCache,
+		DeletionQueue* newDeletionQueue, const std::string& vertexShaderFile);
+
+	// Set 2 of pipelines drawing through recordDraws, the object buffer the vertex shader reads its model matrix from
+	VkDescriptorSetLayout getObjectSetLayout() { return objectSetLayout; }
+
+	// Pyramid the occlusion tests sample, before the first update. A new one makes new sets
+	void setDepthPyramid(VkImageView pyramidView, VkSampler pyramidSampler, uint32_t width, uint32_t height, uint32_t levels);
+
+	// Without it the late phase culls nothing and only the frustum is tested
+	void setOcclusion(bool enabled) { occlusion = enabled; }
+
+	// Print the batch counts when the shared buffers are rebuilt
+	void setPrintStats(bool enable) { printStats = enable; }
+
+	// Writes this frame's objects, the shared buffers and batches are rebuilt if the meshes or their state changed
+	void update(uint32_t frameIndex, const std::vector<GpuCullObject>& objects, const glm::mat4& viewProjection);
+
+	// Outside a render pass, before anything that draws that phase. Phase 0 (early) clears the counts, phase 1 (late) must
+	// come after it in the same frame
+	void recordCull(VkCommandBuffer commandBuffer, uint32_t frameIndex, uint32_t phase);
+
+	// Binds the shared buffers and draws every batch of a phase, bindTextures is false for depth only passes
+	void recordDraws(VkCommandBuffer commandBuffer, uint32_t frameIndex, uint32_t phase, VkPipelineLayout pipelineLayout, VkDescriptorSet frameSet, bool bindTextures);
+
+	// The slot's last cull, read back once the slot is free again. False if it hasn't culled since
+	bool collectStats(uint32_t frameIndex, FrameAllocator* allocator, GpuCullStats* stats);
+
+	void cleanup();
+
+	~GpuCuller();
+
+private:
+	// Push constant block of cull.comp
+	struct CullConstants {
+		uint32_t phase;
+	};
+
+	// Statistics after the per batch counts of both phases, same order as in cull.comp
+	enum CountStat {
+		COUNT_FRUSTUM_CULLED,
+		COUNT_EARLY_OCCLUDED,
+		COUNT_OCCLUDED,
+		COUNT_STAT_COUNT
+	};
+
+	struct Batch {
+		VkDescriptorSet textureSet;
+		PushTexture pushTexture;
+		uint32_t modelOffset;
+		uint32_t commandOffset;		// First command in the command buffer
+		uint32_t capacity;			// Objects in the batch, the most it can draw
+	};
+
+	// What the batches and shared buffers were built from, compared every frame
+	struct SceneEntry {
+		VkBuffer vertexBuffer;
+		int texId;
+		uint32_t modelOffset;
+	};
+
+	struct MeshRange {
+		uint32_t firstIndex;
+		int32_t vertexOffset;
+	};
+
+	struct FrameBuffers {
+		VkBuffer objectBuffer = VK_NULL_HANDLE;		// Host visible, rewritten every frame
+		VkDeviceMemory objectBufferMemory = VK_NULL_HANDLE;
+		VkBuffer commandBuffer = VK_NULL_HANDLE;	// Written by cull.comp, early commands then late ones
+		VkDeviceMemory commandBufferMemory = VK_NULL_HANDLE;
+		VkBuffer countBuffer = VK_NULL_HANDLE;		// Host visible so the draw count can be read back
+		VkDeviceMemory countBufferMemory = VK_NULL_HANDLE;
+		VkBuffer cullDataBuffer = VK_NULL_HANDLE;	// Host visible, GpuCullData
+		VkDeviceMemory cullDataBufferMemory = VK_NULL_HANDLE;
+		VkBuffer lateBuffer = VK_NULL_HANDLE;		// Objects the early phase found hidden, only touched by cull.comp
+		VkDeviceMemory lateBufferMemory = VK_NULL_HANDLE;
+		VkDescriptorSet cullSet = VK_NULL_HANDLE;
+		VkDescriptorSet objectSet = VK_NULL_HANDLE;
+		bool culled = false;						// Recorded a cull since the buffers were created
+	};
+
+	VulkanDevice device;
+	VkQueue transferQueue;
+	VkCommandPool transferCommandPool;
+	DeletionQueue* deletionQueue = nullptr;
+
+	VkDescriptorSetLayout cullSetLayout = VK_NULL_HANDLE;
+	VkDescriptorSetLayout objectSetLayout = VK_NULL_HANDLE;
+	VkPipelineLayout cullPipelineLayout = VK_NULL_HANDLE;
+	VkPipeline cullPipeline = VK_NULL_HANDLE;
+
+	// Rebuilt with the scene, the old ones are retired through the deletion queue
+	std::vector<SceneEntry> scene;
+	std::vector<Batch> batches;
+	std::map<VkBuffer, MeshRange> meshRanges;	// Keyed by the mesh's own vertex buffer
+	VkBuffer vertexBuffer = VK_NULL_HANDLE;
+	VkDeviceMemory vertexBufferMemory = VK_NULL_HANDLE;
+	VkBuffer indexBuffer = VK_NULL_HANDLE;
+	VkDeviceMemory indexBufferMemory = VK_NULL_HANDLE;
+	VkBuffer batchBuffer = VK_NULL_HANDLE;		// Command offset of each batch
+	VkDeviceMemory batchBufferMemory = VK_NULL_HANDLE;
+	VkDescriptorPool descriptorPool = VK_NULL_HANDLE;
+	std::array<FrameBuffers, MAX_FRAMES_IN_FLIGHT> frames;
+
+	// Sampled by the occlusion tests, owned by the DepthPyramid
+	VkImageView pyramidView = VK_NULL_HANDLE;
+	VkSampler pyramidSampler = VK_NULL_HANDLE;
+	bool occlusion = false;
+	bool printStats = false;
+
+	GpuCullData cullData = {};
+	glm::mat4 previousViewProjection = glm::mat4(1.0f);
+	std::vector<GpuCullObjectData> objectData;
+
+	bool sceneChanged(const std::vector<GpuCullObject>& objects);
+	void rebuild(const std::vector<GpuCullObject>& objects);
+	void createSharedGeometry(const std::vector<GpuCullObject>& objects);
+	void createFrameBuffers(uint32_t objectCount);
+	void createDescriptorSets();
+	void retireSceneResources();
+	void retireDescriptorPool();
+	VkDescriptorSetLayout createSetLayout(const std::vector<VkDescriptorSetLayoutBinding>& bindings);
+};
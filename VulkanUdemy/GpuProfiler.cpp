@@ -0,0 +1,277 @@
+#include "GpuProfiler.h"
+
+#include <algorithm>
+#include <cmath>
+
+void RollingStats::add(double value)
+{
+	values[next] = value;
+	next = (next + 1) % GPU_PROFILER_HISTORY;
+	count = std::min(count + 1, GPU_PROFILER_HISTORY);
+}
+
+double RollingStats::getAverage()
+{
+	if (count == 0) return 0.0;
+
+	// Until the history is full, the values are the first count entries
+	double total = 0.0;
+	for (uint32_t i = 0; i < count; i++) {
+		total += values[i];
+	}
+	return total / count;
+}
+
+double RollingStats::getPercentile(double percentile)
+{
+	if (count == 0) return 0.0;
+
+	// Nearest rank
+	std::array<double, GPU_PROFILER_HISTORY> sorted = values;
+	uint32_t rank = static_cast<uint32_t>(std::ceil(percentile / 100.0 * count));
+	uint32_t index = std::min(std::max(rank, 1u), count) - 1;
+	std::nth_element(sorted.begin(), sorted.begin() + index, sorted.begin() + count);
+	return sorted[index];
+}
+
+GpuProfiler::GpuProfiler()
+{
+}
+
+GpuProfiler::~GpuProfiler()
+{
+}
+
+void GpuProfiler::init(VulkanDevice newDevice, float newTimestampPeriod, uint32_t timestampValidBits, bool statisticsSupported)
+{
+	device = newDevice;
+	timestampPeriod = newTimestampPeriod;
+	timestampMask = timestampValidBits >= 64 ? ~0ull : (1ull << timestampValidBits) - 1;
+	scopes.push_back({ "frame", 0, RollingStats() });
+
+	if (timestampValidBits == 0) {
+		printf("GPU timestamps not supported, GPU scopes won't be timed\n");
+	}
+	else {
+		VkQueryPoolCreateInfo timestampPoolCreateInfo = {};
+		timestampPoolCreateInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+		timestampPoolCreateInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+		timestampPoolCreateInfo.queryCount = MAX_FRAMES_IN_FLIGHT * MAX_GPU_SCOPES * 2; // Both ends of every scope of every frame slot
+
+		VkResult result = vkCreateQueryPool(device.logicalDevice, &timestampPoolCreateInfo, nullptr, &timestampPool);
+		if (result != VK_SUCCESS) {
+			throw std::runtime_error("Failed to create a timestamp query pool!");
+		}
+	}
+
+	if (!statisticsSupported) {
+		printf("Pipeline statistics queries not supported, shader invocations won't be counted\n");
+		return;
+	}
+
+	// Results come back in bit order, the same order as GpuPipelineStatistics
+	VkQueryPoolCreateInfo statisticsPoolCreateInfo = {};
+	statisticsPoolCreateInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+	statisticsPoolCreateInfo.queryType = VK_QUERY_TYPE_PIPELINE_STATISTICS;
+	statisticsPoolCreateInfo.queryCount = MAX_FRAMES_IN_FLIGHT; // One per frame slot
+	statisticsPoolCreateInfo.pipelineStatistics = VK_QUERY_PIPELINE_STATISTIC_INPUT_ASSEMBLY_VERTICES_BIT |
+		VK_QUERY_PIPELINE_STATISTIC_VERTEX_SHADER_INVOCATIONS_BIT |
+		VK_QUERY_PIPELINE_STATISTIC_CLIPPING_INVOCATIONS_BIT |
+		VK_QUERY_PIPELINE_STATISTIC_CLIPPING_PRIMITIVES_BIT |
+		VK_QUERY_PIPELINE_STATISTIC_FRAGMENT_SHADER_INVOCATIONS_BIT |
+		VK_QUERY_PIPELINE_STATISTIC_COMPUTE_SHADER_INVOCATIONS_BIT;
+
+	VkResult result = vkCreateQueryPool(device.logicalDevice, &statisticsPoolCreateInfo, nullptr, &statisticsPool);
+	if (result != VK_SUCCESS) {
+		throw std::runtime_error("Failed to create a pipeline statistics query pool!");
+	}
+}
+
+bool GpuProfiler::collect(uint32_t frameIndex, GpuPipelineStatistics* statistics)
+{
+	FrameQueries& frame = frames[frameIndex];
+	if (!frame.pending) return false;
+	frame.pending = false;
+
+	// The slot's frame has finished, so everything it wrote is available without waiting. A scope left open (an
+	// exception mid-recording) leaves a query unwritten, the whole frame is skipped then rather than waited on
+	if (frame.queryCount > 0) {
+		VkResult result = vkGetQueryPoolResults(device.logicalDevice, timestampPool, frameIndex * MAX_GPU_SCOPES * 2, frame.queryCount,
+			sizeof(uint64_t) * frame.queryCount, timestamps.data(), sizeof(uint64_t), VK_QUERY_RESULT_64_BIT);
+		if (result == VK_SUCCESS) {
+			for (uint32_t i = 0; i < frame.scopeCount; i++) {
+				const RecordedScope& recorded = frame.recorded[i];
+				uint64_t ticks = (timestamps[recorded.endQuery] - timestamps[recorded.beginQuery]) & timestampMask;
+				scopes[recorded.scope].times.add(ticks * static_cast<double>(timestampPeriod) / 1000000.0);
+			}
+		}
+	}
+
+	if (!frame.statistics) return false;
+
+	std::array<uint64_t, STATISTIC_COUNT> values;
+	VkResult result = vkGetQueryPoolResults(device.logicalDevice, statisticsPool, frameIndex, 1,
+		sizeof(values), values.data(), sizeof(values), VK_QUERY_RESULT_64_BIT);
+	if (result != VK_SUCCESS) return false;
+
+	for (uint32_t i = 0; i < STATISTIC_COUNT; i++) {
+		statisticStats[i].add(static_cast<double>(values[i]));
+	}
+	*statistics = toStatistics(values);
+	return true;
+}
+
+void GpuProfiler::beginFrame(VkCommandBuffer commandBuffer, uint32_t frameIndex)
+{
+	recordingFrame = frameIndex;
+	openCount = 0;
+
+	FrameQueries& frame = frames[frameIndex];
+	frame.scopeCount = 0;
+	frame.queryCount = 0;
+	frame.statistics = false;
+
+	if (timestampPool != VK_NULL_HANDLE) {
+		vkCmdResetQueryPool(commandBuffer, timestampPool, frameIndex * MAX_GPU_SCOPES * 2, MAX_GPU_SCOPES * 2);
+	}
+	if (statisticsPool != VK_NULL_HANDLE) {
+		vkCmdResetQueryPool(commandBuffer, statisticsPool, frameIndex, 1);
+		vkCmdBeginQuery(commandBuffer, statisticsPool, frameIndex, 0);
+		frame.statistics = true;
+	}
+
+	beginScope(commandBuffer, "frame");
+}
+
+void GpuProfiler::endFrame(VkCommandBuffer commandBuffer)
+{
+	endScope(commandBuffer);
+	if (openCount != 0) {
+		throw std::runtime_error("GPU profiler scope not ended before the end of the frame");
+	}
+
+	FrameQueries& frame = frames[recordingFrame];
+	if (frame.statistics) {
+		vkCmdEndQuery(commandBuffer, statisticsPool, recordingFrame);
+	}
+	frame.pending = true;
+}
+
+void GpuProfiler::beginScope(VkCommandBuffer commandBuffer, const char* name)
+{
+	if (openCount >= MAX_GPU_SCOPE_DEPTH) {
+		throw std::runtime_error("GPU profiler scopes nested too deep");
+	}
+
+	// Past the limit the scope is still tracked, so its end matches up, but not timed
+	uint32_t recordedIndex = ~0u;
+	FrameQueries& frame = frames[recordingFrame];
+	if (timestampPool != VK_NULL_HANDLE && frame.scopeCount < MAX_GPU_SCOPES) {
+		recordedIndex = frame.scopeCount++;
+		RecordedScope& recorded = frame.recorded[recordedIndex];
+		recorded.scope = findScope(name);
+		recorded.beginQuery = frame.queryCount++;
+		scopes[recorded.scope].depth = openCount;
+
+		// Written as soon as the commands before it have started, the end once they've all finished
+		vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, timestampPool, recordingFrame * MAX_GPU_SCOPES * 2 + recorded.beginQuery);
+	}
+	openScopes[openCount++] = recordedIndex;
+}
+
+void GpuProfiler::endScope(VkCommandBuffer commandBuffer)
+{
+	if (openCount == 0) {
+		throw std::runtime_error("GPU profiler scope ended without being begun");
+	}
+
+	uint32_t recordedIndex = openScopes[--openCount];
+	if (recordedIndex == ~0u) return;
+
+	FrameQueries& frame = frames[recordingFrame];
+	RecordedScope& recorded = frame.recorded[recordedIndex];
+	recorded.endQuery = frame.queryCount++;
+	vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, timestampPool, recordingFrame * MAX_GPU_SCOPES * 2 + recorded.endQuery);
+}
+
+GpuScopeStats GpuProfiler::getScopeStats(uint32_t scope)
+{
+	Scope& stats = scopes[scope];
+	return { stats.name.c_str(), stats.depth, stats.times.getCount(), stats.times.getAverage(),
+		stats.times.getPercentile(50.0), stats.times.getPercentile(95.0), stats.times.getPercentile(99.0), stats.times.getLatest() };
+}
+
+GpuPipelineStatistics GpuProfiler::getAverageStatistics()
+{
+	std::array<uint64_t, STATISTIC_COUNT> values;
+	for (uint32_t i = 0; i < STATISTIC_COUNT; i++) {
+		values[i] = static_cast<uint64_t>(statisticStats[i].getAverage() + 0.5);
+	}
+	return toStatistics(values);
+}
+
+GpuPipelineStatistics GpuProfiler::getStatisticsPercentile(double percentile)
+{
+	std::array<uint64_t, STATISTIC_COUNT> values;
+	for (uint32_t i = 0; i < STATISTIC_COUNT; i++) {
+		values[i] = static_cast<uint64_t>(statisticStats[i].getPercentile(percentile));
+	}
+	return toStatistics(values);
+}
+
+void GpuProfiler::printStats()
+{
+	if (isEnabled() && scopes[0].times.getCount() > 0) {
+		printf("GPU scope                | frames | avg (ms) | p50 (ms) | p95 (ms) | p99 (ms)\n");
+		for (uint32_t i = 0; i < scopes.size(); i++) {
+			GpuScopeStats stats = getScopeStats(i);
+			if (stats.samples == 0) continue;
+
+			int indent = static_cast<int>(std::min(stats.depth, MAX_GPU_SCOPE_DEPTH)) * 2;
+			printf("%*s%-*s | %6u | %8.3f | %8.3f | %8.3f | %8.3f\n", indent, "", 24 - indent, stats.name,
+				stats.samples, stats.average, stats.p50, stats.p95, stats.p99);
+		}
+	}
+
+	if (statisticStats[0].getCount() > 0) {
+		GpuPipelineStatistics average = getAverageStatistics();
+		printf("Pipeline statistics per frame (last %u frames): %llu input vertices, %llu vertex shader invocations, %llu clipping invocations, "
+			"%llu clipping primitives, %llu fragment shader invocations, %llu compute shader invocations\n", statisticStats[0].getCount(),
+			(unsigned long long)average.inputVertices, (unsigned long long)average.vertexInvocations, (unsigned long long)average.clippingInvocations,
+			(unsigned long long)average.clippingPrimitives, (unsigned long long)average.fragmentInvocations, (unsigned long long)average.computeInvocations);
+	}
+}
+
+void GpuProfiler::cleanup()
+{
+	if (timestampPool != VK_NULL_HANDLE) {
+		vkDestroyQueryPool(device.logicalDevice, timestampPool, nullptr);
+		timestampPool = VK_NULL_HANDLE;
+	}
+	if (statisticsPool != VK_NULL_HANDLE) {
+		vkDestroyQueryPool(device.logicalDevice, statisticsPool, nullptr);
+		statisticsPool = VK_NULL_HANDLE;
+	}
+}
+
+uint32_t GpuProfiler::findScope(const char* name)
+{
+	// Few scopes, a linear search beats hashing and doesn't allocate
+	for (uint32_t i = 0; i < scopes.size(); i++) {
+		if (scopes[i].name == name) return i;
+	}
+	scopes.push_back({ name, 0, RollingStats() });
+	return static_cast<uint32_t>(scopes.size()) - 1;
+}
+
+GpuPipelineStatistics GpuProfiler::toStatistics(const std::array<uint64_t, STATISTIC_COUNT>& values)
+{
+	GpuPipelineStatistics statistics;
+	statistics.inputVertices = values[0];
+	statistics.vertexInvocations = values[1];
+	statistics.clippingInvocations = values[2];
+	statistics.clippingPrimitives = values[3];
+	statistics.fragmentInvocations = values[4];
+	statistics.computeInvocations = values[5];
+	return statistics;
+}
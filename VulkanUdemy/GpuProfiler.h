@@ -0,0 +1,137 @@
+#pragma once
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include <string>
+#include <vector>
+#include <array>
+#include <stdexcept>
+
+#include "Utilities.h"
+
+const uint32_t MAX_GPU_SCOPES = 32; // Timed per frame, scopes past this aren't recorded
+const uint32_t MAX_GPU_SCOPE_DEPTH = 8;
+const uint32_t GPU_PROFILER_HISTORY = 256; // Frames the rolling stats cover
+
+// The last GPU_PROFILER_HISTORY values of something measured once a frame
+class RollingStats
+{
+public:
+	void add(double value);
+
+	uint32_t getCount() { return count; }
+	double getLatest() { return count > 0 ? values[(next + GPU_PROFILER_HISTORY - 1) % GPU_PROFILER_HISTORY] : 0.0; }
+	double getAverage();
+	double getPercentile(double percentile); // 0 to 100, 100 is the worst
+
+private:
+	std::array<double, GPU_PROFILER_HISTORY> values;
+	uint32_t next = 0;
+	uint32_t count = 0;
+};
+
+// Counted between beginFrame and endFrame, whichever the device supports
+struct GpuPipelineStatistics {
+	uint64_t inputVertices = 0;
+	uint64_t vertexInvocations = 0;
+	uint64_t clippingInvocations = 0;	// Primitives reaching the clipper
+	uint64_t clippingPrimitives = 0;	// Primitives out of it, to be rasterised
+	uint64_t fragmentInvocations = 0;
+	uint64_t computeInvocations = 0;
+};
+
+// Rolling times of one scope (ms)
+struct GpuScopeStats {
+	const char* name;
+	uint32_t depth;		// Nesting when last recorded, 0 is the frame
+	uint32_t samples;
+	double average;
+	double p50;
+	double p95;
+	double p99;
+	double latest;
+};
+
+// GPU time of named scopes of a frame's commands, from timestamps written at either end, plus pipeline statistics over
+// the whole frame. Each frame slot has its own queries, read back when the slot comes round again: its frame has
+// finished by then, so reading never waits. Results are a frame or two old (frames in flight).
+class GpuProfiler
+{
+public:
+	GpuProfiler();
+
+	// timestampValidBits of the queue recorded on, 0 if it doesn't support timestamps
+	void init(VulkanDevice newDevice, float newTimestampPeriod, uint32_t timestampValidBits, bool statisticsSupported);
+
+	// Adds the slot's last frame to the rolling stats. False if it had no pipeline statistics to read
+	bool collect(uint32_t frameIndex, GpuPipelineStatistics* statistics);
+
+	// Outside a render pass, resets the slot's queries and opens the frame scope
+	void beginFrame(VkCommandBuffer commandBuffer, uint32_t frameIndex);
+	void endFrame(VkCommandBuffer commandBuffer);
+
+	// Nested scopes are timed separately, so a pass and the draw groups inside it both show. Scopes with the same name
+	// share stats, the name is copied the first time it's seen
+	void beginScope(VkCommandBuffer commandBuffer, const char* name);
+	void endScope(VkCommandBuffer commandBuffer);
+
+	bool isEnabled() { return timestampPool != VK_NULL_HANDLE; }
+
+	// Every scope seen so far, in the order first recorded
+	uint32_t getScopeCount() { return static_cast<uint32_t>(scopes.size()); }
+	GpuScopeStats getScopeStats(uint32_t scope);
+	GpuScopeStats getFrameStats() { return getScopeStats(0); }
+
+	// Per frame averages and percentiles of each statistic, in GpuPipelineStatistics order
+	GpuPipelineStatistics getAverageStatistics();
+	GpuPipelineStatistics getStatisticsPercentile(double percentile);
+
+	void printStats();
+
+	void cleanup();
+
+	~GpuProfiler();
+
+private:
+	static const uint32_t STATISTIC_COUNT = 6;
+
+	VulkanDevice device;
+	float timestampPeriod = 1.0f; // Nanoseconds per tick
+	uint64_t timestampMask = ~0ull;
+	VkQueryPool timestampPool = VK_NULL_HANDLE; // MAX_GPU_SCOPES * 2 per slot
+	VkQueryPool statisticsPool = VK_NULL_HANDLE; // One per slot
+
+	struct Scope {
+		std::string name;
+		uint32_t depth;
+		RollingStats times;
+	};
+	std::vector<Scope> scopes; // 0 is the frame
+
+	struct RecordedScope {
+		uint32_t scope;
+		uint32_t beginQuery;
+		uint32_t endQuery;
+	};
+
+	struct FrameQueries {
+		std::array<RecordedScope, MAX_GPU_SCOPES> recorded;
+		uint32_t scopeCount = 0;
+		uint32_t queryCount = 0;
+		bool statistics = false;
+		bool pending = false; // Recorded, not read back yet
+	};
+	FrameQueries frames[MAX_FRAMES_IN_FLIGHT];
+
+	// Being recorded
+	uint32_t recordingFrame = 0;
+	std::array<uint32_t, MAX_GPU_SCOPE_DEPTH> openScopes; // Index into the frame's recorded scopes, ~0 if it wasn't recorded
+	uint32_t openCount = 0;
+
+	std::array<uint64_t, MAX_GPU_SCOPES * 2> timestamps; // Read back
+	std::array<RollingStats, STATISTIC_COUNT> statisticStats;
+
+	uint32_t findScope(const char* name);
+	static GpuPipelineStatistics toStatistics(const std::array<uint64_t, STATISTIC_COUNT>& values);
+};
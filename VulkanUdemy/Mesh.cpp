@@ -18,6 +18,7 @@ Mesh::Mesh(VkPhysicalDevice newPhysicalDevice, VkDevice newDevice, VkQueue trans
 	device = newDevice;
 	createVertexBuffer(transferQueue, transferCommandPool, vertices);
 	createIndexBuffer(transferQueue, transferCommandPool, indices);
+	calculateBounds(vertices);
 
 	model.model = glm::mat4(1.0f);
 	model.hasTexture = true;
@@ -32,32 +33,33 @@ Mesh::Mesh(VkPhysicalDevice newPhysicalDevice, VkDevice newDevice, VkQueue trans
 	device = newDevice;
 	createVertexBuffer(transferQueue, transferCommandPool, vertices);
 	createIndexBuffer(transferQueue, transferCommandPool, indices);
+	calculateBounds(vertices);
 
 	model.model = glm::mat4(1.0f);
 	model.hasTexture = false;
 }
 
-int Mesh::getTexId()
+int Mesh::getTexId() const
 {
 	return texId;
 }
 
-int Mesh::getVertexCount()
+int Mesh::getVertexCount() const
 {
 	return vertexCount;
 }
 
-VkBuffer Mesh::getVertexBuffer()
+VkBuffer Mesh::getVertexBuffer() const
 {
 	return vertexBuffer;
 }
 
-int Mesh::getIndexCount()
+int Mesh::getIndexCount() const
 {
 	return indexCount;
 }
 
-VkBuffer Mesh::getIndexBuffer()
+VkBuffer Mesh::getIndexBuffer() const
 {
 	return indexBuffer;
 }
@@ -71,6 +73,12 @@ void Mesh::destroyBuffers()
 	vkFreeMemory(device, indexBufferMemory, nullptr);
 }
 
+void Mesh::destroyBuffers(DeletionQueue* deletionQueue)
+{
+	deletionQueue->destroyBuffer(vertexBuffer, vertexBufferMemory);
+	deletionQueue->destroyBuffer(indexBuffer, indexBufferMemory);
+}
+
 void Mesh::setModel(glm::mat4 newModel)
 {
 	model.model = newModel;
@@ -101,7 +109,8 @@ void Mesh::createVertexBuffer(VkQueue transferQueue, VkCommandPool transferComma
 
 	// Create buffer with TRANSFER_DST_BIT to mark as recipient of transfer data (also VERTEX_BUFFER)
 	// Buffer memory is to be DEVICE_LOCAL_BIT meaning memory is on the GPU and only acessible by it and not the CPU (host)
-	createBuffer(physicalDevice, device, bufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &vertexBuffer, &vertexBufferMemory);
+	// TRANSFER_SRC so the GPU culler can copy it into its shared vertex buffer
+	createBuffer(physicalDevice, device, bufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &vertexBuffer, &vertexBufferMemory);
 
 	copyBuffer(device, transferQueue, transferCommandPool, stagingBuffer, vertexBuffer, bufferSize); // Copy staging buffer to vertex buffer on gpu
 
@@ -126,7 +135,7 @@ void Mesh::createIndexBuffer(VkQueue transferQueue, VkCommandPool transferComman
 	vkUnmapMemory(device, stagingBufferMemory);
 
 	// Create buffer for index data on gpu access only area
-	createBuffer(physicalDevice, device, bufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &indexBuffer, &indexBufferMemory);
+	createBuffer(physicalDevice, device, bufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &indexBuffer, &indexBufferMemory);
 
 	// Copy from staging buffer to gpu access buffer
 	copyBuffer(device, transferQueue, transferCommandPool, stagingBuffer, indexBuffer, bufferSize);
@@ -136,3 +145,16 @@ void Mesh::createIndexBuffer(VkQueue transferQueue, VkCommandPool transferComman
 	vkFreeMemory(device, stagingBufferMemory, nullptr);
 
 }
+
+void Mesh::calculateBounds(std::vector<Vertex>* vertices)
+{
+	boundingBox = { glm::vec3(0.0f), glm::vec3(0.0f) };
+	if (!vertices->empty()) {
+		boundingBox = { (*vertices)[0].pos, (*vertices)[0].pos };
+	}
+
+	for (const Vertex& vertex : *vertices) {
+		boundingBox.min = glm::min(boundingBox.min, vertex.pos);
+		boundingBox.max = glm::max(boundingBox.max, vertex.pos);
+	}
+}
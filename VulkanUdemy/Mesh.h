@@ -4,6 +4,7 @@
 #include <GLFW/glfw3.h>
 #include <vector>
 #include "Utilities.h"
+#include "DeletionQueue.h"
 
 struct Model {
 	glm::mat4 model;
@@ -29,36 +30,44 @@ public:
 		std::vector<uint32_t>* indices,
 		std::vector<Vertex>* vertices);
 	
-	int getTexId();
+	int getTexId() const;
 
-	int getVertexCount();
-	VkBuffer getVertexBuffer();
+	int getVertexCount() const;
+	VkBuffer getVertexBuffer() const;
+	VkDeviceMemory getVertexBufferMemory() const { return vertexBufferMemory; }
 
-	int getIndexCount();
-	VkBuffer getIndexBuffer();
+	int getIndexCount() const;
+	VkBuffer getIndexBuffer() const;
+	VkDeviceMemory getIndexBufferMemory() const { return indexBufferMemory; }
+
+	BoundingBox getBoundingBox() const { return boundingBox; }
 
 	void destroyBuffers();
+	void destroyBuffers(DeletionQueue* deletionQueue); // Once frames still drawing the mesh have finished
 
 	void setModel(glm::mat4 newModel);
 	Model getModel();
 
 	~Mesh();
 private:
-	Model model;
-	int texId;
+	// A default constructed mesh is empty, with no buffers
+	Model model = { glm::mat4(1.0f), false };
+	int texId = -1;
+	BoundingBox boundingBox = {};
 
-	int vertexCount;
-	VkBuffer vertexBuffer;
-	VkDeviceMemory vertexBufferMemory;
+	int vertexCount = 0;
+	VkBuffer vertexBuffer = VK_NULL_HANDLE;
+	VkDeviceMemory vertexBufferMemory = VK_NULL_HANDLE;
 
-	int indexCount;
-	VkBuffer indexBuffer;
-	VkDeviceMemory indexBufferMemory;
+	int indexCount = 0;
+	VkBuffer indexBuffer = VK_NULL_HANDLE;
+	VkDeviceMemory indexBufferMemory = VK_NULL_HANDLE;
 
-	VkPhysicalDevice physicalDevice;
-	VkDevice device;
+	VkPhysicalDevice physicalDevice = VK_NULL_HANDLE;
+	VkDevice device = VK_NULL_HANDLE;
 
 	void createVertexBuffer(VkQueue transferQueue, VkCommandPool transferCommandPool, std::vector<Vertex>* vertices);
 	void createIndexBuffer(VkQueue transferQueue, VkCommandPool transferCommandPool, std::vector<uint32_t>* indices);
+	void calculateBounds(std::vector<Vertex>* vertices);
 };
 
@@ -0,0 +1,637 @@
+#include "MipmapGenerator.h"
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <thread>
+#include <cstdio>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define MIP_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+// MSVC allows AVX2 intrinsics in any function, GCC/Clang need the function marked
+#if defined(__GNUC__) || defined(__clang__)
+#define MIP_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define MIP_TARGET_AVX2
+#endif
+
+const int LINEAR_TO_SRGB_TABLE_SIZE = 65536; // Resolution of linear -> sRGB encode table (error well under half a unit)
+const int KAISER_TAPS = 12; // Source taps per destination pixel (3 destination pixels either side)
+const float KAISER_RADIUS = 3.0f; // Filter radius in destination pixels
+const float KAISER_BETA = 4.0f; // Window shape, higher is smoother
+const uint32_t MIN_ROWS_PER_THREAD = 32; // Don't split small levels across threads, thread startup would dominate
+
+// Lookup tables for converting between 8 bit encoded channels and linear floats
+struct ColourTables {
+	float srgbToLinear[256];
+	float unormToFloat[256];
+	unsigned char linearToSrgb[LINEAR_TO_SRGB_TABLE_SIZE];
+};
+
+static ColourTables buildColourTables()
+{
+	ColourTables tables;
+	for (int i = 0; i < 256; i++) {
+		float c = i / 255.0f;
+		tables.srgbToLinear[i] = c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+		tables.unormToFloat[i] = c;
+	}
+	for (int i = 0; i < LINEAR_TO_SRGB_TABLE_SIZE; i++) {
+		float l = i / static_cast<float>(LINEAR_TO_SRGB_TABLE_SIZE - 1);
+		float c = l <= 0.0031308f ? l * 12.92f : 1.055f * std::pow(l, 1.0f / 2.4f) - 0.055f;
+		tables.linearToSrgb[i] = static_cast<unsigned char>(std::min(std::max(c * 255.0f + 0.5f, 0.0f), 255.0f));
+	}
+	return tables;
+}
+
+static const ColourTables& getColourTables()
+{
+	// Built once on first use, static initialisation is thread safe so worker threads can call this
+	static const ColourTables tables = buildColourTables();
+	return tables;
+}
+
+// Zeroth order modified Bessel function of the first kind (series expansion), used by the Kaiser window
+static double besselI0(double x)
+{
+	double sum = 1.0;
+	double term = 1.0;
+	for (int k = 1; k < 32; k++) {
+		term *= (x / (2.0 * k)) * (x / (2.0 * k));
+		sum += term;
+		if (term < sum * 1e-12) break;
+	}
+	return sum;
+}
+
+struct KaiserWeights {
+	float weights[KAISER_TAPS];
+};
+
+static KaiserWeights buildKaiserWeights()
+{
+	const double pi = 3.14159265358979323846;
+	double tapWeights[KAISER_TAPS];
+	double total = 0.0;
+	for (int k = 0; k < KAISER_TAPS; k++) {
+		// Distance from the destination pixel centre, in destination pixels
+		double t = (k - 5.5) / 2.0;
+		double sinc = t == 0.0 ? 1.0 : std::sin(pi * t) / (pi * t);
+		double r = t / KAISER_RADIUS;
+		double window = std::abs(r) < 1.0 ? besselI0(KAISER_BETA * std::sqrt(1.0 - r * r)) / besselI0(KAISER_BETA) : 0.0;
+		tapWeights[k] = sinc * window;
+		total += tapWeights[k];
+	}
+
+	KaiserWeights kaiser;
+	for (int k = 0; k < KAISER_TAPS; k++) {
+		kaiser.weights[k] = static_cast<float>(tapWeights[k] / total);
+	}
+	return kaiser;
+}
+
+// Normalised weights for the 12 source taps around a destination pixel (source pixels 2x-5 to 2x+6)
+static const float* getKaiserWeights()
+{
+	static const KaiserWeights kaiser = buildKaiserWeights();
+	return kaiser.weights;
+}
+
+// Run rowFunction over [0, rowCount) split into contiguous blocks, one block per thread
+static void parallelRows(uint32_t rowCount, uint32_t threadCount, const std::function<void(uint32_t, uint32_t)>& rowFunction)
+{
+	threadCount = std::max(1u, std::min(threadCount, rowCount / MIN_ROWS_PER_THREAD));
+	if (threadCount == 1) {
+		rowFunction(0, rowCount);
+		return;
+	}
+
+	std::vector<std::thread> threads;
+	uint32_t rowsPerThread = (rowCount + threadCount - 1) / threadCount;
+	for (uint32_t i = 0; i < threadCount; i++) {
+		uint32_t firstRow = i * rowsPerThread;
+		uint32_t lastRow = std::min(firstRow + rowsPerThread, rowCount);
+		if (firstRow >= lastRow) break;
+		threads.emplace_back(rowFunction, firstRow, lastRow);
+	}
+	for (auto& thread : threads) {
+		thread.join();
+	}
+}
+
+// SCALAR REFERENCE //
+static void boxRowsScalar(const float* src, uint32_t srcWidth, uint32_t srcHeight, float* dst, uint32_t dstWidth, uint32_t firstRow, uint32_t lastRow)
+{
+	for (uint32_t y = firstRow; y < lastRow; y++) {
+		const float* row0 = src + (size_t)std::min(y * 2, srcHeight - 1) * srcWidth * 4;
+		const float* row1 = src + (size_t)std::min(y * 2 + 1, srcHeight - 1) * srcWidth * 4;
+		for (uint32_t x = 0; x < dstWidth; x++) {
+			uint32_t x0 = std::min(x * 2, srcWidth - 1) * 4;
+			uint32_t x1 = std::min(x * 2 + 1, srcWidth - 1) * 4;
+			for (uint32_t c = 0; c < 4; c++) {
+				dst[((size_t)y * dstWidth + x) * 4 + c] = ((row0[x0 + c] + row0[x1 + c]) + (row1[x0 + c] + row1[x1 + c])) * 0.25f;
+			}
+		}
+	}
+}
+
+static void kaiserHorizontalScalar(const float* src, uint32_t srcWidth, float* dst, uint32_t dstWidth, uint32_t firstRow, uint32_t lastRow)
+{
+	const float* weights = getKaiserWeights();
+	for (uint32_t y = firstRow; y < lastRow; y++) {
+		const float* srcRow = src + (size_t)y * srcWidth * 4;
+		float* dstRow = dst + (size_t)y * dstWidth * 4;
+		for (uint32_t x = 0; x < dstWidth; x++) {
+			float sum[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+			for (int k = 0; k < KAISER_TAPS; k++) {
+				int sx = std::min(std::max(static_cast<int>(x * 2) - 5 + k, 0), static_cast<int>(srcWidth) - 1);
+				for (uint32_t c = 0; c < 4; c++) {
+					sum[c] = sum[c] + weights[k] * srcRow[sx * 4 + c];
+				}
+			}
+			for (uint32_t c = 0; c < 4; c++) {
+				dstRow[x * 4 + c] = sum[c];
+			}
+		}
+	}
+}
+
+static void kaiserVerticalScalar(const float* src, uint32_t srcHeight, float* dst, uint32_t width, uint32_t firstRow, uint32_t lastRow)
+{
+	const float* weights = getKaiserWeights();
+	for (uint32_t y = firstRow; y < lastRow; y++) {
+		float* dstRow = dst + (size_t)y * width * 4;
+		for (uint32_t i = 0; i < width * 4; i++) {
+			float sum = 0.0f;
+			for (int k = 0; k < KAISER_TAPS; k++) {
+				int sy = std::min(std::max(static_cast<int>(y * 2) - 5 + k, 0), static_cast<int>(srcHeight) - 1);
+				sum = sum + weights[k] * src[(size_t)sy * width * 4 + i];
+			}
+			dstRow[i] = sum;
+		}
+	}
+}
+
+#ifdef MIP_X86
+// SSE: one RGBA pixel per register //
+static void boxRowsSSE(const float* src, uint32_t srcWidth, uint32_t srcHeight, float* dst, uint32_t dstWidth, uint32_t firstRow, uint32_t lastRow)
+{
+	const __m128 quarter = _mm_set1_ps(0.25f);
+	for (uint32_t y = firstRow; y < lastRow; y++) {
+		const float* row0 = src + (size_t)std::min(y * 2, srcHeight - 1) * srcWidth * 4;
+		const float* row1 = src + (size_t)std::min(y * 2 + 1, srcHeight - 1) * srcWidth * 4;
+		float* dstRow = dst + (size_t)y * dstWidth * 4;
+		for (uint32_t x = 0; x < dstWidth; x++) {
+			uint32_t x0 = std::min(x * 2, srcWidth - 1) * 4;
+			uint32_t x1 = std::min(x * 2 + 1, srcWidth - 1) * 4;
+			__m128 top = _mm_add_ps(_mm_loadu_ps(row0 + x0), _mm_loadu_ps(row0 + x1));
+			__m128 bottom = _mm_add_ps(_mm_loadu_ps(row1 + x0), _mm_loadu_ps(row1 + x1));
+			_mm_storeu_ps(dstRow + x * 4, _mm_mul_ps(_mm_add_ps(top, bottom), quarter));
+		}
+	}
+}
+
+static void kaiserHorizontalSSE(const float* src, uint32_t srcWidth, float* dst, uint32_t dstWidth, uint32_t firstRow, uint32_t lastRow)
+{
+	const float* weights = getKaiserWeights();
+	for (uint32_t y = firstRow; y < lastRow; y++) {
+		const float* srcRow = src + (size_t)y * srcWidth * 4;
+		float* dstRow = dst + (size_t)y * dstWidth * 4;
+		for (uint32_t x = 0; x < dstWidth; x++) {
+			__m128 sum = _mm_setzero_ps();
+			for (int k = 0; k < KAISER_TAPS; k++) {
+				int sx = std::min(std::max(static_cast<int>(x * 2) - 5 + k, 0), static_cast<int>(srcWidth) - 1);
+				sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(weights[k]), _mm_loadu_ps(srcRow + sx * 4)));
+			}
+			_mm_storeu_ps(dstRow + x * 4, sum);
+		}
+	}
+}
+
+static void kaiserVerticalSSE(const float* src, uint32_t srcHeight, float* dst, uint32_t width, uint32_t firstRow, uint32_t lastRow)
+{
+	const float* weights = getKaiserWeights();
+	for (uint32_t y = firstRow; y < lastRow; y++) {
+		const float* rows[KAISER_TAPS];
+		for (int k = 0; k < KAISER_TAPS; k++) {
+			int sy = std::min(std::max(static_cast<int>(y * 2) - 5 + k, 0), static_cast<int>(srcHeight) - 1);
+			rows[k] = src + (size_t)sy * width * 4;
+		}
+		float* dstRow = dst + (size_t)y * width * 4;
+		for (uint32_t i = 0; i < width * 4; i += 4) {
+			__m128 sum = _mm_setzero_ps();
+			for (int k = 0; k < KAISER_TAPS; k++) {
+				sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(weights[k]), _mm_loadu_ps(rows[k] + i)));
+			}
+			_mm_storeu_ps(dstRow + i, sum);
+		}
+	}
+}
+
+// AVX2: two RGBA pixels per register //
+MIP_TARGET_AVX2
+static void boxRowsAVX2(const float* src, uint32_t srcWidth, uint32_t srcHeight, float* dst, uint32_t dstWidth, uint32_t firstRow, uint32_t lastRow)
+{
+	const __m256 quarter = _mm256_set1_ps(0.25f);
+	for (uint32_t y = firstRow; y < lastRow; y++) {
+		const float* row0 = src + (size_t)std::min(y * 2, srcHeight - 1) * srcWidth * 4;
+		const float* row1 = src + (size_t)std::min(y * 2 + 1, srcHeight - 1) * srcWidth * 4;
+		float* dstRow = dst + (size_t)y * dstWidth * 4;
+
+		uint32_t x = 0;
+		// Pairs of destination pixels read 4 neighbouring source pixels, no edge clamping needed while 2x+3 is in range
+		for (; x + 1 < dstWidth && x * 2 + 3 < srcWidth; x += 2) {
+			__m256 a0 = _mm256_loadu_ps(row0 + x * 8); // p0 | p1
+			__m256 b0 = _mm256_loadu_ps(row0 + x * 8 + 8); // p2 | p3
+			__m256 a1 = _mm256_loadu_ps(row1 + x * 8);
+			__m256 b1 = _mm256_loadu_ps(row1 + x * 8 + 8);
+
+			// Regroup into (p0 | p2) + (p1 | p3) so each lane holds one destination pixel
+			__m256 top = _mm256_add_ps(_mm256_permute2f128_ps(a0, b0, 0x20), _mm256_permute2f128_ps(a0, b0, 0x31));
+			__m256 bottom = _mm256_add_ps(_mm256_permute2f128_ps(a1, b1, 0x20), _mm256_permute2f128_ps(a1, b1, 0x31));
+			_mm256_storeu_ps(dstRow + x * 4, _mm256_mul_ps(_mm256_add_ps(top, bottom), quarter));
+		}
+
+		// Remaining pixels (odd width or clamped edge)
+		for (; x < dstWidth; x++) {
+			uint32_t x0 = std::min(x * 2, srcWidth - 1) * 4;
+			uint32_t x1 = std::min(x * 2 + 1, srcWidth - 1) * 4;
+			__m128 top = _mm_add_ps(_mm_loadu_ps(row0 + x0), _mm_loadu_ps(row0 + x1));
+			__m128 bottom = _mm_add_ps(_mm_loadu_ps(row1 + x0), _mm_loadu_ps(row1 + x1));
+			_mm_storeu_ps(dstRow + x * 4, _mm_mul_ps(_mm_add_ps(top, bottom), _mm_set1_ps(0.25f)));
+		}
+	}
+}
+
+MIP_TARGET_AVX2
+static void kaiserHorizontalAVX2(const float* src, uint32_t srcWidth, float* dst, uint32_t dstWidth, uint32_t firstRow, uint32_t lastRow)
+{
+	const float* weights = getKaiserWeights();
+	int lastColumn = static_cast<int>(srcWidth) - 1;
+	for (uint32_t y = firstRow; y < lastRow; y++) {
+		const float* srcRow = src + (size_t)y * srcWidth * 4;
+		float* dstRow = dst + (size_t)y * dstWidth * 4;
+
+		uint32_t x = 0;
+		for (; x + 1 < dstWidth; x += 2) {
+			__m256 sum = _mm256_setzero_ps();
+			for (int k = 0; k < KAISER_TAPS; k++) {
+				// Pixel x uses source 2x-5+k, pixel x+1 is two source pixels further along
+				int sx0 = std::min(std::max(static_cast<int>(x * 2) - 5 + k, 0), lastColumn);
+				int sx1 = std::min(std::max(static_cast<int>(x * 2) - 3 + k, 0), lastColumn);
+				__m256 pixels = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(srcRow + sx0 * 4)), _mm_loadu_ps(srcRow + sx1 * 4), 1);
+				sum = _mm256_add_ps(sum, _mm256_mul_ps(_mm256_set1_ps(weights[k]), pixels));
+			}
+			_mm256_storeu_ps(dstRow + x * 4, sum);
+		}
+
+		for (; x < dstWidth; x++) {
+			__m128 sum = _mm_setzero_ps();
+			for (int k = 0; k < KAISER_TAPS; k++) {
+				int sx = std::min(std::max(static_cast<int>(x * 2) - 5 + k, 0), lastColumn);
+				sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(weights[k]), _mm_loadu_ps(srcRow + sx * 4)));
+			}
+			_mm_storeu_ps(dstRow + x * 4, sum);
+		}
+	}
+}
+
+MIP_TARGET_AVX2
+static void kaiserVerticalAVX2(const float* src, uint32_t srcHeight, float* dst, uint32_t width, uint32_t firstRow, uint32_t lastRow)
+{
+	const float* weights = getKaiserWeights();
+	for (uint32_t y = firstRow; y < lastRow; y++) {
+		const float* rows[KAISER_TAPS];
+		for (int k = 0; k < KAISER_TAPS; k++) {
+			int sy = std::min(std::max(static_cast<int>(y * 2) - 5 + k, 0), static_cast<int>(srcHeight) - 1);
+			rows[k] = src + (size_t)sy * width * 4;
+		}
+		float* dstRow = dst + (size_t)y * width * 4;
+
+		// Rows are contiguous so two pixels can be loaded at once
+		uint32_t i = 0;
+		for (; i + 8 <= width * 4; i += 8) {
+			__m256 sum = _mm256_setzero_ps();
+			for (int k = 0; k < KAISER_TAPS; k++) {
+				sum = _mm256_add_ps(sum, _mm256_mul_ps(_mm256_set1_ps(weights[k]), _mm256_loadu_ps(rows[k] + i)));
+			}
+			_mm256_storeu_ps(dstRow + i, sum);
+		}
+		for (; i < width * 4; i += 4) {
+			__m128 sum = _mm_setzero_ps();
+			for (int k = 0; k < KAISER_TAPS; k++) {
+				sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(weights[k]), _mm_loadu_ps(rows[k] + i)));
+			}
+			_mm_storeu_ps(dstRow + i, sum);
+		}
+	}
+}
+#endif
+
+// ENCODE / DECODE //
+static void decodeRows(const unsigned char* src, float* dst, uint32_t width, bool srgb, uint32_t firstRow, uint32_t lastRow)
+{
+	const ColourTables& tables = getColourTables();
+	const float* colourTable = srgb ? tables.srgbToLinear : tables.unormToFloat;
+	for (size_t i = (size_t)firstRow * width; i < (size_t)lastRow * width; i++) {
+		dst[i * 4 + 0] = colourTable[src[i * 4 + 0]];
+		dst[i * 4 + 1] = colourTable[src[i * 4 + 1]];
+		dst[i * 4 + 2] = colourTable[src[i * 4 + 2]];
+		dst[i * 4 + 3] = tables.unormToFloat[src[i * 4 + 3]]; // Alpha is never sRGB encoded
+	}
+}
+
+static unsigned char encodeUnorm(float value)
+{
+	return static_cast<unsigned char>(std::min(std::max(value, 0.0f), 1.0f) * 255.0f + 0.5f);
+}
+
+static void encodeRows(const float* src, unsigned char* dst, uint32_t width, bool srgb, uint32_t firstRow, uint32_t lastRow)
+{
+	const ColourTables& tables = getColourTables();
+	for (size_t i = (size_t)firstRow * width; i < (size_t)lastRow * width; i++) {
+		for (uint32_t c = 0; c < 3; c++) {
+			float value = src[i * 4 + c];
+			if (srgb) {
+				// Kaiser lobes can overshoot, clamp before indexing
+				float clamped = std::min(std::max(value, 0.0f), 1.0f);
+				dst[i * 4 + c] = tables.linearToSrgb[static_cast<int>(clamped * (LINEAR_TO_SRGB_TABLE_SIZE - 1) + 0.5f)];
+			}
+			else {
+				dst[i * 4 + c] = encodeUnorm(value);
+			}
+		}
+		dst[i * 4 + 3] = encodeUnorm(src[i * 4 + 3]);
+	}
+}
+
+// MIPMAP GENERATOR //
+std::vector<MipLevel> MipmapGenerator::generate(const unsigned char* pixels, uint32_t width, uint32_t height, const MipGenerationSettings& settings)
+{
+	std::vector<MipLevel> mips;
+
+	MipLevel baseLevel = {};
+	baseLevel.width = width;
+	baseLevel.height = height;
+	baseLevel.pixels.assign(pixels, pixels + (size_t)width * height * 4);
+	mips.push_back(std::move(baseLevel));
+
+	// Each level is filtered from the one above it
+	while (mips.back().width > 1 || mips.back().height > 1) {
+		mips.push_back(downsample(mips.back(), settings));
+	}
+
+	return mips;
+}
+
+MipLevel MipmapGenerator::downsample(const MipLevel& source, const MipGenerationSettings& settings)
+{
+	MipInstructionSet instructionSet = resolveInstructionSet(settings.instructionSet);
+	uint32_t threadCount = settings.threadCount != 0 ? settings.threadCount : std::max(1u, std::thread::hardware_concurrency());
+
+	uint32_t srcWidth = source.width;
+	uint32_t srcHeight = source.height;
+
+	MipLevel level = {};
+	level.width = std::max(srcWidth / 2, 1u);
+	level.height = std::max(srcHeight / 2, 1u);
+	level.pixels.resize((size_t)level.width * level.height * 4);
+
+	uint32_t dstWidth = level.width;
+	uint32_t dstHeight = level.height;
+
+	// Filter in linear float space
+	std::vector<float> linearSource((size_t)srcWidth * srcHeight * 4);
+	std::vector<float> linearLevel((size_t)dstWidth * dstHeight * 4);
+
+	parallelRows(srcHeight, threadCount, [&](uint32_t firstRow, uint32_t lastRow) {
+		decodeRows(source.pixels.data(), linearSource.data(), srcWidth, settings.srgb, firstRow, lastRow);
+	});
+
+	if (settings.filter == MipFilter::Box) {
+		parallelRows(dstHeight, threadCount, [&](uint32_t firstRow, uint32_t lastRow) {
+			switch (instructionSet) {
+#ifdef MIP_X86
+			case MipInstructionSet::AVX2:
+				boxRowsAVX2(linearSource.data(), srcWidth, srcHeight, linearLevel.data(), dstWidth, firstRow, lastRow);
+				break;
+			case MipInstructionSet::SSE:
+				boxRowsSSE(linearSource.data(), srcWidth, srcHeight, linearLevel.data(), dstWidth, firstRow, lastRow);
+				break;
+#endif
+			default:
+				boxRowsScalar(linearSource.data(), srcWidth, srcHeight, linearLevel.data(), dstWidth, firstRow, lastRow);
+				break;
+			}
+		});
+	}
+	else {
+		// Separable: filter rows into a half width image, then filter its columns
+		std::vector<float> horizontal((size_t)dstWidth * srcHeight * 4);
+
+		parallelRows(srcHeight, threadCount, [&](uint32_t firstRow, uint32_t lastRow) {
+			switch (instructionSet) {
+#ifdef MIP_X86
+			case MipInstructionSet::AVX2:
+				kaiserHorizontalAVX2(linearSource.data(), srcWidth, horizontal.data(), dstWidth, firstRow, lastRow);
+				break;
+			case MipInstructionSet::SSE:
+				kaiserHorizontalSSE(linearSource.data(), srcWidth, horizontal.data(), dstWidth, firstRow, lastRow);
+				break;
+#endif
+			default:
+				kaiserHorizontalScalar(linearSource.data(), srcWidth, horizontal.data(), dstWidth, firstRow, lastRow);
+				break;
+			}
+		});
+
+		// A 1 pixel high source has nothing to filter vertically
+		if (srcHeight == 1) {
+			linearLevel = horizontal;
+		}
+		else {
+			parallelRows(dstHeight, threadCount, [&](uint32_t firstRow, uint32_t lastRow) {
+				switch (instructionSet) {
+#ifdef MIP_X86
+				case MipInstructionSet::AVX2:
+					kaiserVerticalAVX2(horizontal.data(), srcHeight, linearLevel.data(), dstWidth, firstRow, lastRow);
+					break;
+				case MipInstructionSet::SSE:
+					kaiserVerticalSSE(horizontal.data(), srcHeight, linearLevel.data(), dstWidth, firstRow, lastRow);
+					break;
+#endif
+				default:
+					kaiserVerticalScalar(horizontal.data(), srcHeight, linearLevel.data(), dstWidth, firstRow, lastRow);
+					break;
+				}
+			});
+		}
+	}
+
+	parallelRows(dstHeight, threadCount, [&](uint32_t firstRow, uint32_t lastRow) {
+		encodeRows(linearLevel.data(), level.pixels.data(), dstWidth, settings.srgb, firstRow, lastRow);
+	});
+
+	return level;
+}
+
+bool MipmapGenerator::supportsSSE()
+{
+#ifdef MIP_X86
+	return true; // SSE2 is part of the x64 baseline and the default target for 32 bit MSVC
+#else
+	return false;
+#endif
+}
+
+bool MipmapGenerator::supportsAVX2()
+{
+#if defined(MIP_X86) && defined(_MSC_VER)
+	int info[4];
+	__cpuid(info, 0);
+	if (info[0] < 7) return false;
+
+	// OS must save the YMM registers, check OSXSAVE + AVX then XCR0
+	__cpuid(info, 1);
+	if ((info[2] & (1 << 27)) == 0 || (info[2] & (1 << 28)) == 0) return false;
+	if ((_xgetbv(0) & 0x6) != 0x6) return false;
+
+	__cpuidex(info, 7, 0);
+	return (info[1] & (1 << 5)) != 0;
+#elif defined(MIP_X86) && (defined(__GNUC__) || defined(__clang__))
+	return __builtin_cpu_supports("avx2");
+#else
+	return false;
+#endif
+}
+
+MipInstructionSet MipmapGenerator::resolveInstructionSet(MipInstructionSet requested)
+{
+	// Fall back to the next best thing if the CPU can't run what was asked for
+	if (requested == MipInstructionSet::Best || requested == MipInstructionSet::AVX2) {
+		if (supportsAVX2()) return MipInstructionSet::AVX2;
+		requested = MipInstructionSet::SSE;
+	}
+	if (requested == MipInstructionSet::SSE && supportsSSE()) {
+		return MipInstructionSet::SSE;
+	}
+	return MipInstructionSet::Scalar;
+}
+
+// TESTS //
+static std::vector<unsigned char> testImage(uint32_t width, uint32_t height)
+{
+	// Noise from a fixed seed, so every run and compiler sees the same image
+	std::vector<unsigned char> pixels((size_t)width * height * 4);
+	uint32_t state = 12345u + width * 31u + height;
+	for (auto& pixel : pixels) {
+		state = state * 1664525u + 1013904223u;
+		pixel = static_cast<unsigned char>(state >> 24);
+	}
+	return pixels;
+}
+
+// Largest difference of any channel in any level, -1 if the chains don't have the same levels
+static int maxDifference(const std::vector<MipLevel>& a, const std::vector<MipLevel>& b, bool alphaOnly)
+{
+	if (a.size() != b.size()) return -1;
+
+	int difference = 0;
+	for (size_t level = 0; level < a.size(); level++) {
+		if (a[level].width != b[level].width || a[level].height != b[level].height) return -1;
+		for (size_t i = alphaOnly ? 3 : 0; i < a[level].pixels.size(); i += alphaOnly ? 4 : 1) {
+			difference = std::max(difference, std::abs(a[level].pixels[i] - b[level].pixels[i]));
+		}
+	}
+	return difference;
+}
+
+static bool validChain(const std::vector<MipLevel>& mips)
+{
+	// Halves each level (minimum 1) down to 1x1
+	for (size_t level = 1; level < mips.size(); level++) {
+		if (mips[level].width != std::max(mips[level - 1].width / 2, 1u) || mips[level].height != std::max(mips[level - 1].height / 2, 1u)) return false;
+	}
+	return mips.back().width == 1 && mips.back().height == 1;
+}
+
+bool MipmapGenerator::test()
+{
+	const int SIMD_TOLERANCE = 1; // Filters sum in a different order, which may round a channel differently by one unit
+	const uint32_t sizes[][2] = { { 257, 131 }, { 1, 45 }, { 45, 1 }, { 3, 3 }, { 1024, 1024 } };
+	const MipInstructionSet simdSets[] = { MipInstructionSet::SSE, MipInstructionSet::AVX2 };
+	const char* simdNames[] = { "SSE", "AVX2" };
+	bool simdSupported[] = { supportsSSE(), supportsAVX2() };
+	bool passed = true;
+
+	printf("Mipmap generator test (SSE %s, AVX2 %s)\n", simdSupported[0] ? "yes" : "no, skipped", simdSupported[1] ? "yes" : "no, skipped");
+	for (const auto& size : sizes) {
+		std::vector<unsigned char> pixels = testImage(size[0], size[1]);
+
+		for (MipFilter filter : { MipFilter::Box, MipFilter::Kaiser }) {
+			const char* filterName = filter == MipFilter::Box ? "box" : "kaiser";
+			std::vector<MipLevel> references[2]; // Linear, sRGB
+
+			for (bool srgb : { false, true }) {
+				MipGenerationSettings settings;
+				settings.filter = filter;
+				settings.srgb = srgb;
+				settings.instructionSet = MipInstructionSet::Scalar;
+				settings.threadCount = 1;
+				std::vector<MipLevel>& reference = references[srgb];
+				reference = generate(pixels.data(), size[0], size[1], settings);
+
+				bool casePassed = validChain(reference);
+				printf("  %ux%u %s %s: %zu levels%s", size[0], size[1], filterName, srgb ? "sRGB" : "linear", reference.size(), casePassed ? "" : " (wrong sizes)");
+
+				// Rows split across threads must give the same result as one thread
+				settings.threadCount = 4;
+				for (size_t i = 0; i < 2; i++) {
+					if (!simdSupported[i]) continue;
+
+					settings.instructionSet = simdSets[i];
+					int difference = maxDifference(reference, generate(pixels.data(), size[0], size[1], settings), false);
+					printf(", %s max diff %d", simdNames[i], difference);
+					casePassed = casePassed && difference >= 0 && difference <= SIMD_TOLERANCE;
+				}
+				printf("%s\n", casePassed ? "" : "  FAILED");
+				passed = passed && casePassed;
+			}
+
+			// Alpha is filtered the same whether the colour channels are sRGB or not
+			int alphaDifference = maxDifference(references[0], references[1], true);
+			if (alphaDifference != 0) {
+				printf("  %ux%u %s: sRGB alpha differs from linear alpha by %d  FAILED\n", size[0], size[1], filterName, alphaDifference);
+				passed = false;
+			}
+		}
+	}
+
+	// Known values: black and white averaged is 0.5 linear, which is 188 sRGB encoded and 128 unorm. Alpha 0 and 255 is 128 either way
+	const unsigned char halfAndHalf[] = { 0, 0, 0, 0, 255, 255, 255, 255, 0, 0, 0, 0, 255, 255, 255, 255 };
+	for (bool srgb : { true, false }) {
+		MipGenerationSettings settings;
+		settings.srgb = srgb;
+
+		MipLevel source = {};
+		source.width = 2;
+		source.height = 2;
+		source.pixels.assign(halfAndHalf, halfAndHalf + sizeof(halfAndHalf));
+		MipLevel averaged = downsample(source, settings);
+
+		unsigned char expectedColour = srgb ? 188 : 128;
+		bool casePassed = averaged.pixels[0] == expectedColour && averaged.pixels[3] == 128;
+		printf("  2x2 black and white %s: colour %u (expected %u), alpha %u (expected 128)%s\n", srgb ? "sRGB" : "linear",
+			averaged.pixels[0], expectedColour, averaged.pixels[3], casePassed ? "" : "  FAILED");
+		passed = passed && casePassed;
+	}
+
+	printf("Mipmap generator test %s\n", passed ? "passed" : "FAILED");
+	return passed;
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+
+// A single level of a mip chain (RGBA8)
+struct MipLevel {
+	uint32_t width;
+	uint32_t height;
+	std::vector<unsigned char> pixels;
+};
+
+enum class MipFilter {
+	Box,	// 2x2 average, matches what a linear blit does
+	Kaiser	// Kaiser windowed sinc, sharper mips with less aliasing
+};
+
+enum class MipInstructionSet {
+	Scalar,	// Plain C++ reference implementation
+	SSE,	// One RGBA pixel per 128 bit register
+	AVX2,	// Two RGBA pixels per 256 bit register
+	Best	// Fastest supported by this CPU
+};
+
+struct MipGenerationSettings {
+	MipFilter filter = MipFilter::Box;
+	bool srgb = true; // Colour channels are sRGB encoded, filter in linear space (alpha is always linear)
+	MipInstructionSet instructionSet = MipInstructionSet::Best;
+	uint32_t threadCount = 0; // Threads per level, 0 uses every hardware thread
+};
+
+// Builds mip chains on the CPU, for formats that can't be blitted with a linear filter or for baking offline.
+// Doesn't touch Vulkan so can be used from tools and without a GPU.
+class MipmapGenerator
+{
+public:
+	// Full chain from level 0 down to 1x1, level 0 is a copy of pixels
+	static std::vector<MipLevel> generate(const unsigned char* pixels, uint32_t width, uint32_t height, const MipGenerationSettings& settings = MipGenerationSettings());
+
+	// Next level down (half size, minimum 1)
+	static MipLevel downsample(const MipLevel& source, const MipGenerationSettings& settings = MipGenerationSettings());
+
+	static bool supportsSSE();
+	static bool supportsAVX2();
+
+	// Checks the SSE and AVX2 paths against the scalar reference on synthetic images (odd sizes, 1xN, a large power of
+	// two, both filters, sRGB and linear) and that alpha is never sRGB filtered. Prints each case, false if any fail
+	static bool test();
+
+private:
+	static MipInstructionSet resolveInstructionSet(MipInstructionSet requested);
+};
@@ -0,0 +1,87 @@
+#include "PipelineCache.h"
+
+#include <cstring>
+#include <fstream>
+
+PipelineCache::PipelineCache()
+{
+}
+
+PipelineCache::~PipelineCache()
+{
+}
+
+void PipelineCache::init(VulkanDevice newDevice, const std::string& newFileName)
+{
+	device = newDevice;
+	fileName = newFileName;
+
+	// No file yet (first run) just means a cold start
+	std::vector<char> data;
+	std::ifstream file(fileName, std::ios::binary | std::ios::ate);
+	if (file.is_open()) {
+		data.resize((size_t)file.tellg());
+		file.seekg(0);
+		file.read(data.data(), data.size());
+		file.close();
+
+		if (!isCompatible(data)) {
+			printf("Pipeline cache %s was written by a different device or driver, starting cold\n", fileName.c_str());
+			data.clear();
+		}
+	}
+	loaded = !data.empty();
+
+	VkPipelineCacheCreateInfo cacheCreateInfo = {};
+	cacheCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+	cacheCreateInfo.initialDataSize = data.size();
+	cacheCreateInfo.pInitialData = data.empty() ? nullptr : data.data();
+
+	VkResult result = vkCreatePipelineCache(device.logicalDevice, &cacheCreateInfo, nullptr, &cache);
+	if (result != VK_SUCCESS) {
+		throw std::runtime_error("Failed to create pipeline cache!");
+	}
+}
+
+void PipelineCache::save()
+{
+	if (cache == VK_NULL_HANDLE) return;
+
+	size_t dataSize = 0;
+	vkGetPipelineCacheData(device.logicalDevice, cache, &dataSize, nullptr);
+	std::vector<char> data(dataSize);
+	vkGetPipelineCacheData(device.logicalDevice, cache, &dataSize, data.data());
+
+	// Not being able to write the cache only costs the next startup, so don't treat it as fatal
+	std::ofstream file(fileName, std::ios::binary | std::ios::trunc);
+	if (!file.is_open()) {
+		printf("Failed to write pipeline cache %s\n", fileName.c_str());
+		return;
+	}
+	file.write(data.data(), dataSize);
+	file.close();
+}
+
+void PipelineCache::cleanup()
+{
+	save();
+	vkDestroyPipelineCache(device.logicalDevice, cache, nullptr);
+	cache = VK_NULL_HANDLE;
+}
+
+bool PipelineCache::isCompatible(const std::vector<char>& data)
+{
+	// Header layout is fixed by the spec (VkPipelineCacheHeaderVersionOne)
+	VkPipelineCacheHeaderVersionOne header;
+	if (data.size() < sizeof(header)) return false;
+	memcpy(&header, data.data(), sizeof(header));
+
+	VkPhysicalDeviceProperties deviceProperties;
+	vkGetPhysicalDeviceProperties(device.physicalDevice, &deviceProperties);
+
+	return header.headerSize >= sizeof(header) &&
+		header.headerVersion == VK_PIPELINE_CACHE_HEADER_VERSION_ONE &&
+		header.vendorID == deviceProperties.vendorID &&
+		header.deviceID == deviceProperties.deviceID &&
+		memcmp(header.pipelineCacheUUID, deviceProperties.pipelineCacheUUID, VK_UUID_SIZE) == 0;
+}
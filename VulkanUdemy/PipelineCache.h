@@ -0,0 +1,46 @@
+#pragma once
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include <string>
+#include <vector>
+#include <stdexcept>
+
+#include "Utilities.h"
+
+const std::string DEFAULT_PIPELINE_CACHE_FILE = "pipeline_cache.bin";
+
+// VkPipelineCache persisted between runs. Data written by a different driver/device is thrown away on load,
+// the driver would ignore it anyway but checking the header ourselves means we can report it.
+class PipelineCache
+{
+public:
+	PipelineCache();
+
+	void init(VulkanDevice newDevice, const std::string& newFileName = DEFAULT_PIPELINE_CACHE_FILE);
+
+	// VK_NULL_HANDLE while disabled, so pipeline creation can be timed without the cache
+	VkPipelineCache getCache() { return enabled ? cache : VK_NULL_HANDLE; }
+
+	void setEnabled(bool enable) { enabled = enable; }
+	bool isEnabled() { return enabled; }
+	bool wasLoaded() { return loaded; } // Started warm from a valid file
+
+	// Write the cache's current contents to the file
+	void save();
+
+	// Saves then destroys the cache
+	void cleanup();
+
+	~PipelineCache();
+
+private:
+	VulkanDevice device;
+	VkPipelineCache cache = VK_NULL_HANDLE;
+	std::string fileName;
+	bool enabled = true;
+	bool loaded = false;
+
+	bool isCompatible(const std::vector<char>& data);
+};
@@ -0,0 +1,552 @@
+#include "PipelineRegistry.h"
+
+#include <array>
+#include <algorithm>
+
+PipelineRegistry::PipelineRegistry()
+{
+}
+
+PipelineRegistry::~PipelineRegistry()
+{
+}
+
+bool PipelineDesc::operator==(const PipelineDesc& other) const
+{
+	return vertexShader == other.vertexShader &&
+		fragmentShader == other.fragmentShader &&
+		vertexLayout == other.vertexLayout &&
+		topology == other.topology &&
+		polygonMode == other.polygonMode &&
+		cullMode == other.cullMode &&
+		frontFace == other.frontFace &&
+		depthBias == other.depthBias &&
+		samples == other.samples &&
+		depthTest == other.depthTest &&
+		depthWrite == other.depthWrite &&
+		depthCompare == other.depthCompare &&
+		blend == other.blend &&
+		colourWrite == other.colourWrite &&
+		colourAttachments == other.colourAttachments &&
+		renderPass == other.renderPass &&
+		subpass == other.subpass &&
+		layout == other.layout;
+}
+
+bool PipelineDesc::isCompatible(const PipelineDesc& other) const
+{
+	return renderPass == other.renderPass &&
+		subpass == other.subpass &&
+		layout == other.layout &&
+		samples == other.samples &&
+		vertexLayout == other.vertexLayout &&
+		topology == other.topology;
+}
+
+size_t PipelineDescHash::operator()(const PipelineDesc& desc) const
+{
+	// Combine each field's hash (boost::hash_combine)
+	size_t seed = 0;
+	auto combine = [&seed](size_t value) {
+		seed ^= value + 0x9e3779b9 + (seed << 6) + (seed >> 2);
+	};
+
+	combine(std::hash<std::string>()(desc.vertexShader));
+	combine(std::hash<std::string>()(desc.fragmentShader));
+	combine(std::hash<int>()(static_cast<int>(desc.vertexLayout)));
+	combine(std::hash<int>()(desc.topology));
+	combine(std::hash<int>()(desc.polygonMode));
+	combine(std::hash<uint32_t>()(desc.cullMode));
+	combine(std::hash<int>()(desc.frontFace));
+	combine(std::hash<bool>()(desc.depthBias));
+	combine(std::hash<int>()(desc.samples));
+	combine(std::hash<bool>()(desc.depthTest));
+	combine(std::hash<bool>()(desc.depthWrite));
+	combine(std::hash<int>()(desc.depthCompare));
+	combine(std::hash<int>()(static_cast<int>(desc.blend)));
+	combine(std::hash<bool>()(desc.colourWrite));
+	combine(std::hash<uint32_t>()(desc.colourAttachments));
+	combine(std::hash<VkRenderPass>()(desc.renderPass));
+	combine(std::hash<uint32_t>()(desc.subpass));
+	combine(std::hash<VkPipelineLayout>()(desc.layout));
+
+	return seed;
+}
+
+void PipelineRegistry::init(VulkanDevice newDevice, VkPipelineCache newCache, uint32_t workerCount)
+{
+	device = newDevice;
+	cache = newCache;
+	stopping = false;
+
+	// Leave the main thread its core, compiles are latency tolerant
+	if (workerCount == 0) {
+		workerCount = std::max(1u, std::min(std::thread::hardware_concurrency(), 4u) - 1);
+	}
+	for (uint32_t i = 0; i < workerCount; i++) {
+		workers.push_back(std::thread(&PipelineRegistry::workerLoop, this));
+	}
+}
+
+PipelineDesc PipelineRegistry::makeDesc(PipelineVariant variant, VkRenderPass renderPass, VkPipelineLayout layout, VkSampleCountFlagBits samples)
+{
+	PipelineDesc desc;
+	desc.vertexShader = VERTEX_SHADER_FILE;
+	desc.fragmentShader = FRAGMENT_SHADER_FILE;
+	desc.renderPass = renderPass;
+	desc.layout = layout;
+	desc.samples = samples;
+
+	switch (variant) {
+	case PipelineVariant::Opaque:
+		break;
+	case PipelineVariant::AlphaBlend:
+		desc.blend = BlendMode::Alpha;
+		desc.depthWrite = false; // Blended surfaces are sorted back to front, they shouldn't hide each other
+		desc.cullMode = VK_CULL_MODE_NONE;
+		break;
+	case PipelineVariant::Wireframe:
+		desc.polygonMode = VK_POLYGON_MODE_LINE;
+		desc.cullMode = VK_CULL_MODE_NONE;
+		break;
+	case PipelineVariant::DepthOnly:
+		desc.vertexShader = DEPTH_VERTEX_SHADER_FILE;
+		desc.fragmentShader = "";
+		desc.vertexLayout = VertexLayout::PositionOnly;
+		desc.colourWrite = false;
+		desc.colourAttachments = 0;
+		break;
+	case PipelineVariant::Shadow:
+		desc.fragmentShader = "";
+		desc.colourWrite = false;
+		desc.depthBias = true;
+		desc.cullMode = VK_CULL_MODE_FRONT_BIT; // Back faces into the shadow map, less acne on lit surfaces
+		break;
+	}
+
+	return desc;
+}
+
+VkPipeline PipelineRegistry::getPipeline(const PipelineDesc& desc)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	auto found = pipelines.find(desc);
+	if (found != pipelines.end() && found->second.pipeline != VK_NULL_HANDLE) {
+		return found->second.pipeline;
+	}
+
+	if (found == pipelines.end()) {
+		pipelines[desc] = Entry();
+		queue.push_back(desc);
+		workAvailable.notify_one();
+	}
+
+	fallbackCount++;
+	return findFallback(desc);
+}
+
+VkPipeline PipelineRegistry::getPipelineBlocking(const PipelineDesc& desc)
+{
+	std::unique_lock<std::mutex> lock(mutex);
+
+	auto found = pipelines.find(desc);
+	if (found == pipelines.end()) {
+		// Not queued yet, build it here rather than waiting behind other compiles
+		pipelines[desc].state = PipelineState::Compiling;
+		lock.unlock();
+		VkPipeline pipeline = compile(desc);
+		lock.lock();
+
+		Entry& entry = pipelines[desc];
+		entry.pipeline = pipeline;
+		entry.state = pipeline != VK_NULL_HANDLE ? PipelineState::Ready : PipelineState::Failed;
+		workDone.notify_all();
+	}
+	else if (found->second.state == PipelineState::Ready) {
+		// Built (possibly reloading, the current pipeline is fine to use)
+	}
+	else {
+		// Already queued or being compiled on a worker
+		workDone.wait(lock, [&]() {
+			PipelineState state = pipelines[desc].state;
+			return state == PipelineState::Ready || state == PipelineState::Failed;
+		});
+	}
+
+	if (pipelines[desc].pipeline == VK_NULL_HANDLE) {
+		throw std::runtime_error("Failed to create graphics pipeline");
+	}
+	return pipelines[desc].pipeline;
+}
+
+void PipelineRegistry::prewarm(const PipelineDesc& desc)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	if (pipelines.find(desc) != pipelines.end()) return;
+
+	pipelines[desc] = Entry();
+	queue.push_back(desc);
+	workAvailable.notify_one();
+}
+
+bool PipelineRegistry::isReady(const PipelineDesc& desc)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	auto found = pipelines.find(desc);
+	return found != pipelines.end() && found->second.state == PipelineState::Ready;
+}
+
+void PipelineRegistry::retireRenderPass(VkRenderPass renderPass, DeletionQueue& deletionQueue)
+{
+	std::unique_lock<std::mutex> lock(mutex);
+
+	// Anything still queued for this pass is no longer wanted, anything compiling has to finish before it can be freed
+	queue.erase(std::remove_if(queue.begin(), queue.end(), [&](const PipelineDesc& desc) { return desc.renderPass == renderPass; }), queue.end());
+	workDone.wait(lock, [&]() {
+		for (auto& pipeline : pipelines) {
+			if (pipeline.first.renderPass == renderPass && pipeline.second.state == PipelineState::Compiling) return false;
+		}
+		return true;
+	});
+
+	for (auto it = pipelines.begin(); it != pipelines.end();) {
+		if (it->first.renderPass == renderPass) {
+			if (it->second.pipeline != VK_NULL_HANDLE) {
+				deletionQueue.destroyPipeline(it->second.pipeline);
+			}
+			it = pipelines.erase(it);
+		}
+		else {
+			++it;
+		}
+	}
+}
+
+void PipelineRegistry::reloadShader(const std::string& fileName)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	// Next compile reads the file again, a compile running now may still be using the old module
+	auto found = shaders.find(fileName);
+	if (found != shaders.end()) {
+		staleModules.push_back(found->second.module);
+		shaders.erase(found);
+	}
+
+	for (auto& pipeline : pipelines) {
+		const PipelineDesc& desc = pipeline.first;
+		if (desc.vertexShader != fileName && desc.fragmentShader != fileName) continue;
+		if (pipeline.second.state == PipelineState::Queued || pipeline.second.state == PipelineState::Compiling) {
+			// Compiling from the old file, compile again once it's done
+			if (std::find(queue.begin(), queue.end(), desc) == queue.end()) queue.push_back(desc);
+			continue;
+		}
+
+		pipeline.second.state = PipelineState::Queued;
+		queue.push_back(desc);
+	}
+	workAvailable.notify_all();
+}
+
+void PipelineRegistry::collectRetired(DeletionQueue& deletionQueue)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	for (VkPipeline pipeline : retiredPipelines) {
+		deletionQueue.destroyPipeline(pipeline);
+	}
+	retiredPipelines.clear();
+
+	// Modules are only read during pipeline creation
+	if (!staleModules.empty()) {
+		for (auto& pipeline : pipelines) {
+			if (pipeline.second.state == PipelineState::Compiling) return;
+		}
+		for (VkShaderModule module : staleModules) {
+			vkDestroyShaderModule(device.logicalDevice, module, nullptr);
+		}
+		staleModules.clear();
+	}
+}
+
+uint32_t PipelineRegistry::getPipelineCount()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	uint32_t count = 0;
+	for (auto& pipeline : pipelines) {
+		if (pipeline.second.pipeline != VK_NULL_HANDLE) count++;
+	}
+	return count;
+}
+
+void PipelineRegistry::cleanup()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+		queue.clear();
+	}
+	workAvailable.notify_all();
+	for (auto& worker : workers) {
+		worker.join();
+	}
+	workers.clear();
+
+	for (auto& pipeline : pipelines) {
+		if (pipeline.second.pipeline != VK_NULL_HANDLE) {
+			vkDestroyPipeline(device.logicalDevice, pipeline.second.pipeline, nullptr);
+		}
+	}
+	pipelines.clear();
+
+	for (VkPipeline pipeline : retiredPipelines) {
+		vkDestroyPipeline(device.logicalDevice, pipeline, nullptr);
+	}
+	retiredPipelines.clear();
+
+	for (auto& shader : shaders) {
+		vkDestroyShaderModule(device.logicalDevice, shader.second.module, nullptr);
+	}
+	shaders.clear();
+	for (VkShaderModule module : staleModules) {
+		vkDestroyShaderModule(device.logicalDevice, module, nullptr);
+	}
+	staleModules.clear();
+}
+
+void PipelineRegistry::workerLoop()
+{
+	CPU_PROFILE_THREAD("Pipeline compiler");
+	std::unique_lock<std::mutex> lock(mutex);
+	while (true) {
+		workAvailable.wait(lock, [this]() { return stopping || !queue.empty(); });
+		if (stopping) return;
+
+		PipelineDesc desc = queue.front();
+		queue.pop_front();
+		pipelines[desc].state = PipelineState::Compiling;
+
+		lock.unlock();
+		VkPipeline pipeline = VK_NULL_HANDLE;
+		try {
+			pipeline = compile(desc);
+		}
+		catch (const std::runtime_error& e) {
+			// Can't throw out of a worker, the pipeline is marked failed and its fallback stays in use
+			printf("ERROR: %s\n", e.what());
+		}
+		lock.lock();
+
+		// A reload keeps the old pipeline if the new one failed (e.g. a shader error), otherwise it's retired
+		Entry& entry = pipelines[desc];
+		if (pipeline != VK_NULL_HANDLE) {
+			if (entry.pipeline != VK_NULL_HANDLE) {
+				retiredPipelines.push_back(entry.pipeline);
+			}
+			entry.pipeline = pipeline;
+		}
+		entry.state = entry.pipeline != VK_NULL_HANDLE ? PipelineState::Ready : PipelineState::Failed;
+		workDone.notify_all();
+	}
+}
+
+VkPipeline PipelineRegistry::compile(const PipelineDesc& desc)
+{
+	CPU_PROFILE_SCOPE("compilePipeline");
+	// SHADER STAGE CREATION INFORMATION
+	std::vector<VkPipelineShaderStageCreateInfo> shaderStages;
+
+	LoadedShader vertexShader = getShader(desc.vertexShader);
+
+	VkPipelineShaderStageCreateInfo vertShaderCreateInfo = {};
+	vertShaderCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+	vertShaderCreateInfo.stage = VK_SHADER_STAGE_VERTEX_BIT;
+	vertShaderCreateInfo.module = vertexShader.module;
+	vertShaderCreateInfo.pName = "main";
+	shaderStages.push_back(vertShaderCreateInfo);
+
+	// Depth only pipelines have no fragment stage
+	if (!desc.fragmentShader.empty()) {
+		VkPipelineShaderStageCreateInfo fragShaderCreateInfo = {};
+		fragShaderCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+		fragShaderCreateInfo.stage = VK_SHADER_STAGE_FRAGMENT_BIT;
+		fragShaderCreateInfo.module = getShader(desc.fragmentShader).module;
+		fragShaderCreateInfo.pName = "main";
+		shaderStages.push_back(fragShaderCreateInfo);
+	}
+
+	// Vertex input, every layout reads from the same Vertex buffer
+	VkVertexInputBindingDescription bindingDescription = {};
+	bindingDescription.binding = 0;
+	bindingDescription.stride = sizeof(Vertex);
+	bindingDescription.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+
+	// Location, format and offset of everything in Vertex
+	std::array<VkVertexInputAttributeDescription, 4> vertexAttributes;
+	vertexAttributes[0] = { 0, 0, VK_FORMAT_R32G32B32_SFLOAT, offsetof(Vertex, pos) };
+	vertexAttributes[1] = { 1, 0, VK_FORMAT_R32G32B32_SFLOAT, offsetof(Vertex, col) };
+	vertexAttributes[2] = { 2, 0, VK_FORMAT_R32G32_SFLOAT, offsetof(Vertex, tex) };
+	vertexAttributes[3] = { 3, 0, VK_FORMAT_R32G32B32_SFLOAT, offsetof(Vertex, normal) };
+	uint32_t availableAttributes = desc.vertexLayout == VertexLayout::PositionOnly ? 1 : static_cast<uint32_t>(vertexAttributes.size());
+
+	// Only bind what the vertex shader reads, and make sure the layout actually provides it
+	std::vector<VkVertexInputAttributeDescription> attributeDescriptions;
+	for (const auto& input : vertexShader.reflection.vertexInputs) {
+		if (input.location >= availableAttributes || vertexAttributes[input.location].format != input.format) {
+			throw std::runtime_error("Vertex shader input " + std::to_string(input.location) + " in " + desc.vertexShader + " doesn't match the vertex layout");
+		}
+		attributeDescriptions.push_back(vertexAttributes[input.location]);
+	}
+
+	VkPipelineVertexInputStateCreateInfo vertexInputCreateInfo = {};
+	vertexInputCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+	vertexInputCreateInfo.vertexBindingDescriptionCount = 1;
+	vertexInputCreateInfo.pVertexBindingDescriptions = &bindingDescription;
+	vertexInputCreateInfo.vertexAttributeDescriptionCount = static_cast<uint32_t>(attributeDescriptions.size());
+	vertexInputCreateInfo.pVertexAttributeDescriptions = attributeDescriptions.data();
+
+	// Input Assembly
+	VkPipelineInputAssemblyStateCreateInfo inputAssembly = {};
+	inputAssembly.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+	inputAssembly.topology = desc.topology;
+	inputAssembly.primitiveRestartEnable = VK_FALSE;
+
+	// Viewport and scissor are dynamic so pipelines don't depend on the swapchain extent
+	VkPipelineViewportStateCreateInfo viewportStateCreateInfo = {};
+	viewportStateCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+	viewportStateCreateInfo.viewportCount = 1;
+	viewportStateCreateInfo.scissorCount = 1;
+
+	std::vector<VkDynamicState> dynamicStateEnables = { VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR };
+	if (desc.depthBias) {
+		dynamicStateEnables.push_back(VK_DYNAMIC_STATE_DEPTH_BIAS); // Bias is tuned per light
+	}
+
+	VkPipelineDynamicStateCreateInfo dynamicStateCreateInfo = {};
+	dynamicStateCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+	dynamicStateCreateInfo.dynamicStateCount = static_cast<uint32_t>(dynamicStateEnables.size());
+	dynamicStateCreateInfo.pDynamicStates = dynamicStateEnables.data();
+
+	// Rasterizer
+	VkPipelineRasterizationStateCreateInfo rasterizerStateCreateInfo = {};
+	rasterizerStateCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
+	rasterizerStateCreateInfo.depthClampEnable = VK_FALSE;
+	rasterizerStateCreateInfo.rasterizerDiscardEnable = VK_FALSE;
+	rasterizerStateCreateInfo.polygonMode = desc.polygonMode;
+	rasterizerStateCreateInfo.lineWidth = 1.0f;
+	rasterizerStateCreateInfo.cullMode = desc.cullMode;
+	rasterizerStateCreateInfo.frontFace = desc.frontFace;
+	rasterizerStateCreateInfo.depthBiasEnable = desc.depthBias ? VK_TRUE : VK_FALSE;
+
+	// Multisampling
+	VkPipelineMultisampleStateCreateInfo multisampleCreateInfo = {};
+	multisampleCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
+	multisampleCreateInfo.sampleShadingEnable = VK_FALSE;
+	multisampleCreateInfo.rasterizationSamples = desc.samples;
+
+	// Blending
+	VkPipelineColorBlendAttachmentState colorBlendAttachment = {};
+	colorBlendAttachment.colorWriteMask = desc.colourWrite ? VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT : 0;
+	colorBlendAttachment.blendEnable = desc.blend == BlendMode::Alpha ? VK_TRUE : VK_FALSE;
+	colorBlendAttachment.srcColorBlendFactor = VK_BLEND_FACTOR_SRC_ALPHA;
+	colorBlendAttachment.dstColorBlendFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA;
+	colorBlendAttachment.colorBlendOp = VK_BLEND_OP_ADD;
+	colorBlendAttachment.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
+	colorBlendAttachment.dstAlphaBlendFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA;
+	colorBlendAttachment.alphaBlendOp = VK_BLEND_OP_ADD;
+
+	std::vector<VkPipelineColorBlendAttachmentState> blendAttachments(desc.colourAttachments, colorBlendAttachment); // Same state for each
+
+	VkPipelineColorBlendStateCreateInfo colorBlending = {};
+	colorBlending.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+	colorBlending.logicOpEnable = VK_FALSE;
+	colorBlending.attachmentCount = static_cast<uint32_t>(blendAttachments.size());
+	colorBlending.pAttachments = blendAttachments.data();
+
+	// Depth Stencil Testing
+	VkPipelineDepthStencilStateCreateInfo depthStencilCreateInfo = {};
+	depthStencilCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
+	depthStencilCreateInfo.depthTestEnable = desc.depthTest ? VK_TRUE : VK_FALSE;
+	depthStencilCreateInfo.depthWriteEnable = desc.depthWrite ? VK_TRUE : VK_FALSE;
+	depthStencilCreateInfo.depthCompareOp = desc.depthCompare;
+	depthStencilCreateInfo.depthBoundsTestEnable = VK_FALSE;
+	depthStencilCreateInfo.stencilTestEnable = VK_FALSE;
+
+	// Create Graphics Pipeline
+	VkGraphicsPipelineCreateInfo pipelineCreateInfo = {};
+	pipelineCreateInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+	pipelineCreateInfo.stageCount = static_cast<uint32_t>(shaderStages.size());
+	pipelineCreateInfo.pStages = shaderStages.data();
+	pipelineCreateInfo.pVertexInputState = &vertexInputCreateInfo;
+	pipelineCreateInfo.pInputAssemblyState = &inputAssembly;
+	pipelineCreateInfo.pViewportState = &viewportStateCreateInfo;
+	pipelineCreateInfo.pDynamicState = &dynamicStateCreateInfo;
+	pipelineCreateInfo.pRasterizationState = &rasterizerStateCreateInfo;
+	pipelineCreateInfo.pMultisampleState = &multisampleCreateInfo;
+	pipelineCreateInfo.pColorBlendState = &colorBlending;
+	pipelineCreateInfo.pDepthStencilState = &depthStencilCreateInfo;
+	pipelineCreateInfo.layout = desc.layout;
+	pipelineCreateInfo.renderPass = desc.renderPass;
+	pipelineCreateInfo.subpass = desc.subpass;
+	pipelineCreateInfo.basePipelineHandle = VK_NULL_HANDLE;
+	pipelineCreateInfo.basePipelineIndex = -1;
+
+	// The pipeline cache is internally synchronised, workers can share it
+	VkPipeline pipeline = VK_NULL_HANDLE;
+	VkResult result = vkCreateGraphicsPipelines(device.logicalDevice, cache, 1, &pipelineCreateInfo, nullptr, &pipeline);
+	if (result != VK_SUCCESS) {
+		printf("Failed to create graphics pipeline (%s, %s)\n", desc.vertexShader.c_str(), desc.fragmentShader.c_str());
+		return VK_NULL_HANDLE;
+	}
+	return pipeline;
+}
+
+PipelineRegistry::LoadedShader PipelineRegistry::getShader(const std::string& fileName)
+{
+	// Called from workers without the lock, modules are shared between every pipeline using the file
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		auto found = shaders.find(fileName);
+		if (found != shaders.end()) return found->second;
+	}
+
+	std::vector<char> code = readFile(fileName);
+	LoadedShader shader;
+	shader.reflection = ShaderReflection::reflect(code); // Throws on a bad file before anything is created
+
+	VkShaderModuleCreateInfo shaderModuleCreateInfo = {};
+	shaderModuleCreateInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+	shaderModuleCreateInfo.codeSize = code.size();
+	shaderModuleCreateInfo.pCode = reinterpret_cast<const uint32_t*>(code.data());
+
+	VkResult result = vkCreateShaderModule(device.logicalDevice, &shaderModuleCreateInfo, nullptr, &shader.module);
+	if (result != VK_SUCCESS) {
+		throw std::runtime_error("Failed to create a shader module!");
+	}
+
+	// Another worker may have loaded the same file meanwhile, keep theirs
+	std::lock_guard<std::mutex> lock(mutex);
+	auto inserted = shaders.insert({ fileName, shader });
+	if (!inserted.second) {
+		vkDestroyShaderModule(device.logicalDevice, shader.module, nullptr);
+	}
+	return inserted.first->second;
+}
+
+VkPipeline PipelineRegistry::findFallback(const PipelineDesc& desc)
+{
+	// Prefer a ready pipeline that at least blends the same way, then anything compatible
+	VkPipeline fallback = VK_NULL_HANDLE;
+	for (auto& pipeline : pipelines) {
+		if (pipeline.second.pipeline == VK_NULL_HANDLE || !pipeline.first.isCompatible(desc)) continue;
+
+		if (pipeline.first.blend == desc.blend && pipeline.first.colourWrite == desc.colourWrite) {
+			return pipeline.second.pipeline;
+		}
+		if (fallback == VK_NULL_HANDLE) {
+			fallback = pipeline.second.pipeline;
+		}
+	}
+	return fallback;
+}
@@ -0,0 +1,159 @@
+#pragma once
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <unordered_map>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <stdexcept>
+
+#include "Utilities.h"
+#include "DeletionQueue.h"
+#include "ShaderReflection.h"
+#include "CpuProfiler.h"
+
+// Built with the project from the sources in shaders/, compile.bat rebuilds them for hot reload
+const std::string VERTEX_SHADER_FILE = "shaders/vert.spv";
+const std::string FRAGMENT_SHADER_FILE = "shaders/frag.spv";
+const std::string DEPTH_VERTEX_SHADER_FILE = "shaders/depth.spv"; // Position only, for depth pre-passes
+const std::string INDIRECT_VERTEX_SHADER_FILE = "shaders/indirect.spv"; // Model matrix from the GPU culler's object buffer
+
+enum class VertexLayout {
+	Standard,		// Full Vertex (position, colour, texture coords, normal)
+	PositionOnly	// Same buffer, only the position may be read (depth only passes)
+};
+
+enum class BlendMode {
+	Opaque,
+	Alpha	// Standard "over" blending with source alpha
+};
+
+enum class PipelineVariant {
+	Opaque,
+	AlphaBlend,
+	Wireframe,
+	DepthOnly,		// Depth pre-pass, position only and no colour attachments
+	Shadow
+};
+
+// Everything that goes into a graphics pipeline, pipelines are looked up by the hash of this
+struct PipelineDesc {
+	std::string vertexShader;	// SPIR-V file
+	std::string fragmentShader;	// SPIR-V file, empty for depth only pipelines
+	VertexLayout vertexLayout = VertexLayout::Standard;
+	VkPrimitiveTopology topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+
+	// Raster
+	VkPolygonMode polygonMode = VK_POLYGON_MODE_FILL;
+	VkCullModeFlags cullMode = VK_CULL_MODE_BACK_BIT;
+	VkFrontFace frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE;
+	bool depthBias = false; // Constant + slope bias, for shadow maps
+	VkSampleCountFlagBits samples = VK_SAMPLE_COUNT_1_BIT;
+
+	// Depth
+	bool depthTest = true;
+	bool depthWrite = true;
+	VkCompareOp depthCompare = VK_COMPARE_OP_LESS;
+
+	// Blend
+	BlendMode blend = BlendMode::Opaque;
+	bool colourWrite = true;
+	uint32_t colourAttachments = 1; // In the subpass, 0 for depth only subpasses
+
+	// Compatibility
+	VkRenderPass renderPass = VK_NULL_HANDLE;
+	uint32_t subpass = 0;
+	VkPipelineLayout layout = VK_NULL_HANDLE;
+
+	bool operator==(const PipelineDesc& other) const;
+
+	// Could stand in for other while it compiles (same pass, layout and vertex input)
+	bool isCompatible(const PipelineDesc& other) const;
+};
+
+struct PipelineDescHash {
+	size_t operator()(const PipelineDesc& desc) const;
+};
+
+// Owns every graphics pipeline. Pipelines that aren't built yet are compiled on worker threads, and until they're
+// ready a compatible pipeline that is (e.g. the opaque one) is handed out instead so a frame never waits on a compile.
+class PipelineRegistry
+{
+public:
+	PipelineRegistry();
+
+	void init(VulkanDevice newDevice, VkPipelineCache newCache, uint32_t workerCount = 0);
+
+	// Description of a standard variant for a render pass
+	static PipelineDesc makeDesc(PipelineVariant variant, VkRenderPass renderPass, VkPipelineLayout layout, VkSampleCountFlagBits samples);
+
+	// Returns the pipeline if ready, otherwise queues it and returns a ready compatible pipeline (VK_NULL_HANDLE if there is none)
+	VkPipeline getPipeline(const PipelineDesc& desc);
+
+	// Compiles on the calling thread if needed, for pipelines that must exist before the first frame
+	VkPipeline getPipelineBlocking(const PipelineDesc& desc);
+
+	// Queue a compile without using the result yet
+	void prewarm(const PipelineDesc& desc);
+
+	bool isReady(const PipelineDesc& desc);
+
+	// Pipelines built against a render pass that's being replaced, freed once frames using them finish
+	void retireRenderPass(VkRenderPass renderPass, DeletionQueue& deletionQueue);
+
+	// Rebuild every pipeline using this SPIR-V file in the background, the current pipelines stay in use until then
+	void reloadShader(const std::string& fileName);
+
+	// Hands pipelines replaced by reloads to the deletion queue, call once per frame
+	void collectRetired(DeletionQueue& deletionQueue);
+
+	uint32_t getPipelineCount();
+	uint32_t getFallbackCount() { return fallbackCount; } // Times a compatible pipeline stood in for one still compiling
+
+	void cleanup();
+
+	~PipelineRegistry();
+
+private:
+	enum class PipelineState {
+		Queued,
+		Compiling,
+		Ready,
+		Failed
+	};
+
+	struct Entry {
+		VkPipeline pipeline = VK_NULL_HANDLE; // Stays valid (and in use) while a reload compiles its replacement
+		PipelineState state = PipelineState::Queued;
+	};
+
+	struct LoadedShader {
+		VkShaderModule module;
+		ShaderReflection reflection;
+	};
+
+	VulkanDevice device;
+	VkPipelineCache cache;
+
+	std::mutex mutex;
+	std::condition_variable workAvailable;
+	std::condition_variable workDone;
+	std::unordered_map<PipelineDesc, Entry, PipelineDescHash> pipelines;
+	std::deque<PipelineDesc> queue;
+	std::unordered_map<std::string, LoadedShader> shaders;
+	std::vector<VkShaderModule> staleModules; // Replaced by a reload, destroyed once no compile can be using them
+	std::vector<VkPipeline> retiredPipelines; // Replaced by a reload, waiting for collectRetired
+	std::vector<std::thread> workers;
+	bool stopping = false;
+	uint32_t fallbackCount = 0;
+
+	void workerLoop();
+	VkPipeline compile(const PipelineDesc& desc);
+	LoadedShader getShader(const std::string& fileName);
+	VkPipeline findFallback(const PipelineDesc& desc);
+};
@@ -0,0 +1,857 @@
+#include "RenderGraph.h"
+
+#include <algorithm>
+
+void RenderGraphPass::addColourOutput(RenderResource resource, AttachmentLoad load, RenderResource resolve)
+{
+	if (type != RenderGraphPassType::Graphics) {
+		throw std::runtime_error("Only graphics passes have attachments");
+	}
+	colourOutputs.push_back({ resource, ResourceUsage::ColourAttachment, load });
+	resolveOutputs.push_back(resolve);
+}
+
+void RenderGraphPass::setDepthOutput(RenderResource resource, AttachmentLoad load)
+{
+	if (type != RenderGraphPassType::Graphics) {
+		throw std::runtime_error("Only graphics passes have attachments");
+	}
+	depth = { resource, ResourceUsage::DepthAttachment, load };
+}
+
+void RenderGraphPass::setDepthInput(RenderResource resource)
+{
+	if (type != RenderGraphPassType::Graphics) {
+		throw std::runtime_error("Only graphics passes have attachments");
+	}
+	depth = { resource, ResourceUsage::DepthRead, AttachmentLoad::Keep };
+}
+
+void RenderGraphPass::addInput(RenderResource resource, ResourceUsage usage)
+{
+	inputs.push_back({ resource, usage, AttachmentLoad::Keep });
+}
+
+void RenderGraphPass::addOutput(RenderResource resource, ResourceUsage usage)
+{
+	outputs.push_back({ resource, usage, AttachmentLoad::Clear });
+}
+
+std::vector<RenderGraphPass::Access> RenderGraphPass::getAccesses() const
+{
+	std::vector<Access> accesses = colourOutputs;
+	for (RenderResource resolve : resolveOutputs) {
+		if (resolve != RENDER_RESOURCE_NONE) accesses.push_back({ resolve, ResourceUsage::ColourAttachment, AttachmentLoad::Clear });
+	}
+	if (depth.resource != RENDER_RESOURCE_NONE) accesses.push_back(depth);
+	accesses.insert(accesses.end(), inputs.begin(), inputs.end());
+	accesses.insert(accesses.end(), outputs.begin(), outputs.end());
+	return accesses;
+}
+
+bool RenderGraphPass::hasAttachmentUse(RenderResource resource) const
+{
+	if (depth.resource == resource) return true;
+	for (size_t i = 0; i < colourOutputs.size(); i++) {
+		if (colourOutputs[i].resource == resource || resolveOutputs[i] == resource) return true;
+	}
+	return false;
+}
+
+RenderGraph::RenderGraph()
+{
+}
+
+RenderGraph::~RenderGraph()
+{
+}
+
+void RenderGraph::init(VulkanDevice newDevice, RenderTargetPool* newTargetPool)
+{
+	device = newDevice;
+	targetPool = newTargetPool;
+}
+
+RenderResource RenderGraph::createImage(const std::string& name, uint32_t width, uint32_t height, VkFormat format, VkSampleCountFlagBits samples)
+{
+	Resource resource = {};
+	resource.name = name;
+	resource.width = width;
+	resource.height = height;
+	resource.format = format;
+	resource.samples = samples;
+	resource.imported = false;
+	resources.push_back(resource);
+	return static_cast<RenderResource>(resources.size()) - 1;
+}
+
+RenderResource RenderGraph::importImage(const std::string& name, uint32_t width, uint32_t height, VkFormat format, const std::vector<VkImage>& images,
+	const std::vector<VkImageView>& views, VkImageLayout finalLayout)
+{
+	Resource resource = {};
+	resource.name = name;
+	resource.width = width;
+	resource.height = height;
+	resource.format = format;
+	resource.samples = VK_SAMPLE_COUNT_1_BIT;
+	resource.imported = true;
+	resource.images = images;
+	resource.views = views;
+	resource.finalLayout = finalLayout;
+	resources.push_back(resource);
+	return static_cast<RenderResource>(resources.size()) - 1;
+}
+
+RenderResource RenderGraph::importPersistentImage(const std::string& name, uint32_t width, uint32_t height, VkFormat format, VkImage image,
+	VkImageView view, VkImageLayout layout)
+{
+	RenderResource resource = importImage(name, width, height, format, { image }, { view }, layout);
+	resources[resource].persistent = true;
+	return resource;
+}
+
+RenderGraphPass& RenderGraph::addPass(const std::string& name, RenderGraphPassType type)
+{
+	passes.push_back(RenderGraphPass());
+	passes.back().name = name;
+	passes.back().type = type;
+	return passes.back();
+}
+
+void RenderGraph::setOutput(RenderResource resource)
+{
+	outputResources.push_back(resource);
+}
+
+void RenderGraph::compile()
+{
+	cullPasses();
+	buildSteps();
+	computeLifetimes();
+	allocateImages();
+	buildBarriersAndRenderPasses();
+}
+
+void RenderGraph::execute(VkCommandBuffer commandBuffer, uint32_t importIndex, GpuProfiler* profiler)
+{
+	for (auto& step : steps) {
+		if (!step.barriers.empty()) {
+			// Imported images change with the variant being rendered to
+			for (size_t i = 0; i < step.barriers.size(); i++) {
+				const Resource& resource = resources[step.barrierResources[i]];
+				step.barriers[i].image = resource.imported ? resource.images[importIndex % resource.images.size()] : resource.target.image;
+			}
+			vkCmdPipelineBarrier(commandBuffer, step.srcStages, step.dstStages, 0,
+				0, nullptr, 0, nullptr, static_cast<uint32_t>(step.barriers.size()), step.barriers.data());
+		}
+
+		if (step.renderPass == VK_NULL_HANDLE) {
+			for (uint32_t passIndex : step.passes) {
+				if (profiler) profiler->beginScope(commandBuffer, passes[passIndex].name.c_str());
+				if (passes[passIndex].record) passes[passIndex].record(commandBuffer);
+				if (profiler) profiler->endScope(commandBuffer);
+			}
+			continue;
+		}
+
+		VkRenderPassBeginInfo renderPassBeginInfo = {};
+		renderPassBeginInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+		renderPassBeginInfo.renderPass = step.renderPass;
+		renderPassBeginInfo.framebuffer = step.framebuffers[importIndex % step.framebuffers.size()];
+		renderPassBeginInfo.renderArea.offset = { 0, 0 };
+		renderPassBeginInfo.renderArea.extent = step.extent;
+		renderPassBeginInfo.clearValueCount = static_cast<uint32_t>(step.clearValues.size());
+		renderPassBeginInfo.pClearValues = step.clearValues.data();
+
+		// The first subpass's time includes the load ops and the last one's the resolves
+		if (profiler) profiler->beginScope(commandBuffer, passes[step.passes[0]].name.c_str());
+		vkCmdBeginRenderPass(commandBuffer, &renderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
+		for (size_t i = 0; i < step.passes.size(); i++) {
+			if (i > 0) {
+				if (profiler) profiler->endScope(commandBuffer);
+				vkCmdNextSubpass(commandBuffer, VK_SUBPASS_CONTENTS_INLINE);
+				if (profiler) profiler->beginScope(commandBuffer, passes[step.passes[i]].name.c_str());
+			}
+			if (passes[step.passes[i]].record) passes[step.passes[i]].record(commandBuffer);
+		}
+		vkCmdEndRenderPass(commandBuffer);
+		if (profiler) profiler->endScope(commandBuffer);
+	}
+}
+
+VkRenderPass RenderGraph::getRenderPass(const std::string& passName)
+{
+	RenderGraphPass& pass = findPass(passName);
+	if (pass.culled) return VK_NULL_HANDLE;
+	return steps[pass.step].renderPass;
+}
+
+uint32_t RenderGraph::getSubpass(const std::string& passName)
+{
+	return findPass(passName).subpass;
+}
+
+VkImageView RenderGraph::getImageView(RenderResource resource)
+{
+	const Resource& image = resources[resource];
+	return image.imported ? image.views[0] : image.target.imageView;
+}
+
+void RenderGraph::reset(DeletionQueue& deletionQueue)
+{
+	// Frames in flight may still be using these
+	for (auto& step : steps) {
+		for (VkFramebuffer framebuffer : step.framebuffers) {
+			deletionQueue.destroyFramebuffer(framebuffer);
+		}
+	}
+
+	std::vector<RenderTarget> targets;
+	for (auto& resource : resources) {
+		if (resource.target.image != VK_NULL_HANDLE) targets.push_back(resource.target);
+	}
+	RenderTargetPool* pool = targetPool;
+	deletionQueue.push([pool, targets]() mutable {
+		for (auto& target : targets) {
+			pool->release(target);
+		}
+	});
+
+	resources.clear();
+	passes.clear();
+	outputResources.clear();
+	steps.clear();
+}
+
+std::vector<VkRenderPass> RenderGraph::takeRenderPasses()
+{
+	std::vector<VkRenderPass> renderPasses;
+	for (auto& cached : renderPassCache) {
+		renderPasses.push_back(cached.second);
+	}
+	renderPassCache.clear();
+	return renderPasses;
+}
+
+void RenderGraph::printSummary()
+{
+	uint32_t renderPassCount = 0;
+	for (auto& step : steps) {
+		if (step.renderPass != VK_NULL_HANDLE) renderPassCount++;
+	}
+
+	printf("Render graph: %zu passes (%u culled), %u render passes, %u barriers, %u aliased images\n",
+		passes.size(), culledPasses, renderPassCount, barrierCount, aliasedImages);
+	for (size_t i = 0; i < steps.size(); i++) {
+		printf("  %zu:", i);
+		for (uint32_t passIndex : steps[i].passes) {
+			printf(" %s", passes[passIndex].name.c_str());
+		}
+		printf(" (%zu barriers)\n", steps[i].barriers.size());
+	}
+}
+
+void RenderGraph::cleanup()
+{
+	for (auto& step : steps) {
+		for (VkFramebuffer framebuffer : step.framebuffers) {
+			vkDestroyFramebuffer(device.logicalDevice, framebuffer, nullptr);
+		}
+	}
+	for (auto& resource : resources) {
+		targetPool->release(resource.target);
+	}
+	for (auto& cached : renderPassCache) {
+		vkDestroyRenderPass(device.logicalDevice, cached.second, nullptr);
+	}
+
+	renderPassCache.clear();
+	resources.clear();
+	passes.clear();
+	outputResources.clear();
+	steps.clear();
+}
+
+ResourceState RenderGraph::stateFor(ResourceUsage usage)
+{
+	switch (usage) {
+	case ResourceUsage::ColourAttachment:
+		return { VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+			VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT, true };
+	case ResourceUsage::DepthAttachment:
+		return { VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL, VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+			VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT, true };
+	case ResourceUsage::DepthRead:
+		return { VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL, VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+			VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT, false };
+	case ResourceUsage::SampledFragment:
+		return { VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT, false };
+	case ResourceUsage::SampledCompute:
+		return { VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT, false };
+	case ResourceUsage::StorageRead:
+		return { VK_IMAGE_LAYOUT_GENERAL, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT, false };
+	case ResourceUsage::StorageWrite:
+		return { VK_IMAGE_LAYOUT_GENERAL, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT, true };
+	case ResourceUsage::TransferSrc:
+		return { VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_READ_BIT, false };
+	case ResourceUsage::TransferDst:
+		return { VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT, true };
+	}
+	throw std::runtime_error("Unknown render graph resource usage");
+}
+
+VkImageAspectFlags RenderGraph::aspectFor(VkFormat format)
+{
+	switch (format) {
+	case VK_FORMAT_D16_UNORM:
+	case VK_FORMAT_X8_D24_UNORM_PACK32:
+	case VK_FORMAT_D32_SFLOAT:
+		return VK_IMAGE_ASPECT_DEPTH_BIT;
+	case VK_FORMAT_D16_UNORM_S8_UINT:
+	case VK_FORMAT_D24_UNORM_S8_UINT:
+	case VK_FORMAT_D32_SFLOAT_S8_UINT:
+		return VK_IMAGE_ASPECT_DEPTH_BIT | VK_IMAGE_ASPECT_STENCIL_BIT;
+	case VK_FORMAT_S8_UINT:
+		return VK_IMAGE_ASPECT_STENCIL_BIT;
+	default:
+		return VK_IMAGE_ASPECT_COLOR_BIT;
+	}
+}
+
+void RenderGraph::cullPasses()
+{
+	// Walk back from the outputs, a pass is needed if it writes something a later needed pass (or the frame) reads
+	std::vector<bool> needed(resources.size(), false);
+	for (RenderResource output : outputResources) {
+		needed[output] = true;
+	}
+
+	culledPasses = 0;
+	for (size_t i = passes.size(); i-- > 0;) {
+		RenderGraphPass& pass = passes[i];
+		std::vector<RenderGraphPass::Access> accesses = pass.getAccesses();
+
+		bool used = pass.sideEffects;
+		for (const auto& access : accesses) {
+			if (stateFor(access.usage).write && needed[access.resource]) used = true;
+		}
+
+		pass.culled = !used;
+		if (!used) {
+			culledPasses++;
+			continue;
+		}
+
+		// Whatever this pass writes from scratch isn't needed from earlier passes, whatever it reads is
+		for (const auto& access : accesses) {
+			if (stateFor(access.usage).write && access.load == AttachmentLoad::Clear) needed[access.resource] = false;
+		}
+		for (const auto& access : accesses) {
+			if (!stateFor(access.usage).write || access.load == AttachmentLoad::Keep) needed[access.resource] = true;
+		}
+	}
+}
+
+void RenderGraph::buildSteps()
+{
+	steps.clear();
+
+	for (uint32_t i = 0; i < passes.size(); i++) {
+		RenderGraphPass& pass = passes[i];
+		if (pass.culled) continue;
+
+		// Graphics passes join the previous render pass if they fit in its framebuffer and don't sample anything it renders
+		bool merge = false;
+		VkExtent2D extent = {};
+		if (pass.type == RenderGraphPassType::Graphics) {
+			RenderResource first = pass.depth.resource != RENDER_RESOURCE_NONE ? pass.depth.resource : pass.colourOutputs.empty() ? RENDER_RESOURCE_NONE : pass.colourOutputs[0].resource;
+			if (first == RENDER_RESOURCE_NONE) {
+				throw std::runtime_error("Graphics pass " + pass.name + " has no attachments");
+			}
+			extent = { resources[first].width, resources[first].height };
+
+			if (!steps.empty() && passes[steps.back().passes[0]].type == RenderGraphPassType::Graphics &&
+				steps.back().extent.width == extent.width && steps.back().extent.height == extent.height &&
+				resources[steps.back().attachments[0]].samples == resources[first].samples) {
+				merge = true;
+				for (uint32_t other : steps.back().passes) {
+					const RenderGraphPass& otherPass = passes[other];
+					for (const auto& access : pass.inputs) {
+						if (otherPass.hasAttachmentUse(access.resource)) merge = false;
+					}
+					for (const auto& access : pass.outputs) {
+						if (otherPass.hasAttachmentUse(access.resource)) merge = false;
+					}
+					std::vector<RenderGraphPass::Access> otherAccesses = otherPass.inputs;
+					otherAccesses.insert(otherAccesses.end(), otherPass.outputs.begin(), otherPass.outputs.end());
+					for (const auto& otherAccess : otherAccesses) {
+						if (pass.hasAttachmentUse(otherAccess.resource)) merge = false;
+						// Outside attachments only reads can share a render pass, writes need a barrier in between
+						for (const auto& access : pass.outputs) {
+							if (access.resource == otherAccess.resource) merge = false;
+						}
+						if (stateFor(otherAccess.usage).write) {
+							for (const auto& access : pass.inputs) {
+								if (access.resource == otherAccess.resource) merge = false;
+							}
+						}
+					}
+				}
+			}
+		}
+
+		if (!merge) {
+			steps.push_back(Step());
+			steps.back().extent = extent;
+		}
+		Step& step = steps.back();
+
+		pass.step = static_cast<uint32_t>(steps.size()) - 1;
+		pass.subpass = static_cast<uint32_t>(step.passes.size());
+		step.passes.push_back(i);
+
+		// Attachment list of the render pass, one entry per image
+		if (pass.type == RenderGraphPassType::Graphics) {
+			for (const auto& access : pass.getAccesses()) {
+				if (!pass.hasAttachmentUse(access.resource)) continue;
+				if (std::find(step.attachments.begin(), step.attachments.end(), access.resource) == step.attachments.end()) {
+					step.attachments.push_back(access.resource);
+				}
+			}
+		}
+	}
+}
+
+void RenderGraph::computeLifetimes()
+{
+	for (auto& resource : resources) {
+		resource.used = false;
+		resource.usage = 0;
+		resource.attachmentOnly = true;
+	}
+
+	for (uint32_t s = 0; s < steps.size(); s++) {
+		for (uint32_t passIndex : steps[s].passes) {
+			const RenderGraphPass& pass = passes[passIndex];
+			for (const auto& access : pass.getAccesses()) {
+				Resource& resource = resources[access.resource];
+				if (!resource.used) {
+					resource.used = true;
+					resource.firstStep = s;
+				}
+				resource.lastStep = s;
+
+				switch (access.usage) {
+				case ResourceUsage::ColourAttachment: resource.usage |= VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT; break;
+				case ResourceUsage::DepthAttachment:
+				case ResourceUsage::DepthRead: resource.usage |= VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT; break;
+				case ResourceUsage::SampledFragment:
+				case ResourceUsage::SampledCompute: resource.usage |= VK_IMAGE_USAGE_SAMPLED_BIT; break;
+				case ResourceUsage::StorageRead:
+				case ResourceUsage::StorageWrite: resource.usage |= VK_IMAGE_USAGE_STORAGE_BIT; break;
+				case ResourceUsage::TransferSrc: resource.usage |= VK_IMAGE_USAGE_TRANSFER_SRC_BIT; break;
+				case ResourceUsage::TransferDst: resource.usage |= VK_IMAGE_USAGE_TRANSFER_DST_BIT; break;
+				}
+
+				if (!pass.hasAttachmentUse(access.resource)) resource.attachmentOnly = false;
+			}
+		}
+	}
+
+	// Only images that live and die inside one render pass can skip being stored
+	for (auto& resource : resources) {
+		if (resource.imported || resource.firstStep != resource.lastStep) resource.attachmentOnly = false;
+	}
+}
+
+void RenderGraph::allocateImages()
+{
+	// Created images sorted by first use, each joins the first memory group whose images are all dead by then
+	std::vector<RenderResource> created;
+	for (RenderResource i = 0; i < resources.size(); i++) {
+		if (!resources[i].imported && resources[i].used) created.push_back(i);
+	}
+	std::stable_sort(created.begin(), created.end(), [this](RenderResource a, RenderResource b) {
+		return resources[a].firstStep < resources[b].firstStep;
+	});
+
+	std::vector<std::vector<RenderResource>> groups;
+	for (RenderResource index : created) {
+		const Resource& resource = resources[index];
+		bool placed = false;
+		for (auto& group : groups) {
+			const Resource& last = resources[group.back()];
+			// Same kind of image only, depth and colour images don't always share memory types
+			if (last.lastStep < resource.firstStep && last.attachmentOnly == resource.attachmentOnly && aspectFor(last.format) == aspectFor(resource.format)) {
+				group.push_back(index);
+				placed = true;
+				break;
+			}
+		}
+		if (!placed) groups.push_back({ index });
+	}
+
+	aliasedImages = 0;
+	for (auto& group : groups) {
+		std::vector<RenderTargetDesc> descs;
+		for (RenderResource index : group) {
+			const Resource& resource = resources[index];
+			RenderTargetDesc desc = {};
+			desc.width = resource.width;
+			desc.height = resource.height;
+			desc.format = resource.format;
+			desc.samples = resource.samples;
+			desc.usage = resource.usage;
+			desc.aspect = aspectFor(resource.format) & ~VK_IMAGE_ASPECT_STENCIL_BIT;
+			desc.transient = resource.attachmentOnly;
+			descs.push_back(desc);
+		}
+
+		std::vector<RenderTarget> targets = targetPool->acquireAliased(descs);
+		for (size_t i = 0; i < group.size(); i++) {
+			resources[group[i]].target = targets[i];
+		}
+		aliasedImages += static_cast<uint32_t>(group.size()) - 1;
+	}
+
+	// Each image starts the frame after whatever last used its memory: itself in the previous frame, or the image it aliases
+	for (auto& group : groups) {
+		for (size_t i = 0; i < group.size(); i++) {
+			RenderResource previous = group[i > 0 ? i - 1 : group.size() - 1];
+			const Resource& previousResource = resources[previous];
+
+			// Stages and access of the previous image's last use
+			ResourceState lastState = { VK_IMAGE_LAYOUT_UNDEFINED, 0, 0, false };
+			const Step& lastStep = steps[previousResource.lastStep];
+			for (uint32_t passIndex : lastStep.passes) {
+				for (const auto& access : passes[passIndex].getAccesses()) {
+					if (access.resource != previous) continue;
+					ResourceState state = stateFor(access.usage);
+					lastState.stages |= state.stages;
+					if (state.write) lastState.access |= state.access;
+				}
+			}
+			lastState.write = lastState.access != 0;
+			resources[group[i]].frameStartState = lastState;
+		}
+	}
+
+	// Persistent images start the frame after their own last use in the previous one, which must hand them back in their layout
+	for (auto& resource : resources) {
+		if (!resource.persistent || !resource.used) continue;
+		ResourceState lastState = { resource.finalLayout, 0, 0, false };
+		VkImageLayout lastLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+		for (uint32_t passIndex : steps[resource.lastStep].passes) {
+			for (const auto& access : passes[passIndex].getAccesses()) {
+				if (&resources[access.resource] != &resource) continue;
+				ResourceState state = stateFor(access.usage);
+				lastState.stages |= state.stages;
+				if (state.write) lastState.access |= state.access;
+				lastLayout = state.layout;
+			}
+		}
+		if (lastLayout != resource.finalLayout) {
+			throw std::runtime_error("Render graph: persistent image " + resource.name + " isn't left in the layout it starts the frame in");
+		}
+		lastState.write = lastState.access != 0;
+		resource.frameStartState = lastState;
+	}
+
+	// Other imported images are handed over by a semaphore wait, which covers the stages of their first use
+	for (auto& resource : resources) {
+		if (!resource.imported || resource.persistent || !resource.used) continue;
+		ResourceState firstState = { VK_IMAGE_LAYOUT_UNDEFINED, 0, 0, false };
+		for (uint32_t passIndex : steps[resource.firstStep].passes) {
+			for (const auto& access : passes[passIndex].getAccesses()) {
+				if (&resources[access.resource] == &resource) firstState.stages |= stateFor(access.usage).stages;
+			}
+		}
+		resource.frameStartState = firstState;
+	}
+}
+
+void RenderGraph::buildBarriersAndRenderPasses()
+{
+	// What each image was last used for, stages are everything a later use has to wait on
+	std::vector<ResourceState> states(resources.size());
+	for (size_t i = 0; i < resources.size(); i++) {
+		states[i] = resources[i].frameStartState;
+	}
+	std::vector<VkPipelineStageFlags> visibleStages(resources.size(), 0); // Reads since the last write that are already synced
+
+	barrierCount = 0;
+	for (auto& step : steps) {
+		// Barriers for anything used outside attachments, attachments are synced by the render pass itself
+		for (uint32_t passIndex : step.passes) {
+			const RenderGraphPass& pass = passes[passIndex];
+			std::vector<RenderGraphPass::Access> accesses = pass.inputs;
+			accesses.insert(accesses.end(), pass.outputs.begin(), pass.outputs.end());
+
+			for (const auto& access : accesses) {
+				ResourceState& state = states[access.resource];
+				ResourceState next = stateFor(access.usage);
+
+				// Reads of an image in the layout it's already in only need a barrier if the stage hasn't been synced yet
+				bool layoutChange = state.layout != next.layout;
+				bool hazard = state.write || next.write || layoutChange;
+				if (!hazard && (next.stages & ~visibleStages[access.resource]) == 0) continue;
+
+				VkImageMemoryBarrier barrier = {};
+				barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+				barrier.oldLayout = state.layout;
+				barrier.newLayout = next.layout;
+				barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+				barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+				barrier.srcAccessMask = state.write ? state.access : 0;
+				barrier.dstAccessMask = next.access;
+				barrier.subresourceRange.aspectMask = aspectFor(resources[access.resource].format);
+				barrier.subresourceRange.baseMipLevel = 0;
+				barrier.subresourceRange.levelCount = VK_REMAINING_MIP_LEVELS; // Compute passes may use every level (e.g. a depth pyramid)
+				barrier.subresourceRange.baseArrayLayer = 0;
+				barrier.subresourceRange.layerCount = 1;
+
+				step.barriers.push_back(barrier);
+				step.barrierResources.push_back(access.resource);
+				step.srcStages |= state.stages != 0 ? state.stages : VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+				step.dstStages |= next.stages;
+				barrierCount++;
+
+				if (next.write || layoutChange) {
+					// Later uses wait on this one
+					state = next;
+					visibleStages[access.resource] = next.stages;
+				}
+				else {
+					// Still waiting on the same write, now visible to one more stage
+					state.stages |= next.stages;
+					visibleStages[access.resource] |= next.stages;
+				}
+			}
+		}
+
+		if (passes[step.passes[0]].type == RenderGraphPassType::Graphics) {
+			step.renderPass = createRenderPass(step, states);
+			createFramebuffers(step);
+			for (RenderResource attachment : step.attachments) {
+				visibleStages[attachment] = 0;
+			}
+		}
+	}
+}
+
+VkRenderPass RenderGraph::createRenderPass(Step& step, std::vector<ResourceState>& states)
+{
+	uint32_t stepIndex = passes[step.passes[0]].step;
+
+	std::vector<VkAttachmentDescription> attachmentDescriptions(step.attachments.size());
+	std::vector<bool> attachmentSeen(step.attachments.size(), false);
+	std::vector<ResourceState> lastStates(step.attachments.size()); // Last use within the render pass
+	std::vector<int> lastSubpass(step.attachments.size(), -1);
+	std::vector<VkPipelineStageFlags> stepStages(step.attachments.size(), 0);
+	std::vector<VkAccessFlags> stepWrites(step.attachments.size(), 0);
+	step.clearValues.resize(step.attachments.size());
+
+	std::vector<std::vector<VkAttachmentReference>> colourReferences(step.passes.size());
+	std::vector<std::vector<VkAttachmentReference>> resolveReferences(step.passes.size());
+	std::vector<VkAttachmentReference> depthReferences(step.passes.size());
+	std::vector<VkSubpassDescription> subpasses(step.passes.size());
+	std::vector<VkSubpassDependency> dependencies;
+
+	// Dependencies between the same pair of subpasses are combined
+	auto addDependency = [&dependencies](uint32_t src, uint32_t dst, VkPipelineStageFlags srcStages, VkAccessFlags srcAccess, VkPipelineStageFlags dstStages, VkAccessFlags dstAccess) {
+		for (auto& dependency : dependencies) {
+			if (dependency.srcSubpass == src && dependency.dstSubpass == dst) {
+				dependency.srcStageMask |= srcStages;
+				dependency.srcAccessMask |= srcAccess;
+				dependency.dstStageMask |= dstStages;
+				dependency.dstAccessMask |= dstAccess;
+				return;
+			}
+		}
+		VkSubpassDependency dependency = {};
+		dependency.srcSubpass = src;
+		dependency.dstSubpass = dst;
+		dependency.srcStageMask = srcStages;
+		dependency.srcAccessMask = srcAccess;
+		dependency.dstStageMask = dstStages;
+		dependency.dstAccessMask = dstAccess;
+		dependency.dependencyFlags = src != VK_SUBPASS_EXTERNAL ? VK_DEPENDENCY_BY_REGION_BIT : 0;
+		dependencies.push_back(dependency);
+	};
+
+	for (uint32_t subpass = 0; subpass < step.passes.size(); subpass++) {
+		const RenderGraphPass& pass = passes[step.passes[subpass]];
+
+		// References for one attachment use, working out the load op and dependency on first use
+		auto reference = [&](RenderResource resource, ResourceUsage usage, AttachmentLoad load, bool resolve) {
+			uint32_t index = static_cast<uint32_t>(std::find(step.attachments.begin(), step.attachments.end(), resource) - step.attachments.begin());
+			const Resource& image = resources[resource];
+			ResourceState next = stateFor(usage);
+
+			if (!attachmentSeen[index]) {
+				attachmentSeen[index] = true;
+				ResourceState& previous = states[resource];
+				bool keep = load == AttachmentLoad::Keep && !resolve && previous.layout != VK_IMAGE_LAYOUT_UNDEFINED;
+
+				VkAttachmentDescription& description = attachmentDescriptions[index];
+				description.format = image.format;
+				description.samples = image.samples;
+				description.loadOp = keep ? VK_ATTACHMENT_LOAD_OP_LOAD : (load == AttachmentLoad::Clear && !resolve) ? VK_ATTACHMENT_LOAD_OP_CLEAR : VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+				description.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+				description.initialLayout = keep ? previous.layout : VK_IMAGE_LAYOUT_UNDEFINED;
+
+				// Contents that nothing after this render pass reads are never written back to memory
+				bool store = image.imported || image.lastStep > stepIndex;
+				description.storeOp = store ? VK_ATTACHMENT_STORE_OP_STORE : VK_ATTACHMENT_STORE_OP_DONT_CARE;
+				description.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+
+				if (aspectFor(image.format) & VK_IMAGE_ASPECT_DEPTH_BIT) {
+					step.clearValues[index].depthStencil = { pass.clearDepth, 0 };
+				}
+				else {
+					step.clearValues[index].color = pass.clearColour;
+				}
+
+				VkPipelineStageFlags srcStages = previous.stages != 0 ? previous.stages : VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+				addDependency(VK_SUBPASS_EXTERNAL, subpass, srcStages, previous.write ? previous.access : 0, next.stages, next.access);
+			}
+			else if (lastSubpass[index] != static_cast<int>(subpass)) {
+				// Used by an earlier subpass, only writes (or a layout change) need ordering
+				const ResourceState& previous = lastStates[index];
+				if (previous.write || next.write || previous.layout != next.layout) {
+					addDependency(static_cast<uint32_t>(lastSubpass[index]), subpass, previous.stages, previous.write ? previous.access : 0, next.stages, next.access);
+				}
+			}
+
+			lastStates[index] = next;
+			lastSubpass[index] = static_cast<int>(subpass);
+			stepStages[index] |= next.stages;
+			if (next.write) stepWrites[index] |= next.access;
+
+			VkAttachmentReference attachmentReference = {};
+			attachmentReference.attachment = index;
+			attachmentReference.layout = next.layout;
+			return attachmentReference;
+		};
+
+		bool resolves = false;
+		for (size_t i = 0; i < pass.colourOutputs.size(); i++) {
+			colourReferences[subpass].push_back(reference(pass.colourOutputs[i].resource, ResourceUsage::ColourAttachment, pass.colourOutputs[i].load, false));
+			resolves = resolves || pass.resolveOutputs[i] != RENDER_RESOURCE_NONE;
+		}
+		if (resolves) {
+			for (size_t i = 0; i < pass.colourOutputs.size(); i++) {
+				if (pass.resolveOutputs[i] == RENDER_RESOURCE_NONE) {
+					resolveReferences[subpass].push_back({ VK_ATTACHMENT_UNUSED, VK_IMAGE_LAYOUT_UNDEFINED });
+				}
+				else {
+					resolveReferences[subpass].push_back(reference(pass.resolveOutputs[i], ResourceUsage::ColourAttachment, AttachmentLoad::Clear, true));
+				}
+			}
+		}
+		if (pass.depth.resource != RENDER_RESOURCE_NONE) {
+			depthReferences[subpass] = reference(pass.depth.resource, pass.depth.usage, pass.depth.load, false);
+		}
+
+		VkSubpassDescription& description = subpasses[subpass];
+		description.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+		description.colorAttachmentCount = static_cast<uint32_t>(colourReferences[subpass].size());
+		description.pColorAttachments = colourReferences[subpass].data();
+		description.pResolveAttachments = resolves ? resolveReferences[subpass].data() : nullptr;
+		description.pDepthStencilAttachment = pass.depth.resource != RENDER_RESOURCE_NONE ? &depthReferences[subpass] : nullptr;
+	}
+
+	// Attachments are left in their last layout, imported images in the one they're handed back in
+	for (size_t i = 0; i < step.attachments.size(); i++) {
+		const Resource& image = resources[step.attachments[i]];
+		bool lastUse = image.lastStep == stepIndex;
+		attachmentDescriptions[i].finalLayout = image.imported && lastUse ? image.finalLayout : lastStates[i].layout;
+
+		states[step.attachments[i]] = { attachmentDescriptions[i].finalLayout, stepStages[i], stepWrites[i], stepWrites[i] != 0 };
+	}
+
+	VkRenderPassCreateInfo renderPassCreateInfo = {};
+	renderPassCreateInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+	renderPassCreateInfo.attachmentCount = static_cast<uint32_t>(attachmentDescriptions.size());
+	renderPassCreateInfo.pAttachments = attachmentDescriptions.data();
+	renderPassCreateInfo.subpassCount = static_cast<uint32_t>(subpasses.size());
+	renderPassCreateInfo.pSubpasses = subpasses.data();
+	renderPassCreateInfo.dependencyCount = static_cast<uint32_t>(dependencies.size());
+	renderPassCreateInfo.pDependencies = dependencies.data();
+
+	// Everything that went into the create info, a resize to the same formats produces the same key
+	std::vector<uint32_t> key;
+	for (const auto& attachment : attachmentDescriptions) {
+		key.insert(key.end(), { (uint32_t)attachment.format, (uint32_t)attachment.samples, (uint32_t)attachment.loadOp, (uint32_t)attachment.storeOp,
+			(uint32_t)attachment.initialLayout, (uint32_t)attachment.finalLayout });
+	}
+	for (size_t i = 0; i < subpasses.size(); i++) {
+		key.push_back(~0u);
+		for (const auto& ref : colourReferences[i]) key.insert(key.end(), { ref.attachment, (uint32_t)ref.layout });
+		for (const auto& ref : resolveReferences[i]) key.insert(key.end(), { ref.attachment, (uint32_t)ref.layout });
+		if (subpasses[i].pDepthStencilAttachment) key.insert(key.end(), { depthReferences[i].attachment, (uint32_t)depthReferences[i].layout });
+	}
+	for (const auto& dependency : dependencies) {
+		key.insert(key.end(), { dependency.srcSubpass, dependency.dstSubpass, dependency.srcStageMask, dependency.dstStageMask,
+			dependency.srcAccessMask, dependency.dstAccessMask, dependency.dependencyFlags });
+	}
+
+	return findOrCreateRenderPass(renderPassCreateInfo, key);
+}
+
+VkRenderPass RenderGraph::findOrCreateRenderPass(const VkRenderPassCreateInfo& createInfo, const std::vector<uint32_t>& key)
+{
+	for (auto& cached : renderPassCache) {
+		if (cached.first == key) return cached.second;
+	}
+
+	VkRenderPass renderPass;
+	VkResult result = vkCreateRenderPass(device.logicalDevice, &createInfo, nullptr, &renderPass);
+	if (result != VK_SUCCESS) {
+		throw std::runtime_error("Failed to create a render graph render pass!");
+	}
+
+	renderPassCache.push_back({ key, renderPass });
+	return renderPass;
+}
+
+void RenderGraph::createFramebuffers(Step& step)
+{
+	// One framebuffer per variant of the imported attachments (e.g. per swapchain image)
+	size_t variants = 1;
+	for (RenderResource attachment : step.attachments) {
+		if (resources[attachment].imported) variants = std::max(variants, resources[attachment].views.size());
+	}
+
+	for (size_t v = 0; v < variants; v++) {
+		std::vector<VkImageView> views;
+		for (RenderResource attachment : step.attachments) {
+			const Resource& resource = resources[attachment];
+			views.push_back(resource.imported ? resource.views[v % resource.views.size()] : resource.target.imageView);
+		}
+
+		VkFramebufferCreateInfo framebufferCreateInfo = {};
+		framebufferCreateInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+		framebufferCreateInfo.renderPass = step.renderPass;
+		framebufferCreateInfo.attachmentCount = static_cast<uint32_t>(views.size());
+		framebufferCreateInfo.pAttachments = views.data();
+		framebufferCreateInfo.width = step.extent.width;
+		framebufferCreateInfo.height = step.extent.height;
+		framebufferCreateInfo.layers = 1;
+
+		VkFramebuffer framebuffer;
+		VkResult result = vkCreateFramebuffer(device.logicalDevice, &framebufferCreateInfo, nullptr, &framebuffer);
+		if (result != VK_SUCCESS) {
+			throw std::runtime_error("Failed to create a render graph framebuffer!");
+		}
+		step.framebuffers.push_back(framebuffer);
+	}
+}
+
+RenderGraphPass& RenderGraph::findPass(const std::string& passName)
+{
+	for (auto& pass : passes) {
+		if (pass.name == passName) return pass;
+	}
+	throw std::runtime_error("No render graph pass named " + passName);
+}
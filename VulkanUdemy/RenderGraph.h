@@ -0,0 +1,224 @@
+#pragma once
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <functional>
+#include <stdexcept>
+
+#include "Utilities.h"
+#include "RenderTargetPool.h"
+#include "DeletionQueue.h"
+#include "GpuProfiler.h"
+
+typedef uint32_t RenderResource;
+const RenderResource RENDER_RESOURCE_NONE = ~0u;
+
+// How a pass touches an image, decides the layout, stages and access the graph syncs on
+enum class ResourceUsage {
+	ColourAttachment,
+	DepthAttachment,
+	DepthRead,			// Depth test without writes (read only depth attachment)
+	SampledFragment,
+	SampledCompute,
+	StorageRead,		// Compute shader image load
+	StorageWrite,		// Compute shader image store
+	TransferSrc,
+	TransferDst
+};
+
+struct ResourceState {
+	VkImageLayout layout;
+	VkPipelineStageFlags stages;
+	VkAccessFlags access;
+	bool write;
+};
+
+enum class RenderGraphPassType {
+	Graphics,	// Attachments make a render pass, neighbouring graphics passes are merged into subpasses
+	Compute,
+	Transfer
+};
+
+// What to do with an attachment's contents at the start of a pass
+enum class AttachmentLoad {
+	Clear,
+	Keep	// Loads what an earlier pass wrote, don't care if nothing did
+};
+
+class RenderGraph;
+
+class RenderGraphPass
+{
+public:
+	// resolve is the single sample image the attachment resolves into (RENDER_RESOURCE_NONE for none)
+	void addColourOutput(RenderResource resource, AttachmentLoad load = AttachmentLoad::Clear, RenderResource resolve = RENDER_RESOURCE_NONE);
+	void setDepthOutput(RenderResource resource, AttachmentLoad load = AttachmentLoad::Clear);
+	void setDepthInput(RenderResource resource); // Depth tested but not written, e.g. after a depth pre-pass
+
+	// Images used outside of attachments, the graph adds any barriers they need before the pass
+	void addInput(RenderResource resource, ResourceUsage usage);
+	void addOutput(RenderResource resource, ResourceUsage usage);
+
+	void setClearColour(VkClearColorValue colour) { clearColour = colour; }
+	void setClearDepth(float depth) { clearDepth = depth; }
+
+	// Never culled, for passes whose results leave the graph some other way (e.g. buffer writes)
+	void setSideEffects(bool enable) { sideEffects = enable; }
+
+	// Called inside the render pass (graphics) or between barriers (compute, transfer)
+	void setRecord(std::function<void(VkCommandBuffer)> newRecord) { record = newRecord; }
+
+private:
+	friend class RenderGraph;
+
+	struct Access {
+		RenderResource resource;
+		ResourceUsage usage;
+		AttachmentLoad load;
+	};
+
+	std::string name;
+	RenderGraphPassType type;
+	std::vector<Access> colourOutputs;
+	std::vector<RenderResource> resolveOutputs; // One per colour output, RENDER_RESOURCE_NONE if it isn't resolved
+	Access depth = { RENDER_RESOURCE_NONE, ResourceUsage::DepthAttachment, AttachmentLoad::Clear };
+	std::vector<Access> inputs;
+	std::vector<Access> outputs;
+
+	VkClearColorValue clearColour = { { 0.0f, 0.0f, 0.0f, 1.0f } };
+	float clearDepth = 1.0f;
+	bool sideEffects = false;
+	std::function<void(VkCommandBuffer)> record;
+
+	// Set by compile
+	bool culled = false;
+	uint32_t step = 0;
+	uint32_t subpass = 0;
+
+	std::vector<Access> getAccesses() const; // Everything the pass touches, attachments included
+	bool hasAttachmentUse(RenderResource resource) const;
+};
+
+// A frame described as passes and the images they read and write. compile works out the order of work, culls passes
+// nothing uses, merges graphics passes into subpasses of one render pass, places the fewest barriers that keep it
+// correct and lets transient images that are never alive at once share memory.
+// Build and compile once (again after a resize), execute every frame.
+class RenderGraph
+{
+public:
+	RenderGraph();
+
+	void init(VulkanDevice newDevice, RenderTargetPool* newTargetPool);
+
+	// Images created and owned by the graph, usage flags are filled in from how passes use them
+	RenderResource createImage(const std::string& name, uint32_t width, uint32_t height, VkFormat format, VkSampleCountFlagBits samples);
+
+	// Images owned elsewhere, one view per variant (e.g. swapchain images), execute picks one
+	RenderResource importImage(const std::string& name, uint32_t width, uint32_t height, VkFormat format, const std::vector<VkImage>& images,
+		const std::vector<VkImageView>& views, VkImageLayout finalLayout);
+
+	// An image owned elsewhere that keeps its contents between frames (e.g. last frame's depth pyramid). It's expected in
+	// layout at the start of a frame and its last use must leave it there, no semaphore hands it over
+	RenderResource importPersistentImage(const std::string& name, uint32_t width, uint32_t height, VkFormat format, VkImage image,
+		VkImageView view, VkImageLayout layout);
+
+	RenderGraphPass& addPass(const std::string& name, RenderGraphPassType type);
+
+	// Results the frame exists to produce, passes that don't contribute to one are culled
+	void setOutput(RenderResource resource);
+
+	void compile();
+	void execute(VkCommandBuffer commandBuffer, uint32_t importIndex, GpuProfiler* profiler = nullptr); // Each pass timed as a scope of its name
+
+	// Render pass and subpass a graphics pass runs in, for building its pipelines
+	VkRenderPass getRenderPass(const std::string& passName);
+	uint32_t getSubpass(const std::string& passName);
+
+	// View of a created image once compiled, or of an imported one's first variant
+	VkImageView getImageView(RenderResource resource);
+
+	// Retires framebuffers and created images and forgets every pass and resource, to build the graph again.
+	// Render passes are kept and reused when the new graph produces an identical one, so pipelines stay valid
+	void reset(DeletionQueue& deletionQueue);
+
+	// Render passes held for reuse, the caller frees them (and any pipelines built against them)
+	std::vector<VkRenderPass> takeRenderPasses();
+
+	void printSummary();
+
+	void cleanup();
+
+	~RenderGraph();
+
+private:
+	struct Resource {
+		std::string name;
+		uint32_t width;
+		uint32_t height;
+		VkFormat format;
+		VkSampleCountFlagBits samples;
+		bool imported;
+		std::vector<VkImage> images; // Imported: one per variant
+		std::vector<VkImageView> views;
+		VkImageLayout finalLayout; // Imported: layout it's left in at the end of the frame
+		bool persistent; // Imported: contents carry over, synced with its own last use instead of a semaphore
+
+		// Set by compile
+		bool used;
+		uint32_t firstStep;
+		uint32_t lastStep;
+		VkImageUsageFlags usage;
+		bool attachmentOnly; // Never leaves a render pass, doesn't need to be stored
+		RenderTarget target;
+		ResourceState frameStartState; // Last use (of the memory, if aliased) in the previous frame
+	};
+
+	// Image barriers run before a step, and what to do for it
+	struct Step {
+		std::vector<VkImageMemoryBarrier> barriers;
+		std::vector<RenderResource> barrierResources; // Image each barrier is for, filled in at execute for imported images
+		VkPipelineStageFlags srcStages = 0;
+		VkPipelineStageFlags dstStages = 0;
+		std::vector<uint32_t> passes;
+
+		// Graphics steps
+		VkRenderPass renderPass = VK_NULL_HANDLE;
+		std::vector<RenderResource> attachments;
+		std::vector<VkClearValue> clearValues;
+		std::vector<VkFramebuffer> framebuffers; // One per variant of an imported attachment
+		VkExtent2D extent = {};
+	};
+
+	VulkanDevice device;
+	RenderTargetPool* targetPool = nullptr;
+
+	std::vector<Resource> resources;
+	std::deque<RenderGraphPass> passes; // Deque so references from addPass stay valid
+	std::vector<RenderResource> outputResources;
+	std::vector<Step> steps;
+
+	std::vector<std::pair<std::vector<uint32_t>, VkRenderPass>> renderPassCache; // Keyed by everything that went into creating it
+
+	// Stats from the last compile
+	uint32_t culledPasses = 0;
+	uint32_t barrierCount = 0;
+	uint32_t aliasedImages = 0;
+
+	static ResourceState stateFor(ResourceUsage usage);
+	static VkImageAspectFlags aspectFor(VkFormat format);
+
+	void cullPasses();
+	void buildSteps();
+	void computeLifetimes();
+	void allocateImages();
+	void buildBarriersAndRenderPasses();
+	VkRenderPass createRenderPass(Step& step, std::vector<ResourceState>& states);
+	VkRenderPass findOrCreateRenderPass(const VkRenderPassCreateInfo& createInfo, const std::vector<uint32_t>& key);
+	void createFramebuffers(Step& step);
+
+	RenderGraphPass& findPass(const std::string& passName);
+};
@@ -0,0 +1,238 @@
+#include "RenderQueue.h"
+
+#include <algorithm>
+#include <array>
+#include <cstdio>
+
+bool RenderQueueStats::operator==(const RenderQueueStats& other) const
+{
+	return draws == other.draws &&
+		pipelineBinds == other.pipelineBinds &&
+		descriptorSetBinds == other.descriptorSetBinds &&
+		bufferBinds == other.bufferBinds &&
+		pushConstants == other.pushConstants;
+}
+
+RenderQueue::RenderQueue()
+{
+}
+
+RenderQueue::~RenderQueue()
+{
+}
+
+void RenderQueue::clear(FrameAllocator* allocator)
+{
+	peakSize = std::max(peakSize, items.size());
+	items = FrameVector<RenderItem>(allocator);
+	keys = FrameVector<uint64_t>(allocator);
+	sortBuffer = FrameVector<uint64_t>(allocator);
+	items.reserve(peakSize);
+	keys.reserve(peakSize);
+	pipelineIds.clear();
+	stats = RenderQueueStats();
+}
+
+void RenderQueue::add(const RenderItem& item)
+{
+	if (items.size() >= (1ull << INDEX_BITS)) {
+		throw std::runtime_error("Too many items in the render queue");
+	}
+
+	keys.push_back(makeKey(item, static_cast<uint32_t>(items.size())));
+	items.push_back(item);
+}
+
+void RenderQueue::sort()
+{
+	CPU_PROFILE_SCOPE("sortRenderQueue");
+	// LSD radix sort a byte at a time. The item index only makes keys unique, so its bytes are skipped (the sort is stable,
+	// equal keys keep the order they were added in)
+	const uint32_t firstByte = INDEX_BITS / 8;
+	sortBuffer.resize(keys.size());
+
+	for (uint32_t byte = firstByte; byte < 8; byte++) {
+		uint32_t shift = byte * 8;
+		std::array<uint32_t, 256> offsets = {};
+		for (uint64_t key : keys) {
+			offsets[(key >> shift) & 0xff]++;
+		}
+
+		// Every key has the same byte, the order wouldn't change
+		if (offsets[(keys.empty() ? 0 : keys[0] >> shift) & 0xff] == keys.size()) continue;
+
+		uint32_t total = 0;
+		for (uint32_t& offset : offsets) {
+			uint32_t count = offset;
+			offset = total;
+			total += count;
+		}
+		for (uint64_t key : keys) {
+			sortBuffer[offsets[(key >> shift) & 0xff]++] = key;
+		}
+		keys.swap(sortBuffer);
+	}
+}
+
+void RenderQueue::record(VkCommandBuffer commandBuffer, RenderQueuePass pass, VkPipelineLayout pipelineLayout, VkDescriptorSet frameSet)
+{
+	// Keys of a pass are contiguous, the pass is in the top bits
+	uint32_t passShift = 64 - PASS_BITS;
+	uint64_t passValue = static_cast<uint64_t>(pass);
+	auto begin = std::lower_bound(keys.begin(), keys.end(), passValue << passShift);
+	auto end = std::lower_bound(begin, keys.end(), (passValue + 1) << passShift);
+
+	// State bound by this call, nothing is assumed about what was bound before it
+	VkPipeline boundPipeline = VK_NULL_HANDLE;
+	VkDescriptorSet boundTextureSet = VK_NULL_HANDLE;
+	VkBuffer boundVertexBuffer = VK_NULL_HANDLE;
+	VkBuffer boundIndexBuffer = VK_NULL_HANDLE;
+	uint32_t boundModelOffset = 0;
+	bool frameSetBound = false;
+	int pushedTexId = -1;
+
+	for (auto key = begin; key != end; ++key) {
+		const RenderItem& item = items[*key & ((1ull << INDEX_BITS) - 1)];
+
+		if (item.pipeline != boundPipeline) {
+			vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, item.pipeline);
+			boundPipeline = item.pipeline;
+			stats.pipelineBinds++;
+		}
+
+		if (item.vertexBuffer != boundVertexBuffer) {
+			VkDeviceSize offset = 0;
+			vkCmdBindVertexBuffers(commandBuffer, 0, 1, &item.vertexBuffer, &offset);
+			boundVertexBuffer = item.vertexBuffer;
+			stats.bufferBinds++;
+		}
+		if (item.indexBuffer != boundIndexBuffer) {
+			vkCmdBindIndexBuffer(commandBuffer, item.indexBuffer, 0, VK_INDEX_TYPE_UINT32);
+			boundIndexBuffer = item.indexBuffer;
+			stats.bufferBinds++;
+		}
+
+		// Sets share a pipeline layout, so rebinding set 0 leaves set 1 bound and the other way round
+		if (!frameSetBound || item.modelOffset != boundModelOffset) {
+			vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &frameSet, 1, &item.modelOffset);
+			boundModelOffset = item.modelOffset;
+			frameSetBound = true;
+			stats.descriptorSetBinds++;
+		}
+		if (item.textureSet != VK_NULL_HANDLE && item.textureSet != boundTextureSet) {
+			vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 1, 1, &item.textureSet, 0, nullptr);
+			boundTextureSet = item.textureSet;
+			stats.descriptorSetBinds++;
+		}
+
+		vkCmdPushConstants(commandBuffer, pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(glm::mat4), &item.model);
+		stats.pushConstants++;
+		if (item.texId >= 0 && item.texId != pushedTexId) {
+			vkCmdPushConstants(commandBuffer, pipelineLayout, VK_SHADER_STAGE_FRAGMENT_BIT, sizeof(glm::mat4), sizeof(PushTexture), &item.pushTexture);
+			pushedTexId = item.texId;
+			stats.pushConstants++;
+		}
+
+		vkCmdDrawIndexed(commandBuffer, item.indexCount, 1, 0, 0, 0);
+		stats.draws++;
+	}
+}
+
+uint64_t RenderQueue::makeKey(const RenderItem& item, uint32_t index)
+{
+	uint64_t pass = static_cast<uint64_t>(item.pass);
+	uint64_t pipeline = getPipelineId(item.pipeline);
+	uint64_t texture = static_cast<uint64_t>(item.texId + 1) & ((1ull << TEXTURE_BITS) - 1); // -1 (none) sorts first
+	uint64_t depth = static_cast<uint64_t>(std::min(std::max(item.depth, 0.0f), 1.0f) * ((1u << DEPTH_BITS) - 1));
+
+	if (item.pass == RenderQueuePass::Transparent) {
+		depth = ((1ull << DEPTH_BITS) - 1) - depth; // Furthest first
+		uint64_t key = pass;
+		key = (key << DEPTH_BITS) | depth;
+		key = (key << PIPELINE_BITS) | pipeline;
+		key = (key << TEXTURE_BITS) | texture;
+		return (key << INDEX_BITS) | index;
+	}
+
+	uint64_t key = pass;
+	key = (key << PIPELINE_BITS) | pipeline;
+	key = (key << TEXTURE_BITS) | texture;
+	key = (key << DEPTH_BITS) | depth;
+	return (key << INDEX_BITS) | index;
+}
+
+uint32_t RenderQueue::getPipelineId(VkPipeline pipeline)
+{
+	// Few pipelines are used a frame, a linear search beats hashing
+	for (uint32_t i = 0; i < pipelineIds.size(); i++) {
+		if (pipelineIds[i] == pipeline) return i;
+	}
+
+	if (pipelineIds.size() >= (1u << PIPELINE_BITS)) {
+		throw std::runtime_error("Too many pipelines in the render queue");
+	}
+	pipelineIds.push_back(pipeline);
+	return static_cast<uint32_t>(pipelineIds.size()) - 1;
+}
+
+bool RenderQueue::test()
+{
+	// Slots first grow their blocks on the reset after they overflow, so every slot needs two rounds to warm up
+	const uint32_t WARM_UP_FRAMES = 2 * MAX_FRAMES_IN_FLIGHT;
+	const uint32_t FRAMES = 200;
+	const uint32_t MAX_ITEMS = 5000;
+	const uint32_t PIPELINES = 4;
+	const int TEXTURES = 50;
+
+	std::array<FrameAllocator, MAX_FRAMES_IN_FLIGHT> allocators;
+	RenderQueue queue;
+	bool passed = true;
+	uint64_t heapAllocations = 0;
+
+	for (uint32_t frame = 0; frame < WARM_UP_FRAMES + FRAMES; frame++) {
+		// The first frame is the biggest, later ones vary below it like a moving camera
+		uint32_t itemCount = MAX_ITEMS - (frame * 397) % (MAX_ITEMS / 2);
+		if (frame == WARM_UP_FRAMES) {
+			heapAllocations = getThreadHeapAllocations();
+		}
+
+		// What draw does each frame: reset the slot's allocator, then fill the queue from it
+		FrameAllocator& allocator = allocators[frame % MAX_FRAMES_IN_FLIGHT];
+		allocator.reset();
+		queue.clear(&allocator);
+		for (uint32_t i = 0; i < itemCount; i++) {
+			RenderItem item = {};
+			item.pass = i % 7 == 0 ? RenderQueuePass::Transparent : (i % 3 == 0 ? RenderQueuePass::DepthPrePass : RenderQueuePass::Opaque);
+			item.pipeline = (VkPipeline)(uintptr_t)(1 + (i * 13 + frame) % PIPELINES);
+			item.texId = item.pass == RenderQueuePass::DepthPrePass ? -1 : static_cast<int>((i * 31 + frame) % TEXTURES);
+			item.indexCount = 36;
+			item.modelOffset = i * 256;
+			item.model = glm::mat4(1.0f);
+			item.depth = static_cast<float>((i * 7919 + frame * 104729) % 100000) / 100000.0f;
+			queue.add(item);
+		}
+		queue.sort();
+
+		if (!std::is_sorted(queue.keys.begin(), queue.keys.end())) {
+			printf("Render queue test: frame %u keys out of order\n", frame);
+			passed = false;
+		}
+	}
+
+#ifdef COUNT_HEAP_ALLOCATIONS
+	heapAllocations = getThreadHeapAllocations() - heapAllocations;
+	printf("Render queue test: %llu heap allocations in %u frames after %u to warm up\n", (unsigned long long)heapAllocations, FRAMES, WARM_UP_FRAMES);
+	if (heapAllocations != 0) {
+		passed = false;
+	}
+#else
+	printf("Render queue test: heap allocations not counted in release builds, only the sort is checked\n");
+#endif
+
+	for (FrameAllocator& allocator : allocators) {
+		allocator.cleanup();
+	}
+
+	printf("Render queue test %s\n", passed ? "passed" : "FAILED");
+	return passed;
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include <vector>
+#include <stdexcept>
+
+#include <glm/glm.hpp>
+
+#include "Utilities.h"
+#include "FrameAllocator.h"
+#include "CpuProfiler.h"
+
+// Passes the queue sorts into, in the order they're recorded
+enum class RenderQueuePass : uint32_t {
+	DepthPrePass,	// Front to back, position only
+	Opaque,			// Grouped by pipeline then texture, front to back within a texture
+	Transparent		// Back to front, state changes don't matter as much as blending correctly
+};
+
+// One mesh to draw, with everything needed to bind it
+struct RenderItem {
+	RenderQueuePass pass;
+	VkPipeline pipeline;
+	int texId;							// Sort and push constant state, -1 for none (depth only)
+	VkDescriptorSet textureSet;			// Set 1, VK_NULL_HANDLE for none
+	PushTexture pushTexture;
+	VkBuffer vertexBuffer;
+	VkBuffer indexBuffer;
+	uint32_t indexCount;
+	uint32_t modelOffset;				// Dynamic offset into the model uniform buffer (set 0)
+	glm::mat4 model;
+	float depth;						// Distance from the camera, 0 (near plane) to 1 (far plane)
+};
+
+struct RenderQueueStats {
+	uint32_t draws = 0;
+	uint32_t pipelineBinds = 0;
+	uint32_t descriptorSetBinds = 0;
+	uint32_t bufferBinds = 0; // Vertex and index
+	uint32_t pushConstants = 0;
+
+	bool operator==(const RenderQueueStats& other) const;
+	bool operator!=(const RenderQueueStats& other) const { return !(*this == other); }
+};
+
+// Draws for a frame, sorted on packed 64 bit keys so they can be recorded with as few state changes as possible.
+// Key, high to low bits: pass (2) | pipeline (6) | texture (12) | depth (24) | item index (20).
+// Transparent items put inverted depth straight after the pass, so they're back to front whatever their state.
+class RenderQueue
+{
+public:
+	RenderQueue();
+
+	// Items and keys for the new frame come from its allocator, the last frame's are left to be freed with theirs
+	void clear(FrameAllocator* allocator);
+	void add(const RenderItem& item);
+
+	// Radix sorts the keys, call once after everything's added
+	void sort();
+
+	// Records one pass's items, skipping binds of state that's already bound
+	void record(VkCommandBuffer commandBuffer, RenderQueuePass pass, VkPipelineLayout pipelineLayout, VkDescriptorSet frameSet);
+
+	size_t size() { return items.size(); }
+
+	// Counts for everything recorded since the last clear
+	RenderQueueStats getStats() { return stats; }
+
+	// Fills and sorts the queue for a run of frames on rotating frame allocators, fails if a frame after the warm up
+	// touches the heap or leaves the keys out of order. No device needed, heap counts need a debug build
+	static bool test();
+
+	~RenderQueue();
+
+private:
+	static const uint32_t PASS_BITS = 2;
+	static const uint32_t PIPELINE_BITS = 6;
+	static const uint32_t TEXTURE_BITS = 12;
+	static const uint32_t DEPTH_BITS = 24;
+	static const uint32_t INDEX_BITS = 20;
+
+	FrameVector<RenderItem> items;
+	FrameVector<uint64_t> keys;
+	FrameVector<uint64_t> sortBuffer;		// Radix sort scratch
+	std::vector<VkPipeline> pipelineIds;	// Index is the pipeline's id in keys, kept between frames
+	size_t peakSize = 0;					// Most items in a frame so far, reserved up front so growing doesn't waste frame memory
+
+	RenderQueueStats stats;
+
+	uint64_t makeKey(const RenderItem& item, uint32_t index);
+	uint32_t getPipelineId(VkPipeline pipeline);
+};
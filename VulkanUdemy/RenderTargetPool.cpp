@@ -0,0 +1,226 @@
+#include "RenderTargetPool.h"
+
+#include <algorithm>
+
+RenderTargetPool::RenderTargetPool()
+{
+}
+
+RenderTargetPool::~RenderTargetPool()
+{
+}
+
+void RenderTargetPool::init(VulkanDevice newDevice)
+{
+	device = newDevice;
+
+	vkGetPhysicalDeviceMemoryProperties(device.physicalDevice, &memoryProperties);
+
+	// Mostly tile based GPUs, desktop drivers usually don't expose it
+	for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; i++) {
+		if (memoryProperties.memoryTypes[i].propertyFlags & VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT) {
+			lazyMemorySupported = true;
+		}
+	}
+}
+
+RenderTarget RenderTargetPool::acquire(const RenderTargetDesc& desc)
+{
+	return acquireAliased({ desc })[0];
+}
+
+std::vector<RenderTarget> RenderTargetPool::acquireAliased(const std::vector<RenderTargetDesc>& descs)
+{
+	std::vector<RenderTarget> targets(descs.size());
+
+	// Create every image first so the shared memory can fit the largest of them
+	VkMemoryRequirements combined = {};
+	combined.memoryTypeBits = ~0u;
+	bool transient = true;
+	for (size_t i = 0; i < descs.size(); i++) {
+		targets[i].image = createImage(descs[i]);
+
+		VkMemoryRequirements requirements;
+		vkGetImageMemoryRequirements(device.logicalDevice, targets[i].image, &requirements);
+		combined.size = std::max(combined.size, requirements.size);
+		combined.alignment = std::max(combined.alignment, requirements.alignment);
+		combined.memoryTypeBits &= requirements.memoryTypeBits;
+
+		// Only use lazy memory if every target sharing it is transient
+		transient = transient && descs[i].transient;
+	}
+
+	if (combined.memoryTypeBits == 0) {
+		throw std::runtime_error("Render targets can't be aliased, no memory type suits all of them!");
+	}
+
+	int allocation = findAllocation(combined, transient);
+
+	for (size_t i = 0; i < descs.size(); i++) {
+		vkBindImageMemory(device.logicalDevice, targets[i].image, allocations[allocation].memory, 0);
+		targets[i].imageView = createImageView(targets[i].image, descs[i]);
+		targets[i].allocation = allocation;
+		allocations[allocation].users++;
+	}
+
+	return targets;
+}
+
+void RenderTargetPool::release(RenderTarget& target)
+{
+	if (target.image == VK_NULL_HANDLE) return;
+
+	vkDestroyImageView(device.logicalDevice, target.imageView, nullptr);
+	vkDestroyImage(device.logicalDevice, target.image, nullptr);
+	allocations[target.allocation].users--;
+
+	target = RenderTarget();
+}
+
+void RenderTargetPool::trim()
+{
+	for (auto& allocation : allocations) {
+		if (allocation.users == 0 && allocation.memory != VK_NULL_HANDLE) {
+			vkFreeMemory(device.logicalDevice, allocation.memory, nullptr);
+			allocation.memory = VK_NULL_HANDLE;
+			allocation.size = 0;
+		}
+	}
+}
+
+VkDeviceSize RenderTargetPool::getAllocatedBytes()
+{
+	VkDeviceSize total = 0;
+	for (auto& allocation : allocations) {
+		total += allocation.size;
+	}
+	return total;
+}
+
+void RenderTargetPool::cleanup()
+{
+	for (auto& allocation : allocations) {
+		if (allocation.memory != VK_NULL_HANDLE) {
+			vkFreeMemory(device.logicalDevice, allocation.memory, nullptr);
+		}
+	}
+	allocations.clear();
+}
+
+VkImage RenderTargetPool::createImage(const RenderTargetDesc& desc)
+{
+	VkImageCreateInfo imageCreateInfo = {};
+	imageCreateInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+	imageCreateInfo.imageType = VK_IMAGE_TYPE_2D;
+	imageCreateInfo.extent.width = desc.width;
+	imageCreateInfo.extent.height = desc.height;
+	imageCreateInfo.extent.depth = 1;
+	imageCreateInfo.mipLevels = 1;
+	imageCreateInfo.arrayLayers = 1;
+	imageCreateInfo.format = desc.format;
+	imageCreateInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+	imageCreateInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	imageCreateInfo.usage = desc.usage | (desc.transient ? VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT : 0);
+	imageCreateInfo.samples = desc.samples;
+	imageCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+	VkImage image;
+	VkResult result = vkCreateImage(device.logicalDevice, &imageCreateInfo, nullptr, &image);
+	if (result != VK_SUCCESS) {
+		throw std::runtime_error("Failed to create a render target image!");
+	}
+
+	return image;
+}
+
+VkImageView RenderTargetPool::createImageView(VkImage image, const RenderTargetDesc& desc)
+{
+	VkImageViewCreateInfo viewCreateInfo = {};
+	viewCreateInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+	viewCreateInfo.image = image;
+	viewCreateInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+	viewCreateInfo.format = desc.format;
+	viewCreateInfo.components.r = VK_COMPONENT_SWIZZLE_IDENTITY;
+	viewCreateInfo.components.g = VK_COMPONENT_SWIZZLE_IDENTITY;
+	viewCreateInfo.components.b = VK_COMPONENT_SWIZZLE_IDENTITY;
+	viewCreateInfo.components.a = VK_COMPONENT_SWIZZLE_IDENTITY;
+	viewCreateInfo.subresourceRange.aspectMask = desc.aspect;
+	viewCreateInfo.subresourceRange.baseMipLevel = 0;
+	viewCreateInfo.subresourceRange.levelCount = 1;
+	viewCreateInfo.subresourceRange.baseArrayLayer = 0;
+	viewCreateInfo.subresourceRange.layerCount = 1;
+
+	VkImageView imageView;
+	VkResult result = vkCreateImageView(device.logicalDevice, &viewCreateInfo, nullptr, &imageView);
+	if (result != VK_SUCCESS) {
+		throw std::runtime_error("Failed to create a render target image view!");
+	}
+
+	return imageView;
+}
+
+int RenderTargetPool::findAllocation(const VkMemoryRequirements& requirements, bool transient)
+{
+	// Transient targets prefer lazily allocated memory, fall back to plain device local if the device has none that fits
+	int memoryType = -1;
+	if (transient) {
+		memoryType = findMemoryType(requirements.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT);
+	}
+	if (memoryType < 0) {
+		memoryType = findMemoryType(requirements.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+	}
+	if (memoryType < 0) {
+		throw std::runtime_error("Failed to find a memory type for a render target!");
+	}
+
+	// Reuse an unused allocation that's big enough, smallest first so large blocks stay free for large targets
+	int bestFit = -1;
+	int emptySlot = -1;
+	for (size_t i = 0; i < allocations.size(); i++) {
+		const Allocation& allocation = allocations[i];
+		if (allocation.memory == VK_NULL_HANDLE) {
+			emptySlot = static_cast<int>(i);
+			continue;
+		}
+		if (allocation.users == 0 && allocation.memoryTypeIndex == static_cast<uint32_t>(memoryType) && allocation.size >= requirements.size) {
+			if (bestFit < 0 || allocation.size < allocations[bestFit].size) {
+				bestFit = static_cast<int>(i);
+			}
+		}
+	}
+	if (bestFit >= 0) {
+		reuseCount++;
+		return bestFit;
+	}
+
+	VkMemoryAllocateInfo memoryAllocInfo = {};
+	memoryAllocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+	memoryAllocInfo.allocationSize = requirements.size;
+	memoryAllocInfo.memoryTypeIndex = static_cast<uint32_t>(memoryType);
+
+	Allocation allocation = {};
+	VkResult result = vkAllocateMemory(device.logicalDevice, &memoryAllocInfo, nullptr, &allocation.memory);
+	if (result != VK_SUCCESS) {
+		throw std::runtime_error("Failed to allocate memory for a render target!");
+	}
+	allocation.size = requirements.size;
+	allocation.memoryTypeIndex = static_cast<uint32_t>(memoryType);
+	allocation.users = 0;
+
+	if (emptySlot >= 0) {
+		allocations[emptySlot] = allocation;
+		return emptySlot;
+	}
+	allocations.push_back(allocation);
+	return static_cast<int>(allocations.size()) - 1;
+}
+
+int RenderTargetPool::findMemoryType(uint32_t allowedTypes, VkMemoryPropertyFlags properties)
+{
+	for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; i++) {
+		if ((allowedTypes & (1 << i)) && (memoryProperties.memoryTypes[i].propertyFlags & properties) == properties) {
+			return static_cast<int>(i);
+		}
+	}
+	return -1;
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include <vector>
+#include <stdexcept>
+
+#include "Utilities.h"
+
+struct RenderTargetDesc {
+	uint32_t width;
+	uint32_t height;
+	VkFormat format;
+	VkSampleCountFlagBits samples;
+	VkImageUsageFlags usage;
+	VkImageAspectFlags aspect;
+	bool transient; // Contents never leave the render pass (not loaded or stored), backed by lazily allocated memory when available
+};
+
+struct RenderTarget {
+	VkImage image = VK_NULL_HANDLE;
+	VkImageView imageView = VK_NULL_HANDLE;
+	int allocation = -1; // Pool allocation the image is bound to
+};
+
+// Owns the memory behind render targets (MSAA colour, depth etc).
+// Released targets keep their memory in the pool, so recreating targets after a resize reuses it when it still fits.
+// Targets whose lifetimes don't overlap within a frame can be acquired together to share one allocation.
+class RenderTargetPool
+{
+public:
+	RenderTargetPool();
+
+	void init(VulkanDevice newDevice);
+
+	RenderTarget acquire(const RenderTargetDesc& desc);
+
+	// All targets are bound to the same memory, only use for targets that are never alive at the same time in a frame
+	std::vector<RenderTarget> acquireAliased(const std::vector<RenderTargetDesc>& descs);
+
+	// Destroys the image and view, the memory stays in the pool for reuse
+	void release(RenderTarget& target);
+
+	// Free memory no target is using
+	void trim();
+
+	VkDeviceSize getAllocatedBytes();
+	uint32_t getReuseCount() { return reuseCount; }
+	bool supportsLazyMemory() { return lazyMemorySupported; }
+
+	void cleanup();
+
+	~RenderTargetPool();
+
+private:
+	struct Allocation {
+		VkDeviceMemory memory;
+		VkDeviceSize size;
+		uint32_t memoryTypeIndex;
+		uint32_t users; // Images currently bound to this memory
+	};
+
+	VulkanDevice device;
+	VkPhysicalDeviceMemoryProperties memoryProperties;
+	bool lazyMemorySupported = false;
+	uint32_t reuseCount = 0; // Acquires satisfied without a new allocation
+
+	std::vector<Allocation> allocations;
+
+	VkImage createImage(const RenderTargetDesc& desc);
+	VkImageView createImageView(VkImage image, const RenderTargetDesc& desc);
+	int findAllocation(const VkMemoryRequirements& requirements, bool transient);
+	int findMemoryType(uint32_t allowedTypes, VkMemoryPropertyFlags properties);
+};
@@ -0,0 +1,140 @@
+#include "RenderThread.h"
+
+#include <algorithm>
+
+RenderThread::RenderThread()
+{
+}
+
+void RenderThread::start(VulkanRenderer* newRenderer)
+{
+	renderer = newRenderer;
+	lastPublish = std::chrono::steady_clock::now();
+	running = true;
+	thread = std::thread(&RenderThread::run, this);
+}
+
+void RenderThread::publish()
+{
+	// The render thread takes a snapshot per frame, it's only ever waited on for the rest of the frame it's drawing
+	auto waitStart = std::chrono::steady_clock::now();
+	{
+		CPU_PROFILE_SCOPE("waitForRenderThread");
+		std::unique_lock<std::mutex> lock(waitMutex);
+		changed.wait(lock, [this]() { return !(latest.load(std::memory_order_acquire) & NEW_SNAPSHOT) || !running; });
+	}
+	auto now = std::chrono::steady_clock::now();
+
+	uint64_t frame = snapshots[writeIndex].frame;
+	writeIndex = latest.exchange(writeIndex | NEW_SNAPSHOT, std::memory_order_acq_rel) & ~NEW_SNAPSHOT;
+	wake();
+	snapshots[writeIndex].frame = frame + 1;
+	snapshots[writeIndex].sceneCommands.clear();
+	snapshots[writeIndex].requests = RenderSettingRequests();
+
+	double frameTime = std::chrono::duration<double, std::milli>(now - lastPublish).count();
+	double waitTime = std::chrono::duration<double, std::milli>(now - waitStart).count();
+	addFrame(&simulationStats, frameTime, frameTime - waitTime);
+	lastPublish = now;
+}
+
+void RenderThread::stop()
+{
+	running = false;
+	wake();
+	if (thread.joinable()) {
+		thread.join();
+	}
+	if (error) {
+		std::exception_ptr stoppedOn = error;
+		error = nullptr;
+		std::rethrow_exception(stoppedOn);
+	}
+}
+
+void RenderThread::printStats()
+{
+	printThreadStats("Simulation", simulationStats);
+	printThreadStats("Render", renderStats);
+#ifdef COUNT_HEAP_ALLOCATIONS
+	if (renderStats.frames > HEAP_WARM_UP_FRAMES) {
+		printf("Render thread: %llu of %llu warmed up frames allocated from the heap\n", (unsigned long long)heapAllocatingFrames,
+			(unsigned long long)(renderStats.frames - HEAP_WARM_UP_FRAMES));
+	}
+#endif
+}
+
+void RenderThread::run()
+{
+	CPU_PROFILE_THREAD("Render");
+	auto lastDrawEnd = std::chrono::steady_clock::now();
+	while (running) {
+		{
+			std::unique_lock<std::mutex> lock(waitMutex);
+			changed.wait(lock, [this]() { return (latest.load(std::memory_order_acquire) & NEW_SNAPSHOT) || !running; });
+		}
+		if (!running) break;
+		readIndex = latest.exchange(readIndex, std::memory_order_acq_rel) & ~NEW_SNAPSHOT;
+		wake();
+
+		auto drawStart = std::chrono::steady_clock::now();
+		uint64_t heapAllocationsBefore = getThreadHeapAllocations();
+		try {
+			renderer->draw(snapshots[readIndex]);
+		}
+		catch (...) {
+			// Handed to the main thread by stop
+			error = std::current_exception();
+			running = false;
+			wake();
+		}
+		auto drawEnd = std::chrono::steady_clock::now();
+
+#ifdef COUNT_HEAP_ALLOCATIONS
+		// Once warmed up a frame shouldn't touch the heap, transient data comes from the frame allocators. Only operator
+		// new is counted, not the driver's own allocations
+		uint64_t heapAllocations = getThreadHeapAllocations() - heapAllocationsBefore;
+		if (renderStats.frames >= HEAP_WARM_UP_FRAMES && heapAllocations != 0) {
+			heapAllocatingFrames++;
+			if (printHeapAllocations) printf("Heap allocations: %llu in frame %llu\n", (unsigned long long)heapAllocations, (unsigned long long)renderStats.frames);
+		}
+#endif
+
+		addFrame(&renderStats, std::chrono::duration<double, std::milli>(drawEnd - lastDrawEnd).count(),
+			std::chrono::duration<double, std::milli>(drawEnd - drawStart).count());
+		lastDrawEnd = drawEnd;
+	}
+}
+
+void RenderThread::wake()
+{
+	// Taking the mutex orders the change before a waiter's check, so the notify can't land between its check and its sleep
+	{
+		std::lock_guard<std::mutex> lock(waitMutex);
+	}
+	changed.notify_all();
+}
+
+void RenderThread::addFrame(ThreadFrameStats* stats, double frameTime, double busyTime)
+{
+	stats->frames++;
+	stats->frameTimeTotal += frameTime;
+	stats->busyTimeTotal += busyTime;
+	stats->worstFrameTime = std::max(stats->worstFrameTime, frameTime);
+}
+
+void RenderThread::printThreadStats(const char* name, const ThreadFrameStats& stats)
+{
+	if (stats.frames == 0) return;
+	printf("%s thread: %llu frames, %.3f ms per frame (%.3f ms busy), worst %.3f ms\n", name, (unsigned long long)stats.frames,
+		stats.frameTimeTotal / stats.frames, stats.busyTimeTotal / stats.frames, stats.worstFrameTime);
+}
+
+RenderThread::~RenderThread()
+{
+	if (thread.joinable()) {
+		running = false;
+		wake();
+		thread.join();
+	}
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <exception>
+
+#include "FrameSnapshot.h"
+#include "VulkanRenderer.h"
+
+// Frame times of one thread
+struct ThreadFrameStats {
+	uint64_t frames = 0;
+	double frameTimeTotal = 0.0; // Between frame starts (ms)
+	double busyTimeTotal = 0.0; // Frame time not spent waiting on the other thread (ms)
+	double worstFrameTime = 0.0;
+};
+
+// Draws frame snapshots on a thread of its own, so the simulation of the next frame overlaps recording and submitting
+// this one. Three snapshots rotate between the threads without locks: the simulation thread writes one, the render
+// thread reads another, and the third is the latest published. Either side swaps its own for that one with a single
+// atomic exchange, a flag in the same word says whether the render thread has taken it yet. A side that has to wait
+// for the other sleeps on a condition variable, the mutex is only held to wait and to wake.
+class RenderThread
+{
+public:
+	RenderThread();
+
+	// The renderer mustn't be used from any other thread until stop
+	void start(VulkanRenderer* newRenderer);
+
+	// The snapshot the simulation thread is writing, a different one after each publish
+	FrameSnapshot* getSnapshot() { return &snapshots[writeIndex]; }
+
+	// Hands the snapshot over once the render thread has taken the last one, so the simulation runs at most a frame
+	// ahead. The next snapshot starts with no commands or requests, the rest of it is stale and has to be rewritten
+	void publish();
+
+	// False if the render thread stopped on an error, stop rethrows it
+	bool isRunning() { return running; }
+
+	// Print each warmed up frame whose draw allocated from the heap (debug builds only), before start
+	void setPrintStats(bool enable) { printHeapAllocations = enable; }
+
+	// Lets the frame being drawn finish and joins the thread
+	void stop();
+
+	// Average and worst frame times of both threads
+	void printStats();
+
+	~RenderThread();
+
+private:
+	static const uint32_t NEW_SNAPSHOT = 1u << 31; // In latest until the render thread takes it
+	static const uint32_t HEAP_WARM_UP_FRAMES = 2 * MAX_FRAMES_IN_FLIGHT; // Every frame slot's allocator has grown by then
+
+	VulkanRenderer* renderer = nullptr;
+	std::array<FrameSnapshot, 3> snapshots;
+	uint32_t writeIndex = 0; // Simulation thread's
+	uint32_t readIndex = 1; // Render thread's
+	std::atomic<uint32_t> latest{ 2 }; // Index of the latest published, plus NEW_SNAPSHOT
+	std::atomic<bool> running{ false };
+	std::mutex waitMutex;
+	std::condition_variable changed; // latest or running changed
+	std::thread thread;
+	std::exception_ptr error;
+	bool printHeapAllocations = false;
+
+	// Each only written by its own thread, read once both are stopped
+	ThreadFrameStats simulationStats;
+	ThreadFrameStats renderStats;
+	uint64_t heapAllocatingFrames = 0; // Warmed up draws that allocated from the heap
+	std::chrono::steady_clock::time_point lastPublish;
+
+	void run();
+	void wake();
+	static void addFrame(ThreadFrameStats* stats, double frameTime, double busyTime);
+	static void printThreadStats(const char* name, const ThreadFrameStats& stats);
+};
@@ -0,0 +1,119 @@
+#include "SamplerCache.h"
+
+#include <algorithm>
+#include <functional>
+
+bool SamplerSettings::operator==(const SamplerSettings& other) const
+{
+	return magFilter == other.magFilter && minFilter == other.minFilter && mipmapMode == other.mipmapMode
+		&& addressModeU == other.addressModeU && addressModeV == other.addressModeV && addressModeW == other.addressModeW
+		&& mipLodBias == other.mipLodBias && minLod == other.minLod && maxLod == other.maxLod
+		&& anisotropyEnable == other.anisotropyEnable && maxAnisotropy == other.maxAnisotropy
+		&& compareEnable == other.compareEnable && compareOp == other.compareOp
+		&& borderColor == other.borderColor && unnormalizedCoordinates == other.unnormalizedCoordinates;
+}
+
+size_t SamplerSettingsHash::operator()(const SamplerSettings& settings) const
+{
+	// Combine each field's hash (boost::hash_combine)
+	size_t seed = 0;
+	auto combine = [&seed](size_t value) {
+		seed ^= value + 0x9e3779b9 + (seed << 6) + (seed >> 2);
+	};
+
+	combine(std::hash<int>()(settings.magFilter));
+	combine(std::hash<int>()(settings.minFilter));
+	combine(std::hash<int>()(settings.mipmapMode));
+	combine(std::hash<int>()(settings.addressModeU));
+	combine(std::hash<int>()(settings.addressModeV));
+	combine(std::hash<int>()(settings.addressModeW));
+	combine(std::hash<float>()(settings.mipLodBias));
+	combine(std::hash<float>()(settings.minLod));
+	combine(std::hash<float>()(settings.maxLod));
+	combine(std::hash<uint32_t>()(settings.anisotropyEnable));
+	combine(std::hash<float>()(settings.maxAnisotropy));
+	combine(std::hash<uint32_t>()(settings.compareEnable));
+	combine(std::hash<int>()(settings.compareOp));
+	combine(std::hash<int>()(settings.borderColor));
+	combine(std::hash<uint32_t>()(settings.unnormalizedCoordinates));
+
+	return seed;
+}
+
+SamplerCache::SamplerCache()
+{
+}
+
+SamplerCache::~SamplerCache()
+{
+}
+
+void SamplerCache::init(VulkanDevice newDevice)
+{
+	device = newDevice;
+
+	// Anisotropy is capped by the device rather than assumed
+	VkPhysicalDeviceProperties deviceProperties;
+	vkGetPhysicalDeviceProperties(device.physicalDevice, &deviceProperties);
+	maxAnisotropy = deviceProperties.limits.maxSamplerAnisotropy;
+}
+
+VkSampler SamplerCache::getSampler(const SamplerSettings& settings)
+{
+	// Clamp before lookup so requests above the limit share the sampler actually created
+	SamplerSettings key = settings;
+	if (key.anisotropyEnable) {
+		key.maxAnisotropy = std::min(std::max(key.maxAnisotropy, 1.0f), maxAnisotropy);
+	}
+	else {
+		key.maxAnisotropy = 1.0f;
+	}
+
+	auto found = samplers.find(key);
+	if (found != samplers.end()) {
+		return found->second;
+	}
+
+	VkSamplerCreateInfo samplerCreateInfo = {};
+	samplerCreateInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+	samplerCreateInfo.magFilter = key.magFilter;
+	samplerCreateInfo.minFilter = key.minFilter;
+	samplerCreateInfo.mipmapMode = key.mipmapMode;
+	samplerCreateInfo.addressModeU = key.addressModeU;
+	samplerCreateInfo.addressModeV = key.addressModeV;
+	samplerCreateInfo.addressModeW = key.addressModeW;
+	samplerCreateInfo.mipLodBias = key.mipLodBias;
+	samplerCreateInfo.minLod = key.minLod;
+	samplerCreateInfo.maxLod = key.maxLod;
+	samplerCreateInfo.anisotropyEnable = key.anisotropyEnable;
+	samplerCreateInfo.maxAnisotropy = key.maxAnisotropy;
+	samplerCreateInfo.compareEnable = key.compareEnable;
+	samplerCreateInfo.compareOp = key.compareOp;
+	samplerCreateInfo.borderColor = key.borderColor;
+	samplerCreateInfo.unnormalizedCoordinates = key.unnormalizedCoordinates;
+
+	VkSampler sampler;
+	VkResult result = vkCreateSampler(device.logicalDevice, &samplerCreateInfo, nullptr, &sampler);
+	if (result != VK_SUCCESS) {
+		throw std::runtime_error("Failed to create sampler");
+	}
+
+	samplers[key] = sampler;
+
+	return sampler;
+}
+
+SamplerSettings SamplerCache::textureSettings(uint32_t mipCount)
+{
+	SamplerSettings settings;
+	settings.maxLod = static_cast<float>(mipCount);
+	return settings;
+}
+
+void SamplerCache::cleanup()
+{
+	for (auto& sampler : samplers) {
+		vkDestroySampler(device.logicalDevice, sampler.second, nullptr);
+	}
+	samplers.clear();
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include <unordered_map>
+#include <stdexcept>
+
+#include "Utilities.h"
+
+// Full state of a sampler, two equal settings always share one VkSampler
+struct SamplerSettings {
+	VkFilter magFilter = VK_FILTER_LINEAR; // How to render when image is magnified on screen
+	VkFilter minFilter = VK_FILTER_LINEAR; // How to render when image is minified on screen
+	VkSamplerMipmapMode mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
+	VkSamplerAddressMode addressModeU = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+	VkSamplerAddressMode addressModeV = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+	VkSamplerAddressMode addressModeW = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+	float mipLodBias = 0.0f; // Level of detail bias for mip level
+	float minLod = 0.0f;
+	float maxLod = VK_LOD_CLAMP_NONE; // Set to the texture's mip count so sampling never goes past its chain
+	VkBool32 anisotropyEnable = VK_TRUE;
+	float maxAnisotropy = 16.0f; // Clamped to the device limit by the cache
+	VkBool32 compareEnable = VK_FALSE;
+	VkCompareOp compareOp = VK_COMPARE_OP_ALWAYS;
+	VkBorderColor borderColor = VK_BORDER_COLOR_INT_OPAQUE_BLACK; // Border beyond texture, only works for border clamp
+	VkBool32 unnormalizedCoordinates = VK_FALSE; // Whether coords should be normalised between 0 and 1
+
+	bool operator==(const SamplerSettings& other) const;
+};
+
+struct SamplerSettingsHash {
+	size_t operator()(const SamplerSettings& settings) const;
+};
+
+class SamplerCache
+{
+public:
+	SamplerCache();
+
+	void init(VulkanDevice newDevice);
+
+	// Returns the sampler for these settings, creating it the first time they are seen
+	VkSampler getSampler(const SamplerSettings& settings);
+
+	// Default texture sampler for a texture with mipCount levels
+	static SamplerSettings textureSettings(uint32_t mipCount);
+
+	float getMaxAnisotropy() { return maxAnisotropy; }
+	size_t getSamplerCount() { return samplers.size(); }
+
+	void cleanup();
+
+	~SamplerCache();
+
+private:
+	VulkanDevice device;
+	float maxAnisotropy = 1.0f; // VkPhysicalDeviceLimits::maxSamplerAnisotropy
+
+	std::unordered_map<SamplerSettings, VkSampler, SamplerSettingsHash> samplers;
+};
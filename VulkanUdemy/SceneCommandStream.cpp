@@ -0,0 +1,35 @@
+#include "SceneCommandStream.h"
+
+SceneCommandStream::SceneCommandStream()
+{
+}
+
+void SceneCommandStream::setTransform(RenderObjectHandle object, const glm::mat4& transform)
+{
+	commands.push_back({ SceneCommandType::SetTransform, object, transform });
+}
+
+void SceneCommandStream::destroy(RenderObjectHandle object)
+{
+	commands.push_back({ SceneCommandType::Destroy, object, glm::mat4(1.0f) });
+}
+
+void SceneCommandStream::apply(SceneStore* scene, DeletionQueue* deletionQueue) const
+{
+	for (const SceneCommand& command : commands) {
+		if (!scene->isAlive(command.object)) continue;
+
+		switch (command.type) {
+		case SceneCommandType::SetTransform:
+			scene->setTransform(command.object, command.transform);
+			break;
+		case SceneCommandType::Destroy:
+			scene->destroy(command.object, deletionQueue);
+			break;
+		}
+	}
+}
+
+SceneCommandStream::~SceneCommandStream()
+{
+}
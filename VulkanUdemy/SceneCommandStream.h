@@ -0,0 +1,40 @@
+#pragma once
+
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "SceneStore.h"
+#include "DeletionQueue.h"
+
+enum class SceneCommandType {
+	SetTransform,
+	Destroy
+};
+
+struct SceneCommand {
+	SceneCommandType type;
+	RenderObjectHandle object;
+	glm::mat4 transform; // SetTransform only
+};
+
+// Changes to scene objects from the application, applied by the renderer in the order they were recorded. Each frame
+// snapshot carries one, so the application never writes the store the render thread is building frames from. Commands
+// for objects destroyed since they were recorded are dropped, their handles no longer match.
+class SceneCommandStream
+{
+public:
+	SceneCommandStream();
+
+	void setTransform(RenderObjectHandle object, const glm::mat4& transform);
+	void destroy(RenderObjectHandle object);
+
+	void apply(SceneStore* scene, DeletionQueue* deletionQueue) const;
+	void clear() { commands.clear(); } // Capacity is kept, steady state recording doesn't allocate
+	size_t size() const { return commands.size(); }
+
+	~SceneCommandStream();
+
+private:
+	std::vector<SceneCommand> commands;
+};
@@ -0,0 +1,249 @@
+#include "SceneStore.h"
+
+#include <chrono>
+#include <random>
+
+#include "MeshModel.h"
+#include "BoundingVolumeHierarchy.h"
+
+SceneStore::SceneStore()
+{
+}
+
+RenderObjectHandle SceneStore::create(const Mesh& mesh, const glm::mat4& transform, bool hasTexture)
+{
+	uint32_t id;
+	if (!freeIds.empty()) {
+		id = freeIds.back();
+		freeIds.pop_back();
+	}
+	else {
+		id = static_cast<uint32_t>(entityIndices.size());
+		entityIndices.push_back(~0u);
+		generations.push_back(0);
+	}
+	entityIndices[id] = static_cast<uint32_t>(entityIds.size());
+	entityIds.push_back(id);
+
+	transforms.push_back(transform);
+	renderHandles.push_back({ mesh.getVertexBuffer(), mesh.getIndexBuffer(), static_cast<uint32_t>(mesh.getVertexCount()),
+		static_cast<uint32_t>(mesh.getIndexCount()), mesh.getTexId() });
+	localBoxes.push_back(mesh.getBoundingBox());
+	worldBoxes.push_back(BoundingVolumeHierarchy::transformBox(mesh.getBoundingBox(), transform));
+	flags.push_back(hasTexture ? ENTITY_HAS_TEXTURE : 0);
+	meshMemory.push_back({ mesh.getVertexBufferMemory(), mesh.getIndexBufferMemory() });
+
+	structureVersion++;
+	return { id, generations[id] };
+}
+
+void SceneStore::destroy(RenderObjectHandle entity, DeletionQueue* deletionQueue)
+{
+	uint32_t index = getIndex(entity);
+	deletionQueue->destroyBuffer(renderHandles[index].vertexBuffer, meshMemory[index].vertexBufferMemory);
+	deletionQueue->destroyBuffer(renderHandles[index].indexBuffer, meshMemory[index].indexBufferMemory);
+
+	// The last entity fills the gap so the arrays stay packed
+	uint32_t last = static_cast<uint32_t>(entityIds.size()) - 1;
+	if (index != last) {
+		transforms[index] = transforms[last];
+		renderHandles[index] = renderHandles[last];
+		localBoxes[index] = localBoxes[last];
+		worldBoxes[index] = worldBoxes[last];
+		flags[index] = flags[last];
+		meshMemory[index] = meshMemory[last];
+		entityIds[index] = entityIds[last];
+		entityIndices[entityIds[index]] = index;
+	}
+	transforms.pop_back();
+	renderHandles.pop_back();
+	localBoxes.pop_back();
+	worldBoxes.pop_back();
+	flags.pop_back();
+	meshMemory.pop_back();
+	entityIds.pop_back();
+
+	// Old handles to the id stop matching
+	entityIndices[entity.id] = ~0u;
+	generations[entity.id]++;
+	freeIds.push_back(entity.id);
+	structureVersion++;
+}
+
+bool SceneStore::isAlive(RenderObjectHandle entity)
+{
+	return entity.id < entityIndices.size() && entityIndices[entity.id] != ~0u && generations[entity.id] == entity.generation;
+}
+
+uint32_t SceneStore::getIndex(RenderObjectHandle entity)
+{
+	if (!isAlive(entity)) {
+		throw std::runtime_error("Attempted to access an entity that doesn't exist");
+	}
+	return entityIndices[entity.id];
+}
+
+void SceneStore::setTransform(RenderObjectHandle entity, const glm::mat4& transform)
+{
+	uint32_t index = getIndex(entity);
+	transforms[index] = transform;
+	flags[index] |= ENTITY_BOUNDS_DIRTY;
+}
+
+void SceneStore::updateBounds()
+{
+	for (size_t i = 0; i < flags.size(); i++) {
+		if (!(flags[i] & ENTITY_BOUNDS_DIRTY)) continue;
+		worldBoxes[i] = BoundingVolumeHierarchy::transformBox(localBoxes[i], transforms[i]);
+		flags[i] = (flags[i] & ~ENTITY_BOUNDS_DIRTY) | ENTITY_BVH_DIRTY;
+	}
+}
+
+void SceneStore::clearFlags(uint32_t clearedFlags)
+{
+	for (uint32_t& entityFlags : flags) {
+		entityFlags &= ~clearedFlags;
+	}
+}
+
+void SceneStore::cleanup(VkDevice device)
+{
+	for (size_t i = 0; i < renderHandles.size(); i++) {
+		vkDestroyBuffer(device, renderHandles[i].vertexBuffer, nullptr);
+		vkFreeMemory(device, meshMemory[i].vertexBufferMemory, nullptr);
+		vkDestroyBuffer(device, renderHandles[i].indexBuffer, nullptr);
+		vkFreeMemory(device, meshMemory[i].indexBufferMemory, nullptr);
+	}
+	transforms.clear();
+	renderHandles.clear();
+	localBoxes.clear();
+	worldBoxes.clear();
+	flags.clear();
+	meshMemory.clear();
+
+	// Ids are freed rather than forgotten, so handles from before stay stale
+	for (uint32_t id : entityIds) {
+		entityIndices[id] = ~0u;
+		generations[id]++;
+		freeIds.push_back(id);
+	}
+	entityIds.clear();
+	structureVersion++;
+}
+
+void SceneStore::benchmark()
+{
+	std::mt19937 random(1234);
+	std::uniform_real_distribution<float> position(-100.0f, 100.0f);
+	auto elapsed = [](std::chrono::steady_clock::time_point start) {
+		return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	};
+
+	const uint32_t MESHES_PER_MODEL = 4;
+	const int RUNS = 10;
+	for (uint32_t count : { 10000u, 100000u, 1000000u }) {
+		// The old layout: models by value, each holding its meshes by value, and the same objects as entities
+		std::vector<MeshModel> modelList;
+		SceneStore store;
+		for (uint32_t i = 0; i < count / MESHES_PER_MODEL; i++) {
+			glm::mat4 model(1.0f);
+			model[3] = glm::vec4(position(random), position(random), position(random), 1.0f);
+			std::vector<Mesh> modelMeshes(MESHES_PER_MODEL);
+			for (Mesh& mesh : modelMeshes) {
+				store.create(mesh, model, true);
+			}
+			modelList.push_back(MeshModel(modelMeshes));
+			modelList.back().setModel(model);
+		}
+
+		// Each system run over both layouts writes the same output
+		std::vector<Model> uniforms(count);
+		std::vector<BoundingBox> boxes(count);
+		std::vector<RenderHandles> draws(count);
+
+		// Model uniforms, as recordCommands used to walk the models (copying each MeshModel) and by reference
+		auto start = std::chrono::steady_clock::now();
+		for (int run = 0; run < RUNS; run++) {
+			size_t n = 0;
+			for (size_t j = 0; j < modelList.size(); j++) {
+				MeshModel thisModel = modelList[j];
+				for (size_t k = 0; k < thisModel.getMeshCount(); k++) {
+					uniforms[n++] = { thisModel.getModel(), thisModel.getMesh(k)->getModel().hasTexture };
+				}
+			}
+		}
+		double uniformCopyTime = elapsed(start) / RUNS;
+
+		start = std::chrono::steady_clock::now();
+		for (int run = 0; run < RUNS; run++) {
+			size_t n = 0;
+			for (MeshModel& meshModel : modelList) {
+				glm::mat4 model = meshModel.getModel();
+				for (size_t k = 0; k < meshModel.getMeshCount(); k++) {
+					uniforms[n++] = { model, meshModel.getMesh(k)->getModel().hasTexture };
+				}
+			}
+		}
+		double uniformTime = elapsed(start) / RUNS;
+
+		start = std::chrono::steady_clock::now();
+		for (int run = 0; run < RUNS; run++) {
+			for (size_t i = 0; i < store.size(); i++) {
+				uniforms[i] = { store.transforms[i], (store.flags[i] & ENTITY_HAS_TEXTURE) != 0 };
+			}
+		}
+		double storeUniformTime = elapsed(start) / RUNS;
+
+		// World boxes of everything, as if it all moved
+		start = std::chrono::steady_clock::now();
+		for (int run = 0; run < RUNS; run++) {
+			size_t n = 0;
+			for (MeshModel& meshModel : modelList) {
+				glm::mat4 model = meshModel.getModel();
+				for (size_t k = 0; k < meshModel.getMeshCount(); k++) {
+					boxes[n++] = BoundingVolumeHierarchy::transformBox(meshModel.getMesh(k)->getBoundingBox(), model);
+				}
+			}
+		}
+		double boundsTime = elapsed(start) / RUNS;
+
+		start = std::chrono::steady_clock::now();
+		for (int run = 0; run < RUNS; run++) {
+			for (uint32_t& entityFlags : store.flags) {
+				entityFlags |= ENTITY_BOUNDS_DIRTY;
+			}
+			store.updateBounds();
+		}
+		double storeBoundsTime = elapsed(start) / RUNS;
+
+		// What each draw binds
+		start = std::chrono::steady_clock::now();
+		for (int run = 0; run < RUNS; run++) {
+			size_t n = 0;
+			for (MeshModel& meshModel : modelList) {
+				for (size_t k = 0; k < meshModel.getMeshCount(); k++) {
+					Mesh* mesh = meshModel.getMesh(k);
+					draws[n++] = { mesh->getVertexBuffer(), mesh->getIndexBuffer(), static_cast<uint32_t>(mesh->getVertexCount()),
+						static_cast<uint32_t>(mesh->getIndexCount()), mesh->getTexId() };
+				}
+			}
+		}
+		double drawTime = elapsed(start) / RUNS;
+
+		start = std::chrono::steady_clock::now();
+		for (int run = 0; run < RUNS; run++) {
+			for (size_t i = 0; i < store.size(); i++) {
+				draws[i] = store.renderHandles[i];
+			}
+		}
+		double storeDrawTime = elapsed(start) / RUNS;
+
+		printf("Scene %u objects (%zu byte meshes): store vs MeshModel vectors\n", count, sizeof(Mesh));
+		printf("  uniforms %.3f ms vs %.3f ms (%.3f ms copying each model), bounds %.3f ms vs %.3f ms, draws %.3f ms vs %.3f ms\n",
+			storeUniformTime, uniformTime, uniformCopyTime, storeBoundsTime, boundsTime, storeDrawTime, drawTime);
+	}
+}
+
+SceneStore::~SceneStore()
+{
+}
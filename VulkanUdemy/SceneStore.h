@@ -0,0 +1,104 @@
+#pragma once
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include <vector>
+#include <stdexcept>
+
+#include <glm/glm.hpp>
+
+#include "Utilities.h"
+#include "Mesh.h"
+#include "DeletionQueue.h"
+
+// What the application holds for a scene object, it stays the same while the object lives unlike its index into the
+// component arrays. Ids are reused, the generation tells a handle to a destroyed object from one to its successor
+struct RenderObjectHandle {
+	uint32_t id;
+	uint32_t generation;
+
+	bool operator==(const RenderObjectHandle& other) const { return id == other.id && generation == other.generation; }
+	bool operator!=(const RenderObjectHandle& other) const { return !(*this == other); }
+};
+const RenderObjectHandle NULL_RENDER_OBJECT = { ~0u, 0 };
+
+// Entity flags
+const uint32_t ENTITY_HAS_TEXTURE = 1u << 0;
+const uint32_t ENTITY_BOUNDS_DIRTY = 1u << 1; // Transform changed, world box is recomputed by updateBounds
+const uint32_t ENTITY_BVH_DIRTY = 1u << 2; // World box changed since the renderer's BVH last saw it
+
+// What drawing an entity binds, copied out of its mesh so draws never touch the mesh itself
+struct RenderHandles {
+	VkBuffer vertexBuffer;
+	VkBuffer indexBuffer;
+	uint32_t vertexCount;
+	uint32_t indexCount;
+	int texId;
+};
+
+// Memory behind an entity's buffers, only read when it's freed
+struct MeshMemory {
+	VkDeviceMemory vertexBufferMemory;
+	VkDeviceMemory indexBufferMemory;
+};
+
+// Scene objects as entities with their components in packed arrays, one per component, so each per frame system only
+// streams through the data it uses. Index i of every array is the same entity. Destroying an entity moves the last
+// one into its place, so indices are only good until the next create or destroy (see getStructureVersion).
+class SceneStore
+{
+public:
+	SceneStore();
+
+	// The mesh's buffers belong to the store until the entity is destroyed, the mesh itself isn't kept
+	RenderObjectHandle create(const Mesh& mesh, const glm::mat4& transform, bool hasTexture);
+
+	// Frames in flight may still be drawing it, the buffers go once they finish
+	void destroy(RenderObjectHandle entity, DeletionQueue* deletionQueue);
+
+	bool isAlive(RenderObjectHandle entity);
+	uint32_t getIndex(RenderObjectHandle entity);
+	RenderObjectHandle getEntity(uint32_t index) { return { entityIds[index], generations[entityIds[index]] }; }
+	size_t size() { return entityIds.size(); }
+
+	void setTransform(RenderObjectHandle entity, const glm::mat4& transform);
+
+	// World boxes of entities that moved since the last call
+	void updateBounds();
+
+	void clearFlags(uint32_t flags);
+
+	// Changes whenever an entity is created or destroyed, anything holding indices has to rebuild then
+	uint32_t getStructureVersion() { return structureVersion; }
+
+	// Component arrays
+	const std::vector<glm::mat4>& getTransforms() { return transforms; }
+	const std::vector<RenderHandles>& getRenderHandles() { return renderHandles; }
+	const std::vector<BoundingBox>& getLocalBoxes() { return localBoxes; }
+	const std::vector<BoundingBox>& getWorldBoxes() { return worldBoxes; }
+	const std::vector<uint32_t>& getFlags() { return flags; }
+
+	// Destroys every entity's buffers now, the device must be idle
+	void cleanup(VkDevice device);
+
+	// Per frame systems over the store against the same systems over vectors of MeshModel and Mesh, no device needed
+	static void benchmark();
+
+	~SceneStore();
+
+private:
+	std::vector<glm::mat4> transforms;
+	std::vector<RenderHandles> renderHandles;
+	std::vector<BoundingBox> localBoxes;
+	std::vector<BoundingBox> worldBoxes;
+	std::vector<uint32_t> flags;
+	std::vector<MeshMemory> meshMemory;
+	std::vector<uint32_t> entityIds; // Id of the entity at each index
+
+	// By id
+	std::vector<uint32_t> entityIndices; // ~0 if the id is free
+	std::vector<uint32_t> generations; // Bumped when the id's entity is destroyed
+	std::vector<uint32_t> freeIds;
+	uint32_t structureVersion = 0;
+};
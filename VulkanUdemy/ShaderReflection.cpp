@@ -0,0 +1,434 @@
+#include "ShaderReflection.h"
+
+#include <unordered_map>
+#include <algorithm>
+#include <fstream>
+#include <cstring>
+
+namespace {
+	// SPIR-V opcodes, decorations etc. used here (numbers from the SPIR-V spec)
+	const uint32_t SPIRV_MAGIC = 0x07230203;
+
+	enum Op : uint32_t {
+		OpEntryPoint = 15,
+		OpTypeBool = 20,
+		OpTypeInt = 21,
+		OpTypeFloat = 22,
+		OpTypeVector = 23,
+		OpTypeMatrix = 24,
+		OpTypeImage = 25,
+		OpTypeSampler = 26,
+		OpTypeSampledImage = 27,
+		OpTypeArray = 28,
+		OpTypeRuntimeArray = 29,
+		OpTypeStruct = 30,
+		OpTypePointer = 32,
+		OpConstant = 43,
+		OpVariable = 59,
+		OpDecorate = 71,
+		OpMemberDecorate = 72
+	};
+
+	enum Decoration : uint32_t {
+		DecorationBlock = 2,
+		DecorationBufferBlock = 3,
+		DecorationArrayStride = 6,
+		DecorationMatrixStride = 7,
+		DecorationBuiltIn = 11,
+		DecorationLocation = 30,
+		DecorationBinding = 33,
+		DecorationDescriptorSet = 34,
+		DecorationOffset = 35
+	};
+
+	enum StorageClass : uint32_t {
+		StorageUniformConstant = 0,
+		StorageInput = 1,
+		StorageUniform = 2,
+		StoragePushConstant = 9,
+		StorageStorageBuffer = 12
+	};
+
+	const uint32_t DIM_BUFFER = 5;
+	const uint32_t DIM_SUBPASS_DATA = 6;
+
+	struct Type {
+		uint32_t opcode = 0;
+		std::vector<uint32_t> operands; // Everything after the result id
+	};
+
+	struct Id {
+		Type type; // Set for type declarations
+		uint32_t constant = 0; // Value for 32 bit OpConstant
+		bool hasConstant = false;
+
+		// Variables
+		uint32_t variableType = 0; // Pointer type id
+		uint32_t storageClass = 0;
+		bool isVariable = false;
+
+		// Decorations
+		uint32_t set = 0, binding = 0, location = 0, arrayStride = 0;
+		bool hasBinding = false, hasLocation = false, isBuiltIn = false;
+		bool isBlock = false, isBufferBlock = false;
+		std::vector<uint32_t> memberOffsets;
+		std::vector<uint32_t> memberMatrixStrides;
+	};
+
+	class Module {
+	public:
+		std::vector<Id> ids;
+		VkShaderStageFlagBits stage = VK_SHADER_STAGE_ALL_GRAPHICS;
+
+		Module(const std::vector<uint32_t>& words)
+		{
+			if (words.size() < 5 || words[0] != SPIRV_MAGIC) {
+				throw std::runtime_error("Not a SPIR-V module");
+			}
+			ids.resize(words[3]); // Id bound
+
+			// Instructions start after the 5 word header, each starts with (word count << 16) | opcode
+			size_t position = 5;
+			while (position < words.size()) {
+				uint32_t opcode = words[position] & 0xFFFF;
+				uint32_t wordCount = words[position] >> 16;
+				if (wordCount == 0 || position + wordCount > words.size()) {
+					throw std::runtime_error("Malformed SPIR-V instruction");
+				}
+				parse(opcode, &words[position + 1], wordCount - 1);
+				position += wordCount;
+			}
+		}
+
+		Id& id(uint32_t index)
+		{
+			if (index >= ids.size()) {
+				throw std::runtime_error("SPIR-V id out of range");
+			}
+			return ids[index];
+		}
+
+		// Byte size of a type as laid out in a block (uses the Offset/ArrayStride/MatrixStride decorations)
+		uint32_t sizeOf(uint32_t typeId, uint32_t matrixStride = 0)
+		{
+			Id& typeInfo = id(typeId);
+			const std::vector<uint32_t>& operands = typeInfo.type.operands;
+			switch (typeInfo.type.opcode) {
+			case OpTypeBool:
+				return 4;
+			case OpTypeInt:
+			case OpTypeFloat:
+				return operands[0] / 8;
+			case OpTypeVector:
+				return sizeOf(operands[0]) * operands[1];
+			case OpTypeMatrix: {
+				// Columns are matrixStride apart, the last column only takes its own size
+				uint32_t columnSize = sizeOf(operands[0]);
+				uint32_t stride = matrixStride > 0 ? matrixStride : columnSize;
+				return stride * (operands[1] - 1) + columnSize;
+			}
+			case OpTypeArray: {
+				uint32_t length = id(operands[1]).constant;
+				uint32_t stride = typeInfo.arrayStride > 0 ? typeInfo.arrayStride : sizeOf(operands[0]);
+				return stride * length;
+			}
+			case OpTypeStruct: {
+				uint32_t size = 0;
+				for (size_t i = 0; i < operands.size(); i++) {
+					uint32_t offset = i < typeInfo.memberOffsets.size() ? typeInfo.memberOffsets[i] : size;
+					uint32_t memberStride = i < typeInfo.memberMatrixStrides.size() ? typeInfo.memberMatrixStrides[i] : 0;
+					size = std::max(size, offset + sizeOf(operands[i], memberStride));
+				}
+				return size;
+			}
+			default:
+				return 0;
+			}
+		}
+
+		VkFormat formatOf(uint32_t typeId)
+		{
+			Id& typeInfo = id(typeId);
+			uint32_t componentType = typeId;
+			uint32_t components = 1;
+			if (typeInfo.type.opcode == OpTypeVector) {
+				componentType = typeInfo.type.operands[0];
+				components = typeInfo.type.operands[1];
+			}
+
+			const Type& component = id(componentType).type;
+			if (component.opcode == OpTypeFloat && component.operands[0] == 32) {
+				const VkFormat formats[] = { VK_FORMAT_R32_SFLOAT, VK_FORMAT_R32G32_SFLOAT, VK_FORMAT_R32G32B32_SFLOAT, VK_FORMAT_R32G32B32A32_SFLOAT };
+				return formats[components - 1];
+			}
+			if (component.opcode == OpTypeInt && component.operands[0] == 32) {
+				bool isSigned = component.operands[1] != 0;
+				const VkFormat signedFormats[] = { VK_FORMAT_R32_SINT, VK_FORMAT_R32G32_SINT, VK_FORMAT_R32G32B32_SINT, VK_FORMAT_R32G32B32A32_SINT };
+				const VkFormat unsignedFormats[] = { VK_FORMAT_R32_UINT, VK_FORMAT_R32G32_UINT, VK_FORMAT_R32G32B32_UINT, VK_FORMAT_R32G32B32A32_UINT };
+				return isSigned ? signedFormats[components - 1] : unsignedFormats[components - 1];
+			}
+			return VK_FORMAT_UNDEFINED;
+		}
+
+	private:
+		void parse(uint32_t opcode, const uint32_t* operands, uint32_t count)
+		{
+			switch (opcode) {
+			case OpEntryPoint:
+				stage = executionModelStage(operands[0]);
+				break;
+			case OpTypeBool:
+			case OpTypeInt:
+			case OpTypeFloat:
+			case OpTypeVector:
+			case OpTypeMatrix:
+			case OpTypeImage:
+			case OpTypeSampler:
+			case OpTypeSampledImage:
+			case OpTypeArray:
+			case OpTypeRuntimeArray:
+			case OpTypeStruct:
+			case OpTypePointer:
+				id(operands[0]).type.opcode = opcode;
+				id(operands[0]).type.operands.assign(operands + 1, operands + count);
+				break;
+			case OpConstant:
+				id(operands[1]).constant = operands[2];
+				id(operands[1]).hasConstant = true;
+				break;
+			case OpVariable:
+				id(operands[1]).variableType = operands[0];
+				id(operands[1]).storageClass = operands[2];
+				id(operands[1]).isVariable = true;
+				break;
+			case OpDecorate:
+				decorate(id(operands[0]), operands[1], count > 2 ? operands[2] : 0);
+				break;
+			case OpMemberDecorate: {
+				Id& structInfo = id(operands[0]);
+				uint32_t member = operands[1];
+				if (operands[2] == DecorationOffset) {
+					if (structInfo.memberOffsets.size() <= member) structInfo.memberOffsets.resize(member + 1, 0);
+					structInfo.memberOffsets[member] = operands[3];
+				}
+				else if (operands[2] == DecorationMatrixStride) {
+					if (structInfo.memberMatrixStrides.size() <= member) structInfo.memberMatrixStrides.resize(member + 1, 0);
+					structInfo.memberMatrixStrides[member] = operands[3];
+				}
+				break;
+			}
+			default:
+				break;
+			}
+		}
+
+		void decorate(Id& target, uint32_t decoration, uint32_t value)
+		{
+			switch (decoration) {
+			case DecorationBlock: target.isBlock = true; break;
+			case DecorationBufferBlock: target.isBufferBlock = true; break;
+			case DecorationArrayStride: target.arrayStride = value; break;
+			case DecorationBuiltIn: target.isBuiltIn = true; break;
+			case DecorationLocation: target.location = value; target.hasLocation = true; break;
+			case DecorationBinding: target.binding = value; target.hasBinding = true; break;
+			case DecorationDescriptorSet: target.set = value; break;
+			default: break;
+			}
+		}
+
+		static VkShaderStageFlagBits executionModelStage(uint32_t executionModel)
+		{
+			switch (executionModel) {
+			case 0: return VK_SHADER_STAGE_VERTEX_BIT;
+			case 1: return VK_SHADER_STAGE_TESSELLATION_CONTROL_BIT;
+			case 2: return VK_SHADER_STAGE_TESSELLATION_EVALUATION_BIT;
+			case 3: return VK_SHADER_STAGE_GEOMETRY_BIT;
+			case 4: return VK_SHADER_STAGE_FRAGMENT_BIT;
+			case 5: return VK_SHADER_STAGE_COMPUTE_BIT;
+			default: return VK_SHADER_STAGE_ALL;
+			}
+		}
+	};
+
+	// Descriptor type of a resource variable's type, arrays are unwrapped into count
+	bool descriptorType(Module& module, uint32_t storageClass, uint32_t typeId, VkDescriptorType* type, uint32_t* count)
+	{
+		*count = 1;
+		Id* typeInfo = &module.id(typeId);
+		while (typeInfo->type.opcode == OpTypeArray || typeInfo->type.opcode == OpTypeRuntimeArray) {
+			// Runtime arrays are sized when the layout is made, count them as 1 here
+			if (typeInfo->type.opcode == OpTypeArray) {
+				*count *= module.id(typeInfo->type.operands[1]).constant;
+			}
+			typeInfo = &module.id(typeInfo->type.operands[0]);
+		}
+
+		switch (typeInfo->type.opcode) {
+		case OpTypeStruct:
+			if (storageClass == StorageStorageBuffer || typeInfo->isBufferBlock) {
+				*type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+				return true;
+			}
+			if (storageClass == StorageUniform) {
+				*type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+				return true;
+			}
+			return false;
+		case OpTypeSampledImage:
+			*type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+			return true;
+		case OpTypeSampler:
+			*type = VK_DESCRIPTOR_TYPE_SAMPLER;
+			return true;
+		case OpTypeImage: {
+			// Operands: sampled type, dim, depth, arrayed, MS, sampled (1 = sampled, 2 = storage), format
+			uint32_t dim = typeInfo->type.operands[1];
+			uint32_t sampled = typeInfo->type.operands[5];
+			if (dim == DIM_SUBPASS_DATA) *type = VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT;
+			else if (dim == DIM_BUFFER) *type = sampled == 2 ? VK_DESCRIPTOR_TYPE_STORAGE_TEXEL_BUFFER : VK_DESCRIPTOR_TYPE_UNIFORM_TEXEL_BUFFER;
+			else *type = sampled == 2 ? VK_DESCRIPTOR_TYPE_STORAGE_IMAGE : VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
+			return true;
+		}
+		default:
+			return false;
+		}
+	}
+}
+
+ShaderReflection ShaderReflection::reflect(const std::vector<char>& code)
+{
+	if (code.size() % 4 != 0) {
+		throw std::runtime_error("SPIR-V size isn't a whole number of words");
+	}
+	std::vector<uint32_t> words(code.size() / 4);
+	memcpy(words.data(), code.data(), code.size());
+
+	Module module(words);
+
+	ShaderReflection reflection;
+	reflection.stage = module.stage;
+
+	for (uint32_t i = 0; i < module.ids.size(); i++) {
+		Id& variable = module.ids[i];
+		if (!variable.isVariable) continue;
+
+		// Variables are pointers, the pointee is the resource's type
+		uint32_t pointeeType = module.id(variable.variableType).type.operands[1];
+
+		switch (variable.storageClass) {
+		case StorageUniformConstant:
+		case StorageUniform:
+		case StorageStorageBuffer: {
+			ReflectedBinding binding = {};
+			if (!variable.hasBinding || !descriptorType(module, variable.storageClass, pointeeType, &binding.type, &binding.count)) break;
+			binding.set = variable.set;
+			binding.binding = variable.binding;
+			binding.stages = reflection.stage;
+			reflection.bindings.push_back(binding);
+			break;
+		}
+		case StoragePushConstant: {
+			// The range covers the block's members, which may not start at 0 (layout(offset = ...))
+			Id& block = module.id(pointeeType);
+			uint32_t start = block.memberOffsets.empty() ? 0 : *std::min_element(block.memberOffsets.begin(), block.memberOffsets.end());
+			reflection.pushConstants.stageFlags = reflection.stage;
+			reflection.pushConstants.offset = start;
+			reflection.pushConstants.size = module.sizeOf(pointeeType) - start;
+			break;
+		}
+		case StorageInput:
+			if (reflection.stage != VK_SHADER_STAGE_VERTEX_BIT || variable.isBuiltIn || !variable.hasLocation) break;
+			reflection.vertexInputs.push_back({ variable.location, module.formatOf(pointeeType) });
+			break;
+		default:
+			break;
+		}
+	}
+
+	std::sort(reflection.bindings.begin(), reflection.bindings.end(), [](const ReflectedBinding& a, const ReflectedBinding& b) {
+		return a.set != b.set ? a.set < b.set : a.binding < b.binding;
+	});
+	std::sort(reflection.vertexInputs.begin(), reflection.vertexInputs.end(), [](const ReflectedVertexInput& a, const ReflectedVertexInput& b) {
+		return a.location < b.location;
+	});
+
+	return reflection;
+}
+
+ShaderReflection ShaderReflection::reflectFile(const std::string& fileName)
+{
+	std::ifstream file(fileName, std::ios::binary | std::ios::ate);
+	if (!file.is_open()) {
+		throw std::runtime_error("Failed to open a file");
+	}
+	std::vector<char> code((size_t)file.tellg());
+	file.seekg(0);
+	file.read(code.data(), code.size());
+	return reflect(code);
+}
+
+ReflectedLayout ReflectedLayout::merge(const std::vector<ShaderReflection>& shaders, const std::vector<std::pair<uint32_t, uint32_t>>& dynamicBindings)
+{
+	ReflectedLayout layout;
+
+	for (const auto& shader : shaders) {
+		for (const auto& binding : shader.bindings) {
+			if (layout.sets.size() <= binding.set) layout.sets.resize(binding.set + 1);
+			auto& set = layout.sets[binding.set];
+
+			VkDescriptorType type = binding.type;
+			if (type == VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER &&
+				std::find(dynamicBindings.begin(), dynamicBindings.end(), std::make_pair(binding.set, binding.binding)) != dynamicBindings.end()) {
+				type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+			}
+
+			// Same binding used from several stages
+			auto existing = std::find_if(set.begin(), set.end(), [&](const VkDescriptorSetLayoutBinding& b) { return b.binding == binding.binding; });
+			if (existing != set.end()) {
+				if (existing->descriptorType != type || existing->descriptorCount != binding.count) {
+					throw std::runtime_error("Shader stages disagree on a descriptor binding's type");
+				}
+				existing->stageFlags |= binding.stages;
+				continue;
+			}
+
+			VkDescriptorSetLayoutBinding layoutBinding = {};
+			layoutBinding.binding = binding.binding;
+			layoutBinding.descriptorType = type;
+			layoutBinding.descriptorCount = binding.count;
+			layoutBinding.stageFlags = binding.stages;
+			layoutBinding.pImmutableSamplers = nullptr;
+			set.push_back(layoutBinding);
+		}
+
+		if (shader.pushConstants.size > 0) {
+			layout.pushConstantRanges.push_back(shader.pushConstants);
+		}
+	}
+
+	for (auto& set : layout.sets) {
+		std::sort(set.begin(), set.end(), [](const VkDescriptorSetLayoutBinding& a, const VkDescriptorSetLayoutBinding& b) { return a.binding < b.binding; });
+	}
+
+	return layout;
+}
+
+bool ReflectedLayout::operator==(const ReflectedLayout& other) const
+{
+	if (sets.size() != other.sets.size() || pushConstantRanges.size() != other.pushConstantRanges.size()) return false;
+
+	for (size_t i = 0; i < sets.size(); i++) {
+		if (sets[i].size() != other.sets[i].size()) return false;
+		for (size_t j = 0; j < sets[i].size(); j++) {
+			const VkDescriptorSetLayoutBinding& a = sets[i][j];
+			const VkDescriptorSetLayoutBinding& b = other.sets[i][j];
+			if (a.binding != b.binding || a.descriptorType != b.descriptorType || a.descriptorCount != b.descriptorCount || a.stageFlags != b.stageFlags) return false;
+		}
+	}
+	for (size_t i = 0; i < pushConstantRanges.size(); i++) {
+		const VkPushConstantRange& a = pushConstantRanges[i];
+		const VkPushConstantRange& b = other.pushConstantRanges[i];
+		if (a.stageFlags != b.stageFlags || a.offset != b.offset || a.size != b.size) return false;
+	}
+	return true;
+}
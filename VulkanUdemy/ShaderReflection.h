@@ -0,0 +1,47 @@
+#pragma once
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include <string>
+#include <vector>
+#include <utility>
+#include <stdexcept>
+
+struct ReflectedBinding {
+	uint32_t set;
+	uint32_t binding;
+	VkDescriptorType type;
+	uint32_t count; // Array size, 1 for a single descriptor
+	VkShaderStageFlags stages;
+};
+
+struct ReflectedVertexInput {
+	uint32_t location;
+	VkFormat format;
+};
+
+// What a SPIR-V module expects from its pipeline layout and vertex input, read straight from the binary so the
+// C++ side can't silently drift from the GLSL
+struct ShaderReflection {
+	VkShaderStageFlagBits stage;
+	std::vector<ReflectedBinding> bindings;
+	VkPushConstantRange pushConstants = {}; // size 0 if the stage has no push constant block
+	std::vector<ReflectedVertexInput> vertexInputs; // Vertex stage only, sorted by location
+
+	// Throws if the code isn't valid SPIR-V
+	static ShaderReflection reflect(const std::vector<char>& code);
+	static ShaderReflection reflectFile(const std::string& fileName);
+};
+
+// Several stages merged into what a pipeline layout needs
+struct ReflectedLayout {
+	std::vector<std::vector<VkDescriptorSetLayoutBinding>> sets; // Indexed by set number, bindings sorted
+	std::vector<VkPushConstantRange> pushConstantRanges; // One per stage that has push constants
+
+	// SPIR-V can't tell a dynamic uniform buffer from a plain one, dynamicBindings lists the (set, binding) pairs that are
+	static ReflectedLayout merge(const std::vector<ShaderReflection>& shaders, const std::vector<std::pair<uint32_t, uint32_t>>& dynamicBindings = {});
+
+	bool operator==(const ReflectedLayout& other) const;
+	bool operator!=(const ReflectedLayout& other) const { return !(*this == other); }
+};
@@ -0,0 +1,56 @@
+#include "ShaderWatcher.h"
+
+ShaderWatcher::ShaderWatcher()
+{
+}
+
+ShaderWatcher::~ShaderWatcher()
+{
+}
+
+void ShaderWatcher::watch(const std::string& fileName)
+{
+	for (auto& file : files) {
+		if (file.fileName == fileName) return;
+	}
+
+	WatchedFile file;
+	file.fileName = fileName;
+	file.path = fileName;
+	getWriteTime(file.path, &file.lastWrite);
+	files.push_back(file);
+}
+
+std::vector<std::string> ShaderWatcher::poll()
+{
+	std::vector<std::string> changed;
+
+	auto now = std::chrono::steady_clock::now();
+	if (now - lastPoll < interval) return changed;
+	lastPoll = now;
+
+	for (auto& file : files) {
+		std::filesystem::file_time_type writeTime;
+		if (!getWriteTime(file.path, &writeTime)) continue; // Mid replace, try again next poll
+
+		if (file.pending && writeTime == file.pendingWrite) {
+			// Settled since last poll
+			file.lastWrite = writeTime;
+			file.pending = false;
+			changed.push_back(file.fileName);
+		}
+		else if (writeTime != file.lastWrite) {
+			file.pendingWrite = writeTime;
+			file.pending = true;
+		}
+	}
+
+	return changed;
+}
+
+bool ShaderWatcher::getWriteTime(const std::filesystem::path& path, std::filesystem::file_time_type* writeTime)
+{
+	std::error_code error;
+	*writeTime = std::filesystem::last_write_time(path, error);
+	return !error;
+}
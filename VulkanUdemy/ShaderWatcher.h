@@ -0,0 +1,38 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <chrono>
+#include <filesystem>
+
+// Polls files for changes (cheap enough to call every frame, only checks every interval).
+// A change is reported once the write time has stopped moving, so a file isn't picked up half written.
+class ShaderWatcher
+{
+public:
+	ShaderWatcher();
+
+	void watch(const std::string& fileName);
+
+	// Files that changed since the last call
+	std::vector<std::string> poll();
+
+	void setInterval(std::chrono::milliseconds newInterval) { interval = newInterval; }
+
+	~ShaderWatcher();
+
+private:
+	struct WatchedFile {
+		std::string fileName;
+		std::filesystem::path path; // Converted once, so polls don't build one (and allocate) per file
+		std::filesystem::file_time_type lastWrite; // Write time last reported (or when watching started)
+		std::filesystem::file_time_type pendingWrite; // Write time seen last poll, reported when it stays the same
+		bool pending = false;
+	};
+
+	std::vector<WatchedFile> files;
+	std::chrono::milliseconds interval = std::chrono::milliseconds(250);
+	std::chrono::steady_clock::time_point lastPoll;
+
+	static bool getWriteTime(const std::filesystem::path& path, std::filesystem::file_time_type* writeTime);
+};
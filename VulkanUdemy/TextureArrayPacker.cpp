@@ -0,0 +1,237 @@
+#include "TextureArrayPacker.h"
+
+#include <algorithm>
+
+TextureArrayPacker::TextureArrayPacker()
+{
+}
+
+TextureArrayPacker::~TextureArrayPacker()
+{
+}
+
+void TextureArrayPacker::init(VulkanDevice newDevice, FrameScheduler* newFrameScheduler)
+{
+	device = newDevice;
+	frameScheduler = newFrameScheduler;
+
+	VkPhysicalDeviceProperties deviceProperties;
+	vkGetPhysicalDeviceProperties(device.physicalDevice, &deviceProperties);
+	maxLayers = std::min(TEXTURE_PACK_MAX_LAYERS, deviceProperties.limits.maxImageArrayLayers);
+}
+
+bool TextureArrayPacker::shouldPack(uint32_t width, uint32_t height)
+{
+	return width <= TEXTURE_PACK_MAX_SIZE && height <= TEXTURE_PACK_MAX_SIZE;
+}
+
+PackedTexture TextureArrayPacker::addTexture(const unsigned char* pixels, uint32_t width, uint32_t height)
+{
+	uint32_t layerWidth = nextPowerOfTwo(width);
+	uint32_t layerHeight = nextPowerOfTwo(height);
+
+	// Find an array with this layer size that still has room
+	int arrayId = -1;
+	for (size_t i = 0; i < arrays.size(); i++) {
+		if (arrays[i].width == layerWidth && arrays[i].height == layerHeight && arrays[i].layers.size() < maxLayers) {
+			arrayId = static_cast<int>(i);
+			break;
+		}
+	}
+	if (arrayId < 0) {
+		TextureArray textureArray = {};
+		textureArray.width = layerWidth;
+		textureArray.height = layerHeight;
+		textureArray.image = VK_NULL_HANDLE;
+		textureArray.imageMemory = VK_NULL_HANDLE;
+		textureArray.imageView = VK_NULL_HANDLE;
+		arrays.push_back(textureArray);
+		arrayId = static_cast<int>(arrays.size()) - 1;
+	}
+
+	// Pad before building mips so every level of the padding matches the texture's edge
+	MipLevel padded = padTexture(pixels, width, height, layerWidth, layerHeight);
+
+	TextureArray& textureArray = arrays[arrayId];
+	textureArray.layers.push_back(MipmapGenerator::generate(padded.pixels.data(), layerWidth, layerHeight));
+	textureArray.dirty = true;
+
+	PackedTexture packed = {};
+	packed.array = arrayId;
+	packed.layer = static_cast<uint32_t>(textureArray.layers.size()) - 1;
+	packed.uvScale = glm::vec2(static_cast<float>(width) / layerWidth, static_cast<float>(height) / layerHeight);
+
+	return packed;
+}
+
+FrameVector<int> TextureArrayPacker::build(FrameAllocator* allocator)
+{
+	FrameVector<int> changedArrays(allocator);
+	for (size_t i = 0; i < arrays.size(); i++) {
+		if (arrays[i].dirty) {
+			uploadArray(arrays[i]);
+			changedArrays.push_back(static_cast<int>(i));
+		}
+	}
+	return changedArrays;
+}
+
+void TextureArrayPacker::cleanup()
+{
+	for (auto& textureArray : arrays) {
+		destroyArray(textureArray);
+	}
+	arrays.clear();
+}
+
+void TextureArrayPacker::uploadArray(TextureArray& textureArray)
+{
+	uint32_t layerCount = static_cast<uint32_t>(textureArray.layers.size());
+	uint32_t mipCount = static_cast<uint32_t>(textureArray.layers[0].size());
+
+	// Every level of every layer goes through one staging buffer
+	VkDeviceSize stagingSize = 0;
+	for (const auto& layer : textureArray.layers) {
+		for (const auto& level : layer) {
+			stagingSize += level.pixels.size();
+		}
+	}
+
+	VkBuffer stagingBuffer;
+	VkDeviceMemory stagingBufferMemory;
+	createBuffer(device.physicalDevice, device.logicalDevice, stagingSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &stagingBuffer, &stagingBufferMemory);
+
+	std::vector<VkBufferImageCopy> copyRegions;
+	copyRegions.reserve((size_t)layerCount * mipCount);
+
+	void* data;
+	vkMapMemory(device.logicalDevice, stagingBufferMemory, 0, stagingSize, 0, &data);
+	VkDeviceSize offset = 0;
+	for (uint32_t layer = 0; layer < layerCount; layer++) {
+		for (uint32_t mip = 0; mip < mipCount; mip++) {
+			const MipLevel& level = textureArray.layers[layer][mip];
+			memcpy((char*)data + offset, level.pixels.data(), level.pixels.size());
+
+			VkBufferImageCopy region = {};
+			region.bufferOffset = offset;
+			region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+			region.imageSubresource.mipLevel = mip;
+			region.imageSubresource.baseArrayLayer = layer;
+			region.imageSubresource.layerCount = 1;
+			region.imageOffset = { 0, 0, 0 };
+			region.imageExtent = { level.width, level.height, 1 };
+			copyRegions.push_back(region);
+
+			offset += level.pixels.size();
+		}
+	}
+	vkUnmapMemory(device.logicalDevice, stagingBufferMemory);
+
+	VkDeviceMemory newImageMemory;
+	VkImage newImage = createImage(device.physicalDevice, device.logicalDevice, textureArray.width, textureArray.height, mipCount, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_TILING_OPTIMAL,
+		VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &newImageMemory, VK_SAMPLE_COUNT_1_BIT, layerCount);
+
+	VkCommandBuffer commandBuffer = frameScheduler->getUploadCommandBuffer();
+
+	VkImageMemoryBarrier barrier = {};
+	barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+	barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+	barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.image = newImage;
+	barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	barrier.subresourceRange.baseMipLevel = 0;
+	barrier.subresourceRange.levelCount = mipCount;
+	barrier.subresourceRange.baseArrayLayer = 0;
+	barrier.subresourceRange.layerCount = layerCount;
+	barrier.srcAccessMask = 0;
+	barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+		0, nullptr, 0, nullptr, 1, &barrier);
+
+	vkCmdCopyBufferToImage(commandBuffer, stagingBuffer, newImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, static_cast<uint32_t>(copyRegions.size()), copyRegions.data());
+
+	barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+	barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0,
+		0, nullptr, 0, nullptr, 1, &barrier);
+
+	// Staging buffer is freed once the frame has run the copy
+	frameScheduler->getDeletionQueue().destroyBuffer(stagingBuffer, stagingBufferMemory);
+
+	// The old array is freed once the frames that sampled it have finished
+	destroyArray(textureArray);
+
+	VkImageViewCreateInfo viewCreateInfo = {};
+	viewCreateInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+	viewCreateInfo.image = newImage;
+	viewCreateInfo.viewType = VK_IMAGE_VIEW_TYPE_2D_ARRAY;
+	viewCreateInfo.format = VK_FORMAT_R8G8B8A8_UNORM;
+	viewCreateInfo.components.r = VK_COMPONENT_SWIZZLE_IDENTITY;
+	viewCreateInfo.components.g = VK_COMPONENT_SWIZZLE_IDENTITY;
+	viewCreateInfo.components.b = VK_COMPONENT_SWIZZLE_IDENTITY;
+	viewCreateInfo.components.a = VK_COMPONENT_SWIZZLE_IDENTITY;
+	viewCreateInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	viewCreateInfo.subresourceRange.baseMipLevel = 0;
+	viewCreateInfo.subresourceRange.levelCount = mipCount;
+	viewCreateInfo.subresourceRange.baseArrayLayer = 0;
+	viewCreateInfo.subresourceRange.layerCount = layerCount;
+
+	VkResult result = vkCreateImageView(device.logicalDevice, &viewCreateInfo, nullptr, &textureArray.imageView);
+	if (result != VK_SUCCESS) {
+		throw std::runtime_error("Failed to create a texture array image view");
+	}
+
+	textureArray.image = newImage;
+	textureArray.imageMemory = newImageMemory;
+	textureArray.dirty = false;
+}
+
+void TextureArrayPacker::destroyArray(TextureArray& textureArray)
+{
+	if (textureArray.image == VK_NULL_HANDLE) return;
+
+	DeletionQueue& deletionQueue = frameScheduler->getDeletionQueue();
+	deletionQueue.destroyImageView(textureArray.imageView);
+	deletionQueue.destroyImage(textureArray.image, textureArray.imageMemory);
+
+	textureArray.image = VK_NULL_HANDLE;
+	textureArray.imageMemory = VK_NULL_HANDLE;
+	textureArray.imageView = VK_NULL_HANDLE;
+}
+
+uint32_t TextureArrayPacker::nextPowerOfTwo(uint32_t value)
+{
+	uint32_t power = 1;
+	while (power < value) {
+		power *= 2;
+	}
+	return power;
+}
+
+MipLevel TextureArrayPacker::padTexture(const unsigned char* pixels, uint32_t width, uint32_t height, uint32_t paddedWidth, uint32_t paddedHeight)
+{
+	MipLevel padded = {};
+	padded.width = paddedWidth;
+	padded.height = paddedHeight;
+	padded.pixels.resize((size_t)paddedWidth * paddedHeight * 4);
+
+	// Texture in the top left, last column and row repeated out to the edge of the layer
+	for (uint32_t y = 0; y < paddedHeight; y++) {
+		const unsigned char* srcRow = pixels + (size_t)std::min(y, height - 1) * width * 4;
+		unsigned char* dstRow = padded.pixels.data() + (size_t)y * paddedWidth * 4;
+
+		memcpy(dstRow, srcRow, (size_t)width * 4);
+		for (uint32_t x = width; x < paddedWidth; x++) {
+			memcpy(dstRow + x * 4, srcRow + (width - 1) * 4, 4);
+		}
+	}
+
+	return padded;
+}
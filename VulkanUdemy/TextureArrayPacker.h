@@ -0,0 +1,79 @@
+#pragma once
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include <vector>
+#include <stdexcept>
+
+#include <glm/glm.hpp>
+
+#include "Utilities.h"
+#include "MipmapGenerator.h"
+#include "FrameScheduler.h"
+#include "FrameAllocator.h"
+
+const uint32_t TEXTURE_PACK_MAX_SIZE = 512; // Textures no bigger than this (either side) are packed into arrays instead of getting their own image
+const uint32_t TEXTURE_PACK_MAX_LAYERS = 256; // Start a new array past this many layers (also capped by maxImageArrayLayers)
+
+// Where a packed texture ended up
+struct PackedTexture {
+	int array; // Texture array holding the texture
+	uint32_t layer; // Layer within the array
+	glm::vec2 uvScale; // Texture only covers this much of its layer, the rest is padding
+};
+
+struct TextureArray {
+	uint32_t width; // Layer size, power of two
+	uint32_t height;
+	std::vector<std::vector<MipLevel>> layers; // Padded mip chain for every layer, kept so the array can be rebuilt when layers are added
+	bool dirty; // Layers added since last upload
+
+	VkImage image;
+	VkDeviceMemory imageMemory;
+	VkImageView imageView;
+};
+
+// Packs small textures into 2D texture arrays, one array per power of two layer size.
+// A texture is placed in the corner of its layer with its edge texels repeated out to fill the layer,
+// so filtering and mips near the edge never pick up another texture. Drawing then only changes the layer index.
+class TextureArrayPacker
+{
+public:
+	TextureArrayPacker();
+
+	void init(VulkanDevice newDevice, FrameScheduler* newFrameScheduler);
+
+	static bool shouldPack(uint32_t width, uint32_t height);
+
+	// pixels is RGBA8, nothing is uploaded until build
+	PackedTexture addTexture(const unsigned char* pixels, uint32_t width, uint32_t height);
+
+	// Record uploads of any arrays with new layers into the frame's upload command buffer, returns the arrays whose image
+	// view changed (from the frame allocator). The frame being built can use the new views straight away, the uploads run
+	// ahead of it in the same submit. Only between the frame scheduler's beginFrame and submit
+	FrameVector<int> build(FrameAllocator* allocator);
+
+	VkImageView getImageView(int arrayId) { return arrays[arrayId].imageView; }
+	uint32_t getMipCount(int arrayId) { return static_cast<uint32_t>(arrays[arrayId].layers[0].size()); }
+	uint32_t getLayerCount(int arrayId) { return static_cast<uint32_t>(arrays[arrayId].layers.size()); }
+	size_t getArrayCount() { return arrays.size(); }
+
+	void cleanup();
+
+	~TextureArrayPacker();
+
+private:
+	VulkanDevice device;
+	FrameScheduler* frameScheduler; // Uploads go in its frames, rebuilt arrays may still be read by frames in flight
+
+	uint32_t maxLayers = TEXTURE_PACK_MAX_LAYERS;
+
+	std::vector<TextureArray> arrays;
+
+	void uploadArray(TextureArray& textureArray);
+	void destroyArray(TextureArray& textureArray);
+
+	static uint32_t nextPowerOfTwo(uint32_t value);
+	static MipLevel padTexture(const unsigned char* pixels, uint32_t width, uint32_t height, uint32_t paddedWidth, uint32_t paddedHeight);
+};
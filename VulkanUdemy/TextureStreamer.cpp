@@ -0,0 +1,414 @@
+#include "TextureStreamer.h"
+
+#include <algorithm>
+#include <cmath>
+
+TextureStreamer::TextureStreamer()
+{
+}
+
+TextureStreamer::~TextureStreamer()
+{
+}
+
+void TextureStreamer::init(VulkanDevice newDevice, VkQueue newTransferQueue, VkCommandPool newTransferCommandPool, FrameScheduler* newFrameScheduler, VkDeviceSize newBudget)
+{
+	device = newDevice;
+	transferQueue = newTransferQueue;
+	transferCommandPool = newTransferCommandPool;
+	frameScheduler = newFrameScheduler;
+	budget = newBudget;
+}
+
+int TextureStreamer::addTexture(const unsigned char* pixels, uint32_t width, uint32_t height, const MipGenerationSettings& mipSettings)
+{
+	StreamedTexture texture = {};
+
+	// Keep the full resolution image in system memory along with the rest of the chain down to 1x1
+	texture.mips = MipmapGenerator::generate(pixels, width, height, mipSettings);
+
+	// Find the finest of the "low" mips, these are always resident so there is something to sample straight away
+	texture.lockedMip = 0;
+	while (std::max(texture.mips[texture.lockedMip].width, texture.mips[texture.lockedMip].height) > STREAMING_MIN_RESIDENT_SIZE) {
+		texture.lockedMip++;
+	}
+
+	uint32_t lastMip = static_cast<uint32_t>(texture.mips.size()) - 1;
+	texture.residentMip = lastMip + 1; // Nothing resident yet
+	texture.requestedMip = lastMip;
+	texture.lastRequestFrame = 0;
+	texture.image = VK_NULL_HANDLE;
+	texture.imageMemory = VK_NULL_HANDLE;
+	texture.imageView = VK_NULL_HANDLE;
+	texture.residentSize = 0;
+	texture.pendingValue = 0;
+
+	// Only upload the low mips, finer mips are streamed in when feedback asks for them
+	VkBuffer stagingBuffer;
+	VkDeviceMemory stagingBufferMemory;
+	VkCommandBuffer commandBuffer = beginCommandBuffer(device.logicalDevice, transferCommandPool);
+	recordResidency(texture, texture.lockedMip, commandBuffer, &stagingBuffer, &stagingBufferMemory);
+	endAndSubmitCommandBuffer(device.logicalDevice, transferCommandPool, transferQueue, commandBuffer);
+
+	vkDestroyBuffer(device.logicalDevice, stagingBuffer, nullptr);
+	vkFreeMemory(device.logicalDevice, stagingBufferMemory, nullptr);
+	swapPending(texture);
+
+	textures.push_back(std::move(texture));
+
+	return static_cast<int>(textures.size()) - 1;
+}
+
+void TextureStreamer::requestScreenSize(int texId, float screenSize)
+{
+	if (texId < 0 || texId >= static_cast<int>(textures.size())) return;
+
+	const MipLevel& baseLevel = textures[texId].mips[0];
+	float textureSize = static_cast<float>(std::max(baseLevel.width, baseLevel.height));
+
+	// One texel per pixel: each halving of screen size can drop one mip level
+	float mip = screenSize > 1.0f ? std::floor(std::log2(textureSize / screenSize)) : static_cast<float>(textures[texId].mips.size());
+	mip = std::max(mip, 0.0f);
+
+	requestMip(texId, static_cast<uint32_t>(std::min(mip, static_cast<float>(textures[texId].mips.size() - 1))));
+}
+
+void TextureStreamer::requestMip(int texId, uint32_t mipLevel)
+{
+	if (texId < 0 || texId >= static_cast<int>(textures.size())) return;
+
+	StreamedTexture& texture = textures[texId];
+	texture.requestedMip = std::min(texture.requestedMip, mipLevel);
+	if (mipLevel < texture.lockedMip) {
+		texture.lastRequestFrame = frameCount;
+	}
+}
+
+FrameVector<int> TextureStreamer::update(FrameAllocator* allocator)
+{
+	FrameVector<int> changedTextures(allocator);
+
+	// Swap in images whose frame has finished uploading them. Frames recorded since may still read the old image, so it
+	// goes through the deletion queue
+	uint64_t completedValue = frameScheduler->getCompletedValue();
+	for (size_t i = 0; i < textures.size(); i++) {
+		if (textures[i].pendingValue != 0 && textures[i].pendingValue <= completedValue) {
+			swapPending(textures[i]);
+			changedTextures.push_back(static_cast<int>(i));
+		}
+	}
+
+	// Budget may have been lowered since last frame, give back memory first
+	if (residentBytes > budget) {
+		evictFor(0, -1);
+	}
+
+	// Textures that want finer mips than they have, biggest shortfall first. One upload at a time per texture
+	FrameVector<int> candidates(allocator);
+	for (size_t i = 0; i < textures.size(); i++) {
+		if (textures[i].pendingValue == 0 && textures[i].requestedMip < textures[i].residentMip) {
+			candidates.push_back(static_cast<int>(i));
+		}
+	}
+	std::sort(candidates.begin(), candidates.end(), [this](int a, int b) {
+		return (textures[a].residentMip - textures[a].requestedMip) > (textures[b].residentMip - textures[b].requestedMip);
+	});
+
+	uint32_t uploads = 0;
+	for (int texId : candidates) {
+		if (uploads >= MAX_STREAMING_UPLOADS) break;
+
+		StreamedTexture& texture = textures[texId];
+
+		// Try the requested level first, fall back to coarser levels if the budget can't fit it
+		for (uint32_t target = texture.requestedMip; target < texture.residentMip; target++) {
+			VkDeviceSize requiredBytes = estimateSize(texture, target) - std::min(estimateSize(texture, target), texture.residentSize);
+			if (residentBytes + requiredBytes > budget && !evictFor(requiredBytes, texId)) {
+				continue;
+			}
+
+			streamResidency(texture, target);
+			uploads++;
+			break;
+		}
+	}
+
+	// Feedback is gathered fresh each frame
+	for (auto& texture : textures) {
+		texture.requestedMip = static_cast<uint32_t>(texture.mips.size()) - 1;
+	}
+	frameCount++;
+
+	return changedTextures;
+}
+
+VkImageView TextureStreamer::getImageView(int texId)
+{
+	return textures[texId].imageView;
+}
+
+uint32_t TextureStreamer::getMipCount(int texId)
+{
+	return static_cast<uint32_t>(textures[texId].mips.size());
+}
+
+uint32_t TextureStreamer::getResidentMip(int texId)
+{
+	return textures[texId].residentMip;
+}
+
+void TextureStreamer::setBudget(VkDeviceSize newBudget)
+{
+	budget = newBudget;
+}
+
+void TextureStreamer::cleanup()
+{
+	for (auto& texture : textures) {
+		destroyImage(texture);
+	}
+	textures.clear();
+	residentBytes = 0;
+}
+
+void TextureStreamer::streamResidency(StreamedTexture& texture, uint32_t newResidentMip)
+{
+	// Recorded into the frame being built, the staging buffer is freed with the frame
+	VkBuffer stagingBuffer;
+	VkDeviceMemory stagingBufferMemory;
+	recordResidency(texture, newResidentMip, frameScheduler->getUploadCommandBuffer(), &stagingBuffer, &stagingBufferMemory);
+	texture.pendingValue = frameScheduler->getCurrentFrameValue();
+
+	if (stagingBuffer != VK_NULL_HANDLE) {
+		frameScheduler->getDeletionQueue().destroyBuffer(stagingBuffer, stagingBufferMemory);
+	}
+}
+
+void TextureStreamer::recordResidency(StreamedTexture& texture, uint32_t newResidentMip, VkCommandBuffer commandBuffer, VkBuffer* stagingBuffer, VkDeviceMemory* stagingBufferMemory)
+{
+	CPU_PROFILE_SCOPE("recordResidency");
+	uint32_t mipCount = static_cast<uint32_t>(texture.mips.size());
+	uint32_t levelCount = mipCount - newResidentMip;
+
+	// Levels the current image already holds are copied on the GPU, only finer ones come from system memory.
+	// Evicting uploads nothing
+	uint32_t copyFromMip = texture.image != VK_NULL_HANDLE ? std::max(texture.residentMip, newResidentMip) : mipCount;
+	uint32_t uploadCount = copyFromMip - newResidentMip;
+
+	*stagingBuffer = VK_NULL_HANDLE;
+	*stagingBufferMemory = VK_NULL_HANDLE;
+	std::vector<VkBufferImageCopy> uploadRegions(uploadCount);
+	if (uploadCount > 0) {
+		VkDeviceSize stagingSize = 0;
+		for (uint32_t i = newResidentMip; i < copyFromMip; i++) {
+			stagingSize += texture.mips[i].pixels.size();
+		}
+
+		createBuffer(device.physicalDevice, device.logicalDevice, stagingSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingBufferMemory);
+
+		void* data;
+		vkMapMemory(device.logicalDevice, *stagingBufferMemory, 0, stagingSize, 0, &data);
+		VkDeviceSize offset = 0;
+		for (uint32_t i = 0; i < uploadCount; i++) {
+			const MipLevel& level = texture.mips[newResidentMip + i];
+			memcpy((char*)data + offset, level.pixels.data(), level.pixels.size());
+
+			uploadRegions[i] = {};
+			uploadRegions[i].bufferOffset = offset;
+			uploadRegions[i].imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+			uploadRegions[i].imageSubresource.mipLevel = i; // Resident mip 0 is the texture's mip newResidentMip
+			uploadRegions[i].imageSubresource.baseArrayLayer = 0;
+			uploadRegions[i].imageSubresource.layerCount = 1;
+			uploadRegions[i].imageOffset = { 0, 0, 0 };
+			uploadRegions[i].imageExtent = { level.width, level.height, 1 };
+
+			offset += level.pixels.size();
+		}
+		vkUnmapMemory(device.logicalDevice, *stagingBufferMemory);
+	}
+
+	// Image only holds the resident levels, so VRAM use matches residency. Transfer source so the next change can copy from it
+	const MipLevel& topLevel = texture.mips[newResidentMip];
+	VkDeviceMemory newImageMemory;
+	VkImage newImage = createImage(device.physicalDevice, device.logicalDevice, topLevel.width, topLevel.height, levelCount, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_TILING_OPTIMAL,
+		VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &newImageMemory, VK_SAMPLE_COUNT_1_BIT);
+
+	VkMemoryRequirements memoryRequirements;
+	vkGetImageMemoryRequirements(device.logicalDevice, newImage, &memoryRequirements);
+
+	VkImageMemoryBarrier barrier = {};
+	barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+	barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+	barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.image = newImage;
+	barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	barrier.subresourceRange.baseMipLevel = 0;
+	barrier.subresourceRange.levelCount = levelCount;
+	barrier.subresourceRange.baseArrayLayer = 0;
+	barrier.subresourceRange.layerCount = 1;
+	barrier.srcAccessMask = 0;
+	barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+		0, nullptr, 0, nullptr, 1, &barrier);
+
+	if (uploadCount > 0) {
+		vkCmdCopyBufferToImage(commandBuffer, *stagingBuffer, newImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, uploadCount, uploadRegions.data());
+	}
+
+	if (copyFromMip < mipCount) {
+		// Earlier frames may still be sampling the old image, the barrier waits for their fragment shaders before the
+		// layout changes. It goes back to shader readable for this frame, which still draws with it
+		VkImageMemoryBarrier oldBarrier = barrier;
+		oldBarrier.image = texture.image;
+		oldBarrier.oldLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+		oldBarrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+		oldBarrier.subresourceRange.levelCount = mipCount - texture.residentMip;
+		oldBarrier.srcAccessMask = 0;
+		oldBarrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+			0, nullptr, 0, nullptr, 1, &oldBarrier);
+
+		std::vector<VkImageCopy> copyRegions(mipCount - copyFromMip);
+		for (uint32_t i = 0; i < copyRegions.size(); i++) {
+			const MipLevel& level = texture.mips[copyFromMip + i];
+
+			copyRegions[i] = {};
+			copyRegions[i].srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+			copyRegions[i].srcSubresource.mipLevel = copyFromMip + i - texture.residentMip;
+			copyRegions[i].srcSubresource.baseArrayLayer = 0;
+			copyRegions[i].srcSubresource.layerCount = 1;
+			copyRegions[i].dstSubresource = copyRegions[i].srcSubresource;
+			copyRegions[i].dstSubresource.mipLevel = copyFromMip + i - newResidentMip;
+			copyRegions[i].extent = { level.width, level.height, 1 };
+		}
+
+		vkCmdCopyImage(commandBuffer, texture.image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, newImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+			static_cast<uint32_t>(copyRegions.size()), copyRegions.data());
+
+		oldBarrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+		oldBarrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+		oldBarrier.srcAccessMask = 0;
+		oldBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0,
+			0, nullptr, 0, nullptr, 1, &oldBarrier);
+	}
+
+	barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+	barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0,
+		0, nullptr, 0, nullptr, 1, &barrier);
+
+	VkImageViewCreateInfo viewCreateInfo = {};
+	viewCreateInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+	viewCreateInfo.image = newImage;
+	viewCreateInfo.viewType = VK_IMAGE_VIEW_TYPE_2D_ARRAY; // Single layer, the shader samples every texture as an array
+	viewCreateInfo.format = VK_FORMAT_R8G8B8A8_UNORM;
+	viewCreateInfo.components.r = VK_COMPONENT_SWIZZLE_IDENTITY;
+	viewCreateInfo.components.g = VK_COMPONENT_SWIZZLE_IDENTITY;
+	viewCreateInfo.components.b = VK_COMPONENT_SWIZZLE_IDENTITY;
+	viewCreateInfo.components.a = VK_COMPONENT_SWIZZLE_IDENTITY;
+	viewCreateInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	viewCreateInfo.subresourceRange.baseMipLevel = 0;
+	viewCreateInfo.subresourceRange.levelCount = levelCount; // View every resident mip
+	viewCreateInfo.subresourceRange.baseArrayLayer = 0;
+	viewCreateInfo.subresourceRange.layerCount = 1;
+
+	VkResult result = vkCreateImageView(device.logicalDevice, &viewCreateInfo, nullptr, &texture.pendingImageView);
+	if (result != VK_SUCCESS) {
+		throw std::runtime_error("Failed to create a streamed texture image view");
+	}
+
+	// Counted against the budget straight away in place of the current image, which is freed soon after the swap
+	residentBytes += memoryRequirements.size;
+	residentBytes -= texture.residentSize;
+
+	texture.pendingMip = newResidentMip;
+	texture.pendingImage = newImage;
+	texture.pendingImageMemory = newImageMemory;
+	texture.pendingSize = memoryRequirements.size;
+}
+
+void TextureStreamer::swapPending(StreamedTexture& texture)
+{
+	// The old image is freed once the frames that sampled it have finished
+	if (texture.image != VK_NULL_HANDLE) {
+		DeletionQueue& deletionQueue = frameScheduler->getDeletionQueue();
+		deletionQueue.destroyImageView(texture.imageView);
+		deletionQueue.destroyImage(texture.image, texture.imageMemory);
+	}
+
+	texture.image = texture.pendingImage;
+	texture.imageMemory = texture.pendingImageMemory;
+	texture.imageView = texture.pendingImageView;
+	texture.residentMip = texture.pendingMip;
+	texture.residentSize = texture.pendingSize;
+
+	texture.pendingImage = VK_NULL_HANDLE;
+	texture.pendingImageMemory = VK_NULL_HANDLE;
+	texture.pendingImageView = VK_NULL_HANDLE;
+	texture.pendingValue = 0;
+}
+
+void TextureStreamer::destroyImage(StreamedTexture& texture)
+{
+	DeletionQueue& deletionQueue = frameScheduler->getDeletionQueue();
+	if (texture.pendingValue != 0) {
+		deletionQueue.destroyImageView(texture.pendingImageView);
+		deletionQueue.destroyImage(texture.pendingImage, texture.pendingImageMemory);
+		residentBytes -= texture.pendingSize;
+		residentBytes += texture.residentSize; // Was counted in its place
+		texture.pendingValue = 0;
+	}
+
+	if (texture.image == VK_NULL_HANDLE) return;
+
+	deletionQueue.destroyImageView(texture.imageView);
+	deletionQueue.destroyImage(texture.image, texture.imageMemory);
+
+	residentBytes -= texture.residentSize;
+	texture.image = VK_NULL_HANDLE;
+	texture.imageMemory = VK_NULL_HANDLE;
+	texture.imageView = VK_NULL_HANDLE;
+	texture.residentSize = 0;
+}
+
+bool TextureStreamer::evictFor(VkDeviceSize requiredBytes, int protectedTexId)
+{
+	while (residentBytes + requiredBytes > budget) {
+		// Least recently requested texture that still has streamed mips, wasn't asked for this frame and isn't mid upload
+		int victim = -1;
+		for (size_t i = 0; i < textures.size(); i++) {
+			const StreamedTexture& texture = textures[i];
+			if (static_cast<int>(i) == protectedTexId || texture.pendingValue != 0 || texture.residentMip >= texture.lockedMip || texture.lastRequestFrame == frameCount) continue;
+
+			if (victim < 0 || texture.lastRequestFrame < textures[victim].lastRequestFrame) {
+				victim = static_cast<int>(i);
+			}
+		}
+
+		if (victim < 0) return false; // Everything left is needed this frame
+
+		// Drop back to the low mips, copied out of the current image on the GPU
+		streamResidency(textures[victim], textures[victim].lockedMip);
+	}
+
+	return true;
+}
+
+VkDeviceSize TextureStreamer::estimateSize(const StreamedTexture& texture, uint32_t fromMip)
+{
+	VkDeviceSize size = 0;
+	for (uint32_t i = fromMip; i < texture.mips.size(); i++) {
+		size += texture.mips[i].pixels.size();
+	}
+	return size;
+}
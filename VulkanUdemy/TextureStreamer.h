@@ -0,0 +1,91 @@
+#pragma once
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include <vector>
+#include <stdexcept>
+
+#include "Utilities.h"
+#include "MipmapGenerator.h"
+#include "FrameScheduler.h"
+#include "FrameAllocator.h"
+#include "CpuProfiler.h"
+
+const VkDeviceSize DEFAULT_TEXTURE_BUDGET = 256 * 1024 * 1024; // VRAM the streamer may use for texture mips (bytes)
+const uint32_t STREAMING_MIN_RESIDENT_SIZE = 64; // Mips at or below this size are loaded straight away and never evicted
+const uint32_t MAX_STREAMING_UPLOADS = 2; // Maximum number of textures to raise residency for in one frame
+
+struct StreamedTexture {
+	std::vector<MipLevel> mips; // Full mip chain kept in system memory, level 0 is full resolution
+	uint32_t residentMip; // Finest mip level currently on the GPU (the image holds residentMip to the last mip)
+	uint32_t requestedMip; // Finest mip level asked for by feedback since the last update
+	uint32_t lockedMip; // Finest of the always resident "low" mips, never evicted past this
+	uint64_t lastRequestFrame; // Frame that last asked for a finer mip than the lowest
+
+	VkImage image;
+	VkDeviceMemory imageMemory;
+	VkImageView imageView;
+	VkDeviceSize residentSize; // Size of the memory allocation backing the resident mips
+
+	// Image being uploaded by a frame in flight, swapped in for image once the frame's timeline value is reached
+	uint32_t pendingMip;
+	VkImage pendingImage;
+	VkDeviceMemory pendingImageMemory;
+	VkImageView pendingImageView;
+	VkDeviceSize pendingSize;
+	uint64_t pendingValue; // Timeline value of the frame that uploads it, 0 if nothing is pending
+};
+
+class TextureStreamer
+{
+public:
+	TextureStreamer();
+
+	void init(VulkanDevice newDevice, VkQueue newTransferQueue, VkCommandPool newTransferCommandPool, FrameScheduler* newFrameScheduler, VkDeviceSize newBudget = DEFAULT_TEXTURE_BUDGET);
+
+	// pixels is RGBA8, the mip chain is built on the CPU with mipSettings. The low mips are uploaded straight away (waits
+	// for the transfer queue, meant for load time)
+	int addTexture(const unsigned char* pixels, uint32_t width, uint32_t height, const MipGenerationSettings& mipSettings = MipGenerationSettings());
+
+	// Feedback: texture is covering roughly screenSize pixels on screen this frame
+	void requestScreenSize(int texId, float screenSize);
+	// Feedback: texture needs at least this mip level resident
+	void requestMip(int texId, uint32_t mipLevel);
+
+	// Raise/evict residency based on gathered feedback. New images are recorded into the frame's upload command buffer and
+	// swapped in on a later update once that frame has finished, returns the textures whose image view changed. Scratch
+	// lists and the result come from the frame allocator. Only between the frame scheduler's beginFrame and submit
+	FrameVector<int> update(FrameAllocator* allocator);
+
+	VkImageView getImageView(int texId);
+	uint32_t getMipCount(int texId);
+	uint32_t getResidentMip(int texId);
+
+	void setBudget(VkDeviceSize newBudget);
+	VkDeviceSize getBudget() { return budget; }
+	VkDeviceSize getResidentBytes() { return residentBytes; } // Counts pending images in place of the ones they replace
+
+	void cleanup();
+
+	~TextureStreamer();
+
+private:
+	VulkanDevice device;
+	VkQueue transferQueue;
+	VkCommandPool transferCommandPool;
+	FrameScheduler* frameScheduler; // Uploads go in its frames, replaced images may still be read by frames in flight
+
+	VkDeviceSize budget;
+	VkDeviceSize residentBytes = 0;
+	uint64_t frameCount = 0;
+
+	std::vector<StreamedTexture> textures;
+
+	void streamResidency(StreamedTexture& texture, uint32_t newResidentMip);
+	void recordResidency(StreamedTexture& texture, uint32_t newResidentMip, VkCommandBuffer commandBuffer, VkBuffer* stagingBuffer, VkDeviceMemory* stagingBufferMemory);
+	void swapPending(StreamedTexture& texture);
+	void destroyImage(StreamedTexture& texture);
+	bool evictFor(VkDeviceSize requiredBytes, int protectedTexId);
+	VkDeviceSize estimateSize(const StreamedTexture& texture, uint32_t fromMip);
+};
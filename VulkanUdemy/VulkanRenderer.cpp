@@ -9,34 +9,48 @@ VulkanRenderer::~VulkanRenderer()
 {
 }
 
-int VulkanRenderer::init(Window* newWindow, Camera* newCamera)
+int VulkanRenderer::init(Window* newWindow)
 {
 	window = newWindow;
-	camera = newCamera;
+
+	// Snapshots keep it up to date once drawing starts, GLFW can only be asked from the main thread
+	int width = 0, height = 0;
+	glfwGetFramebufferSize(window->getWindow(), &width, &height);
+	framebufferExtent = { static_cast<uint32_t>(width), static_cast<uint32_t>(height) };
 	try {
 		createInstance();
 		setupDebugMessenger();
 		createSurface();
 		getPhysicalDevice();
 		createLogicalDevice();
+		pipelineCache.init(mainDevice);
+		pipelineRegistry.init(mainDevice, pipelineCache.getCache());
+		renderTargetPool.init(mainDevice);
+		renderGraph.init(mainDevice, &renderTargetPool);
 		createSwapChain();
-		createDepthBufferImage();
-		createColourImage();
-		createRenderPass();
+		buildRenderGraph();
+		if (printStats) renderGraph.printSummary();
 		createDescriptorSetLayout();
 		createPushConstantRange();
+		createPipelineLayout();
 		createGraphicsPipeline();
-		createFrameBuffers();
 		createCommandPool();
+		createGpuProfiler();
+		frameScheduler.init(mainDevice, getQueueFamilies(mainDevice.physicalDevice).graphicsFamily);
+		textureStreamer.init(mainDevice, graphicsQueue, graphicsCommandPool, &frameScheduler);
+		textureArrayPacker.init(mainDevice, &frameScheduler);
 		allocateDynamicBufferTransferSpace();
 		createUniformBuffers();
-		createCommandBuffers();
-		createTextureSampler();
+		samplerCache.init(mainDevice);
 		createDescriptorPool();
 		createDescriptorSets();
-		createSynchronisation();
+		createDefaultTexture();
+		createGpuCulling();
+		shaderWatcher.watch(VERTEX_SHADER_FILE);
+		shaderWatcher.watch(FRAGMENT_SHADER_FILE);
+		shaderWatcher.watch(DEPTH_VERTEX_SHADER_FILE);
 
-		uboViewProjection.projection = glm::perspective(glm::radians(45.0f), (float)swapChainExtent.width / (float)swapChainExtent.height, 0.1f, 100.0f);
+		uboViewProjection.projection = glm::perspective(glm::radians(45.0f), (float)swapChainExtent.width / (float)swapChainExtent.height, nearPlane, farPlane);
 		uboViewProjection.projection[1][1] *= -1; // Invert the y axis for vulkan (GLM was made for opengl which uses +y as up)
 
 	}
@@ -50,49 +64,88 @@ int VulkanRenderer::init(Window* newWindow, Camera* newCamera)
 
 void VulkanRenderer::recreateSwapChain()
 {
-	int width = 0, height = 0;
-	glfwGetFramebufferSize(window->getWindow(), &width, &height);
-	while (width == 0 || height == 0) {
-		glfwGetFramebufferSize(window->getWindow(), &width, &height);
-		glfwWaitEvents();
+	CPU_PROFILE_SCOPE("recreateSwapChain");
+	// Minimised, draw skips frames until the window has a size again
+	if (framebufferExtent.width == 0 || framebufferExtent.height == 0) return;
+
+	resizeStart = std::chrono::steady_clock::now();
+	resizeFrameValue = 0;
+	measuringResize = true;
+
+	// Frames in flight may still be rendering to the old swapchain objects, retire them instead of waiting for the device
+	DeletionQueue& deletionQueue = frameScheduler.getDeletionQueue();
+	for (auto image : swapChainImages) {
+		deletionQueue.destroyImageView(image.imageView);
 	}
+	swapChainImages.clear();
 
-	cleanupSwapChain();
-	createSwapChain();
-	createDepthBufferImage();
-	createColourImage();
-	createRenderPass();
-	createGraphicsPipeline();
-	createFrameBuffers();
-	createCommandBuffers();
+	// Framebuffers are retired and targets go back to the pool once retired, so a later resize can reuse their memory
+	renderGraph.reset(deletionQueue);
+
+	// The old swapchain hands its resources over to the new one, it can only be destroyed once nothing is presenting from it.
+	// Present completion isn't observable, the last frame rendered to it finishing is the closest point we can track
+	VkSwapchainKHR oldSwapchain = swapchain;
+	VkFormat oldImageFormat = swapChainImageFormat;
+	createSwapChain(oldSwapchain);
+	VkDevice logicalDevice = mainDevice.logicalDevice;
+	deletionQueue.push([logicalDevice, oldSwapchain]() { vkDestroySwapchainKHR(logicalDevice, oldSwapchain, nullptr); });
+
+	// Viewport and scissor are dynamic so the pipeline survives a resize, the graph hands back the same render pass unless the image format changed
+	if (fullRebuildOnResize || swapChainImageFormat != oldImageFormat) {
+		for (VkRenderPass oldRenderPass : renderGraph.takeRenderPasses()) {
+			pipelineRegistry.retireRenderPass(oldRenderPass, deletionQueue);
+			deletionQueue.destroyRenderPass(oldRenderPass);
+		}
+	}
+
+	if (fullRebuildOnResize) {
+		// Old behaviour, kept to compare resize latency: stall until the device is idle and free everything straight away
+		vkDeviceWaitIdle(mainDevice.logicalDevice);
+		deletionQueue.flush();
+	}
+
+	VkRenderPass oldRenderPass = renderPass;
+	buildRenderGraph();
+	if (renderPass != oldRenderPass) {
+		createGraphicsPipeline();
+	}
+
+	// Memory released by earlier (now retired) resizes that the new targets didn't reuse
+	renderTargetPool.trim();
+
+	uboViewProjection.projection = glm::perspective(glm::radians(45.0f), (float)swapChainExtent.width / (float)swapChainExtent.height, nearPlane, farPlane);
+	uboViewProjection.projection[1][1] *= -1;
 }
 
 void VulkanRenderer::cleanup()
 {
 	// Clean up all components of the swapchain, render pass, graphics pipeline, command buffers, image views
 	cleanupSwapChain();
-
-	for (size_t i = 0; i < textureImages.size(); i++) {
-		vkDestroyImage(mainDevice.logicalDevice, textureImages[i], nullptr);
-		vkFreeMemory(mainDevice.logicalDevice, textureImageMemory[i], nullptr);
-		vkDestroyImageView(mainDevice.logicalDevice, textureImageViews[i], nullptr);
+	pipelineRegistry.cleanup();
+	gpuCuller.cleanup(); // Its buffers go through the deletion queue, flushed below
+	depthPyramid.cleanup();
+	if (indirectPipelineLayout != VK_NULL_HANDLE) {
+		vkDestroyPipelineLayout(mainDevice.logicalDevice, indirectPipelineLayout, nullptr);
 	}
+	gpuProfiler.cleanup();
+	frameScheduler.getDeletionQueue().flush(); // Retired render targets must go back to the pool before it's freed
+	renderTargetPool.cleanup();
+
+	textureStreamer.cleanup();
+	textureArrayPacker.cleanup();
 
 	vkDestroyDescriptorPool(mainDevice.logicalDevice, samplerDescriptorPool, nullptr);
 	vkDestroyDescriptorSetLayout(mainDevice.logicalDevice, samplerSetLayout, nullptr);
-	vkDestroySampler(mainDevice.logicalDevice, textureSampler, nullptr);
-
-	for (size_t i = 0; i < modelList.size(); i++) {
-		modelList[i].destroyMeshModel();
-	}
+	samplerCache.cleanup();
 
 	// C style memory free for dynamic descriptor sets
 	_aligned_free(modelTransferSpace);
 
+	vkDestroyPipelineLayout(mainDevice.logicalDevice, pipelineLayout, nullptr);
 	vkDestroyDescriptorPool(mainDevice.logicalDevice, descriptorPool, nullptr);
 	vkDestroyDescriptorSetLayout(mainDevice.logicalDevice, descriptorSetLayout, nullptr);
 
-	for (size_t i = 0; i < swapChainImages.size(); i++) {
+	for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
 		vkDestroyBuffer(mainDevice.logicalDevice, vpUniformBuffer[i], nullptr);
 		vkFreeMemory(mainDevice.logicalDevice, vpUniformBufferMemory[i], nullptr);
 		vkDestroyBuffer(mainDevice.logicalDevice, modelDUniformBuffer[i], nullptr);
@@ -103,16 +156,14 @@ void VulkanRenderer::cleanup()
 		vkDestroyBuffer(mainDevice.logicalDevice, cameraPositionUniformBuffer[i], nullptr);
 		vkFreeMemory(mainDevice.logicalDevice, cameraPositionUniformBufferMemory[i], nullptr);
 	}
-	for (size_t i = 0; i < meshList.size(); i++) {
-		meshList[i].destroyBuffers();
-	}
-	for (size_t i = 0; i < MAX_FRAME_DRAWS; i++) {
-		vkDestroySemaphore(mainDevice.logicalDevice, renderFinished[i], nullptr);
-		vkDestroySemaphore(mainDevice.logicalDevice, imageAvailable[i], nullptr);
-		vkDestroyFence(mainDevice.logicalDevice, drawFences[i], nullptr);
-	}
+	scene.cleanup(mainDevice.logicalDevice);
+
+	// Frees anything still waiting in the deletion queue
+	frameScheduler.cleanup();
 	vkDestroyCommandPool(mainDevice.logicalDevice, graphicsCommandPool, nullptr);
 
+	pipelineCache.cleanup(); // Saved for the next run
+
 	vkDestroySurfaceKHR(instance, surface, nullptr);
 	if (enableValidationLayers) {
 		destroyDebugMessenger(nullptr);
@@ -122,27 +173,11 @@ void VulkanRenderer::cleanup()
 }
 
 void VulkanRenderer::cleanupSwapChain() {
-	// Wait until no actions being run on device before cleanup
+	// Only used at shutdown (recreation retires objects through the deletion queue), wait until no actions being run on device
 	vkDeviceWaitIdle(mainDevice.logicalDevice);
 
-	vkFreeCommandBuffers(mainDevice.logicalDevice, graphicsCommandPool, static_cast<uint32_t>(commandBuffers.size()), commandBuffers.data());
-
-	for (auto framebuffer : swapChainFramebuffers) {
-		vkDestroyFramebuffer(mainDevice.logicalDevice, framebuffer, nullptr);
-	}
-	vkDestroyPipeline(mainDevice.logicalDevice, graphicsPipeline, nullptr);
-	vkDestroyPipelineLayout(mainDevice.logicalDevice, pipelineLayout, nullptr);
-	vkDestroyRenderPass(mainDevice.logicalDevice, renderPass, nullptr);
-
-	// Cleanup for depth buffer
-	vkDestroyImageView(mainDevice.logicalDevice, depthBufferImageView, nullptr);
-	vkDestroyImage(mainDevice.logicalDevice, depthBufferImage, nullptr);
-	vkFreeMemory(mainDevice.logicalDevice, depthBufferImageMemory, nullptr);
-
-	// Cleanup for colour buffer
-	vkDestroyImageView(mainDevice.logicalDevice, colourImageView, nullptr);
-	vkDestroyImage(mainDevice.logicalDevice, colourImage, nullptr);
-	vkFreeMemory(mainDevice.logicalDevice, colourImageMemory, nullptr);
+	// Framebuffers, render passes and targets (the pool frees their memory on cleanup)
+	renderGraph.cleanup();
 
 	for (auto image : swapChainImages) {
 		//vkDestroyImage(mainDevice.logicalDevice, image.image, nullptr);
@@ -150,30 +185,102 @@ void VulkanRenderer::cleanupSwapChain() {
 	}
 	swapChainImages.clear();
 	vkDestroySwapchainKHR(mainDevice.logicalDevice, swapchain, nullptr);
+	swapchain = VK_NULL_HANDLE;
 }
 
-void VulkanRenderer::updateModel(int modelId, glm::mat4 newModel)
+RenderObjectHandle VulkanRenderer::createMesh(std::vector<Vertex>* vertices, std::vector<uint32_t>* indices, int texId)
 {
-	if (modelId >= modelList.size()) return;
-	modelList[modelId].setModel(newModel);
+	if (texId < 0) {
+		// Drawn with the default texture, hasTexture off so the shader ignores it
+		return addSceneObject(Mesh(mainDevice.physicalDevice, mainDevice.logicalDevice, graphicsQueue, graphicsCommandPool, indices, vertices, DEFAULT_TEXTURE), glm::mat4(1.0f), false);
+	}
+	return addSceneObject(Mesh(mainDevice.physicalDevice, mainDevice.logicalDevice, graphicsQueue, graphicsCommandPool, indices, vertices, texId), glm::mat4(1.0f), true);
 }
 
-void VulkanRenderer::updateModelMesh(int modelId, glm::mat4 newModel) {
-	if (modelId >= meshList.size()) return;
-	meshList[modelId].setModel(newModel);
+std::vector<RenderObjectHandle> VulkanRenderer::addMeshModel(MeshModel* meshModel)
+{
+	std::vector<RenderObjectHandle> objects;
+	for (size_t k = 0; k < meshModel->getMeshCount(); k++) {
+		objects.push_back(addSceneObject(*meshModel->getMesh(k), meshModel->getModel(), true));
+	}
+
+	// The store has the buffers now, the model mustn't free them too
+	*meshModel = MeshModel(std::vector<Mesh>());
+	return objects;
 }
 
-void VulkanRenderer::draw()
+RenderObjectHandle VulkanRenderer::addSceneObject(const Mesh& mesh, const glm::mat4& transform, bool hasTexture)
 {
-	// Stop running code until the fence is opened, only opened when the frame is finished drawing
-	vkWaitForFences(mainDevice.logicalDevice, 1, &drawFences[currentFrame], VK_TRUE, std::numeric_limits<uint64_t>::max());
-	vkResetFences(mainDevice.logicalDevice, 1, &drawFences[currentFrame]); // Unsignal fence (close it so other frames can't eneter)
+	if (scene.size() >= MAX_OBJECTS) {
+		throw std::runtime_error("Too many scene objects for the model uniform buffer!");
+	}
+	return scene.create(mesh, transform, hasTexture);
+}
+
+void VulkanRenderer::draw(const FrameSnapshot& snapshot)
+{
+	CPU_PROFILE_SCOPE("draw");
+
+	// Changes since the last snapshot, applied even for frames that are skipped so none are lost
+	const RenderSettingRequests& requests = snapshot.requests;
+	if (requests.framesInFlight >= 0) setFramesInFlight(requests.framesInFlight);
+	if (requests.fullRebuildOnResize >= 0) setFullRebuildOnResize(requests.fullRebuildOnResize != 0);
+	if (requests.wireframe >= 0) setWireframe(requests.wireframe != 0);
+	if (requests.depthPrePass >= 0) setDepthPrePass(requests.depthPrePass != 0);
+	if (requests.gpuCulling >= 0) setGpuCulling(requests.gpuCulling != 0);
+	if (requests.occlusionCulling >= 0) setOcclusionCulling(requests.occlusionCulling != 0);
+	if (requests.bvhCulling >= 0) setBvhCulling(requests.bvhCulling != 0);
+	snapshot.sceneCommands.apply(&scene, &frameScheduler.getDeletionQueue()); // Retired after the last frame submitted, the one being built doesn't use them
+	scene.updateBounds(); // World boxes of whatever moved, streaming, culling and picking read them
+
+	uboViewProjection.view = snapshot.view;
+	cameraPosition = snapshot.cameraPosition;
+	cameraDirection = snapshot.cameraDirection;
+	directionalLight = snapshot.light;
+	if (requests.pick) pick();
+
+	// A new window size is picked up by the next acquire
+	VkExtent2D newExtent = { static_cast<uint32_t>(snapshot.framebufferWidth), static_cast<uint32_t>(snapshot.framebufferHeight) };
+	if (newExtent.width != framebufferExtent.width || newExtent.height != framebufferExtent.height) {
+		framebufferExtent = newExtent;
+		frameBufferResized = true;
+	}
+	if (framebufferExtent.width == 0 || framebufferExtent.height == 0) return;
+
+	// Wait until this frame's slot is free (the frame framesInFlight back has finished), runs its deferred deletions
+	frameScheduler.beginFrame();
+	uint32_t frameIndex = frameScheduler.getFrameIndex();
+
+	// Resize latency: from starting the recreation until the GPU has finished the first frame at the new size
+	if (measuringResize && resizeFrameValue != 0 && frameScheduler.getCompletedValue() >= resizeFrameValue) {
+		double latency = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - resizeStart).count();
+		if (printStats) printf("Resize to first frame (%s): %.3f ms\n", fullRebuildOnResize ? "full rebuild" : "incremental", latency);
+		measuringResize = false;
+	}
+
+	collectPipelineStatistics(frameIndex);
+	collectGpuCullingStats(frameIndex);
+
+	// Pass layout changed (depth pre-pass or GPU culling toggled), retired like on a resize. GPU culling changes the
+	// pipelines' shaders and layout but not the render pass, so the pipelines are always fetched again
+	if (renderGraphChanged) {
+		renderGraphChanged = false;
+		renderGraph.reset(frameScheduler.getDeletionQueue());
+		buildRenderGraph();
+		createGraphicsPipeline();
+	}
+
+	updateShaderReload();
 
 	// GET NEXT IMAGE
 	uint32_t imageIndex;
-	VkResult result = vkAcquireNextImageKHR(mainDevice.logicalDevice, swapchain, std::numeric_limits<uint64_t>::max(), imageAvailable[currentFrame], VK_NULL_HANDLE, &imageIndex);
+	VkResult result;
+	{
+		CPU_PROFILE_SCOPE("acquireImage"); // Blocks while every swapchain image is queued for present
+		result = vkAcquireNextImageKHR(mainDevice.logicalDevice, swapchain, std::numeric_limits<uint64_t>::max(), frameScheduler.getFrame().imageAvailable, VK_NULL_HANDLE, &imageIndex);
+	}
 
-	if (result == VK_ERROR_OUT_OF_DATE_KHR || frameBufferResized) {
+	if (result == VK_ERROR_OUT_OF_DATE_KHR) {
 		frameBufferResized = false;
 		recreateSwapChain();
 		return;
@@ -182,40 +289,41 @@ void VulkanRenderer::draw()
 		throw std::runtime_error("Failed to acquire swap chain image");
 	}
 
-	uboViewProjection.view = camera->calculateViewMatrix();
+	updatePackedTextures();
+	updateTextureStreaming(); // Must happen before recording so new texture views are picked up
+	refreshTextureDescriptors(frameIndex);
+	buildRenderQueue();
 	recordCommands(imageIndex); // Rerecord commands every draw
-	updateUniformBuffers(imageIndex);
+
+	// Counts only change with the scene or the view, print them when they do
+	RenderQueueStats queueStats = renderQueue.getStats();
+	if (printStats && queueStats != printedQueueStats) {
+		printf("Render queue: %u draws, %u pipeline binds, %u descriptor set binds, %u buffer binds, %u push constants per frame\n",
+			queueStats.draws, queueStats.pipelineBinds, queueStats.descriptorSetBinds, queueStats.bufferBinds, queueStats.pushConstants);
+		printedQueueStats = queueStats;
+	}
+	updateUniformBuffers(frameIndex);
 
 	// SUBMIT COMMAND BUFFER FOR EXECUTION
-	VkSubmitInfo submitInfo = {};
-	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-	submitInfo.waitSemaphoreCount = 1; // Number of semaphores to wait on
-	submitInfo.pWaitSemaphores = &imageAvailable[currentFrame]; // List of semaphores to wait on
-	VkPipelineStageFlags waitStages[] = {
-		VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT
-	};
-	submitInfo.pWaitDstStageMask = waitStages; // stages to check semaphores at
-	submitInfo.commandBufferCount = 1; // Number of command buffers to submit
-	submitInfo.pCommandBuffers = &commandBuffers[imageIndex]; // Command buffer to submit
-	submitInfo.signalSemaphoreCount = 1; // Number of semaphore to signal
-	submitInfo.pSignalSemaphores = &renderFinished[currentFrame]; // Semaphores to signal when command buffer finishes
-
-	// Submit command buffer to queue
-	result = vkQueueSubmit(graphicsQueue, 1, &submitInfo, drawFences[currentFrame]);
-	if (result != VK_SUCCESS) {
-		throw std::runtime_error("Failed to submit command buffer to queue");
+	// Waits on imageAvailable, signals renderFinished for present and the frame's timeline value
+	frameScheduler.submit(graphicsQueue, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT);
+	if (measuringResize && resizeFrameValue == 0) {
+		resizeFrameValue = frameScheduler.getSubmittedValue();
 	}
 
 	// PRESENT RENDERED IMAGE TO SCREEN
 	VkPresentInfoKHR presentInfo = {};
 	presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
 	presentInfo.waitSemaphoreCount = 1; // Number of semaphores to wait on
-	presentInfo.pWaitSemaphores = &renderFinished[currentFrame]; // Semaphores to wait on
+	presentInfo.pWaitSemaphores = &frameScheduler.getFrame(frameIndex).renderFinished; // Semaphores to wait on
 	presentInfo.swapchainCount = 1; // Number of swapchains to present to
 	presentInfo.pSwapchains = &swapchain; // Swapchains to present images to
 	presentInfo.pImageIndices = &imageIndex; // Index of images in swapchains to present
 
-	result = vkQueuePresentKHR(presentationQueue, &presentInfo);
+	{
+		CPU_PROFILE_SCOPE("present");
+		result = vkQueuePresentKHR(presentationQueue, &presentInfo);
+	}
 	if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR || frameBufferResized) {
 		frameBufferResized = false;
 		recreateSwapChain();
@@ -223,9 +331,98 @@ void VulkanRenderer::draw()
 	else if (result != VK_SUCCESS) {
 		throw std::runtime_error("Failed to present image!");
 	}
+}
+
+void VulkanRenderer::setPrintStats(bool enable)
+{
+	printStats = enable;
+	gpuCuller.setPrintStats(enable);
+}
+
+void VulkanRenderer::setDepthPrePass(bool enable)
+{
+	if (enable == depthPrePass) return;
+
+	printFragmentStats();
+	depthPrePass = enable;
+	renderGraphChanged = true;
+	printf("Depth pre-pass: %s\n", depthPrePass ? "on" : "off");
+}
+
+void VulkanRenderer::setGpuCulling(bool enable)
+{
+	// Why it's unavailable was printed at startup
+	if (enable && !gpuCullingSupported) return;
+	if (enable == gpuCulling) return;
+
+	gpuCulling = enable;
+	renderGraphChanged = true;
+	printedGpuDrawn = ~0u;
+	printf("GPU culling: %s\n", gpuCulling ? "on" : "off");
+}
+
+void VulkanRenderer::setBvhCulling(bool enable)
+{
+	if (enable == bvhCulling) return;
+
+	bvhCulling = enable;
+	printedVisible = ~0u;
+	cullTime = 0.0;
+	cullFrames = 0;
+	printf("Frustum culling: %s\n", bvhCulling ? "BVH" : "flat");
+}
+
+void VulkanRenderer::pick()
+{
+	CPU_PROFILE_SCOPE("pick");
+	// Kept up to date by the CPU cull, but GPU culling skips that
+	updateBvh();
+
+	Ray ray = { cameraPosition, cameraDirection };
+	uint32_t object = 0;
+	float distance = 0.0f;
+	RenderObjectHandle picked = bvh.raycast(ray, farPlane, &object, &distance) ? scene.getEntity(object) : NULL_RENDER_OBJECT;
+	if (picked == printedPick) return;
+	printedPick = picked;
+
+	if (picked == NULL_RENDER_OBJECT) {
+		printf("Picked: nothing\n");
+		return;
+	}
+	printf("Picked: object %u (generation %u) with texture %d, %.2f away\n", picked.id, picked.generation, scene.getRenderHandles()[object].texId, distance);
+}
 
-	// Get next frame (use modulo MAX_FRAME_DRAWS to keep value below MAX_FRAME_DRAWS)
-	currentFrame = (currentFrame + 1) % MAX_FRAME_DRAWS;
+void VulkanRenderer::setOcclusionCulling(bool enable)
+{
+	// Why it's unavailable was printed at startup
+	if (enable && !occlusionCullingSupported) return;
+	if (enable == occlusionCulling) return;
+
+	occlusionCulling = enable;
+	gpuCuller.setOcclusion(enable);
+	renderGraphChanged = true;
+	printedGpuDrawn = ~0u;
+	printf("Occlusion culling: %s%s\n", occlusionCulling ? "on" : "off", occlusionCulling && !gpuCulling ? " (once GPU culling is on)" : "");
+}
+
+void VulkanRenderer::printFragmentStats()
+{
+	if (!pipelineStatisticsSupported) return;
+
+	for (int withPrePass = 0; withPrePass < 2; withPrePass++) {
+		if (statisticsFrames[withPrePass] == 0) continue;
+		printf("Fragment shader invocations (%s depth pre-pass): %llu per frame over %u frames\n", withPrePass ? "with" : "without",
+			(unsigned long long)(fragmentInvocations[withPrePass] / statisticsFrames[withPrePass]), statisticsFrames[withPrePass]);
+	}
+}
+
+void VulkanRenderer::setFramesInFlight(uint32_t count)
+{
+	if (count == frameScheduler.getFramesInFlight()) return;
+
+	frameScheduler.printStats();
+	frameScheduler.setFramesInFlight(count);
+	printf("Frames in flight: %u\n", frameScheduler.getFramesInFlight());
 }
 
 void VulkanRenderer::createInstance()
@@ -325,9 +522,34 @@ void VulkanRenderer::createLogicalDevice()
 	// Physical device features the logical device will be using
 	VkPhysicalDeviceFeatures deviceFeatures = {};
 	deviceFeatures.samplerAnisotropy = VK_TRUE; // Enable anisotropy
+
+	// Wireframe pipelines need line fill mode, optional
+	VkPhysicalDeviceFeatures supportedFeatures;
+	vkGetPhysicalDeviceFeatures(mainDevice.physicalDevice, &supportedFeatures);
+	wireframeSupported = supportedFeatures.fillModeNonSolid == VK_TRUE;
+	deviceFeatures.fillModeNonSolid = supportedFeatures.fillModeNonSolid;
+	pipelineStatisticsSupported = supportedFeatures.pipelineStatisticsQuery == VK_TRUE;
+	deviceFeatures.pipelineStatisticsQuery = supportedFeatures.pipelineStatisticsQuery; // Fragment shader invocation counts
+	deviceFeatures.multiDrawIndirect = supportedFeatures.multiDrawIndirect; // GPU culling draws a batch per indirect call
 	//deviceFeatures.depthClamp = VK_TRUE; // use if using depthClampEnable to true
 	deviceCreateInfo.pEnabledFeatures = &deviceFeatures; // Physical Device features Logical Device will use
 
+	// GPU culling also needs the draw count to come from a buffer, optional
+	VkPhysicalDeviceVulkan12Features supportedVulkan12Features = {};
+	supportedVulkan12Features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+	VkPhysicalDeviceFeatures2 supportedFeatures2 = {};
+	supportedFeatures2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+	supportedFeatures2.pNext = &supportedVulkan12Features;
+	vkGetPhysicalDeviceFeatures2(mainDevice.physicalDevice, &supportedFeatures2);
+	gpuCullingSupported = supportedFeatures.multiDrawIndirect == VK_TRUE && supportedVulkan12Features.drawIndirectCount == VK_TRUE;
+
+	// Frame pacing waits on a timeline semaphore
+	VkPhysicalDeviceVulkan12Features vulkan12Features = {};
+	vulkan12Features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+	vulkan12Features.timelineSemaphore = VK_TRUE;
+	vulkan12Features.drawIndirectCount = supportedVulkan12Features.drawIndirectCount;
+	deviceCreateInfo.pNext = &vulkan12Features;
+
 	// Create the logical device for the given phyiscal device
 	VkResult result = vkCreateDevice(mainDevice.physicalDevice, &deviceCreateInfo, nullptr, &mainDevice.logicalDevice);
 	if (result != VK_SUCCESS) {
@@ -468,8 +690,14 @@ bool VulkanRenderer::checkDeviceSuitable(VkPhysicalDevice device)
 	vkGetPhysicalDeviceProperties(device, &deviceProperties);
 	*/
 	// Information about what the device can do (geo shader, tess shader, wide lines etc)
-	VkPhysicalDeviceFeatures deviceFeatures;
-	vkGetPhysicalDeviceFeatures(device, &deviceFeatures);
+	VkPhysicalDeviceVulkan12Features vulkan12Features = {};
+	vulkan12Features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+
+	VkPhysicalDeviceFeatures2 deviceFeatures2 = {};
+	deviceFeatures2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+	deviceFeatures2.pNext = &vulkan12Features; // Vulkan 1.2 features (timeline semaphores) are chained on
+	vkGetPhysicalDeviceFeatures2(device, &deviceFeatures2);
+	VkPhysicalDeviceFeatures& deviceFeatures = deviceFeatures2.features;
 
 
 	// Check what Queues are supported
@@ -485,7 +713,7 @@ bool VulkanRenderer::checkDeviceSuitable(VkPhysicalDevice device)
 	}
 
 
-	return indicies.isValid() && extensionsSupported && swapChainValid &deviceFeatures.samplerAnisotropy;
+	return indicies.isValid() && extensionsSupported && swapChainValid && deviceFeatures.samplerAnisotropy && vulkan12Features.timelineSemaphore;
 }
 
 bool VulkanRenderer::checkValidiationLayerSupport()
@@ -677,13 +905,8 @@ VkExtent2D VulkanRenderer::chooseSwapExtent(const VkSurfaceCapabilitiesKHR& surf
 		return surfaceCapabilities.currentExtent;
 	} else {
 		// If value can vary, need to set manually
-		int width, height;
-		glfwGetFramebufferSize(window->getWindow(), &width, &height); // Get width and height from window (glfw)
-
 		// Create new extent using window size
-		VkExtent2D newExtent = {};
-		newExtent.width = static_cast<uint32_t>(width);
-		newExtent.height = static_cast<uint32_t>(height);
+		VkExtent2D newExtent = framebufferExtent;
 
 		// Surface also defines max and min, make sure inside boundaries by clamping value
 		newExtent.width = std::max(surfaceCapabilities.minImageExtent.width, std::min(surfaceCapabilities.maxImageExtent.width, newExtent.width)); // Keeps width within the boundaries
@@ -712,7 +935,7 @@ VkFormat VulkanRenderer::chooseSupportedFormat(const std::vector<VkFormat>& form
 	throw std::runtime_error("Failed to find a matching format!");
 }
 
-void VulkanRenderer::createSwapChain()
+void VulkanRenderer::createSwapChain(VkSwapchainKHR oldSwapchain)
 {
 	SwapChainDetails swapChainDetails = getSwapChainDetails(mainDevice.physicalDevice); // Get the swapchain details so we can pick best settings
 
@@ -767,8 +990,8 @@ void VulkanRenderer::createSwapChain()
 		swapChainCreateInfo.pQueueFamilyIndices = nullptr;
 	}
 
-	// If old swapchain has been destroyed, and this one replaces it, then quickly hand over responsibilities.
-	swapChainCreateInfo.oldSwapchain = VK_NULL_HANDLE;
+	// If this swapchain replaces an old one, hand over responsibilities (the old one is retired, not destroyed yet)
+	swapChainCreateInfo.oldSwapchain = oldSwapchain;
 
 	// Create swapchain
 	VkResult result = vkCreateSwapchainKHR(mainDevice.logicalDevice, &swapChainCreateInfo, nullptr, &swapchain);
@@ -797,224 +1020,8 @@ void VulkanRenderer::createSwapChain()
 	}
 }
 
-void VulkanRenderer::createRenderPass()
-{
-	VkAttachmentDescription colorAttachment{};
-	colorAttachment.format = swapChainImageFormat;
-	colorAttachment.samples = msaaSamples;
-	colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-	colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
-	colorAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
-	colorAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-	colorAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-	colorAttachment.finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
-
-	VkAttachmentDescription depthAttachment{};
-	depthAttachment.format = depthBufferFormat;
-	depthAttachment.samples = msaaSamples;
-	depthAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-	depthAttachment.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-	depthAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
-	depthAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-	depthAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-	depthAttachment.finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
-
-	VkAttachmentDescription colorAttachmentResolve{};
-	colorAttachmentResolve.format = swapChainImageFormat;
-	colorAttachmentResolve.samples = VK_SAMPLE_COUNT_1_BIT;
-	colorAttachmentResolve.loadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
-	colorAttachmentResolve.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
-	colorAttachmentResolve.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
-	colorAttachmentResolve.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-	colorAttachmentResolve.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-	colorAttachmentResolve.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
-
-	VkAttachmentReference colorAttachmentRef{};
-	colorAttachmentRef.attachment = 0;
-	colorAttachmentRef.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
-
-	VkAttachmentReference depthAttachmentRef{};
-	depthAttachmentRef.attachment = 1;
-	depthAttachmentRef.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
-
-	VkAttachmentReference colorAttachmentResolveRef{};
-	colorAttachmentResolveRef.attachment = 2;
-	colorAttachmentResolveRef.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
-
-	VkSubpassDescription subpass{};
-	subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
-	subpass.colorAttachmentCount = 1;
-	subpass.pColorAttachments = &colorAttachmentRef;
-	subpass.pDepthStencilAttachment = &depthAttachmentRef;
-	subpass.pResolveAttachments = &colorAttachmentResolveRef;
-
-	VkSubpassDependency dependency{};
-	dependency.srcSubpass = VK_SUBPASS_EXTERNAL;
-	dependency.dstSubpass = 0;
-	dependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
-	dependency.srcAccessMask = 0;
-	dependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
-	dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
-
-	std::array<VkAttachmentDescription, 3> attachments = { colorAttachment, depthAttachment, colorAttachmentResolve };
-	VkRenderPassCreateInfo renderPassInfo{};
-	renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
-	renderPassInfo.attachmentCount = static_cast<uint32_t>(attachments.size());
-	renderPassInfo.pAttachments = attachments.data();
-	renderPassInfo.subpassCount = 1;
-	renderPassInfo.pSubpasses = &subpass;
-	renderPassInfo.dependencyCount = 1;
-	renderPassInfo.pDependencies = &dependency;
-
-	if (vkCreateRenderPass(mainDevice.logicalDevice, &renderPassInfo, nullptr, &renderPass) != VK_SUCCESS) {
-		throw std::runtime_error("failed to create render pass!");
-	}
-}
-
-void VulkanRenderer::createGraphicsPipeline()
+void VulkanRenderer::createPipelineLayout()
 {
-	// Read in SPIR-V code of shaders
-	auto vertexShaderCode = readFile("shaders/vert.spv");
-	auto fragShaderCode = readFile("shaders/frag.spv");
-
-	// Build shader Modules to link to graphics pipeline
-	VkShaderModule vertShaderModule = createShaderModule(vertexShaderCode);
-	VkShaderModule fragShaderModule = createShaderModule(fragShaderCode);
-
-	// SHADER STAGE CREATION INFORMATION
-	// Vertex stage creation information
-	VkPipelineShaderStageCreateInfo vertShaderCreateInfo = {};
-	vertShaderCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-	vertShaderCreateInfo.stage = VK_SHADER_STAGE_VERTEX_BIT;
-	vertShaderCreateInfo.module = vertShaderModule;
-	vertShaderCreateInfo.pName = "main";
-
-	// Fragment stage creation information
-	VkPipelineShaderStageCreateInfo fragShaderCreateInfo = {};
-	fragShaderCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-	fragShaderCreateInfo.stage = VK_SHADER_STAGE_FRAGMENT_BIT;
-	fragShaderCreateInfo.module = fragShaderModule;
-	fragShaderCreateInfo.pName = "main";
-
-	// Create array of shader stages (Requires array)
-	VkPipelineShaderStageCreateInfo shaderStages[] = { vertShaderCreateInfo, fragShaderCreateInfo };
-
-	// How the data for a single vertex (including info such as position, color, texture coords, normals, etc) is as a whole
-	VkVertexInputBindingDescription bindingDescription = {};
-	bindingDescription.binding = 0; // Can bind multiple streams of data, this defines which one (first binding as only one string)
-	bindingDescription.stride = sizeof(Vertex); // Size of a single vertex object, defines how big each vertex is and how to split them
-	bindingDescription.inputRate = VK_VERTEX_INPUT_RATE_VERTEX; // How to move between data after each vertex, 
-	//VK_VERTEX_INPUT_RATE_INDEX: Move onto next vertex
-	//VK_VERTEX_INPUT_RATE_INSTANCE: Move to a vertex for the next instance (If you have multiple instances of the same object) - draws the first vertex of each
-
-	// How the data for an attribute is defined within a vertex
-	std::array<VkVertexInputAttributeDescription, 4> attributeDescriptions;
-
-	// Position attribute
-	attributeDescriptions[0].binding = 0; // Which binding the data is at (should be the same as above binding value)
-	attributeDescriptions[0].location = 0; // Location in shader where data will be read from
-	attributeDescriptions[0].format = VK_FORMAT_R32G32B32_SFLOAT; // Format the data will take (also helps define the size of data)
-	attributeDescriptions[0].offset = offsetof(Vertex, pos); // Where the attribute is defined in the data for a single vertex
-
-	// Color Attribute
-	attributeDescriptions[1].binding = 0;
-	attributeDescriptions[1].location = 1;
-	attributeDescriptions[1].format = VK_FORMAT_R32G32B32_SFLOAT;
-	attributeDescriptions[1].offset = offsetof(Vertex, col);
-
-	// Texture Attribute
-	attributeDescriptions[2].binding = 0;
-	attributeDescriptions[2].location = 2;
-	attributeDescriptions[2].format = VK_FORMAT_R32G32_SFLOAT;
-	attributeDescriptions[2].offset = offsetof(Vertex, tex);
-
-	// Normal Attribute
-	attributeDescriptions[3].binding = 0;
-	attributeDescriptions[3].location = 3;
-	attributeDescriptions[3].format = VK_FORMAT_R32G32B32_SFLOAT;
-	attributeDescriptions[3].offset = offsetof(Vertex, normal);
-
-	// Vertex Input
-	VkPipelineVertexInputStateCreateInfo vertexInputCreateInfo = {};
-	vertexInputCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
-	vertexInputCreateInfo.vertexBindingDescriptionCount = 1;
-	vertexInputCreateInfo.pVertexBindingDescriptions = &bindingDescription; // List of vertex binding descriptions (data spacing/stride information)
-	vertexInputCreateInfo.vertexAttributeDescriptionCount = static_cast<uint32_t>(attributeDescriptions.size());
-	vertexInputCreateInfo.pVertexAttributeDescriptions = attributeDescriptions.data(); // List of vertex attribute descriptions (data format and where to bind to/from)
-
-	// Input Assembly
-	VkPipelineInputAssemblyStateCreateInfo inputAssembly = {};
-	inputAssembly.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
-	inputAssembly.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST; // Primitive type to assemble verticies
-	inputAssembly.primitiveRestartEnable = VK_FALSE; // Allow overriding of "strip" topology to start new primitives
-
-	// Viewport and Scissor
-	VkViewport viewport = {};
-	viewport.x = 0.0f; // x start coordinate
-	viewport.y = 0.0f; // y start coordinate
-	viewport.width = (float)swapChainExtent.width; // width of viewport
-	viewport.height = (float)swapChainExtent.height; // height of viewport
-	viewport.minDepth = 0.0f; // Min framebuffer depth
-	viewport.maxDepth = 1.0f; // Max framebuffer depth
-
-	// Create a scissor info struct
-	VkRect2D scissor = {};
-	scissor.offset = { 0, 0 }; // Offset to use region from
-	scissor.extent = swapChainExtent; // Extent to describe region to use, starting at offset
-
-	// Viewport and scissor info struct
-	VkPipelineViewportStateCreateInfo viewportStateCreateInfo = {};
-	viewportStateCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
-	viewportStateCreateInfo.viewportCount = 1;
-	viewportStateCreateInfo.pViewports = &viewport;
-	viewportStateCreateInfo.scissorCount = 1;
-	viewportStateCreateInfo.pScissors = &scissor;
-
-	/*
-	// Dyanamic states to enable (Change values in runtime instead of hardcoding pipeline)
-	std::vector<VkDynamicState> dyanamicStateEnables;
-	dyanamicStateEnables.push_back(VK_DYNAMIC_STATE_VIEWPORT); // Dynamic Viewport: Can resize in command buffer with vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
-	dyanamicStateEnables.push_back(VK_DYNAMIC_STATE_SCISSOR); // Dynamic Scissor: Can resize in command buffer with vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
-
-	// Dynamic state creation info
-	VkPipelineDynamicStateCreateInfo dynamicStateCreateInfo = {};
-	dynamicStateCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
-	dynamicStateCreateInfo.dynamicStateCount = static_cast<uint32_t>(dyanamicStateEnables.size());
-	dynamicStateCreateInfo.pDynamicStates = dyanamicStateEnables.data();
-	*/
-
-	// Rasterizer
-	VkPipelineRasterizationStateCreateInfo rasterizerStateCreateInfo = {};
-	rasterizerStateCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
-	rasterizerStateCreateInfo.depthClampEnable = VK_FALSE; // Change if fragments beyond near/far plane are clipped (default) or clamped to plane
-	rasterizerStateCreateInfo.rasterizerDiscardEnable = VK_FALSE; // Whether to discard data and skip rasterizer. Never creates fragements
-	rasterizerStateCreateInfo.polygonMode = VK_POLYGON_MODE_FILL; // How to handle filling points between vertices
-	rasterizerStateCreateInfo.lineWidth = 1.0f; // The thickness of the lines when drawn (enable wide lines for anything other than 1.0f)
-	rasterizerStateCreateInfo.cullMode = VK_CULL_MODE_BACK_BIT;
-	rasterizerStateCreateInfo.frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE; // Winding to determine which side is front
-	rasterizerStateCreateInfo.depthBiasEnable = VK_FALSE; // Whether to add depth bias to fragments (good for stopping "shadow achne" in shadow mapping)
-
-	// Multisampling
-	VkPipelineMultisampleStateCreateInfo multisampleCreateInfo = {};
-	multisampleCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
-	multisampleCreateInfo.sampleShadingEnable = VK_FALSE; // Enable multisample shading or not
-	multisampleCreateInfo.rasterizationSamples = msaaSamples; // Number of samples to use per fragment
-
-	VkPipelineColorBlendAttachmentState colorBlendAttachment{};
-	colorBlendAttachment.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
-	colorBlendAttachment.blendEnable = VK_FALSE;
-
-	VkPipelineColorBlendStateCreateInfo colorBlending{};
-	colorBlending.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
-	colorBlending.logicOpEnable = VK_FALSE;
-	colorBlending.logicOp = VK_LOGIC_OP_COPY;
-	colorBlending.attachmentCount = 1;
-	colorBlending.pAttachments = &colorBlendAttachment;
-	colorBlending.blendConstants[0] = 0.0f;
-	colorBlending.blendConstants[1] = 0.0f;
-	colorBlending.blendConstants[2] = 0.0f;
-	colorBlending.blendConstants[3] = 0.0f;
-
 	// Pipeline layout (descriptor sets and push constants)
 	std::array<VkDescriptorSetLayout, 2> descriptorSetLayouts = { descriptorSetLayout, samplerSetLayout };
 
@@ -1022,57 +1029,71 @@ void VulkanRenderer::createGraphicsPipeline()
 	pipelineLayoutCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
 	pipelineLayoutCreateInfo.setLayoutCount = static_cast<uint32_t>(descriptorSetLayouts.size());
 	pipelineLayoutCreateInfo.pSetLayouts = descriptorSetLayouts.data();
-	pipelineLayoutCreateInfo.pushConstantRangeCount = 1;
-	pipelineLayoutCreateInfo.pPushConstantRanges = &pushConstantRange;
+	pipelineLayoutCreateInfo.pushConstantRangeCount = static_cast<uint32_t>(pushConstantRanges.size());
+	pipelineLayoutCreateInfo.pPushConstantRanges = pushConstantRanges.data();
 
 	// Create Pipeline Layout
 	VkResult result = vkCreatePipelineLayout(mainDevice.logicalDevice, &pipelineLayoutCreateInfo, nullptr, &pipelineLayout);
 	if (result != VK_SUCCESS) {
 		throw std::runtime_error("Failed to create pipeline layout");
 	}
+}
 
-	// Depth Stencil Testing
-	VkPipelineDepthStencilStateCreateInfo depthStencilCreateInfo = {};
-	depthStencilCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
-	depthStencilCreateInfo.depthTestEnable = VK_TRUE; // Enable checking depth to determine fragment write
-	depthStencilCreateInfo.depthWriteEnable = VK_TRUE; // Enable writing to the depth buffer (to replace old values)
-	depthStencilCreateInfo.depthCompareOp = VK_COMPARE_OP_LESS; // Comparision operation that allows an overwrite (is in front)
-	depthStencilCreateInfo.depthBoundsTestEnable = VK_FALSE; // Depth bounds test: Does the depth value exist between 2 bounds (front, back)
-	depthStencilCreateInfo.stencilTestEnable = VK_FALSE;
-
-
-	// Create Graphics Pipeline
-	VkGraphicsPipelineCreateInfo pipelineCreateInfo = {};
-	pipelineCreateInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
-	pipelineCreateInfo.stageCount = 2; // Number of shader stages (vertex, fragment)
-	pipelineCreateInfo.pStages = shaderStages; // List of shader stages
-	pipelineCreateInfo.pVertexInputState = &vertexInputCreateInfo; // All the fixed function pipeline states
-	pipelineCreateInfo.pInputAssemblyState = &inputAssembly;
-	pipelineCreateInfo.pViewportState = &viewportStateCreateInfo;
-	pipelineCreateInfo.pDynamicState = nullptr;
-	pipelineCreateInfo.pRasterizationState = &rasterizerStateCreateInfo;
-	pipelineCreateInfo.pMultisampleState = &multisampleCreateInfo;
-	pipelineCreateInfo.pColorBlendState = &colorBlending;
-	pipelineCreateInfo.pDepthStencilState = &depthStencilCreateInfo;
-	pipelineCreateInfo.layout = pipelineLayout; // Pipeline layout pipeline should use
-	pipelineCreateInfo.renderPass = renderPass; // Render pass description the pipeline is compatible with
-	pipelineCreateInfo.subpass = 0; // Subpass of render pass to use with pipeline
-
-	// Pipeline derivatives: Can create multiple pipelines that derive from one another for optimisation
-	pipelineCreateInfo.basePipelineHandle = VK_NULL_HANDLE; // Existing pipeline to derive from
-	pipelineCreateInfo.basePipelineIndex = -1; // Or index of pipeline being created to derive from (in case creating multiple at once) 
-
-	result = vkCreateGraphicsPipelines(mainDevice.logicalDevice, VK_NULL_HANDLE, 1, &pipelineCreateInfo, nullptr, &graphicsPipeline);
-	if (result != VK_SUCCESS) {
-		throw std::runtime_error("Failed to create graphics pipeline");
+void VulkanRenderer::createGraphicsPipeline()
+{
+	// The opaque pipeline is needed for the first frame, so it's built here. Timed so cold, warm and uncached creation can be compared
+	auto pipelineStart = std::chrono::steady_clock::now();
+	opaqueDesc = forwardPipelineDesc(PipelineVariant::Opaque);
+	wireframeDesc = forwardPipelineDesc(PipelineVariant::Wireframe);
+	graphicsPipeline = pipelineRegistry.getPipelineBlocking(opaqueDesc);
+	double pipelineTime = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - pipelineStart).count();
+	if (printStats) printf("Graphics pipeline created in %.3f ms (%s)\n", pipelineTime,
+		!pipelineCache.isEnabled() ? "no cache" : pipelineCache.wasLoaded() ? "cache loaded from disk" : "cold cache");
+
+	// Other variants compile in the background, the opaque pipeline stands in until they're ready
+	pipelineRegistry.prewarm(forwardPipelineDesc(PipelineVariant::AlphaBlend));
+	if (wireframeSupported) {
+		pipelineRegistry.prewarm(wireframeDesc);
+	}
+
+	// Nothing can stand in for the pre-pass pipeline (the forward pass would draw nothing without its depth), so it's built here too
+	depthPrePassPipeline = VK_NULL_HANDLE;
+	if (depthPrePass) {
+		depthPrePassDesc = depthPrePassPipelineDesc();
+		depthPrePassPipeline = pipelineRegistry.getPipelineBlocking(depthPrePassDesc);
 	}
+}
 
-	// Destroy shader modules after pipeline (no longer needed after pipeline created)
-	vkDestroyShaderModule(mainDevice.logicalDevice, vertShaderModule, nullptr);
-	vkDestroyShaderModule(mainDevice.logicalDevice, fragShaderModule, nullptr);
+PipelineDesc VulkanRenderer::forwardPipelineDesc(PipelineVariant variant)
+{
+	PipelineDesc desc = PipelineRegistry::makeDesc(variant, renderPass, pipelineLayout, msaaSamples);
+	desc.subpass = renderGraph.getSubpass("forward");
+	if (depthPrePass) {
+		// Depth is already final and read only, opaque surfaces only shade where they are the nearest one
+		desc.depthWrite = false;
+		desc.depthCompare = variant == PipelineVariant::Opaque ? VK_COMPARE_OP_EQUAL : VK_COMPARE_OP_LESS_OR_EQUAL;
+	}
+	if (gpuCulling) {
+		desc.vertexShader = INDIRECT_VERTEX_SHADER_FILE;
+		desc.layout = indirectPipelineLayout;
+	}
+	return desc;
+}
+
+PipelineDesc VulkanRenderer::depthPrePassPipelineDesc()
+{
+	PipelineDesc desc = PipelineRegistry::makeDesc(PipelineVariant::DepthOnly, renderPass, pipelineLayout, msaaSamples);
+	desc.subpass = renderGraph.getSubpass("depthPrePass");
+	if (gpuCulling) {
+		// No position only version of indirect.vert, the forward pass uses the same shader so EQUAL still holds
+		desc.vertexShader = INDIRECT_VERTEX_SHADER_FILE;
+		desc.vertexLayout = VertexLayout::Standard;
+		desc.layout = indirectPipelineLayout;
+	}
+	return desc;
 }
 
-void VulkanRenderer::createDepthBufferImage()
+void VulkanRenderer::buildRenderGraph()
 {
 	// Get supported format for depth buffer 
 	depthBufferFormat = chooseSupportedFormat(
@@ -1080,38 +1101,92 @@ void VulkanRenderer::createDepthBufferImage()
 		VK_IMAGE_TILING_OPTIMAL,
 		VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT);
 
-	// Create the depth buffer image
-	depthBufferImage = createImage(swapChainExtent.width, swapChainExtent.height, 1, depthBufferFormat, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &depthBufferImageMemory, msaaSamples);
+	std::vector<VkImage> images;
+	std::vector<VkImageView> imageViews;
+	for (auto& swapChainImage : swapChainImages) {
+		images.push_back(swapChainImage.image);
+		imageViews.push_back(swapChainImage.imageView);
+	}
+	RenderResource backbuffer = renderGraph.importImage("backbuffer", swapChainExtent.width, swapChainExtent.height, swapChainImageFormat,
+		images, imageViews, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR);
 
-	// Create depth buffer image view
-	depthBufferImageView = createImageView(depthBufferImage, depthBufferFormat, VK_IMAGE_ASPECT_DEPTH_BIT);
-}
+	// MSAA colour and depth never leave the pass, the graph keeps them in transient memory
+	RenderResource colour = renderGraph.createImage("colour", swapChainExtent.width, swapChainExtent.height, swapChainImageFormat, msaaSamples);
+	RenderResource depth = renderGraph.createImage("depth", swapChainExtent.width, swapChainExtent.height, depthBufferFormat, msaaSamples);
 
-void VulkanRenderer::createFrameBuffers()
-{
-	// Resize frame buffer count to equal swap chain image count (one framebuffer per image so we can draw to multiple at a time)
-	swapChainFramebuffers.resize(swapChainImages.size());
-	for (size_t i = 0; i < swapChainFramebuffers.size(); i++) {
+	// Writes the indirect draws both graphics passes read, buffers aren't graph resources so it's kept with side effects.
+	// The early cull tests against the pyramid the previous frame left behind
+	RenderResource pyramid = RENDER_RESOURCE_NONE;
+	if (gpuCulling) {
+		depthPyramid.resize(swapChainExtent.width, swapChainExtent.height);
+		gpuCuller.setDepthPyramid(depthPyramid.getImageView(), depthPyramid.getSampler(), depthPyramid.getWidth(), depthPyramid.getHeight(), depthPyramid.getLevelCount());
+		pyramid = renderGraph.importPersistentImage("depthPyramid", depthPyramid.getWidth(), depthPyramid.getHeight(), DEPTH_PYRAMID_FORMAT,
+			depthPyramid.getImage(), depthPyramid.getImageView(), DEPTH_PYRAMID_LAYOUT);
 
-		std::array<VkImageView, 3> attachments = {
-			colourImageView,
-			depthBufferImageView,
-			swapChainImages[i].imageView
-		};
+		RenderGraphPass& cull = renderGraph.addPass("gpuCull", RenderGraphPassType::Compute);
+		cull.setSideEffects(true);
+		cull.addInput(pyramid, ResourceUsage::SampledCompute);
+		cull.setRecord([this](VkCommandBuffer commandBuffer) { gpuCuller.recordCull(commandBuffer, frameScheduler.getFrameIndex(), 0); });
+	}
+
+	// Both are graphics passes on the same attachments, so the graph merges them into subpasses of one render pass
+	if (depthPrePass) {
+		RenderGraphPass& prePass = renderGraph.addPass("depthPrePass", RenderGraphPassType::Graphics);
+		prePass.setDepthOutput(depth, AttachmentLoad::Clear);
+		prePass.setRecord([this](VkCommandBuffer commandBuffer) { recordDepthPrePass(commandBuffer, 0); });
+	}
+
+	RenderGraphPass& forward = renderGraph.addPass("forward", RenderGraphPassType::Graphics);
+	forward.addColourOutput(colour, AttachmentLoad::Clear, backbuffer);
+	if (depthPrePass) {
+		forward.setDepthInput(depth);
+	}
+	else {
+		forward.setDepthOutput(depth, AttachmentLoad::Clear);
+	}
+	forward.setClearColour({ { 0.6f, 0.65f, 0.4f, 1.0f } });
+	forward.setRecord([this](VkCommandBuffer commandBuffer) { recordForwardPass(commandBuffer, 0); });
+
+	// Objects the early cull found hidden get a second chance: the pyramid is rebuilt from the depth just drawn, the late cull
+	// retests them against it and the late passes draw what's visible on top. Their render pass only differs in load ops,
+	// so it's compatible with the early one and the same pipelines draw in both
+	bool occlusion = gpuCulling && occlusionCulling;
+	if (occlusion) {
+		RenderGraphPass& hizBuild = renderGraph.addPass("hizBuild", RenderGraphPassType::Compute);
+		hizBuild.addInput(depth, ResourceUsage::SampledCompute);
+		hizBuild.addOutput(pyramid, ResourceUsage::StorageWrite);
+		hizBuild.setRecord([this](VkCommandBuffer commandBuffer) { depthPyramid.record(commandBuffer); });
+
+		RenderGraphPass& lateCull = renderGraph.addPass("gpuCullLate", RenderGraphPassType::Compute);
+		lateCull.setSideEffects(true);
+		lateCull.addInput(pyramid, ResourceUsage::SampledCompute);
+		lateCull.setRecord([this](VkCommandBuffer commandBuffer) { gpuCuller.recordCull(commandBuffer, frameScheduler.getFrameIndex(), 1); });
+
+		if (depthPrePass) {
+			RenderGraphPass& latePrePass = renderGraph.addPass("depthPrePassLate", RenderGraphPassType::Graphics);
+			latePrePass.setDepthOutput(depth, AttachmentLoad::Keep);
+			latePrePass.setRecord([this](VkCommandBuffer commandBuffer) { recordDepthPrePass(commandBuffer, 1); });
+		}
 
-		VkFramebufferCreateInfo frameBufferCreateInfo = {};
-		frameBufferCreateInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
-		frameBufferCreateInfo.renderPass = renderPass; // Renderpass layout the framebuffer will be used with
-		frameBufferCreateInfo.attachmentCount = static_cast<uint32_t>(attachments.size());
-		frameBufferCreateInfo.pAttachments = attachments.data(); // List of attachments 1-to-1 with renderpass
-		frameBufferCreateInfo.width = swapChainExtent.width; // Framebuffer width
-		frameBufferCreateInfo.height = swapChainExtent.height; // Framebuffer height
-		frameBufferCreateInfo.layers = 1; // Framebuffer layers
-
-		VkResult result = vkCreateFramebuffer(mainDevice.logicalDevice, &frameBufferCreateInfo, nullptr, &swapChainFramebuffers[i]);
-		if (result != VK_SUCCESS) {
-			throw std::runtime_error("Failed to create a framebuffer");
+		RenderGraphPass& lateForward = renderGraph.addPass("forwardLate", RenderGraphPassType::Graphics);
+		lateForward.addColourOutput(colour, AttachmentLoad::Keep, backbuffer);
+		if (depthPrePass) {
+			lateForward.setDepthInput(depth);
+		}
+		else {
+			lateForward.setDepthOutput(depth, AttachmentLoad::Keep);
 		}
+		lateForward.setRecord([this](VkCommandBuffer commandBuffer) { recordForwardPass(commandBuffer, 1); });
+	}
+
+	renderGraph.setOutput(backbuffer);
+	renderGraph.compile();
+
+	renderPass = renderGraph.getRenderPass("forward");
+
+	// Depth is only sampled (and its view only valid for it) while the pyramid is built from it
+	if (occlusion) {
+		depthPyramid.setDepthSource(renderGraph.getImageView(depth), swapChainExtent.width, swapChainExtent.height, msaaSamples);
 	}
 }
 
@@ -1132,85 +1207,90 @@ void VulkanRenderer::createCommandPool()
 	}
 }
 
-void VulkanRenderer::createCommandBuffers()
+void VulkanRenderer::createGpuProfiler()
 {
-	commandBuffers.resize(swapChainFramebuffers.size());
-	VkCommandBufferAllocateInfo cbAllocInfo = {}; // Command buffers already exist so we allocate the command buffer from our pool
-	cbAllocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-	cbAllocInfo.commandPool = graphicsCommandPool;
-	cbAllocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY; // Primary means that you can submit directly to queue, secondary can only be executed by other command buffers vkCmdExecuteCommands
-	cbAllocInfo.commandBufferCount = static_cast<uint32_t>(commandBuffers.size());
+	statisticsQueryMode.fill(-1);
 
-	// Allocate command buffers from graphics pool and place handles in array of buffers
-	VkResult result = vkAllocateCommandBuffers(mainDevice.logicalDevice, &cbAllocInfo, commandBuffers.data());
-	if (result != VK_SUCCESS) {
-		throw std::runtime_error("Failed to allocate Command Buffers!");
-	}
+	// Ticks are timestampPeriod ns, and only the queue's valid bits count
+	VkPhysicalDeviceProperties properties;
+	vkGetPhysicalDeviceProperties(mainDevice.physicalDevice, &properties);
+
+	uint32_t queueFamilyCount = 0;
+	vkGetPhysicalDeviceQueueFamilyProperties(mainDevice.physicalDevice, &queueFamilyCount, nullptr);
+	std::vector<VkQueueFamilyProperties> queueFamilyList(queueFamilyCount);
+	vkGetPhysicalDeviceQueueFamilyProperties(mainDevice.physicalDevice, &queueFamilyCount, queueFamilyList.data());
+	uint32_t timestampValidBits = queueFamilyList[getQueueFamilies(mainDevice.physicalDevice).graphicsFamily].timestampValidBits;
+
+	gpuProfiler.init(mainDevice, properties.limits.timestampPeriod, timestampValidBits, pipelineStatisticsSupported);
 }
 
-void VulkanRenderer::createSynchronisation()
+void VulkanRenderer::createGpuCulling()
 {
-	imageAvailable.resize(MAX_FRAME_DRAWS);
-	renderFinished.resize(MAX_FRAME_DRAWS);
-	drawFences.resize(MAX_FRAME_DRAWS);
+	if (!gpuCullingSupported) {
+		printf("GPU culling: drawIndirectCount or multiDrawIndirect not supported, CPU culling only\n");
+		return;
+	}
+	for (const std::string& file : { CULL_COMPUTE_SHADER_FILE, INDIRECT_VERTEX_SHADER_FILE, DEPTH_PYRAMID_SHADER_FILE }) {
+		if (!std::ifstream(file).good()) {
+			printf("GPU culling: %s not built, CPU culling only\n", file.c_str());
+			gpuCullingSupported = false;
+			return;
+		}
+	}
 
-	// Semaphore creation information
-	VkSemaphoreCreateInfo semaphoreCreateInfo = {};
-	semaphoreCreateInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+	gpuCuller.init(mainDevice, graphicsQueue, graphicsCommandPool, pipelineCache.getCache(), &frameScheduler.getDeletionQueue(), INDIRECT_VERTEX_SHADER_FILE);
 
-	// Fence creation information
-	VkFenceCreateInfo fenceCreateInfo = {};
-	fenceCreateInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
-	fenceCreateInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
+	// Always bound to the cull shader, but it only hides anything once built. hiz.comp reads depth as a sampler2DMS
+	depthPyramid.init(mainDevice, graphicsQueue, graphicsCommandPool, pipelineCache.getCache(), &frameScheduler.getDeletionQueue(), &samplerCache);
+	depthPyramid.resize(swapChainExtent.width, swapChainExtent.height);
+	gpuCuller.setDepthPyramid(depthPyramid.getImageView(), depthPyramid.getSampler(), depthPyramid.getWidth(), depthPyramid.getHeight(), depthPyramid.getLevelCount());
+	occlusionCullingSupported = msaaSamples != VK_SAMPLE_COUNT_1_BIT;
+	if (!occlusionCullingSupported) {
+		printf("Occlusion culling: needs a multisampled depth buffer, frustum culling only\n");
+	}
 
-	for (size_t i = 0; i < MAX_FRAME_DRAWS; i++) {
-		if (vkCreateSemaphore(mainDevice.logicalDevice, &semaphoreCreateInfo, nullptr, &imageAvailable[i]) != VK_SUCCESS ||
-			vkCreateSemaphore(mainDevice.logicalDevice, &semaphoreCreateInfo, nullptr, &renderFinished[i]) != VK_SUCCESS ||
-			vkCreateFence(mainDevice.logicalDevice, &fenceCreateInfo, nullptr, &drawFences[i]) != VK_SUCCESS) {
-			throw std::runtime_error("Failed to create a sempahore and/or Fence!");
-		}
+	// Sets 0 and 1 are bound from the same descriptor sets as the other pipelines, so they must declare the same bindings
+	ReflectedLayout indirectLayout = ReflectedLayout::merge(
+		{ ShaderReflection::reflectFile(INDIRECT_VERTEX_SHADER_FILE), ShaderReflection::reflectFile(FRAGMENT_SHADER_FILE) }, { { 0, 1 } });
+	ReflectedLayout sharedSets = indirectLayout;
+	sharedSets.sets.resize(2);
+	sharedSets.pushConstantRanges = shaderLayout.pushConstantRanges;
+	if (sharedSets != shaderLayout) {
+		throw std::runtime_error("indirect.vert should use the same sets 0 and 1 as shader.vert, rebuild the shaders");
 	}
+
+	std::array<VkDescriptorSetLayout, 3> descriptorSetLayouts = { descriptorSetLayout, samplerSetLayout, gpuCuller.getObjectSetLayout() };
+
+	// The model matrix isn't pushed, only the fragment stage's texture layer is
+	VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo = {};
+	pipelineLayoutCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+	pipelineLayoutCreateInfo.setLayoutCount = static_cast<uint32_t>(descriptorSetLayouts.size());
+	pipelineLayoutCreateInfo.pSetLayouts = descriptorSetLayouts.data();
+	pipelineLayoutCreateInfo.pushConstantRangeCount = static_cast<uint32_t>(indirectLayout.pushConstantRanges.size());
+	pipelineLayoutCreateInfo.pPushConstantRanges = indirectLayout.pushConstantRanges.data();
+
+	VkResult result = vkCreatePipelineLayout(mainDevice.logicalDevice, &pipelineLayoutCreateInfo, nullptr, &indirectPipelineLayout);
+	if (result != VK_SUCCESS) {
+		throw std::runtime_error("Failed to create indirect pipeline layout");
+	}
+
+	shaderWatcher.watch(INDIRECT_VERTEX_SHADER_FILE);
 }
 
 void VulkanRenderer::createDescriptorSetLayout()
 {
-	// UNIFORM VALUES DESCRIPTOR SET LAYOUT
-	// UboViewProjection binding info
-	VkDescriptorSetLayoutBinding vpLayoutBinding = {};
-	vpLayoutBinding.binding = 0; // Binding point in shader (designated by binding number in shader)
-	vpLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER; // Type of descriptor (uniform, dynamic uniform)
-	vpLayoutBinding.descriptorCount = 1;
-	vpLayoutBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT; // Shader stage to bind to
-	vpLayoutBinding.pImmutableSamplers = nullptr; // Not using any textures atm (For texture: can make sampler data immutable by specifying in layout
-
-	VkDescriptorSetLayoutBinding modelLayoutBinding = {};
-	modelLayoutBinding.binding = 1;
-	modelLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
-	modelLayoutBinding.descriptorCount = 1;
-	modelLayoutBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
-	modelLayoutBinding.pImmutableSamplers = nullptr;
-
-	VkDescriptorSetLayoutBinding lightLayoutBinding = {};
-	lightLayoutBinding.binding = 2;
-	lightLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-	lightLayoutBinding.descriptorCount = 1;
-	lightLayoutBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
-	lightLayoutBinding.pImmutableSamplers = nullptr;
-
-	VkDescriptorSetLayoutBinding cameraLayoutBinding = {};
-	cameraLayoutBinding.binding = 3;
-	cameraLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-	cameraLayoutBinding.descriptorCount = 1;
-	cameraLayoutBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
-	cameraLayoutBinding.pImmutableSamplers = nullptr;
-
-	std::vector<VkDescriptorSetLayoutBinding> layoutBindings = { vpLayoutBinding, modelLayoutBinding, lightLayoutBinding, cameraLayoutBinding };
+	// Bindings come from the shaders, set 0 is the uniform buffers and set 1 the texture sampler
+	shaderLayout = reflectShaderLayout();
+	if (shaderLayout.sets.size() != 2) {
+		throw std::runtime_error("Shaders should use descriptor sets 0 (uniforms) and 1 (texture)");
+	}
 
+	// UNIFORM VALUES DESCRIPTOR SET LAYOUT
 	// Create Descriptor Set Layout with given bindings
 	VkDescriptorSetLayoutCreateInfo createInfo = {};
 	createInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
-	createInfo.bindingCount = static_cast<uint32_t>(layoutBindings.size()); // Number of binding infos
-	createInfo.pBindings = layoutBindings.data(); // Pointer to binding info
+	createInfo.bindingCount = static_cast<uint32_t>(shaderLayout.sets[0].size()); // Number of binding infos
+	createInfo.pBindings = shaderLayout.sets[0].data(); // Pointer to binding info
 
 	VkResult result = vkCreateDescriptorSetLayout(mainDevice.logicalDevice, &createInfo, nullptr, &descriptorSetLayout);
 	if (result != VK_SUCCESS) {
@@ -1218,19 +1298,10 @@ void VulkanRenderer::createDescriptorSetLayout()
 	}
 
 	// TEXTURE SAMPLER DESCRIPTOR SET LAYOUT
-	// Texture binding info 
-	VkDescriptorSetLayoutBinding textureLayoutBinding = {};
-	textureLayoutBinding.binding = 0;
-	textureLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-	textureLayoutBinding.descriptorCount = 1;
-	textureLayoutBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
-	textureLayoutBinding.pImmutableSamplers = nullptr;
-
-	// Create a descriptor set layout with given bindings for texture
 	VkDescriptorSetLayoutCreateInfo textureLayoutCreateInfo = {};
 	textureLayoutCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
-	textureLayoutCreateInfo.bindingCount = 1;
-	textureLayoutCreateInfo.pBindings = &textureLayoutBinding;
+	textureLayoutCreateInfo.bindingCount = static_cast<uint32_t>(shaderLayout.sets[1].size());
+	textureLayoutCreateInfo.pBindings = shaderLayout.sets[1].data();
 
 	result = vkCreateDescriptorSetLayout(mainDevice.logicalDevice, &textureLayoutCreateInfo, nullptr, &samplerSetLayout);
 	if (result != VK_SUCCESS) {
@@ -1240,10 +1311,37 @@ void VulkanRenderer::createDescriptorSetLayout()
 
 void VulkanRenderer::createPushConstantRange()
 {
-	// Define push constant values
-	pushConstantRange.stageFlags = VK_SHADER_STAGE_VERTEX_BIT; // Shader stage push constant will go to
-	pushConstantRange.offset = 0; // Offset into given data to pass push constant
-	pushConstantRange.size = sizeof(Model);
+	// Ranges come from the shaders, they have to match what recordCommands pushes
+	pushConstantRanges = shaderLayout.pushConstantRanges;
+
+	for (const auto& range : pushConstantRanges) {
+		bool matches = false;
+		if (range.stageFlags == VK_SHADER_STAGE_VERTEX_BIT) {
+			matches = range.offset == 0 && range.size == sizeof(glm::mat4); // Model matrix
+		}
+		else if (range.stageFlags == VK_SHADER_STAGE_FRAGMENT_BIT) {
+			// Texture layer follows the model matrix (layout(offset = 64) in shader.frag)
+			matches = range.offset == sizeof(glm::mat4) && range.size == sizeof(PushTexture);
+		}
+		if (!matches) {
+			throw std::runtime_error("Shader push constants don't match the model matrix and PushTexture, rebuild the shaders");
+		}
+	}
+	if (pushConstantRanges.size() != 2) {
+		throw std::runtime_error("Shaders should have vertex and fragment push constants, rebuild the shaders");
+	}
+}
+
+ReflectedLayout VulkanRenderer::reflectShaderLayout(const std::string& changedFile, const ShaderReflection* changed)
+{
+	// changed replaces the reflection of changedFile, to check an edited shader against the layout in use
+	std::vector<ShaderReflection> shaders;
+	for (const std::string& file : { VERTEX_SHADER_FILE, FRAGMENT_SHADER_FILE, DEPTH_VERTEX_SHADER_FILE }) {
+		shaders.push_back(file == changedFile && changed ? *changed : ShaderReflection::reflectFile(file));
+	}
+
+	// The model uniform buffer is bound with a per mesh offset
+	return ReflectedLayout::merge(shaders, { { 0, 1 } });
 }
 
 void VulkanRenderer::createUniformBuffers()
@@ -1255,20 +1353,20 @@ void VulkanRenderer::createUniformBuffers()
 	VkDeviceSize cameraPositionBufferSize = sizeof(glm::vec3);
 
 	// One uniform buffer for each image (and by extention, command buffer)
-	vpUniformBuffer.resize(swapChainImages.size());
-	vpUniformBufferMemory.resize(swapChainImages.size());
+	vpUniformBuffer.resize(MAX_FRAMES_IN_FLIGHT);
+	vpUniformBufferMemory.resize(MAX_FRAMES_IN_FLIGHT);
 
-	modelDUniformBuffer.resize(swapChainImages.size());
-	modelDUniformBufferMemory.resize(swapChainImages.size());
+	modelDUniformBuffer.resize(MAX_FRAMES_IN_FLIGHT);
+	modelDUniformBufferMemory.resize(MAX_FRAMES_IN_FLIGHT);
 
-	directionalLightUniformBuffer.resize(swapChainImages.size());
-	directionalLightUniformBufferMemory.resize(swapChainImages.size());
+	directionalLightUniformBuffer.resize(MAX_FRAMES_IN_FLIGHT);
+	directionalLightUniformBufferMemory.resize(MAX_FRAMES_IN_FLIGHT);
 
-	cameraPositionUniformBuffer.resize(swapChainImages.size());
-	cameraPositionUniformBufferMemory.resize(swapChainImages.size());
+	cameraPositionUniformBuffer.resize(MAX_FRAMES_IN_FLIGHT);
+	cameraPositionUniformBufferMemory.resize(MAX_FRAMES_IN_FLIGHT);
 
-	// Create the uniform buffers
-	for (size_t i = 0; i < swapChainImages.size(); i++) {
+	// Create the uniform buffers, one set per frame in flight so the CPU never writes one the GPU is reading
+	for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
 		createBuffer(mainDevice.physicalDevice, mainDevice.logicalDevice, vpBufferSize, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
 			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &vpUniformBuffer[i], &vpUniformBufferMemory[i]);
 
@@ -1310,7 +1408,7 @@ void VulkanRenderer::createDescriptorPool()
 	poolCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
 	poolCreateInfo.poolSizeCount = static_cast<uint32_t>(descriptorPoolSizes.size()); // Amount of pool sizes being passed
 	poolCreateInfo.pPoolSizes = descriptorPoolSizes.data(); // Pool sizes to create pool with
-	poolCreateInfo.maxSets = static_cast<uint32_t>(swapChainImages.size()); // Maximum number of descriptor sets that can be created from pool
+	poolCreateInfo.maxSets = MAX_FRAMES_IN_FLIGHT; // Maximum number of descriptor sets that can be created from pool
 
 	VkResult result = vkCreateDescriptorPool(mainDevice.logicalDevice, &poolCreateInfo, nullptr, &descriptorPool);
 	if (result != VK_SUCCESS) {
@@ -1320,11 +1418,11 @@ void VulkanRenderer::createDescriptorPool()
 	// SAMPLER POOL
 	VkDescriptorPoolSize samplerPoolSize = {};
 	samplerPoolSize.type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-	samplerPoolSize.descriptorCount = MAX_OBJECTS;
+	samplerPoolSize.descriptorCount = MAX_OBJECTS * MAX_FRAMES_IN_FLIGHT; // A set per frame slot for each texture
 
 	VkDescriptorPoolCreateInfo samplerPoolCreateInfo = {};
 	samplerPoolCreateInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
-	samplerPoolCreateInfo.maxSets = MAX_OBJECTS;
+	samplerPoolCreateInfo.maxSets = MAX_OBJECTS * MAX_FRAMES_IN_FLIGHT;
 	samplerPoolCreateInfo.poolSizeCount = 1;
 	samplerPoolCreateInfo.pPoolSizes = &samplerPoolSize;
 
@@ -1336,14 +1434,14 @@ void VulkanRenderer::createDescriptorPool()
 
 void VulkanRenderer::createDescriptorSets()
 {
-	descriptorSets.resize(swapChainImages.size()); // Resize descriptor set list so one for every buffer
+	descriptorSets.resize(MAX_FRAMES_IN_FLIGHT); // Resize descriptor set list so one for every buffer
 
-	std::vector<VkDescriptorSetLayout> setLayouts(swapChainImages.size(), descriptorSetLayout);
+	std::vector<VkDescriptorSetLayout> setLayouts(MAX_FRAMES_IN_FLIGHT, descriptorSetLayout);
 
 	VkDescriptorSetAllocateInfo setAllocInfo = {};
 	setAllocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
 	setAllocInfo.descriptorPool = descriptorPool; // Pool to allocate descriptor set from
-	setAllocInfo.descriptorSetCount = static_cast<uint32_t>(swapChainImages.size()); // Number of sets to allocate
+	setAllocInfo.descriptorSetCount = MAX_FRAMES_IN_FLIGHT; // Number of sets to allocate
 	setAllocInfo.pSetLayouts = setLayouts.data(); // Layouts to use to allocate sets (1:1 relationship)
 
 	// Allocate descriptor sets
@@ -1353,7 +1451,7 @@ void VulkanRenderer::createDescriptorSets()
 	}
 
 	// Update all of the descriptor set buffer bindings
-	for (size_t i = 0; i < swapChainImages.size(); i++) {
+	for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
 
 		// VIEW PROJECTION DESCRIPTOR
 		// Buffer info and data offset info
@@ -1430,153 +1528,362 @@ void VulkanRenderer::createDescriptorSets()
 	}
 }
 
-void VulkanRenderer::createTextureSampler()
-{
-	VkSamplerCreateInfo samplerCreateInfo = {};
-	samplerCreateInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
-	samplerCreateInfo.magFilter = VK_FILTER_LINEAR; // How to render when image is magnified on screen
-	samplerCreateInfo.minFilter = VK_FILTER_LINEAR; // How to render when image is minified on screen
-	samplerCreateInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_REPEAT;
-	samplerCreateInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_REPEAT;
-	samplerCreateInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_REPEAT;
-	samplerCreateInfo.borderColor = VK_BORDER_COLOR_INT_OPAQUE_BLACK; // Border beyond texture, only works for border clamp
-	samplerCreateInfo.unnormalizedCoordinates = VK_FALSE; // Whether coords should be normalised between 0 and 1
-	samplerCreateInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
-	samplerCreateInfo.mipLodBias = 0.0f; // Level of detail bias for mip level
-	samplerCreateInfo.minLod = 0.0f;
-	samplerCreateInfo.maxLod = static_cast<float>(mipLevels /2);
-	samplerCreateInfo.anisotropyEnable = VK_TRUE;
-	samplerCreateInfo.maxAnisotropy = 16; // Sample level of anisotropy
-
-	VkResult result = vkCreateSampler(mainDevice.logicalDevice, &samplerCreateInfo, nullptr, &textureSampler);
-	if (result != VK_SUCCESS) {
-		throw std::runtime_error("Failed to create sampler");
-	}
-
-}
-
-void VulkanRenderer::updateUniformBuffers(uint32_t imageIndex)
+void VulkanRenderer::updateUniformBuffers(uint32_t frameIndex)
 {
+	CPU_PROFILE_SCOPE("updateUniformBuffers");
 	// Copy VP data
 	void* data;
-	vkMapMemory(mainDevice.logicalDevice, vpUniformBufferMemory[imageIndex], 0, sizeof(UboViewProjection), 0, &data);
+	vkMapMemory(mainDevice.logicalDevice, vpUniformBufferMemory[frameIndex], 0, sizeof(UboViewProjection), 0, &data);
 	memcpy(data, &uboViewProjection, sizeof(UboViewProjection));
-	vkUnmapMemory(mainDevice.logicalDevice, vpUniformBufferMemory[imageIndex]);
+	vkUnmapMemory(mainDevice.logicalDevice, vpUniformBufferMemory[frameIndex]);
 
-	// Copy Model data
-	for (size_t i = 0; i < meshList.size(); i++) {
+	// Copy Model data, one slot per entity
+	const std::vector<glm::mat4>& transforms = scene.getTransforms();
+	const std::vector<uint32_t>& flags = scene.getFlags();
+	for (size_t i = 0; i < scene.size(); i++) {
 		Model* thisModel = (Model*)((uint64_t)modelTransferSpace + (i * modelUniformAlignment));
-		*thisModel = meshList[i].getModel();
+		thisModel->model = transforms[i];
+		thisModel->hasTexture = (flags[i] & ENTITY_HAS_TEXTURE) != 0;
 	}
 	// Map the list of model data
-	vkMapMemory(mainDevice.logicalDevice, modelDUniformBufferMemory[imageIndex], 0, modelUniformAlignment * meshList.size(), 0, &data);
-	memcpy(data, modelTransferSpace, modelUniformAlignment * meshList.size());
-	vkUnmapMemory(mainDevice.logicalDevice, modelDUniformBufferMemory[imageIndex]);
+	if (scene.size() > 0) {
+		vkMapMemory(mainDevice.logicalDevice, modelDUniformBufferMemory[frameIndex], 0, modelUniformAlignment * scene.size(), 0, &data);
+		memcpy(data, modelTransferSpace, modelUniformAlignment * scene.size());
+		vkUnmapMemory(mainDevice.logicalDevice, modelDUniformBufferMemory[frameIndex]);
+	}
 
 	UniformLight light = directionalLight.getLight();
 	//std::cout << light.direction.x << " " << light.direction.y << " " << light.direction.z << "\n";
 	//std::cout << light.diffuseIntensity << "\n";
 	//std::cout << light.ambientIntensity << "\n";
 
-	vkMapMemory(mainDevice.logicalDevice, directionalLightUniformBufferMemory[imageIndex], 0, sizeof(UniformLight), 0, &data);
+	vkMapMemory(mainDevice.logicalDevice, directionalLightUniformBufferMemory[frameIndex], 0, sizeof(UniformLight), 0, &data);
 	memcpy(data, &light, sizeof(UniformLight));
-	vkUnmapMemory(mainDevice.logicalDevice, directionalLightUniformBufferMemory[imageIndex]);
+	vkUnmapMemory(mainDevice.logicalDevice, directionalLightUniformBufferMemory[frameIndex]);
 
-	glm::vec3 cameraPosition = camera->getCameraPosition();
 	//std::cout << "CAMERA POSITION" << "\n";
 	//std::cout << cameraPosition.x << " " << cameraPosition.y << " " << cameraPosition.z << "\n";
 
-	vkMapMemory(mainDevice.logicalDevice, cameraPositionUniformBufferMemory[imageIndex], 0, sizeof(glm::vec3), 0, &data);
+	vkMapMemory(mainDevice.logicalDevice, cameraPositionUniformBufferMemory[frameIndex], 0, sizeof(glm::vec3), 0, &data);
 	memcpy(data, &cameraPosition, sizeof(glm::vec3));
-	vkUnmapMemory(mainDevice.logicalDevice, cameraPositionUniformBufferMemory[imageIndex]);
+	vkUnmapMemory(mainDevice.logicalDevice, cameraPositionUniformBufferMemory[frameIndex]);
+}
+
+void VulkanRenderer::updateTextureStreaming()
+{
+	CPU_PROFILE_SCOPE("updateTextureStreaming");
+	float pixelsPerUnit = uboViewProjection.projection[1][1] * 0.5f * swapChainExtent.height; // Screen pixels covered by 1 unit at distance 1
+
+	// Screen space size feedback: estimate how many pixels each entity covers, textures then only need mips that fine.
+	// The sphere around its world box stands in for the mesh
+	const std::vector<RenderHandles>& renderHandles = scene.getRenderHandles();
+	const std::vector<BoundingBox>& worldBoxes = scene.getWorldBoxes();
+	const std::vector<uint32_t>& flags = scene.getFlags();
+	for (size_t i = 0; i < scene.size(); i++) {
+		// Packed textures are always fully resident, bad ids fall back to the default which is packed too
+		if (!(flags[i] & ENTITY_HAS_TEXTURE)) continue;
+		int streamId = getTextureSlot(renderHandles[i].texId).streamId;
+		if (streamId < 0) continue;
+
+		float radius = glm::length(worldBoxes[i].max - worldBoxes[i].min) * 0.5f;
+		float distance = glm::length(cameraPosition - (worldBoxes[i].min + worldBoxes[i].max) * 0.5f);
+
+		// Camera inside bounds, could be anywhere on screen at full size
+		float screenSize = distance > radius ? (2.0f * radius / distance) * pixelsPerUnit : static_cast<float>(swapChainExtent.height);
+		textureStreamer.requestScreenSize(streamId, screenSize);
+	}
+
+	// Point descriptors of any textures that changed residency at their new views
+	FrameVector<int> changedTextures = textureStreamer.update(frameScheduler.getFrameAllocator());
+	for (int streamId : changedTextures) {
+		setTextureDescriptor(streamDescriptorSets[streamId], textureStreamer.getImageView(streamId), getTextureSampler(streamId));
+	}
+}
+
+void VulkanRenderer::updateShaderReload()
+{
+	CPU_PROFILE_SCOPE("updateShaderReload");
+	for (const std::string& file : shaderWatcher.poll()) {
+		// A broken or half written file keeps the current pipelines
+		ShaderReflection reflection;
+		try {
+			reflection = ShaderReflection::reflectFile(file);
+			if (reflectShaderLayout(file, &reflection) != shaderLayout) {
+				printf("Shader reload: %s changed its descriptor or push constant layout, restart to use it\n", file.c_str());
+				continue;
+			}
+		}
+		catch (const std::runtime_error& e) {
+			printf("Shader reload: %s: %s\n", file.c_str(), e.what());
+			continue;
+		}
+
+		printf("Shader reload: %s\n", file.c_str());
+		pipelineRegistry.reloadShader(file);
+	}
+
+	// Rebuilt pipelines replace the old ones, which are freed once frames using them finish
+	pipelineRegistry.collectRetired(frameScheduler.getDeletionQueue());
+	graphicsPipeline = pipelineRegistry.getPipeline(opaqueDesc);
+	if (depthPrePass) {
+		depthPrePassPipeline = pipelineRegistry.getPipeline(depthPrePassDesc);
+	}
+}
+
+void VulkanRenderer::updatePackedTextures()
+{
+	CPU_PROFILE_SCOPE("updatePackedTextures");
+	// Arrays that gained layers are rebuilt, point their descriptor at the new view
+	FrameVector<int> changedArrays = textureArrayPacker.build(frameScheduler.getFrameAllocator());
+	for (int arrayId : changedArrays) {
+		if (arrayId >= static_cast<int>(arrayDescriptorSets.size())) {
+			arrayDescriptorSets.resize(arrayId + 1, -1);
+		}
+
+		if (arrayDescriptorSets[arrayId] < 0) {
+			arrayDescriptorSets[arrayId] = createTextureDescriptor(textureArrayPacker.getImageView(arrayId), getPackedTextureSampler(arrayId));
+		}
+		else {
+			setTextureDescriptor(arrayDescriptorSets[arrayId], textureArrayPacker.getImageView(arrayId), getPackedTextureSampler(arrayId));
+		}
+	}
 }
 
 void VulkanRenderer::recordCommands(uint32_t currentImage)
 {
+	CPU_PROFILE_SCOPE("recordCommands");
 	// Information about how to begin each command buffer
 	VkCommandBufferBeginInfo bufferBeginInfo = {};
 	bufferBeginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	bufferBeginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT; // Rerecorded every frame
+
+	// The frame slot's command buffer, its pool was reset when the slot came free
+	VkCommandBuffer commandBuffer = frameScheduler.getFrame().commandBuffer;
+
+	VkResult result = vkBeginCommandBuffer(commandBuffer, &bufferBeginInfo);
+	if (result != VK_SUCCESS) {
+		throw std::runtime_error("Failed to start recording to a command buffer!");
+	}
 
-	// Information about how to begin a render pass (only needed for graphical applications)
-	VkRenderPassBeginInfo renderPassBeginInfo = {};
-	renderPassBeginInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-	renderPassBeginInfo.renderPass = renderPass;
-	renderPassBeginInfo.renderArea.offset = { 0, 0 };
-	renderPassBeginInfo.renderArea.extent = swapChainExtent;
-	std::array<VkClearValue, 2> clearValues = {};
-	clearValues[0].color = { 0.6f, 0.65f, 0.4f, 1.0f }; // Color attachment clear value
-	clearValues[1].depthStencil.depth = 1.0f;
+	// Timestamps around the frame and each pass, pipeline statistics over the whole frame
+	uint32_t frameIndex = frameScheduler.getFrameIndex();
+	gpuProfiler.beginFrame(commandBuffer, frameIndex);
 
-	renderPassBeginInfo.pClearValues = clearValues.data(); // List of clear values
-	renderPassBeginInfo.clearValueCount = static_cast<uint32_t>(clearValues.size());
+	// Render passes, barriers and layout transitions come from the graph, the swapchain image picks the framebuffer
+	renderGraph.execute(commandBuffer, currentImage, &gpuProfiler);
 
-	renderPassBeginInfo.framebuffer = swapChainFramebuffers[currentImage];
+	gpuProfiler.endFrame(commandBuffer);
+	statisticsQueryMode[frameIndex] = depthPrePass ? 1 : 0;
 
-	VkResult result = vkBeginCommandBuffer(commandBuffers[currentImage], &bufferBeginInfo);
+	result = vkEndCommandBuffer(commandBuffer);
 	if (result != VK_SUCCESS) {
-		throw std::runtime_error("Failed to start recording to a command buffer!");
+		throw std::runtime_error("Failed to stop recording to a command buffer!");
 	}
+}
 
-	vkCmdBeginRenderPass(commandBuffers[currentImage], &renderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
+void VulkanRenderer::buildRenderQueue()
+{
+	CPU_PROFILE_SCOPE("buildRenderQueue");
+	renderQueue.clear(frameScheduler.getFrameAllocator());
+	if (gpuCulling) {
+		updateGpuCulling();
+		return;
+	}
 
-	// Bind Pipeline to be used in renderpass
-	vkCmdBindPipeline(commandBuffers[currentImage], VK_PIPELINE_BIND_POINT_GRAPHICS, graphicsPipeline);
+	// Wireframe compiles in the background, draw with the opaque pipeline until it's ready
+	VkPipeline pipeline = getForwardPipeline();
 
-	for (size_t j = 0; j < modelList.size(); j++) {
-		MeshModel thisModel = modelList[j];
-		glm::mat4 model = thisModel.getModel();
-		vkCmdPushConstants(commandBuffers[currentImage], pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(Model), &model);
+	// Either walked down the BVH or every box tested in batches
+	auto cullStart = std::chrono::steady_clock::now();
+	glm::mat4 viewProjection = uboViewProjection.projection * uboViewProjection.view;
+	if (bvhCulling) {
+		updateBvh();
+		bvh.queryFrustum(FrustumCuller::extractPlanes(viewProjection), visibleObjects);
+	}
+	else {
+		const std::vector<BoundingBox>& localBoxes = scene.getLocalBoxes();
+		const std::vector<glm::mat4>& transforms = scene.getTransforms();
+		frustumCuller.clear();
+		frustumCuller.setFrustum(viewProjection);
+		for (size_t i = 0; i < scene.size(); i++) {
+			frustumCuller.add(localBoxes[i], transforms[i]);
+		}
+		frustumCuller.cull(visibleObjects);
+	}
+	cullTime += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - cullStart).count();
+	cullFrames++;
+
+	uint32_t visibleCount = static_cast<uint32_t>(visibleObjects.size());
+	uint32_t culledCount = static_cast<uint32_t>(scene.size()) - visibleCount;
+	if (printStats && (visibleCount != printedVisible || culledCount != printedCulled)) {
+		printf("Frustum culling (%s): %u visible, %u culled, %.4f ms\n", bvhCulling ? "BVH" : "flat", visibleCount, culledCount, cullTime / cullFrames);
+		printedVisible = visibleCount;
+		printedCulled = culledCount;
+		cullTime = 0.0;
+		cullFrames = 0;
+	}
+
+	const std::vector<RenderHandles>& renderHandles = scene.getRenderHandles();
+	const std::vector<glm::mat4>& transforms = scene.getTransforms();
+	for (uint32_t index : visibleObjects) {
+		const RenderHandles& handles = renderHandles[index];
+		RenderItem item = {};
+		item.pass = RenderQueuePass::Opaque;
+		item.pipeline = pipeline;
+		item.texId = handles.texId;
+		item.textureSet = getTextureDescriptorSet(item.texId);
+		item.pushTexture = getPushTexture(item.texId);
+		item.vertexBuffer = handles.vertexBuffer;
+		item.indexBuffer = handles.indexBuffer;
+		item.indexCount = handles.indexCount;
+		item.modelOffset = static_cast<uint32_t>(modelUniformAlignment * index); // Dynamic offset amount
+		item.model = transforms[index];
+		item.depth = glm::length(glm::vec3(item.model[3]) - cameraPosition) / farPlane; // Object origin, close enough to order objects
+		renderQueue.add(item);
+
+		// Position only, no textures
+		if (depthPrePass) {
+			item.pass = RenderQueuePass::DepthPrePass;
+			item.pipeline = depthPrePassPipeline;
+			item.texId = -1;
+			item.textureSet = VK_NULL_HANDLE;
+			renderQueue.add(item);
+		}
+	}
 
-		for (size_t k = 0; k < thisModel.getMeshCount(); k++) {
-			// Bind our vertex buffer
-			VkBuffer vertexBuffers[] = { thisModel.getMesh(k)->getVertexBuffer() }; // Buffers to bind
-			VkDeviceSize offsets[] = { 0 }; // Offsets into buffers being bound
-			vkCmdBindVertexBuffers(commandBuffers[currentImage], 0, 1, vertexBuffers, offsets); // Command to bind vertex buffer before drawing with them
-			vkCmdBindIndexBuffer(commandBuffers[currentImage], thisModel.getMesh(k)->getIndexBuffer(), 0, VK_INDEX_TYPE_UINT32); // Bind mesh index buffer with 0 offset and using uint32 type
+	renderQueue.sort();
+}
 
-			// Dynamic offset amount
-			uint32_t dynamicOffset = static_cast<uint32_t>(modelUniformAlignment) * j;
+void VulkanRenderer::updateBvh()
+{
+	CPU_PROFILE_SCOPE("updateBvh");
+	// Entities created or destroyed (which moves others) need a new tree, moved ones only have their boxes refit
+	if (bvhStructureVersion != scene.getStructureVersion()) {
+		bvh.build(scene.getWorldBoxes());
+		bvhStructureVersion = scene.getStructureVersion();
+		scene.clearFlags(ENTITY_BVH_DIRTY);
+		return;
+	}
 
-			std::array<VkDescriptorSet, 2> descriptorSetGroup = { descriptorSets[currentImage], samplerDescriptorSets[thisModel.getMesh(k)->getTexId()] };
+	const std::vector<BoundingBox>& worldBoxes = scene.getWorldBoxes();
+	const std::vector<uint32_t>& flags = scene.getFlags();
+	bool moved = false;
+	for (size_t i = 0; i < scene.size(); i++) {
+		if (!(flags[i] & ENTITY_BVH_DIRTY)) continue;
+		bvh.update(static_cast<uint32_t>(i), worldBoxes[i]);
+		moved = true;
+	}
+	if (moved) {
+		scene.clearFlags(ENTITY_BVH_DIRTY);
+		bvh.refit();
+		if (bvh.needsRebuild()) bvh.rebuild();
+	}
+}
 
-			// Bind descriptor sets
-			vkCmdBindDescriptorSets(commandBuffers[currentImage], VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout,
-				0, static_cast<uint32_t>(descriptorSetGroup.size()), descriptorSetGroup.data(), 1, &dynamicOffset);
+void VulkanRenderer::updateGpuCulling()
+{
+	CPU_PROFILE_SCOPE("updateGpuCulling");
+	// Every entity goes to the GPU, which culls and compacts them. Only the object list is built here, no per object draws
+	const std::vector<RenderHandles>& renderHandles = scene.getRenderHandles();
+	const std::vector<BoundingBox>& localBoxes = scene.getLocalBoxes();
+	const std::vector<glm::mat4>& transforms = scene.getTransforms();
+	gpuCullObjects.resize(scene.size());
+	for (size_t i = 0; i < scene.size(); i++) {
+		GpuCullObject& object = gpuCullObjects[i];
+		object.vertexBuffer = renderHandles[i].vertexBuffer;
+		object.indexBuffer = renderHandles[i].indexBuffer;
+		object.vertexCount = renderHandles[i].vertexCount;
+		object.indexCount = renderHandles[i].indexCount;
+		object.localBox = localBoxes[i];
+		object.model = transforms[i];
+		object.modelOffset = static_cast<uint32_t>(modelUniformAlignment * i);
+		object.texId = renderHandles[i].texId;
+		object.textureSet = getTextureDescriptorSet(object.texId);
+		object.pushTexture = getPushTexture(object.texId);
+	}
+
+	gpuCuller.update(frameScheduler.getFrameIndex(), gpuCullObjects, uboViewProjection.projection * uboViewProjection.view);
+}
 
-			// Execute our pipeline
-			vkCmdDrawIndexed(commandBuffers[currentImage], thisModel.getMesh(k)->getIndexCount(), 1, 0, 0, 0);
+VkPipeline VulkanRenderer::getForwardPipeline()
+{
+	// Wireframe compiles in the background, draw with the opaque pipeline until it's ready
+	if (wireframe) {
+		VkPipeline wireframePipeline = pipelineRegistry.getPipeline(wireframeDesc);
+		if (wireframePipeline != VK_NULL_HANDLE) {
+			return wireframePipeline;
 		}
+	}
+	return graphicsPipeline;
+}
 
-		for (size_t j = 0; j < meshList.size(); j++) {
-			Mesh thisMesh = meshList[j];
-			Model thisModel = thisMesh.getModel();
-			// Bind our vertex buffer
-			VkBuffer vertexBuffers[] = { meshList[j].getVertexBuffer() }; // Buffers to bind
-			VkDeviceSize offsets[] = { 0 }; // Offsets into buffers being bound
-			vkCmdBindVertexBuffers(commandBuffers[currentImage], 0, 1, vertexBuffers, offsets); // Command to bind vertex buffer before drawing with them
-			vkCmdBindIndexBuffer(commandBuffers[currentImage], meshList[j].getIndexBuffer(), 0, VK_INDEX_TYPE_UINT32); // Bind mesh index buffer with 0 offset and using uint32 type
+void VulkanRenderer::recordDepthPrePass(VkCommandBuffer commandBuffer, uint32_t cullPhase)
+{
+	setViewportAndScissor(commandBuffer);
+	if (gpuCulling) {
+		vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, depthPrePassPipeline);
+		gpuCuller.recordDraws(commandBuffer, frameScheduler.getFrameIndex(), cullPhase, indirectPipelineLayout, descriptorSets[frameScheduler.getFrameIndex()], false);
+		return;
+	}
+	renderQueue.record(commandBuffer, RenderQueuePass::DepthPrePass, pipelineLayout, descriptorSets[frameScheduler.getFrameIndex()]);
+}
 
-			// Dynamic offset amount
-			uint32_t dynamicOffset = static_cast<uint32_t>(modelUniformAlignment) * j;
+void VulkanRenderer::recordForwardPass(VkCommandBuffer commandBuffer, uint32_t cullPhase)
+{
+	setViewportAndScissor(commandBuffer);
+	if (gpuCulling) {
+		vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, getForwardPipeline());
+		gpuCuller.recordDraws(commandBuffer, frameScheduler.getFrameIndex(), cullPhase, indirectPipelineLayout, descriptorSets[frameScheduler.getFrameIndex()], true);
+		return;
+	}
 
-			std::array<VkDescriptorSet, 2> descriptorSetGroup = { descriptorSets[currentImage], samplerDescriptorSets[meshList[j].getTexId()] };
+	// Draw groups are timed inside the pass's own scope
+	gpuProfiler.beginScope(commandBuffer, "opaque");
+	renderQueue.record(commandBuffer, RenderQueuePass::Opaque, pipelineLayout, descriptorSets[frameScheduler.getFrameIndex()]);
+	gpuProfiler.endScope(commandBuffer);
+	gpuProfiler.beginScope(commandBuffer, "transparent");
+	renderQueue.record(commandBuffer, RenderQueuePass::Transparent, pipelineLayout, descriptorSets[frameScheduler.getFrameIndex()]);
+	gpuProfiler.endScope(commandBuffer);
+}
 
-			// Bind descriptor sets
-			vkCmdBindDescriptorSets(commandBuffers[currentImage], VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout,
-				0, static_cast<uint32_t>(descriptorSetGroup.size()), descriptorSetGroup.data(), 1, &dynamicOffset);
+void VulkanRenderer::setViewportAndScissor(VkCommandBuffer commandBuffer)
+{
+	// Dynamic state, covers the whole swapchain extent
+	VkViewport viewport = {};
+	viewport.width = (float)swapChainExtent.width;
+	viewport.height = (float)swapChainExtent.height;
+	viewport.minDepth = 0.0f;
+	viewport.maxDepth = 1.0f;
+	vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
 
-			vkCmdPushConstants(commandBuffers[currentImage], pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(Model), &thisModel.model);
+	VkRect2D scissor = {};
+	scissor.extent = swapChainExtent;
+	vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+}
 
-			// Execute our pipeline
-			vkCmdDrawIndexed(commandBuffers[currentImage], meshList[j].getIndexCount(), 1, 0, 0, 0);
-		}
-	}
+void VulkanRenderer::collectPipelineStatistics(uint32_t frameIndex)
+{
+	// The slot's last frame has finished, so its timestamps and statistics are available without waiting
+	GpuPipelineStatistics statistics;
+	int mode = statisticsQueryMode[frameIndex];
+	statisticsQueryMode[frameIndex] = -1;
+	if (!gpuProfiler.collect(frameIndex, &statistics) || mode < 0) return;
+
+	fragmentInvocations[mode] += statistics.fragmentInvocations;
+	statisticsFrames[mode]++;
+}
 
-	vkCmdEndRenderPass(commandBuffers[currentImage]);
+void VulkanRenderer::collectGpuCullingStats(uint32_t frameIndex)
+{
+	GpuCullStats stats;
+	if (!gpuCuller.collectStats(frameIndex, frameScheduler.getFrameAllocator(), &stats)) return;
 
-	result = vkEndCommandBuffer(commandBuffers[currentImage]);
-	if (result != VK_SUCCESS) {
-		throw std::runtime_error("Failed to stop recording to a command buffer!");
+	uint32_t drawn = stats.earlyDrawn + stats.lateDrawn;
+	if (printStats && (drawn != printedGpuDrawn || stats.occluded != printedGpuOccluded)) {
+		printf("GPU culling: %u of %u objects drawn (%u early, %u late), %u frustum culled, %u occluded\n",
+			drawn, stats.total, stats.earlyDrawn, stats.lateDrawn, stats.frustumCulled, stats.occluded);
+		printedGpuDrawn = drawn;
+		printedGpuOccluded = stats.occluded;
 	}
 }
 
@@ -1629,139 +1936,92 @@ VkShaderModule VulkanRenderer::createShaderModule(const std::vector<char>& code)
 
 VkImage VulkanRenderer::createImage(uint32_t width, uint32_t height, uint32_t mipLevels, VkFormat format, VkImageTiling tiling, VkImageUsageFlags useFlags, VkMemoryPropertyFlags propFlags, VkDeviceMemory* imageMemory, VkSampleCountFlagBits numSamples)
 {
-	// CREATE IMAGE
-	VkImageCreateInfo imageCreateInfo = {};
-	imageCreateInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
-	imageCreateInfo.imageType = VK_IMAGE_TYPE_2D; // Type of image (1D, 2D, 3D)
-	imageCreateInfo.extent.width = width;
-	imageCreateInfo.extent.height = height;
-	imageCreateInfo.extent.depth = 1; // Depth of image (just 1, no 3D aspect)
-	imageCreateInfo.mipLevels = mipLevels; // Number of mipmap levels
-	imageCreateInfo.arrayLayers = 1; // Number of levels in image array
-	imageCreateInfo.format = format; // Format type of image (depth format, colour etc)
-	imageCreateInfo.tiling = tiling; // How image data should be tiled, (arranged for optimal reading)
-	imageCreateInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED; // Layout of image data on creation
-	imageCreateInfo.usage = useFlags; // Being used as a depth buffer attachment (Bit flag defining what image will be used for)
-	imageCreateInfo.samples = VK_SAMPLE_COUNT_1_BIT; // Number of samples for multisamples
-	imageCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE; // Whether image can be shared between queues
-	imageCreateInfo.samples = numSamples;
-
-
-	VkImage image;
-	VkResult result = vkCreateImage(mainDevice.logicalDevice, &imageCreateInfo, nullptr, &image);
-	if (result != VK_SUCCESS) {
-		throw std::runtime_error("Failed to create an image!");
-	}
-
-	// CREATE MEMORY FOR IMAGE
-
-	// Get memory requirements for a type of image
-	VkMemoryRequirements memoryRequirements;
-	vkGetImageMemoryRequirements(mainDevice.logicalDevice, image, &memoryRequirements);
-
-	// Allocate memory using image requirements and user defined properties
-	VkMemoryAllocateInfo memoryAllocInfo = {};
-	memoryAllocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-	memoryAllocInfo.allocationSize = memoryRequirements.size;
-	memoryAllocInfo.memoryTypeIndex = findMemoryTypeIndex(mainDevice.physicalDevice, memoryRequirements.memoryTypeBits, propFlags);
-
-	result = vkAllocateMemory(mainDevice.logicalDevice, &memoryAllocInfo, nullptr, imageMemory);
-	if (result != VK_SUCCESS) {
-		throw std::runtime_error("Failed to allocate memory for image!");
-	}
-
-	// Connect memory to image
-	vkBindImageMemory(mainDevice.logicalDevice, image, *imageMemory, 0);
-
-	return image;
+	return ::createImage(mainDevice.physicalDevice, mainDevice.logicalDevice, width, height, mipLevels, format, tiling, useFlags, propFlags, imageMemory, numSamples);
 }
 
-int VulkanRenderer::createTextureImage(std::string fileName)
+int VulkanRenderer::createTexture(std::string fileName)
 {
+	CPU_PROFILE_SCOPE("createTexture");
 	// Load image file
 	int width, height;
 	VkDeviceSize imageSize;
 	stbi_uc* imageData = loadTextureFile(fileName, &width, &height, &imageSize);
 
-	mipLevels = static_cast<uint32_t>(std::floor(std::log2(std::max(width, height)))) + 1;
-
-	// Create staging buffer to hold loaded data, ready to copy to device
-	VkBuffer imageStagingBuffer;
-	VkDeviceMemory imageStagingBufferMemory;
-	createBuffer(mainDevice.physicalDevice, mainDevice.logicalDevice, imageSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, 
-		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-		&imageStagingBuffer, &imageStagingBufferMemory);
-
-	// Copy image data to staging buffer
-	void* data;
-	vkMapMemory(mainDevice.logicalDevice, imageStagingBufferMemory, 0, imageSize, 0, &data);
-	memcpy(data, imageData, static_cast<size_t>(imageSize));
-	vkUnmapMemory(mainDevice.logicalDevice, imageStagingBufferMemory);
+	int texId = createTexture(imageData, width, height);
 
 	stbi_image_free(imageData);
 
-	// Create image to hold final texture
-	VkImage texImage;
-	VkDeviceMemory texImageMemory;
-	texImage = createImage(width, height, mipLevels, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &texImageMemory, VK_SAMPLE_COUNT_1_BIT);
-
-	// Transition image to be DST for copy operation
-	transitionImageLayout(mainDevice.logicalDevice, graphicsQueue, graphicsCommandPool, texImage, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, mipLevels);
-
-	// Copy data to image (Staging buffer to texImage)
-	copyImageBuffer(mainDevice.logicalDevice, graphicsQueue, graphicsCommandPool, imageStagingBuffer, texImage, width, height);
-
-	// Transition image to be shader readable for shader usage
-	//transitionImageLayout(mainDevice.logicalDevice, graphicsQueue, graphicsCommandPool, texImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, mipLevels);
-
-	generateMipmaps(mainDevice, graphicsQueue, graphicsCommandPool, texImage, VK_FORMAT_R8G8B8A8_SRGB, width, height, mipLevels);
-
-	// Add texture data to vector for reference
-	textureImages.push_back(texImage);
-	textureImageMemory.push_back(texImageMemory);
-
-	vkDestroyBuffer(mainDevice.logicalDevice, imageStagingBuffer, nullptr);
-	vkFreeMemory(mainDevice.logicalDevice, imageStagingBufferMemory, nullptr);
-
-	// Return index of new texture image
-	return textureImages.size()-1;
+	return texId;
 }
 
-int VulkanRenderer::createTexture(std::string fileName)
+int VulkanRenderer::createTexture(const unsigned char* pixels, uint32_t width, uint32_t height)
 {
-	// Create texture image and get its location in array
-	int textureImageLoc = createTextureImage(fileName);
+	TextureSlot slot = {};
+	if (TextureArrayPacker::shouldPack(width, height)) {
+		// Small textures become a layer of a shared array, uploaded before the next frame is recorded
+		PackedTexture packed = textureArrayPacker.addTexture(pixels, width, height);
+		slot.streamId = -1;
+		slot.arrayId = packed.array;
+		slot.layer = packed.layer;
+		slot.uvScale = packed.uvScale;
+	}
+	else {
+		// Hand texture to the streamer, which only uploads the low mips to begin with
+		int streamId = textureStreamer.addTexture(pixels, width, height);
+		streamDescriptorSets.push_back(createTextureDescriptor(textureStreamer.getImageView(streamId), getTextureSampler(streamId)));
 
-	VkImageView imageView = createImageView(textureImages[textureImageLoc], VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_ASPECT_COLOR_BIT);
-	textureImageViews.push_back(imageView);
+		slot.streamId = streamId;
+		slot.arrayId = -1;
+		slot.layer = 0;
+		slot.uvScale = glm::vec2(1.0f, 1.0f);
+	}
 
-	int descriptorLoc = createTextureDescriptor(imageView);
+	textureSlots.push_back(slot);
 
-	// Return location of set with texture
-	return descriptorLoc;
+	// Return texture id
+	return static_cast<int>(textureSlots.size()) - 1;
 }
 
-int VulkanRenderer::createTextureDescriptor(VkImageView textureImage)
+int VulkanRenderer::createTextureDescriptor(VkImageView textureImage, VkSampler sampler)
 {
-	VkDescriptorSet descriptorSet;
+	TextureDescriptor descriptor = {};
+	descriptor.imageView = textureImage;
+	descriptor.sampler = sampler;
+	descriptor.staleSets = 0;
+
+	// Descriptor Set Allocation Info, one set for each frame slot
+	std::array<VkDescriptorSetLayout, MAX_FRAMES_IN_FLIGHT> setLayouts;
+	setLayouts.fill(samplerSetLayout);
 
-	// Descriptor Set Allocation Info
 	VkDescriptorSetAllocateInfo setAllocInfo = {};
 	setAllocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
 	setAllocInfo.descriptorPool = samplerDescriptorPool;
-	setAllocInfo.descriptorSetCount = 1;
-	setAllocInfo.pSetLayouts = &samplerSetLayout;
+	setAllocInfo.descriptorSetCount = MAX_FRAMES_IN_FLIGHT;
+	setAllocInfo.pSetLayouts = setLayouts.data();
 
-	VkResult result = vkAllocateDescriptorSets(mainDevice.logicalDevice, &setAllocInfo, &descriptorSet);
+	VkResult result = vkAllocateDescriptorSets(mainDevice.logicalDevice, &setAllocInfo, descriptor.sets.data());
 	if (result != VK_SUCCESS) {
 		throw std::runtime_error("Failed to allocate texture descriptor set");
 	}
 
+	// Not bound by any frame yet, so every set can be written now
+	for (VkDescriptorSet descriptorSet : descriptor.sets) {
+		updateTextureDescriptor(descriptorSet, textureImage, sampler);
+	}
+
+	// Add descriptor to list
+	textureDescriptors.push_back(descriptor);
+
+	return static_cast<int>(textureDescriptors.size()) - 1;
+}
+
+void VulkanRenderer::updateTextureDescriptor(VkDescriptorSet descriptorSet, VkImageView textureImage, VkSampler sampler)
+{
 	// Texture image info
 	VkDescriptorImageInfo imageInfo = {};
 	imageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL; // Image layout when in use
 	imageInfo.imageView = textureImage; // Image to bind to set
-	imageInfo.sampler = textureSampler; // Sampler to use for set
+	imageInfo.sampler = sampler; // Sampler to use for set
 
 	// Descriptor Write Info
 	VkWriteDescriptorSet descriptorWrite = {};
@@ -1773,17 +2033,97 @@ int VulkanRenderer::createTextureDescriptor(VkImageView textureImage)
 	descriptorWrite.descriptorCount = 1;
 	descriptorWrite.pImageInfo = &imageInfo;
 
-	// Update new descriptor set
+	// Update descriptor set
 	vkUpdateDescriptorSets(mainDevice.logicalDevice, 1, &descriptorWrite, 0, nullptr);
+}
+
+void VulkanRenderer::setTextureDescriptor(int descriptor, VkImageView textureImage, VkSampler sampler)
+{
+	// Sets of frames in flight may still be read, each is rewritten when its slot is next recorded
+	TextureDescriptor& textureDescriptor = textureDescriptors[descriptor];
+	textureDescriptor.imageView = textureImage;
+	textureDescriptor.sampler = sampler;
+	if (textureDescriptor.staleSets == 0) {
+		staleTextureDescriptors.push_back(descriptor);
+	}
+	textureDescriptor.staleSets = (1u << MAX_FRAMES_IN_FLIGHT) - 1;
+}
+
+void VulkanRenderer::refreshTextureDescriptors(uint32_t frameIndex)
+{
+	// The slot's last frame has finished (beginFrame waited for it), so its sets are free to rewrite
+	uint32_t slotBit = 1u << frameIndex;
+	for (size_t i = 0; i < staleTextureDescriptors.size();) {
+		TextureDescriptor& textureDescriptor = textureDescriptors[staleTextureDescriptors[i]];
+		if (textureDescriptor.staleSets & slotBit) {
+			updateTextureDescriptor(textureDescriptor.sets[frameIndex], textureDescriptor.imageView, textureDescriptor.sampler);
+			textureDescriptor.staleSets &= ~slotBit;
+		}
+
+		if (textureDescriptor.staleSets == 0) {
+			staleTextureDescriptors[i] = staleTextureDescriptors.back();
+			staleTextureDescriptors.pop_back();
+		}
+		else {
+			i++;
+		}
+	}
+}
+
+VkSampler VulkanRenderer::getTextureSampler(int streamId)
+{
+	// Clamp LOD to this texture's own chain, not whichever texture happened to load last
+	return samplerCache.getSampler(SamplerCache::textureSettings(textureStreamer.getMipCount(streamId)));
+}
 
-	// Add descriptor set to list
-	samplerDescriptorSets.push_back(descriptorSet);
+VkSampler VulkanRenderer::getPackedTextureSampler(int arrayId)
+{
+	// Wrapping is done in the shader so repeats stay inside the texture's part of the layer, clamp to keep away from the padding edge
+	SamplerSettings settings = SamplerCache::textureSettings(textureArrayPacker.getMipCount(arrayId));
+	settings.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	settings.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	settings.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	return samplerCache.getSampler(settings);
+}
+
+void VulkanRenderer::createDefaultTexture()
+{
+	// Packed like any small texture, so it's uploaded with the arrays before the first frame is recorded
+	const unsigned char white[4] = { 255, 255, 255, 255 };
+	if (createTexture(white, 1, 1) != DEFAULT_TEXTURE) {
+		throw std::runtime_error("Default texture must be the first texture created");
+	}
+}
 
-	return samplerDescriptorSets.size() - 1;
+const VulkanRenderer::TextureSlot& VulkanRenderer::getTextureSlot(int texId)
+{
+	// Ids that don't name a texture (-1 for untextured meshes) draw the default one
+	if (texId < 0 || texId >= static_cast<int>(textureSlots.size())) {
+		texId = DEFAULT_TEXTURE;
+	}
+	return textureSlots[texId];
+}
+
+VkDescriptorSet VulkanRenderer::getTextureDescriptorSet(int texId)
+{
+	// The set of the frame slot being recorded
+	const TextureSlot& slot = getTextureSlot(texId);
+	int descriptor = slot.arrayId >= 0 ? arrayDescriptorSets[slot.arrayId] : streamDescriptorSets[slot.streamId];
+	return textureDescriptors[descriptor].sets[frameScheduler.getFrameIndex()];
+}
+
+PushTexture VulkanRenderer::getPushTexture(int texId)
+{
+	const TextureSlot& slot = getTextureSlot(texId);
+	PushTexture pushTexture = {};
+	pushTexture.uvScale = slot.uvScale;
+	pushTexture.layer = slot.layer;
+	return pushTexture;
 }
 
 MeshModel VulkanRenderer::createMeshModel(std::string modelFile, int texId)
 {
+	CPU_PROFILE_SCOPE("createMeshModel");
 	// Import model "scene"
 	Assimp::Importer importer;
 	const aiScene *scene = importer.ReadFile(modelFile, aiProcess_Triangulate | aiProcess_FlipUVs | aiProcess_GenSmoothNormals | aiProcess_JoinIdenticalVertices);
@@ -1807,7 +2147,7 @@ MeshModel VulkanRenderer::createMeshModel(std::string modelFile, int texId)
 			matToTex[i] = texId;
 		}
 		else if (textureNames[i].empty()) {
-			matToTex[i] = 0; // Choose first texture ever loaded in
+			matToTex[i] = DEFAULT_TEXTURE;
 		}
 		else { // Otherwise if texture does exist, use that
 			// Otherwise create texture and set value to index of new texture inside sampler
@@ -1824,14 +2164,6 @@ MeshModel VulkanRenderer::createMeshModel(std::string modelFile, int texId)
 	return meshModel;
 }
 
-void VulkanRenderer::createColourImage()
-{
-	VkFormat colourFormat = swapChainImageFormat;
-
-	colourImage = createImage(swapChainExtent.width, swapChainExtent.height, 1, colourFormat, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT | VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &colourImageMemory, msaaSamples);
-	colourImageView = createImageView(colourImage, colourFormat, VK_IMAGE_ASPECT_COLOR_BIT);
-}
-
 stbi_uc* VulkanRenderer::loadTextureFile(std::string fileName, int* width, int* height, VkDeviceSize* imageSize)
 {
 	// Number of channels the image uses
@@ -1,3 +1,5 @@
+#pragma once
+
 #define GLFW_INCLUDE_VULKAN
 
 #include <GLFW/glfw3.h>
@@ -5,8 +7,27 @@
 #include "Mesh.h"
 #include "MeshModel.h"
 #include "Window.h"
-#include "Camera.h"
 #include "DirectionalLight.h"
+#include "TextureStreamer.h"
+#include "SamplerCache.h"
+#include "TextureArrayPacker.h"
+#include "RenderTargetPool.h"
+#include "FrameScheduler.h"
+#include "FrameAllocator.h"
+#include "GpuProfiler.h"
+#include "CpuProfiler.h"
+#include "PipelineCache.h"
+#include "PipelineRegistry.h"
+#include "ShaderReflection.h"
+#include "ShaderWatcher.h"
+#include "RenderGraph.h"
+#include "RenderQueue.h"
+#include "FrustumCuller.h"
+#include "BoundingVolumeHierarchy.h"
+#include "GpuCuller.h"
+#include "DepthPyramid.h"
+#include "SceneStore.h"
+#include "FrameSnapshot.h"
 
 #include <assimp/Importer.hpp>
 #include <assimp/scene.h>
@@ -17,24 +38,31 @@
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 
+// White 1x1 texture created at init, drawn for meshes without a texture of their own
+const int DEFAULT_TEXTURE = 0;
+
 #include <stdexcept>
 #include <vector>
 #include <iostream>
 #include <set>
 #include <algorithm>
 #include <array>
+#include <chrono>
 
 class VulkanRenderer
 {
 public:
 	VulkanRenderer();
 
-	int init(Window* window, Camera* camera);
+	int init(Window* window);
 
-	void updateModel(int modelId, glm::mat4 newModel);
-	void updateModelMesh(int modelId, glm::mat4 newModel);
+	// Scene objects, the renderer owns their meshes and the application keeps handles. Transforms and destruction go
+	// through the scene commands of frame snapshots
+	RenderObjectHandle createMesh(std::vector<Vertex>* vertices, std::vector<uint32_t>* indices, int texId);
+	std::vector<RenderObjectHandle> addMeshModel(MeshModel* meshModel); // One object per mesh, the model is left empty
 
-	void draw();
+	// Everything the frame needs from the application comes from the snapshot, it's safe to call from a thread of its own
+	void draw(const FrameSnapshot& snapshot);
 	void cleanup();
 	void cleanupSwapChain();
 
@@ -47,38 +75,43 @@ public:
 	void createLogicalDevice();
 	void setupDebugMessenger();
 	void createSurface();
-	void createSwapChain();
-	void createDepthBufferImage();
-	void createRenderPass();
+	void createSwapChain(VkSwapchainKHR oldSwapchain = VK_NULL_HANDLE);
+	void buildRenderGraph();
 	void createDescriptorSetLayout();
 	void createPushConstantRange();
+	void createPipelineLayout();
 	void createGraphicsPipeline();
-	void createFrameBuffers();
 	void createCommandPool();
-	void createCommandBuffers();
-	void createSynchronisation();
+	void createGpuProfiler();
+	void createGpuCulling();
 	void createUniformBuffers();
 	void createDescriptorPool();
 	void createDescriptorSets();
-	void createTextureSampler();
+	void createDefaultTexture();
 
 	// Recreate functions
 	void recreateSwapChain();
 
 	// Record functions
 	void recordCommands(uint32_t currentImage);
-	void updateUniformBuffers(uint32_t imageIndex);
+	void buildRenderQueue();
+	void updateGpuCulling();
+	void updateBvh();
+	void recordDepthPrePass(VkCommandBuffer commandBuffer, uint32_t cullPhase);
+	void recordForwardPass(VkCommandBuffer commandBuffer, uint32_t cullPhase);
+	VkPipeline getForwardPipeline();
+	void setViewportAndScissor(VkCommandBuffer commandBuffer);
+	void collectPipelineStatistics(uint32_t frameIndex);
+	void collectGpuCullingStats(uint32_t frameIndex);
+	void updateUniformBuffers(uint32_t frameIndex);
+	void updateTextureStreaming();
+	void updatePackedTextures();
+	void updateShaderReload();
 
 	// Get Functions
 	void getPhysicalDevice();
 
 	// Set functions
-	void setMeshList(std::vector<Mesh>* theMeshlist) {
-		meshList = *theMeshlist;
-	}
-	void setModelList(std::vector<MeshModel>* theModelList) { 
-		modelList = *theModelList;
-	}
 	void setDirectionalLight(DirectionalLight light) {
 		directionalLight = light;
 	}
@@ -109,16 +142,56 @@ public:
 	VkShaderModule createShaderModule(const std::vector<char>& code);
 	VkImage createImage(uint32_t width, uint32_t height, uint32_t mipLevels, VkFormat format, VkImageTiling tiling, VkImageUsageFlags useFlags, VkMemoryPropertyFlags propFlags, VkDeviceMemory* imageMemory, VkSampleCountFlagBits numSamples);
 
-	int createTextureImage(std::string fileName);
 	int createTexture(std::string fileName);
-	int createTextureDescriptor(VkImageView textureImage);
+	int createTexture(const unsigned char* pixels, uint32_t width, uint32_t height); // RGBA8
+	int createTextureDescriptor(VkImageView textureImage, VkSampler sampler);
+	void updateTextureDescriptor(VkDescriptorSet descriptorSet, VkImageView textureImage, VkSampler sampler);
+	void setTextureDescriptor(int descriptor, VkImageView textureImage, VkSampler sampler);
+	void refreshTextureDescriptors(uint32_t frameIndex);
+	VkSampler getTextureSampler(int streamId);
+	VkSampler getPackedTextureSampler(int arrayId);
+	VkDescriptorSet getTextureDescriptorSet(int texId);
+
+	// Frame pacing, 1 (lowest latency) to MAX_FRAMES_IN_FLIGHT (most CPU/GPU overlap)
+	void setFramesInFlight(uint32_t count);
+	FrameScheduler& getFrameScheduler() { return frameScheduler; }
+	GpuProfiler& getGpuProfiler() { return gpuProfiler; } // Only from the thread drawing, or once it has stopped
+
+	// Resize handling, the full rebuild (device idle, new render pass and pipeline) is kept to compare against
+	void setFullRebuildOnResize(bool fullRebuild) { fullRebuildOnResize = fullRebuild; }
+
+	// Pipeline cache, disable to time pipeline creation without it
+	void setPipelineCacheEnabled(bool enable) { pipelineCache.setEnabled(enable); }
+
+	// Depth only pass before shading, so each pixel is shaded once. Fragment shader invocations are counted either way
+	void setDepthPrePass(bool enable);
+	void printFragmentStats();
+
+	// Cull and compact draws in a compute shader, drawn with indirect count draws. Ignored if the device or shaders don't support it
+	void setGpuCulling(bool enable);
+
+	// Two phase occlusion culling against a depth pyramid, only while GPU culling is on. Needs MSAA depth
+	void setOcclusionCulling(bool enable);
+
+	// CPU frustum culling through the BVH, or every box through the flat SIMD culler. Compare the cull times printed
+	void setBvhCulling(bool enable);
+
+	// Prints the mesh under the centre of the screen when it changes, by its world space box
+	void pick();
+
+	// Debug view, ignored if the device can't draw lines
+	void setWireframe(bool enable) { wireframe = enable && wireframeSupported; }
+
+	// Diagnostics printed as they change (culling and render queue counts, resize latency, pipeline and render graph
+	// rebuilds). Off by default, before init to include startup
+	void setPrintStats(bool enable);
+
+	// Texture streaming
+	void setTextureBudget(VkDeviceSize budget) { textureStreamer.setBudget(budget); }
 
 	// Model creation
 	MeshModel createMeshModel(std::string modelFile, int texId);
 
-	// Colour Resources
-	void createColourImage();
-
 	// Loader Functions
 	stbi_uc* loadTextureFile(std::string fileName, int* width, int* height, VkDeviceSize* imageSize); // Return a unsigned char byte array
 
@@ -126,12 +199,20 @@ public:
 
 private:
 	Window* window;
-	Camera* camera;
 
-	uint32_t mipLevels;
+	// From the latest snapshot
+	glm::vec3 cameraPosition = glm::vec3(0.0f);
+	glm::vec3 cameraDirection = glm::vec3(0.0f, 0.0f, -1.0f);
+	VkExtent2D framebufferExtent = {}; // Window size, 0 while minimised
 
-	int currentFrame = 0;
 	bool frameBufferResized = false;
+	bool printStats = false;
+
+	// Resize measurement
+	bool fullRebuildOnResize = false;
+	bool measuringResize = false;
+	std::chrono::steady_clock::time_point resizeStart;
+	uint64_t resizeFrameValue = 0; // Timeline value of the first frame submitted after the resize
 
 	// Vulkan Components
 	VkInstance instance;
@@ -148,40 +229,110 @@ private:
 	VkQueue graphicsQueue;
 	VkQueue presentationQueue;
 	VkSurfaceKHR surface;
-	VkSwapchainKHR swapchain;
+	VkSwapchainKHR swapchain = VK_NULL_HANDLE;
 	std::vector<SwapChainImage> swapChainImages;
-	std::vector<VkFramebuffer> swapChainFramebuffers;
-	std::vector<VkCommandBuffer> commandBuffers;
 
-	// Depth buffer class members
-	VkImage depthBufferImage;
-	VkDeviceMemory depthBufferImageMemory;
-	VkImageView depthBufferImageView;
-	VkFormat depthBufferFormat;
+	// Per frame command buffers and semaphores, frames are paced on a timeline semaphore
+	FrameScheduler frameScheduler;
 
-	// Multisample class members
-	VkImage colourImage;
-	VkDeviceMemory colourImageMemory;
-	VkImageView colourImageView;
+	// Render targets, memory is pooled so it survives swapchain recreation
+	RenderTargetPool renderTargetPool;
 
-	VkSampler textureSampler;
+	// Passes of the frame, owns the framebuffers, render passes and the targets they draw to
+	RenderGraph renderGraph;
+	VkFormat depthBufferFormat;
 
-	// Assets
-	std::vector<VkImage> textureImages;
-	std::vector<VkDeviceMemory> textureImageMemory;
-	std::vector<VkImageView> textureImageViews;
+	SamplerCache samplerCache; // One sampler per distinct sampler state, shared between textures
 
-	// Scene objects
-	std::vector<MeshModel> modelList;
-	std::vector<Mesh> meshList;
+	// Assets
+	TextureStreamer textureStreamer; // Owns the large texture images, only finer mips that are needed are kept resident
+	TextureArrayPacker textureArrayPacker; // Small textures share texture arrays, one layer each
+
+	// What a texture id (as held by meshes) refers to
+	struct TextureSlot {
+		int streamId; // Streamed texture, -1 if packed
+		int arrayId; // Packed texture array, -1 if streamed
+		uint32_t layer;
+		glm::vec2 uvScale;
+	};
+	std::vector<TextureSlot> textureSlots;
+	std::vector<int> streamDescriptorSets; // Texture descriptor for each streamed texture
+	std::vector<int> arrayDescriptorSets; // Texture descriptor for each texture array, -1 until first built
+	const TextureSlot& getTextureSlot(int texId); // Falls back to DEFAULT_TEXTURE
+
+	// Scene objects, one entity per mesh
+	SceneStore scene;
+	RenderObjectHandle addSceneObject(const Mesh& mesh, const glm::mat4& transform, bool hasTexture);
+
+	// This frame's draws, sorted to keep state changes down
+	RenderQueue renderQueue;
+	RenderQueueStats printedQueueStats; // Printed when a frame's counts differ from it
+
+	// Entities outside the view are left out of the queue
+	FrustumCuller frustumCuller;
+	std::vector<uint32_t> visibleObjects; // Scene indices
+	uint32_t printedVisible = ~0u; // Counts are printed when they change, with the average cull time since the last print
+	uint32_t printedCulled = ~0u;
+	double cullTime = 0.0;
+	uint32_t cullFrames = 0;
+
+	// The scene's world boxes, rebuilt when entities are created or destroyed and refit when they move
+	BoundingVolumeHierarchy bvh;
+	bool bvhCulling = true;
+	uint32_t bvhStructureVersion = ~0u; // Scene structure the tree was built for
+	RenderObjectHandle printedPick = { ~0u, ~0u }; // Last printed by pick, NULL_RENDER_OBJECT for nothing
+
+	// GPU culling replaces the CPU culling and render queue, the graphics passes draw what the compute pass wrote
+	GpuCuller gpuCuller;
+	bool gpuCullingSupported = false;
+	bool gpuCulling = false;
+	VkPipelineLayout indirectPipelineLayout = VK_NULL_HANDLE; // Sets 0 and 1 of pipelineLayout, plus the object set
+	std::vector<GpuCullObject> gpuCullObjects;
+	uint32_t printedGpuDrawn = ~0u; // Printed when the counts read back change
+	uint32_t printedGpuOccluded = ~0u;
+
+	// Max depth mip chain the occlusion tests sample, rebuilt every frame from the early passes' depth
+	DepthPyramid depthPyramid;
+	bool occlusionCullingSupported = false;
+	bool occlusionCulling = false;
 
 	// Multisample count
 	VkSampleCountFlagBits msaaSamples;
 
 	// Pipeline
 	VkPipelineLayout pipelineLayout;
-	VkRenderPass renderPass;
+	VkRenderPass renderPass; // The forward pass's, owned by renderGraph
 	VkPipeline graphicsPipeline;
+	PipelineCache pipelineCache; // Loaded at startup and saved at shutdown
+	PipelineRegistry pipelineRegistry; // Every pipeline variant, graphicsPipeline is its opaque pipeline for renderPass
+	bool wireframe = false;
+	bool wireframeSupported = false;
+
+	// Descs looked up every frame, built with the pipelines so the lookups don't build shader name strings
+	PipelineDesc opaqueDesc;
+	PipelineDesc wireframeDesc;
+	PipelineDesc depthPrePassDesc;
+
+	// Depth pre-pass, the forward pass then tests for EQUAL without writing depth
+	bool depthPrePass = false;
+	bool renderGraphChanged = false; // Rebuilt at the start of the next frame
+	VkPipeline depthPrePassPipeline = VK_NULL_HANDLE;
+	PipelineDesc forwardPipelineDesc(PipelineVariant variant);
+	PipelineDesc depthPrePassPipelineDesc();
+
+	// Pass and draw group timestamps plus pipeline statistics, read back when the frame slot comes round again
+	GpuProfiler gpuProfiler;
+	bool pipelineStatisticsSupported = false;
+
+	// Fragment shader invocations from the profiler's statistics, split by whether the pre-pass was on
+	std::array<int, MAX_FRAMES_IN_FLIGHT> statisticsQueryMode; // Pre-pass on (1) or off (0) when the slot's query was recorded, -1 if unused
+	uint64_t fragmentInvocations[2] = {}; // Totals without, with the pre-pass
+	uint32_t statisticsFrames[2] = {};
+
+	// Shaders, layouts are built from what the SPIR-V declares and the files are rebuilt into pipelines when they change
+	ReflectedLayout shaderLayout;
+	ShaderWatcher shaderWatcher;
+	ReflectedLayout reflectShaderLayout(const std::string& changedFile = "", const ShaderReflection* changed = nullptr);
 
 	// Pools
 	VkCommandPool graphicsCommandPool;
@@ -191,6 +342,8 @@ private:
 	VkExtent2D swapChainExtent;
 
 	// Scene Settings
+	const float nearPlane = 0.1f;
+	const float farPlane = 100.0f;
 	struct UboViewProjection {
 		glm::mat4 projection;
 		glm::mat4 view;
@@ -200,12 +353,24 @@ private:
 	VkDescriptorSetLayout descriptorSetLayout;
 	VkDescriptorSetLayout samplerSetLayout;
 
-	VkPushConstantRange pushConstantRange;
+	std::vector<VkPushConstantRange> pushConstantRanges; // Vertex model matrix, fragment texture layer
+
+	PushTexture getPushTexture(int texId);
 
 	VkDescriptorPool descriptorPool;
 	VkDescriptorPool samplerDescriptorPool;
 	std::vector<VkDescriptorSet> descriptorSets;
-	std::vector<VkDescriptorSet> samplerDescriptorSets;
+
+	// Texture descriptors, one set per frame slot. A texture's new view is written to a slot's set when that slot comes
+	// round again, so a set is never rewritten while a frame in flight may still read it
+	struct TextureDescriptor {
+		std::array<VkDescriptorSet, MAX_FRAMES_IN_FLIGHT> sets;
+		VkImageView imageView;
+		VkSampler sampler;
+		uint32_t staleSets; // Bit per frame slot whose set still has an older view
+	};
+	std::vector<TextureDescriptor> textureDescriptors;
+	std::vector<int> staleTextureDescriptors; // Any with stale sets
 
 	// Uniform Buffers (Static for every model)
 	std::vector<VkBuffer> vpUniformBuffer;
@@ -225,10 +390,5 @@ private:
 
 	std::vector<VkBuffer> cameraPositionUniformBuffer;
 	std::vector<VkDeviceMemory> cameraPositionUniformBufferMemory;
-
-	// Synchronisation
-	std::vector<VkSemaphore> imageAvailable;
-	std::vector<VkSemaphore> renderFinished;
-	std::vector<VkFence> drawFences;
 };
 
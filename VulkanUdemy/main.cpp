@@ -8,17 +8,20 @@
 #include <iostream>
 
 #include "VulkanRenderer.h"
+#include "RenderThread.h"
 #include "Window.h"
 #include "Camera.h"
 #include "DirectionalLight.h"
 
 class Main {
 public:
-	Main() {
+	Main(bool printStats) {
+		vulkanRenderer.setPrintStats(printStats);
+		renderThread.setPrintStats(printStats);
 		gameLoop();
 	}
 
-	VulkanRenderer getVulkanRenderer() {
+	VulkanRenderer& getVulkanRenderer() {
 		return vulkanRenderer;
 	}
 
@@ -38,25 +41,64 @@ public:
 			8.0f, 20.0f, 8.0f);
 
 		// Create VulkanRenderer Instance
-		if (vulkanRenderer.init(theWindow, camera) == EXIT_FAILURE)
+		if (vulkanRenderer.init(theWindow) == EXIT_FAILURE)
 		{
 			return EXIT_FAILURE;
 		}
 
-		// Populate meshList and modelList with vertices
+		// Create the scene's objects, the renderer keeps them and we keep handles
 		CreateObjects();
 
 		float angle = 0.0f;
 		float deltaTime = 0.0f;
 		float lastTime = 0.0f;
 
+		// Draw on a thread of its own, this one simulates the next frame meanwhile and only talks to it through snapshots
+		renderThread.start(&vulkanRenderer);
+
 		// Loop until closed
-		while (!theWindow->getShouldClose())
+		CPU_PROFILE_THREAD("Simulation");
+		while (!theWindow->getShouldClose() && renderThread.isRunning())
 		{
+			CPU_PROFILE_SCOPE("simulate");
 			glfwPollEvents();
 			camera->keyControl(theWindow->getKeys(), deltaTime);
 			camera->mouseControl(theWindow->getXChange(), theWindow->getYChange());
 
+			FrameSnapshot* snapshot = renderThread.getSnapshot();
+			RenderSettingRequests& requests = snapshot->requests;
+
+			// Frames in flight, compare latency against throughput
+			bool* keys = theWindow->getKeys();
+			if (keys[GLFW_KEY_1]) requests.framesInFlight = 1;
+			if (keys[GLFW_KEY_2]) requests.framesInFlight = 2;
+			if (keys[GLFW_KEY_3]) requests.framesInFlight = 3;
+
+			// Resize path, compare resize to first frame latency
+			if (keys[GLFW_KEY_4]) requests.fullRebuildOnResize = 1;
+			if (keys[GLFW_KEY_5]) requests.fullRebuildOnResize = 0;
+
+			// Wireframe is compiled in the background the first time it's used
+			if (keys[GLFW_KEY_6]) requests.wireframe = 1;
+			if (keys[GLFW_KEY_7]) requests.wireframe = 0;
+
+			// Depth pre-pass, compare fragment shader invocations with and without it
+			if (keys[GLFW_KEY_8]) requests.depthPrePass = 1;
+			if (keys[GLFW_KEY_9]) requests.depthPrePass = 0;
+
+			// Culling on the GPU (G) or CPU (C), compare the CPU time spent on draws
+			if (keys[GLFW_KEY_G]) requests.gpuCulling = 1;
+			if (keys[GLFW_KEY_C]) requests.gpuCulling = 0;
+
+			// Occlusion culling against a depth pyramid on (O) or off (P), on top of GPU culling
+			if (keys[GLFW_KEY_O]) requests.occlusionCulling = 1;
+			if (keys[GLFW_KEY_P]) requests.occlusionCulling = 0;
+
+			// CPU frustum culling through the BVH (B) or flat (N), and picking what's under the centre of the screen (K)
+			if (keys[GLFW_KEY_B]) requests.bvhCulling = 1;
+			if (keys[GLFW_KEY_N]) requests.bvhCulling = 0;
+			if (keys[GLFW_KEY_K]) requests.pick = true;
+
 			float now = glfwGetTime();
 			deltaTime = now - lastTime;
 			lastTime = now;
@@ -72,16 +114,38 @@ public:
 			//firstModel = glm::rotate(firstModel, glm::radians(angle), glm::vec3(0.0f, 1.0f, 0.0f));
 			firstModel = glm::rotate(firstModel, glm::radians(-90.0f), glm::vec3(1.0f, 0.0f, 0.0f));
 			
-			vulkanRenderer.updateModel(0, firstModel);
+			for (RenderObjectHandle object : roomObjects) {
+				snapshot->sceneCommands.setTransform(object, firstModel);
+			}
 
 			firstModel = glm::mat4(1.0f); // Identity matrix
 			firstModel = glm::translate(firstModel, glm::vec3(0.0f, 2.0f, -2.0f));
 			//firstModel = glm::rotate(firstModel, glm::radians(angle), glm::vec3(-0.0f, -1.0f, 0.0f));
-			vulkanRenderer.updateModelMesh(1, firstModel);
+			snapshot->sceneCommands.setTransform(cubeObject, firstModel);
+
+			// Rest of the frame's state, the snapshot may hold a frame from two ago
+			snapshot->view = camera->calculateViewMatrix();
+			snapshot->cameraPosition = camera->getCameraPosition();
+			snapshot->cameraDirection = camera->getCameraDirection();
+			snapshot->light = light;
+			glfwGetFramebufferSize(theWindow->getWindow(), &snapshot->framebufferWidth, &snapshot->framebufferHeight);
 
-			vulkanRenderer.draw();
+			renderThread.publish();
 		}
 
+		// A render thread error is rethrown here, the device and window still have to go first
+		try {
+			renderThread.stop();
+		}
+		catch (...) {
+			vulkanRenderer.cleanup();
+			theWindow->cleanUp();
+			throw;
+		}
+		renderThread.printStats();
+		vulkanRenderer.getFrameScheduler().printStats();
+		vulkanRenderer.printFragmentStats();
+		vulkanRenderer.getGpuProfiler().printStats();
 		vulkanRenderer.cleanup();
 
 		// Destory GLFW window and stop GLFW
@@ -158,9 +222,6 @@ public:
 			1, 2, 3
 		};
 
-		VkPhysicalDevice physicalDevice = vulkanRenderer.getVulkanDevice().physicalDevice;
-		VkDevice logicalDevice = vulkanRenderer.getVulkanDevice().logicalDevice;
-
 		calcAverageNormals(&floorIndices, &floorVertices);
 		calcAverageNormals(&meshIndices, &meshVertices);
 
@@ -178,23 +239,17 @@ public:
 		std::cout << meshVertices[6].normal.x << " " << meshVertices[6].normal.y << " " << meshVertices[6].normal.z << "\n";
 		std::cout << meshVertices[7].normal.x << " " << meshVertices[7].normal.y << " " << meshVertices[7].normal.z << "\n";
 
-		Mesh firstMesh = Mesh(physicalDevice, logicalDevice, vulkanRenderer.getGraphicsQueue(), vulkanRenderer.getGraphicsCommandPool(), &floorIndices, &floorVertices, vulkanRenderer.createTexture("marble.jpg"));
-		Mesh secondMesh = Mesh(physicalDevice, logicalDevice, vulkanRenderer.getGraphicsQueue(), vulkanRenderer.getGraphicsCommandPool(), &meshIndices, &meshVertices, vulkanRenderer.createTexture("wood.png"));
-
-		meshList.push_back(firstMesh);
-		meshList.push_back(secondMesh);
+		floorObject = vulkanRenderer.createMesh(&floorVertices, &floorIndices, vulkanRenderer.createTexture("marble.jpg"));
+		cubeObject = vulkanRenderer.createMesh(&meshVertices, &meshIndices, vulkanRenderer.createTexture("wood.png"));
 
 		MeshModel meshModel1 = vulkanRenderer.createMeshModel("models/viking_room.obj", vulkanRenderer.createTexture("viking_room.png"));
 		//MeshModel meshModel1 = vulkanRenderer.createMeshModel("models/chair_01.obj", vulkanRenderer.createTexture("cottage_diffuse.png"));
-		modelList.push_back(meshModel1);
+		roomObjects = vulkanRenderer.addMeshModel(&meshModel1);
 
-		for (size_t i = 0; i <= MAX_FRAME_DRAWS; ++i) {
+		for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; ++i) {
 			vulkanRenderer.updateUniformBuffers(i);
 		}
 
-		vulkanRenderer.setModelList(&modelList);
-		vulkanRenderer.setMeshList(&meshList);
-
 		vulkanRenderer.setDirectionalLight(light);
 	}
 
@@ -202,13 +257,57 @@ public:
 private:
 	Camera *camera;
 	Window *theWindow;
-	std::vector<Mesh> meshList;
-	std::vector<MeshModel> modelList;
+	RenderObjectHandle floorObject;
+	RenderObjectHandle cubeObject;
+	std::vector<RenderObjectHandle> roomObjects;
 	DirectionalLight light;
 
 	VulkanRenderer vulkanRenderer;
+	RenderThread renderThread;
 };
 
-int main() {
-	Main main;
+int main(int argc, char** argv) {
+	// Spatial index timings on synthetic scenes, no window or device
+	if (argc > 1 && std::string(argv[1]) == "--bvh-benchmark") {
+		BoundingVolumeHierarchy::benchmark();
+		return 0;
+	}
+	if (argc > 1 && std::string(argv[1]) == "--scene-benchmark") {
+		SceneStore::benchmark();
+		return 0;
+	}
+	if (argc > 1 && std::string(argv[1]) == "--profiler-benchmark") {
+		CpuProfiler::benchmark();
+		return 0;
+	}
+
+	// SIMD mip generation against the scalar reference, exits non-zero on a mismatch
+	if (argc > 1 && std::string(argv[1]) == "--mipmap-test") {
+		return MipmapGenerator::test() ? EXIT_SUCCESS : EXIT_FAILURE;
+	}
+
+	// Frames of the render queue on frame allocators, exits non-zero if a warmed up frame allocates from the heap
+	if (argc > 1 && std::string(argv[1]) == "--render-queue-test") {
+		return RenderQueue::test() ? EXIT_SUCCESS : EXIT_FAILURE;
+	}
+
+	// Where CPU time goes on every thread, opened in chrome://tracing or ui.perfetto.dev
+	std::string cpuTraceFile;
+	if (argc > 2 && std::string(argv[1]) == "--cpu-trace") {
+		cpuTraceFile = argv[2];
+		CpuProfiler::setEnabled(true);
+	}
+
+	// Culling and render queue counts, resize and pipeline timings printed as they change
+	bool printStats = false;
+	for (int i = 1; i < argc; i++) {
+		if (std::string(argv[i]) == "--stats") printStats = true;
+	}
+
+	Main main(printStats);
+
+	// Every thread has been joined by now
+	if (!cpuTraceFile.empty()) {
+		CpuProfiler::writeChromeTrace(cpuTraceFile);
+	}
 }
\ No newline at end of file
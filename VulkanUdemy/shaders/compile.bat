@@ -1,3 +1,7 @@
 C:/VulkanSDK/1.2.148.1/Bin32/glslangValidator.exe -V shader.vert
 C:/VulkanSDK/1.2.148.1/Bin32/glslangValidator.exe -V shader.frag
+C:/VulkanSDK/1.2.148.1/Bin32/glslangValidator.exe -V depth.vert -o depth.spv
+C:/VulkanSDK/1.2.148.1/Bin32/glslangValidator.exe -V indirect.vert -o indirect.spv
+C:/VulkanSDK/1.2.148.1/Bin32/glslangValidator.exe -V cull.comp -o cull.spv
+C:/VulkanSDK/1.2.148.1/Bin32/glslangValidator.exe -V hiz.comp -o hiz.spv
 pause
\ No newline at end of file
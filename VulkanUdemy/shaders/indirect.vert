@@ -0,0 +1,48 @@
+#version 450 		// Use GLSL 4.5
+
+// shader.vert for GPU culled draws, the model matrix comes from the object buffer cull.comp read, indexed by the
+// draw's firstInstance, instead of a push constant
+
+layout(location = 0) in vec3 pos;
+layout(location = 1) in vec3 col;
+layout(location = 2) in vec2 tex;
+layout(location = 3) in vec3 normal;
+
+layout(set = 0, binding = 0) uniform UboViewProjection {
+	mat4 projection;
+	mat4 view;
+} uboViewProjection;
+
+// Must match cull.comp
+struct ObjectData {
+	mat4 model;
+	vec4 boundsMin;
+	vec4 boundsMax;
+	uint indexCount;
+	uint firstIndex;
+	int vertexOffset;
+	uint batch;
+};
+
+layout(std430, set = 2, binding = 0) readonly buffer Objects {
+	ObjectData objects[];
+};
+
+layout(location = 0) out vec3 fragCol;
+layout(location = 1) out vec2 fragTex;
+layout(location = 2) out vec3 Normal;
+layout(location = 3) out vec3 FragPos;
+
+// The depth pre-pass draws with this shader too, the main pass tests for EQUAL against it
+invariant gl_Position;
+
+void main() {
+	mat4 model = objects[gl_InstanceIndex].model;
+	gl_Position = uboViewProjection.projection * uboViewProjection.view * model * vec4(pos, 1.0);
+	
+	Normal = mat3(transpose(inverse(model))) * normal;  
+	
+	FragPos = vec3(model * vec4(pos, 1.0)); 	
+	fragCol = col;
+	fragTex = tex;
+}
@@ -5,7 +5,13 @@ layout(location = 1) in vec2 fragTex;
 layout(location = 2) in vec3 Normal;
 layout(location = 3) in vec3 FragPos;
 
-layout(set = 1, binding = 0) uniform sampler2D textureSampler;
+layout(set = 1, binding = 0) uniform sampler2DArray textureSampler;
+
+// Small textures are packed into array layers, the model matrix takes the first 64 bytes (shader.vert)
+layout(push_constant) uniform PushTexture {
+	layout(offset = 64) vec2 uvScale;	// Part of the layer the texture covers
+	uint layer;
+} pushTexture;
 
 layout(location = 0) out vec4 outColour; 	// Final output colour (must also have location
 
@@ -58,7 +64,10 @@ void main()
 {
 	vec4 finalColour = CalcDirectionalLight();		
 	if (uboModel.hasTexture) {
-		outColour = texture(textureSampler, fragTex) * finalColour;
+		// Wrap within the texture's part of the layer, gradients come from the unwrapped coords so the mip doesn't jump at the seam
+		vec2 scaledTex = fragTex * pushTexture.uvScale;
+		vec2 packedTex = fract(fragTex) * pushTexture.uvScale;
+		outColour = textureGrad(textureSampler, vec3(packedTex, pushTexture.layer), dFdx(scaledTex), dFdy(scaledTex)) * finalColour;
 		
 		//vec3 normal = normalize(Normal);
 		//vec3 lightDir = normalize(directionalLight.direction - FragPos);
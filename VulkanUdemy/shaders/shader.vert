@@ -20,6 +20,9 @@ layout(location = 1) out vec2 fragTex;
 layout(location = 2) out vec3 Normal;
 layout(location = 3) out vec3 FragPos;
 
+// Must come out bit identical to depth.vert, the main pass tests for EQUAL against the depth pre-pass
+invariant gl_Position;
+
 void main() {
 	gl_Position = uboViewProjection.projection * uboViewProjection.view * pushModel.model * vec4(pos, 1.0);
 	